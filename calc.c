@@ -5,6 +5,7 @@
  * $Id$
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <omp.h>
@@ -12,18 +13,39 @@
 #include "vector.h"
 #include "kernel.h"
 #include "eos.h"
+#include "neighb.h"
+#include "refine.h"
+#include "distfield.h"
+#include "collide.h"
+#include "motion.h"
 #include "calc.h"
 
 /**********************************************************/
 
-/* The function to calculate the particles' pressures */
-static void  (*CalcPressByEOS)   ( void);
+#ifndef LEAN_PARTICLES
+/* 'leap-frog' integration scheme */
+static void  LeapfrogIntegration ( struct Simulation *Sim);
+#endif
 
-/* The function to calculate the kernel's gradient */
-static int   (*GetGradKernel)    ( float *Grad, float *Rij);
+/* Kick-drift-kick integration scheme */
+static void  KeepRates           ( struct Simulation *Sim);
+static void  KickDriftKickIntegration( struct Simulation *Sim);
 
-/* 'leap-frog' integration scheme */
-static void  LeapfrogIntegration ( void);
+/* Reduce the diagnostics during the integration */
+static struct Diagnostics *BeginDiagnostics( struct Simulation *Sim);
+static void  AddDiagnostics      ( struct Simulation *Sim,
+                                   struct Diagnostics *Part, int i);
+static void  EndDiagnostics      ( struct Simulation *Sim);
+
+/* Reduce the diagnostics of the initial state */
+static void  InitDiagnostics     ( struct Simulation *Sim);
+
+/* Adapt the particles' smoothing lengths to the density */
+static void  UpdateSmoothLengths ( struct Simulation *Sim);
+
+/* Bounce the particle off the obstacle it's stopped at */
+static void  BounceVelocity      ( struct Simulation *Sim,
+                                   float *Vel, float *Normal);
 
 /**********************************************************/
 
@@ -41,99 +63,273 @@ static float LenJonP2 = 2.0f;
 
 /**********************************************************/
 
-/* Equation of state to calculate pressures */
-char  EOSType[20];
-
-/* Kernel to use in the calculations */
-char  KernelType[20];
-
-/* Kernel smoothing length */
-float SmoothR;
-
-/* Rest density */
-float Density0;
-
-/* Speed of sound */
-float SOS;
-
-/* Alpha factor to calculate viscosity */
-float ViscAlpha;
+/* Scheme of the time integration */
+struct Integrator
+{
+    char  *Name;                                     /* Name in the scene file */
+    void (*Prepare)  ( struct Simulation *Sim);      /* Prepare the integration */
+    void (*Integrate)( struct Simulation *Sim);      /* Integrate the motion */
+};
 
-/* Beta factor to calculate viscosity */
-float ViscBeta;
+/* All implemented integration schemes (the first one is the default) */
+static struct Integrator Integrators[] =
+{
+#ifndef LEAN_PARTICLES
+    /* 'leap-frog' (the values at t-dt/2 and at t are kept) */
+    "LEAPFROG", NULL,      LeapfrogIntegration,
+#endif
+    /* Kick-drift-kick (only the values at t are kept) */
+    "KDK",      KeepRates, KickDriftKickIntegration,
+};
 
-/* Time step of integration */
-float TimeStep;
+/* The size of this array */
+static int IntegratorsNum = sizeof(Integrators) / sizeof(Integrators[0]);
 
 /**********************************************************/
 
 /**
  * Initialize calculation module - choose appropriate 
  * kernel(s), equation of state, etc. according to 
- * parameters in the scene description file.
+ * parameters in the scene description file. The 
+ * function returns 0 if succeeded and -1 if the 
+ * kernel, the equation of state, the integrator,
+ * the treatment of the boundary or the method of 
+ * the neighbour search is unknown.
  */
-void
-InitCalc( void)
+int
+InitCalc( struct Simulation *Sim)   /* Simulation */
 {
-    int i;
+    int i, j;
 
     /* Choose the kernel for calculations */
+    Sim->GetGradKernel = NULL;
     for ( i = 0; i < KernelsNum; i++ )
     {
         /* Search for the required kernel */
-        if ( strcmp( KernelType, Kernels[i].Name) )
+        if ( strcmp( Sim->KernelType, Kernels[i].Name) )
             continue;
         /* Initialize the kernel */
-        Kernels[i].Init();
+        Kernels[i].Init( Sim);
         /* The function to calculate the kernel's gradient */
-        GetGradKernel = Kernels[i].GetGrad;
+        Sim->GetGradKernel = Kernels[i].GetGrad;
+        /* The function to calculate the kernel's value */
+        Sim->GetKernel = Kernels[i].GetValue;
+        /* The same functions for the given smoothing length */
+        Sim->GetGradKernelH = Kernels[i].GetGradH;
+        Sim->GetKernelH = Kernels[i].GetValueH;
         break;
     }
 
     /* Choose the equation of state for calculations */
+    Sim->CalcPressByEOS = NULL;
     for ( i = 0; i < StateEquationsNum; i++ )
     {
         /* Search for the required EOS */
-        if ( strcmp(EOSType, StateEquations[i].Name) )
+        if ( strcmp( Sim->EOSType, StateEquations[i].Name) )
             continue;
+        /* Initialize the EOS */
+        if ( StateEquations[i].Init != NULL )
+            StateEquations[i].Init( Sim);
         /* The function to calculate the particles' pressures */
-        CalcPressByEOS = StateEquations[i].CalcPress;
+        Sim->CalcPressByEOS = StateEquations[i].CalcPress;
+        /* The function to correct the pressures (iterative solvers) */
+        Sim->CorrectPressByEOS = StateEquations[i].CorrectPress;
         break;
     }
+
+    /* Choose the integration scheme */
+    Sim->Integrate = NULL;
+    for ( i = 0; i < IntegratorsNum; i++ )
+    {
+        /* Search for the required scheme (the default one if it isn't set) */
+        if ( Sim->Integrator[0] != '\0' &&
+             strcmp( Sim->Integrator, Integrators[i].Name) )
+            continue;
+        Sim->PrepareIntegration = Integrators[i].Prepare;
+        Sim->Integrate = Integrators[i].Integrate;
+        break;
+    }
+
+    if ( Sim->GetGradKernel == NULL || Sim->CalcPressByEOS == NULL ||
+         Sim->Integrate == NULL )
+        return -1;
+
+    /* Periods of the domain along periodic axes */
+    Sim->PeriodicDomain = 0;
+    for ( i = 0; i < 3; i++ )
+    {
+        Sim->Period[i] = 0.0f;
+        if ( i >= Sim->Dimension || Sim->Periodic[i][1] <= Sim->Periodic[i][0] )
+            continue;
+        Sim->Period[i] = Sim->Periodic[i][1] - Sim->Periodic[i][0];
+        Sim->PeriodicDomain = 1;
+    }
+
+    /* Smoothing lengths of the particles (they differ if they 
+     * adapt to the density or the particles are refined) */
+    Sim->AdaptiveSmooth = ( Sim->AdaptSmooth[1] > Sim->AdaptSmooth[0] || 
+                            Sim->RefineLevels > 0 );
+    Sim->MaxSmoothR = Sim->SmoothR;
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        if ( Sim->Particles[i].SmoothR <= 0.0f )
+            Sim->Particles[i].SmoothR = Sim->SmoothR;
+        if ( Sim->Particles[i].SmoothR > Sim->MaxSmoothR )
+            Sim->MaxSmoothR = Sim->Particles[i].SmoothR;
+    }
+
+    /* The distance field of the obstacles replaces the boundary
+     * particles, so they are dropped (the field can't follow the 
+     * moving obstacles, they keep their boundary particles) */
+    if ( strcmp( Sim->Boundary, "SDF") == 0 )
+    {
+        if ( InitDistField( Sim) )
+            return -1;
+        for ( i = j = 0; i < Sim->BParticlesNumber; i++ )
+            if ( GetObstacleBody( Sim, Sim->BParticles[i].Obstacle) >= 0 )
+                Sim->BParticles[j++] = Sim->BParticles[i];
+        Sim->BParticlesNumber = j;
+        if ( j == 0 )
+        {
+            free( Sim->BParticles);
+            Sim->BParticles = NULL;
+        }
+    }
+    else if ( Sim->Boundary[0] != '\0' && strcmp( Sim->Boundary, "PARTICLES") )
+        return -1;
+
+    /* The obstacles and the boundary particles of the moving bodies */
+    if ( InitMotion( Sim) )
+        return -1;
+
+    /* The hierarchy of the obstacles to sweep the particles against */
+    if ( Sim->Collisions && InitCollisions( Sim) )
+        return -1;
+
+    /* Choose the method to search for the neighbours */
+    if ( InitNeighbSearch( Sim) )
+        return -1;
+
+    /* The diagnostics describe the initial state until the first step */
+    InitDiagnostics( Sim);
     
-    return;
+    return 0;
 } /* InitCalc */
 
 /**********************************************************/
 
+/**
+ * Free the memory allocated by calculation module.
+ */
+void
+FreeCalc( struct Simulation *Sim)   /* Simulation */
+{
+    free( Sim->PredPos);
+    free( Sim->PressAccel);
+    free( Sim->DensError);
+    free( Sim->PressDensScale);
+    free( Sim->PressDelta);
+    free( Sim->BoundVolume);
+    free( Sim->BoundMixed);
+    free( Sim->PrevAccel);
+    free( Sim->PrevDervDens);
+    free( Sim->DiagParts);
+    FreeNeighbPairs( Sim);
+    FreeRefine( Sim);
+    FreeDistField( Sim);
+    FreeCollisions( Sim);
+    FreeMotion( Sim);
+    Sim->PredPos = NULL;
+    Sim->PressAccel = NULL;
+    Sim->DensError = NULL;
+    Sim->PressDensScale = NULL;
+    Sim->PressDelta = NULL;
+    Sim->PressLevels = 0;
+    Sim->BoundVolume = NULL;
+    Sim->BoundMixed = NULL;
+    Sim->PressSolverSize = 0;
+    Sim->PrevAccel = NULL;
+    Sim->PrevDervDens = NULL;
+    Sim->PrevRatesSize = 0;
+    Sim->DiagParts = NULL;
+    Sim->DiagPartsSize = 0;
+
+    return;
+} /* FreeCalc */
+
+/**********************************************************/
+
 /**
  * Do one calculation step.
  */
 void
-DoCalcStep( void)
+DoCalcStep( struct Simulation *Sim)   /* Simulation */
 {
-    float GradKernel[3];
+    struct Particle *Particles;
+    struct NeighbPair *Pair;
     float PressTerm;
     float ViscTerm;
     float ViscNu;
+    float SmoothR;
+    float Distrib;
+    float Dist;
+    float MaxRepulsion;
     float Vij[3];
-    float Rij[3];
+    float Normal[3];
     float tmp1, tmp2;
-    int   i, j, d;
+    double Time, Now;
+    int   Dimension;
+    int   i, j, k, d;
     
+    Dimension = Sim->Dimension;
+    Time = omp_get_wtime();
+
     /* Nu factor to calculate viscosity */
-    ViscNu = 0.01f * SmoothR * SmoothR;
+    ViscNu = 0.01f * Sim->SmoothR * Sim->SmoothR;
+
+    /* The repulsion which moves a particle by its distance in one step */
+    MaxRepulsion = 1.0f / (Sim->TimeStep * Sim->TimeStep);
     
+    /* The moving obstacles take their poses at the time of the step */
+    if ( Sim->BodiesNumber > 0 )
+        MoveObstacles( Sim);
+
+    /* The smoothing lengths follow the density of the last step */
+    if ( Sim->AdaptSmooth[1] > Sim->AdaptSmooth[0] )
+        UpdateSmoothLengths( Sim);
+
+    /* Split and merge the particles where it's needed */
+    if ( Sim->RefineLevels > 0 )
+        RefineParticles( Sim);
+
+    /* The refinement reallocates the particles if it adds them */
+    Particles = Sim->Particles;
+
+    Now = omp_get_wtime();
+    Sim->PhaseTime[PHASE_REFINE] = Now - Time;
+    Time = Now;
+
+    /* Find the neighbours, the kernel is evaluated once per pair */
+    FindNeighbPairs( Sim);
+
+    Now = omp_get_wtime();
+    Sim->PhaseTime[PHASE_NEIGHB] = Now - Time;
+    Time = Now;
+
+    /* The integrator may need the rates of the last step */
+    if ( Sim->PrepareIntegration != NULL )
+        Sim->PrepareIntegration( Sim);
+
     /* Calculate the particles' pressures */
-    CalcPressByEOS();
+    Sim->CalcPressByEOS( Sim);
 
     /* Calculate the rates of change of velocities and the 
      * rates of change of densities for all the particles
      * J.J.Monaghan, Simulating Free Surface Flows with SPH, 
      * J.Comput.Phys., 110, 399-406, 1994.
      */
-#pragma omp parallel for schedule(dynamic,50) private(GradKernel,PressTerm,ViscTerm,Vij,Rij,tmp1,tmp2,j,d)
-    for ( i = 0; i < ParticlesNumber; i++ )
+#pragma omp parallel for schedule(dynamic,50) private(Pair,PressTerm,ViscTerm,SmoothR,Distrib,Dist,Vij,Normal,tmp1,tmp2,j,k,d) firstprivate(ViscNu)
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
     {
         /* Take into account the external force field */
         memcpy( Particles[i].Accel, ExternalForce, sizeof(ExternalForce));
@@ -142,25 +338,26 @@ DoCalcStep( void)
 
         /* Calculate forces between smoothing particles 
          * and update the rate of change of the density */
-        for ( j = 0; j < ParticlesNumber; j++ )
+        for ( k = Sim->PairsStart[i]; k < Sim->PairsStart[i + 1]; k++ )
         {
-            if ( j == i )
-                continue;
-
-            VectorSubstraction( Rij, Particles[i].Pos, Particles[j].Pos);
+            Pair = &Sim->Pairs[k];
+            j = Pair->j;
 
-            /* Get the kernel's gradient at the point Rij */
-            if ( GetGradKernel( GradKernel, Rij) )
-                continue;
-            
             /* Take into account the viscocity of the medium */
-            VectorSubstraction( Vij, Particles[i].Vel, Particles[j].Vel);
-            tmp1 = VectorInnerproduct( Rij, Vij);
+            VectorSubstraction( Dimension, Vij, Particles[i].Vel, Particles[j].Vel);
+            tmp1 = VectorInnerproduct( Dimension, Pair->Rij, Vij);
             if ( tmp1 < 0.0f )
             {
-                tmp2 = VectorInnerproduct( Rij, Rij);
+                /* The mean smoothing length of the pair */
+                SmoothR = Sim->SmoothR;
+                if ( Sim->AdaptiveSmooth )
+                {
+                    SmoothR = 0.5f * (Particles[i].SmoothR + Particles[j].SmoothR);
+                    ViscNu = 0.01f * SmoothR * SmoothR;
+                }
+                tmp2 = VectorInnerproduct( Dimension, Pair->Rij, Pair->Rij);
                 tmp1 = SmoothR * tmp1 / (tmp2 + ViscNu);
-                ViscTerm = 2.0f * tmp1 * (-ViscAlpha * SOS + ViscBeta * tmp1) / 
+                ViscTerm = 2.0f * tmp1 * (-Sim->ViscAlpha * Sim->SOS + Sim->ViscBeta * tmp1) / 
                           (Particles[i].Dens + Particles[j].Dens);
             }
             else
@@ -172,72 +369,537 @@ DoCalcStep( void)
             PressTerm = Particles[i].Press / (Particles[i].Dens * Particles[i].Dens) +
                         Particles[j].Press / (Particles[j].Dens * Particles[j].Dens);
             
-            /* Update the acceleration of the particle */
-            tmp1 = Particles[j].Mass * (PressTerm + ViscTerm);
+            /* Update the acceleration of the particle (the kernel's
+             * gradient is GradFactor * Rij) */
+            tmp1 = Particles[j].Mass * (PressTerm + ViscTerm) * Pair->GradFactor;
             for ( d = 0; d < Dimension; d++ )
-                Particles[i].Accel[d] -= tmp1 * GradKernel[d];
+                Particles[i].Accel[d] -= tmp1 * Pair->Rij[d];
 
             /* Update the rate of change of the density for the particle */
-            tmp1 = VectorInnerproduct( Vij, GradKernel);
+            tmp1 = VectorInnerproduct( Dimension, Vij, Pair->Rij) * Pair->GradFactor;
             Particles[i].DervDens += Particles[j].Mass * tmp1;
         }
 
-        /* Calculate the Lennard-Jones forces between 
-         * the particle and the boundary particles */
-        for ( j = 0; j < BParticlesNumber; j++ )
+        /* Calculate the Lennard-Jones forces between the particle and 
+         * the boundary particles, the refined particles are repulsed 
+         * at the distance between the particles of their level */
+        Distrib = Sim->ParticlesDistrib;
+        if ( Sim->RefineLevels > 0 )
+            Distrib *= pow( Particles[i].Mass / Sim->ParticleMass, 1.0f / Dimension);
+        for ( k = Sim->BPairsStart[i]; k < Sim->BPairsStart[i + 1]; k++ )
         {
-            VectorSubstraction( Rij, Particles[i].Pos, BParticles[j].Pos);
-            tmp1 = VectorInnerproduct( Rij, Rij);
-            tmp2 = ParticlesDistrib / sqrt( tmp1);
+            Pair = &Sim->BPairs[k];
+            tmp1 = VectorInnerproduct( Dimension, Pair->Rij, Pair->Rij);
+            tmp2 = Distrib / sqrt( tmp1);
             /* Only repulsive forces are taken into account */
             if ( tmp2 > 1.0f )
             {
                 tmp1 = (pow( tmp2, LenJonP1) - pow( tmp2, LenJonP2)) * 
                        LenJonD / tmp1;
+                /* If the particles are swept against the obstacles, they
+                 * can't cross them, so the force only has to push the
+                 * particle out of its range in one step (the stiff force
+                 * near the boundary doesn't limit the time step) */
+                if ( Sim->Collisions )
+                {
+                    Dist = Distrib / tmp2;
+                    if ( tmp1 * Dist > (Distrib - Dist) * MaxRepulsion )
+                        tmp1 = (Distrib - Dist) * MaxRepulsion / Dist;
+                }
+                for ( d = 0; d < Dimension; d++ )
+                    Particles[i].Accel[d] += Pair->Rij[d] * tmp1;
+            }
+        }
+
+        /* The same force from the nearest point of the obstacles if
+         * the boundary is the distance field (one lookup per particle) */
+        if ( Sim->DistField.Nodes != NULL )
+        {
+            Dist = GetObstacleDist( Sim, Particles[i].Pos, Normal);
+            if ( Dist > 0.0f && Dist < Distrib )
+            {
+                tmp2 = Distrib / Dist;
+                tmp1 = (pow( tmp2, LenJonP1) - pow( tmp2, LenJonP2)) * 
+                       LenJonD / Dist;
+                if ( Sim->Collisions && tmp1 > (Distrib - Dist) * MaxRepulsion )
+                    tmp1 = (Distrib - Dist) * MaxRepulsion;
                 for ( d = 0; d < Dimension; d++ )
-                    Particles[i].Accel[d] += Rij[d] * tmp1;
+                    Particles[i].Accel[d] += Normal[d] * tmp1;
             }
         }
     }
 
+    Now = omp_get_wtime();
+    Sim->PhaseTime[PHASE_FORCES] = Now - Time;
+    Time = Now;
+
+    /* Incompressible solvers correct the pressures (and the 
+     * accelerations) iteratively using the forces above */
+    if ( Sim->CorrectPressByEOS != NULL )
+        Sim->CorrectPressByEOS( Sim);
+
+    Now = omp_get_wtime();
+    Sim->PhaseTime[PHASE_PRESS] = Now - Time;
+    Time = Now;
+
     /* Time integration */
-    LeapfrogIntegration();
+    Sim->Integrate( Sim);
+
+    Sim->PhaseTime[PHASE_INTEGRATE] = omp_get_wtime() - Time;
+
+    Sim->StepsNumber++;
+    Sim->Time += Sim->TimeStep;
     
     return;
 } /* DoCalcStep */
 
 /**********************************************************/
 
+#ifndef LEAN_PARTICLES
 /**
  * 'leap-frog' integration scheme
  * M.P.Allen and D.J.Tildesley, Computer Simulation 
  * of Liquids, Oxford Univ.Press, 1987.
  */
 static void
-LeapfrogIntegration( void)
+LeapfrogIntegration( struct Simulation *Sim)   /* Simulation */
 {
-    int i;
-    int d;
+    struct Particle *Particles;
+    float TimeStep;
     
-    /* Calculate new positions, velocities and densities for all the particles */
-    for ( i = 0; i < ParticlesNumber; i++ )
+    Particles = Sim->Particles;
+    TimeStep = Sim->TimeStep;
+
+    /* Calculate new positions, velocities and densities for all the 
+     * particles, the diagnostics are reduced in the same sweep */
+#pragma omp parallel
     {
-        for ( d = 0; d < Dimension; d++ )
+        struct Diagnostics *Diag;
+        float Start[3];
+        float Normal[3];
+        int i;
+        int d;
+
+        Diag = BeginDiagnostics( Sim);
+
+#pragma omp for schedule(static)
+        for ( i = 0; i < Sim->ParticlesNumber; i++ )
         {
-            /* New interval velocity (t+dt/2) */
-            Particles[i].IvalVel[d] += Particles[i].Accel[d] * TimeStep;
-            /* New position (t+dt) */
-            Particles[i].Pos[d] += Particles[i].IvalVel[d] * TimeStep;
-            /* New velocity (t+dt) */
-            Particles[i].Vel[d] = Particles[i].IvalVel[d] + 
-                                  Particles[i].Accel[d] * TimeStep / 2.0f;
+            memcpy( Start, Particles[i].Pos, sizeof(Start));
+            for ( d = 0; d < Sim->Dimension; d++ )
+            {
+                /* New interval velocity (t+dt/2) */
+                Particles[i].IvalVel[d] += Particles[i].Accel[d] * TimeStep;
+                /* New position (t+dt) */
+                Particles[i].Pos[d] += Particles[i].IvalVel[d] * TimeStep;
+                /* New velocity (t+dt) */
+                Particles[i].Vel[d] = Particles[i].IvalVel[d] + 
+                                      Particles[i].Accel[d] * TimeStep / 2.0f;
+            }
+            /* The particle mustn't cross the obstacles during the step */
+            if ( Sim->Collisions && SweepParticle( Sim, Start, Particles[i].Pos, Normal) )
+            {
+                BounceVelocity( Sim, Particles[i].IvalVel, Normal);
+                BounceVelocity( Sim, Particles[i].Vel, Normal);
+            }
+            /* Wrap the particle around periodic boundaries */
+            for ( d = 0; d < Sim->Dimension; d++ )
+            {
+                if ( Sim->Period[d] == 0.0f )
+                    continue;
+                if ( Particles[i].Pos[d] < Sim->Periodic[d][0] )
+                    Particles[i].Pos[d] += Sim->Period[d];
+                else if ( Particles[i].Pos[d] >= Sim->Periodic[d][1] )
+                    Particles[i].Pos[d] -= Sim->Period[d];
+            }
+            /* The neighbour search moves the particle if it changes its cell */
+            UpdateNeighbCell( Sim, i);
+            /* New interval density (t+dt/2) */
+            Particles[i].IvalDens += Particles[i].DervDens * TimeStep;
+            /* New density (t+dt) */
+            Particles[i].Dens = Particles[i].IvalDens +
+                                Particles[i].DervDens * TimeStep / 2.0f;
+
+            AddDiagnostics( Sim, Diag, i);
         }
-        /* New interval density (t+dt/2) */
-        Particles[i].IvalDens += Particles[i].DervDens * TimeStep;
-        /* New density (t+dt) */
-        Particles[i].Dens = Particles[i].IvalDens +
-                            Particles[i].DervDens * TimeStep / 2.0f;
+
+        EndDiagnostics( Sim);
     }
     
     return;
 } /* LeapfrogIntegration */
+#endif
+
+/**
+ * Keep the accelerations and the rates of change of the densities of
+ * the last step before they are replaced by the ones of this step, 
+ * the kick-drift-kick integration needs both of them. The arrays are 
+ * kept between the steps and grow with the number of the particles.
+ */
+static void
+KeepRates( struct Simulation *Sim)   /* Simulation */
+{
+    struct Particle *Particles;
+    int i;
+
+    Particles = Sim->Particles;
+
+    if ( Sim->PrevRatesSize < Sim->ParticlesNumber )
+    {
+        Sim->PrevRatesSize = Sim->ParticlesNumber;
+        Sim->PrevAccel = (float (*)[3])
+                         realloc( Sim->PrevAccel, Sim->PrevRatesSize * sizeof(*Sim->PrevAccel));
+        Sim->PrevDervDens = (float *)
+                            realloc( Sim->PrevDervDens, Sim->PrevRatesSize * sizeof(float));
+    }
+
+#pragma omp parallel for schedule(static)
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        memcpy( Sim->PrevAccel[i], Particles[i].Accel, sizeof(Particles[i].Accel));
+        Sim->PrevDervDens[i] = Particles[i].DervDens;
+    }
+
+    return;
+} /* KeepRates */
+
+/**
+ * Kick-drift-kick integration scheme (velocity Verlet), every particle
+ * keeps only its velocity and its density at t. They were kicked from 
+ * (t-dt/2) to t by the rates of the last step (the viscous forces and
+ * the density's rate need the velocities at t before the forces at t
+ * are known), so the closing kick is redone with the rates of this 
+ * step, then the particle is kicked to (t+dt/2), drifted to (t+dt) and
+ * kicked to (t+dt) by the same rates. The scheme is the same as the 
+ * 'leap-frog' one, but the particles are smaller by the values at 
+ * (t-dt/2), though the last rates are kept aside of them, so only
+ * the particles' own memory is smaller.
+ */
+static void
+KickDriftKickIntegration( struct Simulation *Sim)   /* Simulation */
+{
+    struct Particle *Particles;
+    float TimeStep;
+
+    Particles = Sim->Particles;
+    TimeStep = Sim->TimeStep;
+
+    /* Calculate new positions, velocities and densities for all the 
+     * particles, the diagnostics are reduced in the same sweep */
+#pragma omp parallel
+    {
+        struct Diagnostics *Diag;
+        float Start[3];
+        float Normal[3];
+        float Vel;
+        float Dens;
+        int i;
+        int d;
+
+        Diag = BeginDiagnostics( Sim);
+
+#pragma omp for schedule(static)
+        for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        {
+            memcpy( Start, Particles[i].Pos, sizeof(Start));
+            for ( d = 0; d < Sim->Dimension; d++ )
+            {
+                /* Velocity at (t-dt/2) kicked to (t+dt/2) */
+                Vel = Particles[i].Vel[d] - Sim->PrevAccel[i][d] * TimeStep / 2.0f +
+                      Particles[i].Accel[d] * TimeStep;
+                /* New position (t+dt) */
+                Particles[i].Pos[d] += Vel * TimeStep;
+                /* New velocity (t+dt) */
+                Particles[i].Vel[d] = Vel + Particles[i].Accel[d] * TimeStep / 2.0f;
+            }
+            /* The particle mustn't cross the obstacles during the step */
+            if ( Sim->Collisions && SweepParticle( Sim, Start, Particles[i].Pos, Normal) )
+                BounceVelocity( Sim, Particles[i].Vel, Normal);
+            /* Wrap the particle around periodic boundaries */
+            for ( d = 0; d < Sim->Dimension; d++ )
+            {
+                if ( Sim->Period[d] == 0.0f )
+                    continue;
+                if ( Particles[i].Pos[d] < Sim->Periodic[d][0] )
+                    Particles[i].Pos[d] += Sim->Period[d];
+                else if ( Particles[i].Pos[d] >= Sim->Periodic[d][1] )
+                    Particles[i].Pos[d] -= Sim->Period[d];
+            }
+            /* The neighbour search moves the particle if it changes its cell */
+            UpdateNeighbCell( Sim, i);
+            /* Density at (t-dt/2) kicked to (t+dt/2) */
+            Dens = Particles[i].Dens - Sim->PrevDervDens[i] * TimeStep / 2.0f +
+                   Particles[i].DervDens * TimeStep;
+            /* New density (t+dt) */
+            Particles[i].Dens = Dens + Particles[i].DervDens * TimeStep / 2.0f;
+
+            AddDiagnostics( Sim, Diag, i);
+        }
+
+        EndDiagnostics( Sim);
+    }
+
+    return;
+} /* KickDriftKickIntegration */
+
+/**
+ * Prepare the reduction of the diagnostics, it's called by every thread
+ * of the integration's parallel region before the particles are swept, 
+ * and returns the cleared part of the diagnostics of the calling thread.
+ */
+static struct Diagnostics *
+BeginDiagnostics( struct Simulation *Sim)   /* Simulation */
+{
+    struct Diagnostics *Part;
+    int ThreadsNum;
+
+    ThreadsNum = omp_get_num_threads();
+#pragma omp single
+    {
+        if ( Sim->DiagPartsSize < ThreadsNum )
+        {
+            Sim->DiagPartsSize = ThreadsNum;
+            Sim->DiagParts = (struct Diagnostics *)
+                             realloc( Sim->DiagParts, ThreadsNum * sizeof(struct Diagnostics));
+        }
+    }
+
+    Part = &Sim->DiagParts[omp_get_thread_num()];
+    memset( Part, 0, sizeof(struct Diagnostics));
+
+    return Part;
+} /* BeginDiagnostics */
+
+/**
+ * Add the particle <i> (it's just integrated) to the thread's part
+ * <Part> of the diagnostics, the maximum speed is kept squared.
+ */
+static void
+AddDiagnostics( struct Simulation *Sim,      /* Simulation */
+                struct Diagnostics *Part,    /* Thread's part */
+                int i)                       /* The particle */
+{
+    struct Particle *Pi;
+    float Vel2;
+    float DensDev;
+    int d;
+
+    Pi = &Sim->Particles[i];
+
+    Vel2 = VectorInnerproduct( Sim->Dimension, Pi->Vel, Pi->Vel);
+    Part->Mass += Pi->Mass;
+    Part->KinEnergy += 0.5 * Pi->Mass * Vel2;
+    Part->PotEnergy -= Pi->Mass * VectorInnerproduct( Sim->Dimension, 
+                                                      ExternalForce, Pi->Pos);
+    Part->MeanDens += Pi->Dens;
+    for ( d = 0; d < Sim->Dimension; d++ )
+    {
+        Part->Momentum[d] += Pi->Mass * Pi->Vel[d];
+        Part->Centroid[d] += Pi->Mass * Pi->Pos[d];
+    }
+    if ( Vel2 > Part->MaxVel )
+        Part->MaxVel = Vel2;
+    DensDev = (float)fabs( Pi->Dens - Sim->Density0) / Sim->Density0;
+    if ( DensDev > Part->MaxDensDev )
+        Part->MaxDensDev = DensDev;
+
+    return;
+} /* AddDiagnostics */
+
+/**
+ * Sum the parts of the diagnostics of all the threads in the order
+ * of the threads, it's called by every thread of the integration's
+ * parallel region after the particles are swept.
+ */
+static void
+EndDiagnostics( struct Simulation *Sim)   /* Simulation */
+{
+#pragma omp single
+    {
+        struct Diagnostics *Diag;
+        struct Diagnostics *Part;
+        int t, d;
+
+        Diag = &Sim->Diag;
+        memset( Diag, 0, sizeof(struct Diagnostics));
+        for ( t = 0; t < omp_get_num_threads(); t++ )
+        {
+            Part = &Sim->DiagParts[t];
+            Diag->Mass += Part->Mass;
+            Diag->KinEnergy += Part->KinEnergy;
+            Diag->PotEnergy += Part->PotEnergy;
+            Diag->MeanDens += Part->MeanDens;
+            for ( d = 0; d < 3; d++ )
+            {
+                Diag->Momentum[d] += Part->Momentum[d];
+                Diag->Centroid[d] += Part->Centroid[d];
+            }
+            if ( Part->MaxVel > Diag->MaxVel )
+                Diag->MaxVel = Part->MaxVel;
+            if ( Part->MaxDensDev > Diag->MaxDensDev )
+                Diag->MaxDensDev = Part->MaxDensDev;
+        }
+        Diag->MaxVel = (float)sqrt( Diag->MaxVel);
+        if ( Diag->Mass > 0.0 )
+        {
+            for ( d = 0; d < 3; d++ )
+                Diag->Centroid[d] /= Diag->Mass;
+        }
+        if ( Sim->ParticlesNumber > 0 )
+            Diag->MeanDens /= Sim->ParticlesNumber;
+    }
+
+    return;
+} /* EndDiagnostics */
+
+/**
+ * Reduce the diagnostics of the initial state of the simulation <Sim>
+ * the same way the integration does after every step.
+ */
+static void
+InitDiagnostics( struct Simulation *Sim)   /* Simulation */
+{
+#pragma omp parallel
+    {
+        struct Diagnostics *Diag;
+        int i;
+
+        Diag = BeginDiagnostics( Sim);
+#pragma omp for schedule(static)
+        for ( i = 0; i < Sim->ParticlesNumber; i++ )
+            AddDiagnostics( Sim, Diag, i);
+        EndDiagnostics( Sim);
+    }
+
+    return;
+} /* InitDiagnostics */
+
+/**
+ * Get the velocity <Vel> of the particle <i> at (t-dt/2) (it's known
+ * during the step only if the kick-drift-kick scheme is used).
+ */
+void
+GetIntervalVel( struct Simulation *Sim,   /* Simulation */
+                int i,                    /* The particle */
+                float *Vel)               /* Velocity at (t-dt/2) */
+{
+    struct Particle *Pi;
+    int d;
+
+    Pi = &Sim->Particles[i];
+#ifndef LEAN_PARTICLES
+    if ( Sim->Integrate == LeapfrogIntegration )
+    {
+        memcpy( Vel, Pi->IvalVel, Sim->Dimension * sizeof(float));
+        return;
+    }
+#endif
+    for ( d = 0; d < Sim->Dimension; d++ )
+        Vel[d] = Pi->Vel[d] - Sim->PrevAccel[i][d] * Sim->TimeStep / 2.0f;
+
+    return;
+} /* GetIntervalVel */
+
+/**********************************************************/
+
+/**
+ * Adapt the smoothing lengths of the particles to the local density,
+ * the length of the particle i is h_i = h * (n0 / n_i)^(1/D), where
+ * h is the smoothing length of the scene, n_i is the number density 
+ * summed over the pairs of the last step and n0 is the number density 
+ * of the initial particle distribution. So the number of neighbours 
+ * stays about the same in the dense regions, and the sparse regions
+ * are still resolved. The lengths are clamped to the limits given by 
+ * the scene, the largest of them sets the radius of the search.
+ */
+static void
+UpdateSmoothLengths( struct Simulation *Sim)   /* Simulation */
+{
+    struct Particle *Particles;
+    float Zero[3];
+    float Number0;
+    float Number;
+    float SmoothR;
+    int i, k;
+
+    Particles = Sim->Particles;
+    Zero[0] = Zero[1] = Zero[2] = 0.0f;
+    Number0 = 1.0f / pow( Sim->ParticlesDistrib, Sim->Dimension);
+
+    /* There are no pairs before the first step */
+    if ( Sim->StepsNumber > 0 && Sim->PairsStart != NULL )
+    {
+#pragma omp parallel for schedule(dynamic,50) private(Number,SmoothR,k)
+        for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        {
+            /* The particle's own contribution and the ones of its pairs */
+            Number = Sim->GetKernelH( Sim, Zero, Particles[i].SmoothR);
+            for ( k = Sim->PairsStart[i]; k < Sim->PairsStart[i + 1]; k++ )
+                Number += Sim->Pairs[k].Kernel;
+
+            SmoothR = Sim->SmoothR * pow( Number0 / Number, 1.0f / Sim->Dimension);
+            if ( !(SmoothR >= Sim->AdaptSmooth[0]) )
+                SmoothR = Sim->AdaptSmooth[0];
+            else if ( SmoothR > Sim->AdaptSmooth[1] )
+                SmoothR = Sim->AdaptSmooth[1];
+            Particles[i].SmoothR = SmoothR;
+        }
+    }
+
+    Sim->MaxSmoothR = Sim->AdaptSmooth[0];
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        if ( Particles[i].SmoothR > Sim->MaxSmoothR )
+            Sim->MaxSmoothR = Particles[i].SmoothR;
+
+    return;
+} /* UpdateSmoothLengths */
+
+/**
+ * Bounce the velocity <Vel> of the particle off the obstacle with the
+ * unit normal <Normal> facing it - the normal velocity towards the
+ * obstacle is reversed and scaled by RESTITUTION (it's removed if it's
+ * 0), the tangential velocity is kept.
+ */
+static void
+BounceVelocity( struct Simulation *Sim,   /* Simulation */
+                float *Vel,               /* Velocity of the particle */
+                float *Normal)            /* Normal of the obstacle */
+{
+    float NormVel;
+    int d;
+
+    NormVel = VectorInnerproduct( Sim->Dimension, Vel, Normal);
+    if ( NormVel >= 0.0f )
+        return;
+    for ( d = 0; d < Sim->Dimension; d++ )
+        Vel[d] -= (1.0f + Sim->Restitution) * NormVel * Normal[d];
+
+    return;
+} /* BounceVelocity */
+
+/**********************************************************/
+
+/**
+ * Apply minimum image convention to the vector <Rij> - along every 
+ * periodic axis the component of <Rij> is replaced by the one to the 
+ * nearest periodic image of the particle j. The convention is valid 
+ * as long as each period is larger than the kernel's support.
+ */
+void
+GetMinimumImage( struct Simulation *Sim,   /* Simulation */
+                 float *Rij)               /* Vector Rij = Ri - Rj */
+{
+    int d;
+
+    for ( d = 0; d < Sim->Dimension; d++ )
+    {
+        if ( Sim->Period[d] == 0.0f )
+            continue;
+        if ( Rij[d] > 0.5f * Sim->Period[d] )
+            Rij[d] -= Sim->Period[d];
+        else if ( Rij[d] < -0.5f * Sim->Period[d] )
+            Rij[d] += Sim->Period[d];
+    }
+
+    return;
+} /* GetMinimumImage */
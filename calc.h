@@ -10,37 +10,24 @@
 
 /**********************************************************/
 
-/* Equation of state to calculate pressures */
-extern char  EOSType[20];
+struct Simulation;
 
-/* Kernel to use in the calculations */
-extern char  KernelType[20];
-
-/* Kernel smoothing length */
-extern float SmoothR;
-
-/* Rest density */
-extern float Density0;
-
-/* Speed of sound */
-extern float SOS;
-
-/* Alpha factor to calculate viscosity */
-extern float ViscAlpha;
-
-/* Beta factor to calculate viscosity */
-extern float ViscBeta;
+/* Initialize calculation module */
+extern int  InitCalc( struct Simulation *Sim);
 
-/* Time step of integration */
-extern float TimeStep;
+/* Free the memory allocated by calculation module */
+extern void FreeCalc( struct Simulation *Sim);
 
-/**********************************************************/
+/* Do one calculation step */
+extern void DoCalcStep( struct Simulation *Sim);
 
-/* Initialize calculation module */
-extern void InitCalc( void);
+/* Get the velocity of the particle at (t-dt/2) */
+extern void GetIntervalVel( struct Simulation *Sim, int i,
+                            float *Vel);
 
-/* Do one calculation step */
-extern void DoCalcStep( void);
+/* Apply minimum image convention to the vector Rij */
+extern void GetMinimumImage( struct Simulation *Sim, 
+                             float *Rij);
 
 /**********************************************************/
 
@@ -0,0 +1,786 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "vector.h"
+#include "motion.h"
+#include "collide.h"
+
+/**********************************************************/
+
+/* The maximum number of the obstacles of a leaf */
+#define LEAF_OBSTACLES       4
+
+/* The maximum depth of the hierarchy (the nodes are split at
+ * the median, so it's enough for any number of the obstacles) */
+#define TREE_MAX_DEPTH       64
+
+/* The part of the initial distribution of the particles (the range
+ * of the repulsion) they are kept off the obstacle they are stopped at */
+#define COLLIDE_MARGIN       1.0f
+
+/* The part of the initial distribution of the particles they are kept
+ * off the obstacle at least (the particle which begins the step at the
+ * obstacle mustn't be stopped on it, it'd tunnel through it later) */
+#define COLLIDE_MIN_MARGIN   0.05f
+
+/* The maximum number of the obstacles the particle slides along
+ * during a step (it's stopped at the last one) */
+#define COLLIDE_ITERATIONS   4
+
+/**********************************************************/
+
+/* Node of the bounding volume hierarchy of the obstacles - the box
+ * of its obstacles, the first child (the second one follows it) or
+ * the first obstacle of a leaf, the number of the obstacles of a leaf
+ * (0 for an inner node), and non-zero if some of its obstacles move */
+struct ObstacleNode
+{
+    float Box[2][3];
+    int   First;
+    int   Count;
+    int   Moving;
+};
+
+/* The segment the particle moves along during the step */
+struct Sweep
+{
+    float Start[3];       /* Position at the beginning of the step */
+    float Dir[3];         /* Motion during the step */
+    float InvDir[3];      /* Its inverse (large if it's 0) */
+};
+
+/**********************************************************/
+
+/* Get the vertices of the obstacle */
+static int   GetVertices      ( struct Simulation *Sim, int i,
+                                float **Vrtx);
+
+/* Get the box of the obstacles */
+static void  GetObstaclesBox  ( struct Simulation *Sim, int First,
+                                int Count, float (*Box)[3]);
+
+/* Build the subtree of the obstacles */
+static void  BuildNode        ( struct Simulation *Sim, int Node,
+                                int First, int Count,
+                                float (*Centres)[3]);
+
+/* Move the median of the obstacles along the axis to its place */
+static void  SelectMedian     ( int *Obstacles, float (*Centres)[3],
+                                int Count, int Axis);
+
+/* Find the first obstacle the particle crosses */
+static int   FindCrossing     ( struct Simulation *Sim, float *From,
+                                int Carried, float *Pos, float *Begin,
+                                float *Cross, float *Normal);
+
+/* Set the segment between the points */
+static void  SetSweep         ( int Dim, struct Sweep *Sweep,
+                                float *Start, float *End);
+
+/* Set the segment relative to the moving body */
+static void  SetBodySweep     ( int Dim, struct Sweep *Sweep,
+                                struct MovingBody *Body, float *From,
+                                int Carried, float *Pos);
+
+/* Move the point with the body during the step */
+static void  StepPoint        ( struct MovingBody *Body, float *Point,
+                                float *Moved, int Back);
+
+/* Check if the segment crosses the box */
+static int   SweepBox         ( int Dim, struct Sweep *Sweep,
+                                float (*Box)[3], float MaxT);
+
+/* Cross the segment with the obstacle */
+static int   SweepObstacle    ( struct Simulation *Sim, struct Sweep *Sweep,
+                                int i, float *T, float *Normal);
+
+/**********************************************************/
+
+/**
+ * Build the bounding volume hierarchy of the obstacles of the simulation
+ * <Sim>, the motion of the particles is swept against it. The obstacles
+ * are split at the median of their centres along the longest axis of
+ * the box, so the hierarchy is balanced. It's built once, the boxes
+ * of the moving obstacles are refitted by RefitCollisions(). The
+ * function returns 0 if succeeded.
+ */
+int
+InitCollisions( struct Simulation *Sim)   /* Simulation */
+{
+    struct ObstacleTree *Tree;
+    float (*Centres)[3];
+    float *Vrtx[3];
+    int VrtxNum;
+    int i, n, d;
+
+    Tree = &Sim->ObstacleTree;
+    if ( Sim->ObstaclesNumber == 0 )
+        return 0;
+
+    /* The centres of the obstacles */
+    Centres = (float (*)[3])malloc( Sim->ObstaclesNumber * sizeof(*Centres));
+    Tree->Obstacles = (int *)malloc( Sim->ObstaclesNumber * sizeof(int));
+    Tree->Bodies = (int *)malloc( Sim->ObstaclesNumber * sizeof(int));
+    for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+    {
+        VrtxNum = GetVertices( Sim, i, Vrtx);
+        for ( d = 0; d < 3; d++ )
+        {
+            Centres[i][d] = 0.0f;
+            for ( n = 0; n < VrtxNum; n++ )
+                Centres[i][d] += Vrtx[n][d] / VrtxNum;
+        }
+        Tree->Obstacles[i] = i;
+    }
+
+    /* A binary tree with the leaves of at least one obstacle */
+    Tree->Nodes = (struct ObstacleNode *)
+                  malloc( 2 * Sim->ObstaclesNumber * sizeof(struct ObstacleNode));
+    Tree->NodesNum = 1;
+    BuildNode( Sim, 0, 0, Sim->ObstaclesNumber, Centres);
+    for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+        Tree->Bodies[i] = GetObstacleBody( Sim, Tree->Obstacles[i]);
+
+    free( Centres);
+
+    return 0;
+} /* InitCollisions */
+
+/**
+ * Free the bounding volume hierarchy of the obstacles of the simulation
+ * <Sim>.
+ */
+void
+FreeCollisions( struct Simulation *Sim)   /* Simulation */
+{
+    free( Sim->ObstacleTree.Nodes);
+    free( Sim->ObstacleTree.Obstacles);
+    free( Sim->ObstacleTree.Bodies);
+    memset( &Sim->ObstacleTree, 0, sizeof(struct ObstacleTree));
+
+    return;
+} /* FreeCollisions */
+
+/**
+ * Refit the boxes of the hierarchy of the obstacles of the simulation
+ * <Sim> after the obstacles have moved. The tree isn't changed, only
+ * the nodes holding the moving obstacles are updated (the children
+ * follow their parent, so the nodes are updated from the last one).
+ */
+void
+RefitCollisions( struct Simulation *Sim)   /* Simulation */
+{
+    struct ObstacleTree *Tree;
+    struct ObstacleNode *Node;
+    struct ObstacleNode *Child;
+    int n, d;
+
+    Tree = &Sim->ObstacleTree;
+    for ( n = Tree->NodesNum - 1; n >= 0; n-- )
+    {
+        Node = &Tree->Nodes[n];
+        if ( !Node->Moving )
+            continue;
+        if ( Node->Count > 0 )
+        {
+            GetObstaclesBox( Sim, Node->First, Node->Count, Node->Box);
+            continue;
+        }
+        Child = &Tree->Nodes[Node->First];
+        for ( d = 0; d < 3; d++ )
+        {
+            Node->Box[0][d] = ( Child[0].Box[0][d] < Child[1].Box[0][d] ) ?
+                              Child[0].Box[0][d] : Child[1].Box[0][d];
+            Node->Box[1][d] = ( Child[0].Box[1][d] > Child[1].Box[1][d] ) ?
+                              Child[0].Box[1][d] : Child[1].Box[1][d];
+        }
+    }
+
+    return;
+} /* RefitCollisions */
+
+/**
+ * Sweep the motion of the particle of the simulation <Sim> from <Start>
+ * to <Pos> during the step against the obstacles (the moving ones are
+ * swept in their own frames, so they don't pass over the particle
+ * either). If it crosses any of them, the particle is stopped at the
+ * first one - it's kept off it by the distance it had at the beginning
+ * of the step (no more than the range of the repulsion, so the
+ * repulsion doesn't blow up, and no less than a small part of it),
+ * and the rest of its motion along the obstacle is swept again. The
+ * particle which slides along too many obstacles stays at the last
+ * one. The normal <Normal> of the last obstacle faces the particle. The function returns 1 if the particle
+ * is stopped and 0 otherwise.
+ */
+int
+SweepParticle( struct Simulation *Sim,   /* Simulation */
+               float *Start,             /* Position at the beginning of the step */
+               float *Pos,               /* Position at the end of the step */
+               float *Normal)            /* Normal of the obstacle */
+{
+    float From[3], Begin[3], Cross[3];
+    float HitNormal[3];
+    float Dist, Proj;
+    int   Dimension;
+    int   Carried;
+    int   Iter, d;
+
+    Dimension = Sim->Dimension;
+    if ( Sim->ObstacleTree.Nodes == NULL )
+        return 0;
+
+    /* The moving obstacles carry the particle from the beginning of
+     * the step, the slides start where they are at its end */
+    memset( From, 0, sizeof(From));
+    for ( d = 0; d < Dimension; d++ )
+        From[d] = Start[d];
+    Carried = 1;
+
+    for ( Iter = 0; Iter < COLLIDE_ITERATIONS; Iter++ )
+    {
+        if ( !FindCrossing( Sim, From, Carried, Pos, Begin, Cross, HitNormal) )
+            return ( Iter > 0 );
+        memcpy( Normal, HitNormal, 3 * sizeof(float));
+
+        /* The distance to the obstacle at the beginning of the motion */
+        Dist = 0.0f;
+        Proj = 0.0f;
+        for ( d = 0; d < Dimension; d++ )
+        {
+            Dist += (Begin[d] - Cross[d]) * Normal[d];
+            Proj += (Pos[d] - Cross[d]) * Normal[d];
+        }
+        if ( Dist > COLLIDE_MARGIN * Sim->ParticlesDistrib )
+            Dist = COLLIDE_MARGIN * Sim->ParticlesDistrib;
+        if ( Dist < COLLIDE_MIN_MARGIN * Sim->ParticlesDistrib )
+            Dist = COLLIDE_MIN_MARGIN * Sim->ParticlesDistrib;
+
+        /* The rest of the motion along the obstacle */
+        for ( d = 0; d < Dimension; d++ )
+        {
+            From[d] = Cross[d] + Dist * Normal[d];
+            Pos[d] = From[d] + (Pos[d] - Cross[d]) - Proj * Normal[d];
+        }
+        Carried = 0;
+    }
+
+    /* The last slide isn't swept, the particle stays off the obstacle */
+    for ( d = 0; d < Dimension; d++ )
+        Pos[d] = From[d];
+
+    return 1;
+} /* SweepParticle */
+
+/**********************************************************/
+
+/**
+ * Get the vertices <Vrtx> of the obstacle <i> of the simulation <Sim>.
+ * The function returns the number of the vertices (2 for a segment
+ * and 3 for a triangle).
+ */
+static int
+GetVertices( struct Simulation *Sim,   /* Simulation */
+             int i,                    /* Obstacle */
+             float **Vrtx)             /* Its vertices */
+{
+    struct ObstacleSegment *Segment;
+    struct ObstacleTriangle *Triangle;
+
+    if ( Sim->Dimension == 2 )
+    {
+        Segment = &((struct ObstacleSegment *)Sim->Obstacles)[i];
+        Vrtx[0] = Segment->Vrtx1;
+        Vrtx[1] = Segment->Vrtx2;
+        return 2;
+    }
+
+    Triangle = &((struct ObstacleTriangle *)Sim->Obstacles)[i];
+    Vrtx[0] = Triangle->Vrtx1;
+    Vrtx[1] = Triangle->Vrtx2;
+    Vrtx[2] = Triangle->Vrtx3;
+
+    return 3;
+} /* GetVertices */
+
+/**
+ * Find the first obstacle of the simulation <Sim> the particle crosses
+ * moving from <From> to <Pos>. The moving obstacles are swept in the
+ * frames of their bodies - the particle is at <From> when they begin
+ * to move if <Carried> is non-zero, otherwise the motion is relative
+ * to their places at the end of the step. The beginning <Begin> of the
+ * motion relative to the obstacle, the crossing <Cross> and the unit
+ * normal <Normal> of the obstacle facing the particle are found where
+ * the obstacle is at the end of the step. The function returns 1 if
+ * the particle crosses an obstacle and 0 otherwise.
+ */
+static int
+FindCrossing( struct Simulation *Sim,   /* Simulation */
+              float *From,              /* Beginning of the motion */
+              int Carried,              /* Non-zero if it's carried by the bodies */
+              float *Pos,               /* End of the motion */
+              float *Begin,             /* Beginning relative to the obstacle */
+              float *Cross,             /* Crossing */
+              float *Normal)            /* Normal of the obstacle */
+{
+    struct ObstacleTree *Tree;
+    struct ObstacleNode *Node;
+    struct MovingBody *Body;
+    struct Sweep Sweep, BodySweep;
+    float HitNormal[3], Point[3];
+    float MinT, T;
+    int   Stack[TREE_MAX_DEPTH];
+    int   StackSize;
+    int   Dimension;
+    int   SweepBody, HitBody;
+    int   Hit, Crosses;
+    int   k, b, d;
+
+    Tree = &Sim->ObstacleTree;
+    Dimension = Sim->Dimension;
+    SetSweep( Dimension, &Sweep, From, Pos);
+
+    /* The first crossing, the nodes beyond it are skipped (the nodes
+     * of the moving obstacles are checked in the frames of the bodies
+     * which move during the step too, SweepBody is the body of the
+     * last one of them) */
+    Hit = 0;
+    HitBody = -1;
+    SweepBody = -1;
+    MinT = 1.0f;
+    Stack[0] = 0;
+    StackSize = 1;
+    while ( StackSize > 0 )
+    {
+        Node = &Tree->Nodes[Stack[--StackSize]];
+        Crosses = SweepBox( Dimension, &Sweep, Node->Box, MinT);
+        for ( b = 0; Node->Moving && !Crosses && b < Sim->BodiesNumber; b++ )
+        {
+            if ( !Sim->Bodies[b].StepMoving )
+                continue;
+            if ( SweepBody != b )
+                SetBodySweep( Dimension, &BodySweep, &Sim->Bodies[b], From, Carried, Pos);
+            SweepBody = b;
+            Crosses = SweepBox( Dimension, &BodySweep, Node->Box, MinT);
+        }
+        if ( !Crosses )
+            continue;
+        if ( Node->Count == 0 )
+        {
+            Stack[StackSize++] = Node->First;
+            Stack[StackSize++] = Node->First + 1;
+            continue;
+        }
+        for ( k = Node->First; k < Node->First + Node->Count; k++ )
+        {
+            b = Tree->Bodies[k];
+            if ( b >= 0 && Sim->Bodies[b].StepMoving )
+            {
+                if ( SweepBody != b )
+                    SetBodySweep( Dimension, &BodySweep, &Sim->Bodies[b], From, Carried, Pos);
+                SweepBody = b;
+                Crosses = SweepObstacle( Sim, &BodySweep, Tree->Obstacles[k], &T, HitNormal);
+            }
+            else
+            {
+                b = -1;
+                Crosses = SweepObstacle( Sim, &Sweep, Tree->Obstacles[k], &T, HitNormal);
+            }
+            if ( !Crosses || T > MinT )
+                continue;
+            MinT = T;
+            memcpy( Normal, HitNormal, 3 * sizeof(float));
+            HitBody = b;
+            Hit = 1;
+        }
+    }
+
+    if ( !Hit )
+        return 0;
+
+    if ( HitBody < 0 )
+    {
+        for ( d = 0; d < 3; d++ )
+        {
+            Begin[d] = Sweep.Start[d];
+            Cross[d] = Sweep.Start[d] + MinT * Sweep.Dir[d];
+        }
+        return 1;
+    }
+
+    /* The crossing is moved with the body to the end of the step */
+    Body = &Sim->Bodies[HitBody];
+    if ( SweepBody != HitBody )
+        SetBodySweep( Dimension, &BodySweep, Body, From, Carried, Pos);
+    for ( d = 0; d < 3; d++ )
+        Point[d] = BodySweep.Start[d] + MinT * BodySweep.Dir[d];
+    StepPoint( Body, BodySweep.Start, Begin, 0);
+    StepPoint( Body, Point, Cross, 0);
+    memcpy( HitNormal, Normal, 3 * sizeof(float));
+    for ( d = 0; d < 3; d++ )
+        Normal[d] = Body->StepRotation[d][0] * HitNormal[0] +
+                    Body->StepRotation[d][1] * HitNormal[1] +
+                    Body->StepRotation[d][2] * HitNormal[2];
+
+    return 1;
+} /* FindCrossing */
+
+/**
+ * Set the segment <Sweep> from <Start> to <End>.
+ */
+static void
+SetSweep( int Dim,               /* Dimension */
+          struct Sweep *Sweep,   /* Segment */
+          float *Start,          /* Its beginning */
+          float *End)            /* Its end */
+{
+    int d;
+
+    memset( Sweep, 0, sizeof(struct Sweep));
+    for ( d = 0; d < Dim; d++ )
+    {
+        Sweep->Start[d] = Start[d];
+        Sweep->Dir[d] = End[d] - Start[d];
+        Sweep->InvDir[d] = ( Sweep->Dir[d] != 0.0f ) ? 1.0f / Sweep->Dir[d] : 1e30f;
+    }
+
+    return;
+} /* SetSweep */
+
+/**
+ * Set the segment <Sweep> of the motion of the particle from <From>
+ * to <Pos> relative to the body <Body> where it's at the beginning of
+ * the step - the end of the motion is moved back with the body, and
+ * its beginning is moved back too unless it's <Carried> (the particle
+ * is there when the body begins to move).
+ */
+static void
+SetBodySweep( int Dim,                  /* Dimension */
+              struct Sweep *Sweep,      /* Segment */
+              struct MovingBody *Body,  /* Moving body */
+              float *From,              /* Beginning of the motion */
+              int Carried,              /* Non-zero if it's carried by the body */
+              float *Pos)               /* End of the motion */
+{
+    float Point[3], Start[3], End[3];
+    int d;
+
+    memset( Point, 0, sizeof(Point));
+    for ( d = 0; d < Dim; d++ )
+        Point[d] = Pos[d];
+    StepPoint( Body, Point, End, 1);
+
+    for ( d = 0; d < Dim; d++ )
+        Point[d] = From[d];
+    if ( Carried )
+        memcpy( Start, Point, sizeof(Start));
+    else
+        StepPoint( Body, Point, Start, 1);
+
+    SetSweep( Dim, Sweep, Start, End);
+
+    return;
+} /* SetBodySweep */
+
+/**
+ * Move the point <Point> with the body <Body> from the beginning of the
+ * step to its end (or back if <Back> is non-zero) to <Moved>.
+ */
+static void
+StepPoint( struct MovingBody *Body,   /* Moving body */
+           float *Point,              /* Point */
+           float *Moved,              /* Moved point */
+           int Back)                  /* Non-zero to move it back */
+{
+    int d;
+
+    for ( d = 0; d < 3; d++ )
+    {
+        if ( Back )
+            Moved[d] = Body->StepRotation[0][d] * (Point[0] - Body->StepOffset[0]) +
+                       Body->StepRotation[1][d] * (Point[1] - Body->StepOffset[1]) +
+                       Body->StepRotation[2][d] * (Point[2] - Body->StepOffset[2]);
+        else
+            Moved[d] = Body->StepRotation[d][0] * Point[0] + Body->StepRotation[d][1] * Point[1] +
+                       Body->StepRotation[d][2] * Point[2] + Body->StepOffset[d];
+    }
+
+    return;
+} /* StepPoint */
+
+/**
+ * Get the box <Box> of the obstacles Obstacles[First] ... Obstacles
+ * [First + Count - 1] of the hierarchy of the simulation <Sim>.
+ */
+static void
+GetObstaclesBox( struct Simulation *Sim,   /* Simulation */
+                 int First,                /* The first obstacle */
+                 int Count,                /* Number of the obstacles */
+                 float (*Box)[3])          /* Their box */
+{
+    float *Vrtx[3];
+    int   VrtxNum;
+    int   i, n, d;
+
+    for ( d = 0; d < 3; d++ )
+    {
+        Box[0][d] = 1e30f;
+        Box[1][d] = -1e30f;
+    }
+    for ( i = First; i < First + Count; i++ )
+    {
+        VrtxNum = GetVertices( Sim, Sim->ObstacleTree.Obstacles[i], Vrtx);
+        for ( n = 0; n < VrtxNum; n++ )
+            for ( d = 0; d < 3; d++ )
+            {
+                if ( Vrtx[n][d] < Box[0][d] )
+                    Box[0][d] = Vrtx[n][d];
+                if ( Vrtx[n][d] > Box[1][d] )
+                    Box[1][d] = Vrtx[n][d];
+            }
+    }
+
+    return;
+} /* GetObstaclesBox */
+
+/**
+ * Build the node <Node> of the hierarchy of the obstacles of the
+ * simulation <Sim> which holds the obstacles Obstacles[First] ...
+ * Obstacles[First + Count - 1] (<Centres> are their centres). The node
+ * is a leaf if it holds few obstacles, otherwise they are split at the
+ * median along the longest axis of its box between two new children.
+ */
+static void
+BuildNode( struct Simulation *Sim,   /* Simulation */
+           int Node,                 /* Node */
+           int First,                /* The first obstacle of the node */
+           int Count,                /* Number of its obstacles */
+           float (*Centres)[3])      /* Centres of the obstacles */
+{
+    struct ObstacleTree *Tree;
+    struct ObstacleNode *Nodes;
+    float Size, MaxSize;
+    int   Axis;
+    int   Child;
+    int   i, d;
+
+    Tree = &Sim->ObstacleTree;
+    Nodes = Tree->Nodes;
+
+    /* The box of the obstacles */
+    GetObstaclesBox( Sim, First, Count, Nodes[Node].Box);
+
+    if ( Count <= LEAF_OBSTACLES )
+    {
+        Nodes[Node].First = First;
+        Nodes[Node].Count = Count;
+        Nodes[Node].Moving = 0;
+        for ( i = First; i < First + Count; i++ )
+            if ( GetObstacleBody( Sim, Tree->Obstacles[i]) >= 0 )
+                Nodes[Node].Moving = 1;
+        return;
+    }
+
+    /* Split the obstacles along the longest axis */
+    Axis = 0;
+    MaxSize = -1.0f;
+    for ( d = 0; d < Sim->Dimension; d++ )
+    {
+        Size = Nodes[Node].Box[1][d] - Nodes[Node].Box[0][d];
+        if ( Size > MaxSize )
+        {
+            MaxSize = Size;
+            Axis = d;
+        }
+    }
+    SelectMedian( &Tree->Obstacles[First], Centres, Count, Axis);
+
+    Child = Tree->NodesNum;
+    Tree->NodesNum += 2;
+    Nodes[Node].First = Child;
+    Nodes[Node].Count = 0;
+    BuildNode( Sim, Child, First, Count / 2, Centres);
+    BuildNode( Sim, Child + 1, First + Count / 2, Count - Count / 2, Centres);
+    Nodes[Node].Moving = Nodes[Child].Moving || Nodes[Child + 1].Moving;
+
+    return;
+} /* BuildNode */
+
+/**
+ * Reorder the obstacles <Obstacles> so the one with the median centre
+ * along the axis <Axis> is in the middle, the obstacles before it have
+ * no larger centres and the ones after it have no smaller centres
+ * (Hoare's selection).
+ */
+static void
+SelectMedian( int *Obstacles,          /* Obstacles */
+              float (*Centres)[3],     /* Centres of all the obstacles */
+              int Count,               /* Number of the obstacles */
+              int Axis)                /* Axis */
+{
+    float Pivot;
+    int Lower, Upper;
+    int i, j;
+    int tmp;
+
+    Lower = 0;
+    Upper = Count - 1;
+    while ( Lower < Upper )
+    {
+        Pivot = Centres[Obstacles[(Lower + Upper) / 2]][Axis];
+        i = Lower;
+        j = Upper;
+        while ( i <= j )
+        {
+            while ( Centres[Obstacles[i]][Axis] < Pivot )
+                i++;
+            while ( Centres[Obstacles[j]][Axis] > Pivot )
+                j--;
+            if ( i <= j )
+            {
+                tmp = Obstacles[i];
+                Obstacles[i] = Obstacles[j];
+                Obstacles[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if ( Count / 2 <= j )
+            Upper = j;
+        else if ( Count / 2 >= i )
+            Lower = i;
+        else
+            break;
+    }
+
+    return;
+} /* SelectMedian */
+
+/**
+ * Check if the segment <Sweep> crosses the box <Box> before the part
+ * <MaxT> of its length (the slabs' test). The function returns 1 if
+ * it does and 0 otherwise.
+ */
+static int
+SweepBox( int Dim,               /* Dimension */
+          struct Sweep *Sweep,   /* Segment */
+          float (*Box)[3],       /* Box */
+          float MaxT)            /* Part of the segment */
+{
+    float Near, Far;
+    float T1, T2, tmp;
+    int d;
+
+    Near = 0.0f;
+    Far = MaxT;
+    for ( d = 0; d < Dim; d++ )
+    {
+        if ( Sweep->Dir[d] == 0.0f )
+        {
+            if ( Sweep->Start[d] < Box[0][d] || Sweep->Start[d] > Box[1][d] )
+                return 0;
+            continue;
+        }
+        T1 = (Box[0][d] - Sweep->Start[d]) * Sweep->InvDir[d];
+        T2 = (Box[1][d] - Sweep->Start[d]) * Sweep->InvDir[d];
+        if ( T1 > T2 )
+        {
+            tmp = T1;
+            T1 = T2;
+            T2 = tmp;
+        }
+        if ( T1 > Near )
+            Near = T1;
+        if ( T2 < Far )
+            Far = T2;
+        if ( Near > Far )
+            return 0;
+    }
+
+    return 1;
+} /* SweepBox */
+
+/**
+ * Cross the segment <Sweep> with the obstacle <i> of the simulation <Sim>
+ * - a segment in 2D or a triangle in 3D (T.Moller and B.Trumbore, Fast,
+ * Minimum Storage Ray-Triangle Intersection, J.Graphics Tools, 2, 21-28,
+ * 1997). The part <T> of the segment before the crossing and the unit
+ * normal <Normal> of the obstacle facing the beginning of the segment
+ * are found. The function returns 1 if the segment crosses the obstacle
+ * and 0 otherwise (the segments parallel to the obstacle don't cross it).
+ */
+static int
+SweepObstacle( struct Simulation *Sim,   /* Simulation */
+               struct Sweep *Sweep,      /* Segment */
+               int i,                    /* Obstacle */
+               float *T,                 /* Part of the segment */
+               float *Normal)            /* Normal of the obstacle */
+{
+    float *Vrtx[3];
+    float E1[3], E2[3], Rel[3], P[3], Q[3];
+    float Det, U, V;
+    float Norm;
+    int VrtxNum;
+    int d;
+
+    VrtxNum = GetVertices( Sim, i, Vrtx);
+    VectorSubstraction( 3, E1, Vrtx[1], Vrtx[0]);
+    VectorSubstraction( 3, Rel, Sweep->Start, Vrtx[0]);
+
+    if ( VrtxNum == 2 )
+    {
+        /* Segment with segment */
+        Det = Sweep->Dir[0] * E1[1] - Sweep->Dir[1] * E1[0];
+        if ( fabs( Det) < 1e-12f )
+            return 0;
+        *T = (E1[0] * Rel[1] - E1[1] * Rel[0]) / Det;
+        U = (Sweep->Dir[0] * Rel[1] - Sweep->Dir[1] * Rel[0]) / Det;
+        if ( *T < 0.0f || *T > 1.0f || U < 0.0f || U > 1.0f )
+            return 0;
+        Normal[0] = -E1[1];
+        Normal[1] = E1[0];
+        Normal[2] = 0.0f;
+    }
+    else
+    {
+        /* Segment with triangle */
+        VectorSubstraction( 3, E2, Vrtx[2], Vrtx[0]);
+        P[0] = Sweep->Dir[1] * E2[2] - Sweep->Dir[2] * E2[1];
+        P[1] = Sweep->Dir[2] * E2[0] - Sweep->Dir[0] * E2[2];
+        P[2] = Sweep->Dir[0] * E2[1] - Sweep->Dir[1] * E2[0];
+        Det = VectorInnerproduct( 3, E1, P);
+        if ( fabs( Det) < 1e-12f )
+            return 0;
+        U = VectorInnerproduct( 3, Rel, P) / Det;
+        if ( U < 0.0f || U > 1.0f )
+            return 0;
+        Q[0] = Rel[1] * E1[2] - Rel[2] * E1[1];
+        Q[1] = Rel[2] * E1[0] - Rel[0] * E1[2];
+        Q[2] = Rel[0] * E1[1] - Rel[1] * E1[0];
+        V = VectorInnerproduct( 3, Sweep->Dir, Q) / Det;
+        if ( V < 0.0f || U + V > 1.0f )
+            return 0;
+        *T = VectorInnerproduct( 3, E2, Q) / Det;
+        if ( *T < 0.0f || *T > 1.0f )
+            return 0;
+        Normal[0] = E1[1] * E2[2] - E1[2] * E2[1];
+        Normal[1] = E1[2] * E2[0] - E1[0] * E2[2];
+        Normal[2] = E1[0] * E2[1] - E1[1] * E2[0];
+    }
+
+    /* The normal faces the side the particle comes from */
+    Norm = VectorNorm( 3, Normal);
+    if ( VectorInnerproduct( 3, Normal, Sweep->Dir) > 0.0f )
+        Norm = -Norm;
+    for ( d = 0; d < 3; d++ )
+        Normal[d] /= Norm;
+
+    return 1;
+} /* SweepObstacle */
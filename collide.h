@@ -0,0 +1,31 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_COLLIDE_H
+#define YAPS_COLLIDE_H
+
+/**********************************************************/
+
+struct Simulation;
+
+/* Build the bounding volume hierarchy of the obstacles */
+extern int  InitCollisions( struct Simulation *Sim);
+
+/* Refit the hierarchy to the moving obstacles */
+extern void RefitCollisions( struct Simulation *Sim);
+
+/* Free the bounding volume hierarchy */
+extern void FreeCollisions( struct Simulation *Sim);
+
+/* Sweep the motion of the particle against the obstacles, it slides
+ * along the ones it crosses */
+extern int  SweepParticle ( struct Simulation *Sim, float *Start,
+                            float *Pos, float *Normal);
+
+/**********************************************************/
+
+#endif /* YAPS_COLLIDE_H */
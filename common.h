@@ -8,53 +8,42 @@
 #ifndef YAPS_COMMON_H
 #define YAPS_COMMON_H
 
-/**********************************************************/
-
-/* Dimension of the simulation */
-int Dimension;
+#include <limits.h>
 
 /**********************************************************/
 
-/* Initial particle distribution */
-float ParticlesDistrib;
-
-/* Smoothing particle */
+/* Smoothing particle (the lean particles, LEAN_PARTICLES is defined,
+ * don't keep the values at (t-dt/2), they can be integrated by the
+ * kick-drift-kick scheme only) */
 struct Particle
 {
     float Pos[3];        /* Particle's position (x,y,z) */
     float Vel[3];        /* Particle's velocity vector (Vx,Vy,Vz) */
+#ifndef LEAN_PARTICLES
     float IvalVel[3];    /* Velocity vector (Vx,Vy,Vz) at (t-dt/2) */
+#endif
     float Accel[3];      /* Acceleration (Ax,Ay,Az) of the particle */
     float Dens;          /* Density at the location of the partile */
+#ifndef LEAN_PARTICLES
     float IvalDens;      /* Density at (t-dt/2) */
+#endif
     float DervDens;      /* The rate of change of the density (dro/dt) */
     float Press;         /* Pressure at the location of the particle */
     float Mass;          /* The mass carried by the particle */
+    float SmoothR;       /* Smoothing length of the particle */
+    int   Id;            /* Number which follows the particle when the
+                          * particles are reordered */
 };
 
-/* The array of all smoothing particles in the scene */
-struct Particle *Particles;
-
-/* Number of all smoothing particles in the scene */
-int ParticlesNumber;
-
 /**********************************************************/
 
-/* Initial boundary particle distribution */
-float BParticlesDistrib;
-
 /* Boundary particle */
 struct BParticle
 {
     float Pos[3];        /* Boundary particle's position (x,y,z) */
+    int   Obstacle;      /* The obstacle it's generated on */
 };
 
-/* The array of all boundary particles in the scene */
-struct BParticle *BParticles;
-
-/* Number of all boundary particles in the scene */
-int BParticlesNumber;
-
 /**********************************************************/
 
 /* Segment-obstacle (is used in 2D simulation) */
@@ -62,6 +51,7 @@ struct ObstacleSegment
 {
     float Vrtx1[3];  /* Vertex 1 */
     float Vrtx2[3];  /* Vertex 2 */
+    int   Line;      /* Its line of the obstacles section */
 };
 
 /* Triangle-obstacle (is used in 3D simulation) */
@@ -70,13 +60,525 @@ struct ObstacleTriangle
     float Vrtx1[3];      /* Vertex 1 */
     float Vrtx2[3];      /* Vertex 2 */
     float Vrtx3[3];      /* Vertex 3 */
+    int   Line;          /* Its line of the obstacles section */
 };
 
-/* The array of all the obstacles in the scene */
-struct Obstacle *Obstacles;
+/**********************************************************/
+
+/* The pair of the neighbouring particles i and j (the pairs are
+ * found at the beginning of every step, and all the interaction
+ * passes of the step use the values stored here). The kernels are
+ * radial, so their gradient is kept as its factor only */
+struct NeighbPair
+{
+    int   j;             /* Index of the neighbour */
+    float Rij[3];        /* Vector Rij = Ri - Rj */
+    float GradFactor;    /* Kernel's gradient at Rij is GradFactor * Rij */
+    float Kernel;        /* Kernel's value at Rij */
+};
+
+/* The points which have left their cells of the spatial hash, 
+ * they are stored by one thread (so it needn't lock them) */
+struct MovedPoints
+{
+    int   *Points;       /* Indices of the points */
+    int   Num;           /* Number of the points */
+    int   Size;          /* Size of the array */
+};
+
+/* The data to find the neighbours among a set of points */
+struct NeighbData
+{
+    /* Coordinates of the points (all X, then all Y, then all Z), 
+     * they are read by the brute force search tile by tile */
+    float *Coords;
+    int   CoordsSize;
+
+    /* Uniform grid of cells - the corner of the grid, the sizes 
+     * of the cells and their numbers along each axis, the points
+     * sorted by the cells (the points of the cell n are CellPoints
+     * [CellStart[n]] ... CellPoints[CellStart[n + 1] - 1] sorted
+     * by index), the cell of every point, and the counts of the 
+     * points of the cells of every thread used by the sort */
+    float Origin[3];
+    float CellSize[3];
+    int   CellsNum[3];
+    int   *CellStart;
+    int   *CellPoints;
+    int   *PointKeys;
+    int   *CellCounts;
+    int   CellStartSize;
+    int   CellPointsSize;
+    int   CellCountsSize;
+
+    /* The copy of the points used to permute them into the
+     * order of the cells (and the number of the points in it) */
+    char  *SortBuf;
+    int   SortBufSize;
+
+    /* Spatial hash of the occupied cells of the same grid - the
+     * integer coordinates of the cell of every slot of the open
+     * addressing table, the first point of the slot's cell (-1 
+     * if the slot is free) and the next point of the same cell
+     * for each point, the number of the slots is a power of two */
+    int   *HashCells;
+    int   *CellHead;
+    int   *CellNext;
+    int   CellHeadSize;
+    int   CellNextSize;
+    int   HashSize;
+    int   HashCellsSize;
+
+    /* The hash is kept between the steps - the number of the used
+     * slots, the number of the points, the cell of every point, and
+     * the lists of the points which have changed their cells since
+     * the hash was updated, one list per thread (they are linked into
+     * the cells of their positions at the next search), non-zero if 
+     * the hash is valid */
+    int   HashUsed;
+    int   HashNum;
+    int   *PointCells;
+    int   PointCellsSize;
+    struct MovedPoints *MovedLists;
+    int   MovedListsNum;
+    int   HashValid;
+};
+
+/* Distance field of the obstacles - the distances to the nearest
+ * obstacle and the unit vectors pointing away from it sampled at the
+ * nodes of a uniform grid (the corner of the grid, the size of its
+ * cells and the numbers of the nodes along each axis). The distances
+ * are exact within Band of the obstacles, the farther nodes and the
+ * points outside the grid get Band and no direction. The obstacles
+ * are open walls, so the distance isn't signed */
+struct DistField
+{
+    float Origin[3];
+    float CellSize;
+    int   NodesNum[3];
+    float Band;
+    float (*Nodes)[4];
+};
+
+/* Node of the bounding volume hierarchy of the obstacles */
+struct ObstacleNode;
+
+/* Bounding volume hierarchy of the obstacles - the nodes (the root is
+ * the first one), and the obstacles in the order of the leaves (every
+ * leaf holds a range of them) with their moving bodies (-1 if they
+ * don't move) */
+struct ObstacleTree
+{
+    struct ObstacleNode *Nodes;
+    int   NodesNum;
+    int   *Obstacles;
+    int   *Bodies;
+};
+
+/**********************************************************/
+
+/* The pose of a moving body at the given time - it's rotated by Angle
+ * (degrees) about Axis passing through Pivot and then moved by Offset */
+struct MotionKey
+{
+    float Time;          /* Time of the key */
+    float Offset[3];     /* Translation */
+    float Angle;         /* Angle of the rotation */
+    float Axis[3];       /* Axis of the rotation (Z in 2D simulation) */
+    float Pivot[3];      /* The point the axis passes through */
+};
+
+/* The obstacles of the lines FirstLine ... LastLine of the obstacles
+ * section moving as a rigid body - the keys of its motion (sorted by
+ * time, the pose is interpolated between them), the current pose (the
+ * points of the body are at Rotation * x + Offset, x is their place
+ * in the scene file), its motion during the current step (the points
+ * move from x to StepRotation * x + StepOffset, StepMoving is non-zero
+ * if they move at all), non-zero if it has moved since the volumes of
+ * the boundary particles were found, the moving obstacles and the
+ * boundary particles with their places in the scene file */
+struct MovingBody
+{
+    int   FirstLine;
+    int   LastLine;
+    struct MotionKey *Keys;
+    int   KeysNum;
+    float Rotation[3][3];
+    float Offset[3];
+    float StepRotation[3][3];
+    float StepOffset[3];
+    int   StepMoving;
+    int   Moved;
+    int   *Obstacles;
+    void  *RestObstacles;
+    int   ObstaclesNum;
+    int   *BParticles;
+    float (*RestBParticles)[3];
+    int   BParticlesNum;
+};
+
+/**********************************************************/
+
+/* Diagnostics of the state of the fluid (they are reduced by the
+ * integration while it sweeps the particles, so they describe the
+ * state at the end of the last step, or the initial state before
+ * the first step) */
+struct Diagnostics
+{
+    double Mass;          /* Total mass of the particles */
+    double KinEnergy;     /* Total kinetic energy */
+    double PotEnergy;     /* Total potential energy in the external force field */
+    double MeanDens;      /* Average density of the particles */
+    double Momentum[3];   /* Total momentum */
+    double Centroid[3];   /* Centre of mass */
+    float  MaxVel;        /* Maximum speed of the particles */
+    float  MaxDensDev;    /* Maximum relative deviation of the density from Density0 */
+};
+
+/**********************************************************/
+
+/* The phases of the calculation step (they are timed every step) */
+enum CalcPhases
+{
+    PHASE_REFINE,     /* Adaptation of the smoothing lengths and refinement */
+    PHASE_NEIGHB,     /* Search for the neighbours                          */
+    PHASE_FORCES,     /* Pressures and forces                               */
+    PHASE_PRESS,      /* Iterative correction of the pressures              */
+    PHASE_INTEGRATE,  /* Time integration                                   */
+    PHASES_NUMBER
+};
+
+/**********************************************************/
+
+/* The maximum length of the names of the kernel and the EOS */
+#define TYPE_NAME_LENGTH    20
+
+/* The size of the names of the files (with the terminating zero) */
+#ifdef PATH_MAX
+#define PATH_NAME_LENGTH    PATH_MAX
+#else
+#define PATH_NAME_LENGTH    4096
+#endif
+
+/* Simulation - the context which carries all the state of one
+ * simulation (the scene, the parameters of the calculation,
+ * the particles, etc.), so several independent simulations
+ * could be run in one process */
+struct Simulation
+{
+    /*** Scene ***/
+
+    /* Dimension of the simulation */
+    int Dimension;
+
+    /* Initial particle distribution */
+    float ParticlesDistrib;
+
+    /* The array of all smoothing particles in the scene */
+    struct Particle *Particles;
+
+    /* Number of all smoothing particles in the scene and the size of
+     * the array (the refinement adds the particles to its end) */
+    int ParticlesNumber;
+    int ParticlesSize;
+
+    /* The identifier of the next particle created (the particles of
+     * the scene are numbered in their initial order, the particles 
+     * created by the splits get the next numbers) */
+    int NextParticleId;
+
+    /* The mass of the particles of the initial distribution */
+    float ParticleMass;
+
+    /* Initial boundary particle distribution */
+    float BParticlesDistrib;
+
+    /* Tolerance of the unification of the boundary particles (in the
+     * units of their distribution), the particles rounded to the same
+     * node of the lattice of this spacing are merged (if it's 0, only
+     * the identical particles are merged) */
+    float UnifyTolerance;
+
+    /* The array of all boundary particles in the scene */
+    struct BParticle *BParticles;
+
+    /* Number of all boundary particles in the scene */
+    int BParticlesNumber;
+
+    /* The array of all the obstacles in the scene (segments
+     * in 2D simulation and triangles in 3D simulation) */
+    void *Obstacles;
+
+    /* Number of all the obstacles in the scene */
+    int ObstaclesNumber;
 
-/* Number of all the obstacles in the scene */
-int ObstaclesNumber;
+    /* The obstacles moving as rigid bodies (MOTION section) */
+    struct MovingBody *Bodies;
+    int BodiesNumber;
+
+    /* Clipping volume (the area to render) */
+    float ClipVolume;
+
+    /* The cache of the particles and the obstacles generated from
+     * the scene (the scene file's name with ".cache" if it's empty,
+     * "OFF" turns the cache off) */
+    char  SceneCache[PATH_NAME_LENGTH];
+
+    /* Treatment of the boundary - the boundary particles (PARTICLES,
+     * the default) or the distance field of the obstacles (SDF), and
+     * the size of the cells of the field (0 - a half of PRTS_DISTR) */
+    char  Boundary[TYPE_NAME_LENGTH];
+    float DistFieldCell;
+
+    /* Non-zero if the motion of the particles is swept against the
+     * obstacles after the integration (the particles which would cross
+     * an obstacle are stopped at it, slide along it and bounce off it,
+     * the moving obstacles are swept too), and the part of
+     * the normal velocity kept by the bounce (0 - it's removed) */
+    int   Collisions;
+    float Restitution;
+
+    /*** Parameters of the calculation ***/
+
+    /* Equation of state to calculate pressures */
+    char  EOSType[TYPE_NAME_LENGTH];
+
+    /* Kernel to use in the calculations */
+    char  KernelType[TYPE_NAME_LENGTH];
+
+    /* Kernel smoothing length */
+    float SmoothR;
+
+    /* Rest density */
+    float Density0;
+
+    /* Speed of sound */
+    float SOS;
+
+    /* Alpha factor to calculate viscosity */
+    float ViscAlpha;
+
+    /* Beta factor to calculate viscosity */
+    float ViscBeta;
+
+    /* Time step of integration */
+    float TimeStep;
+
+    /* Scheme of the time integration */
+    char  Integrator[TYPE_NAME_LENGTH];
+
+    /* Maximum relative density error of incompressible solvers */
+    float MaxDensError;
+
+    /* Periodic boundaries - lower and upper bounds along
+     * each axis, the axis is periodic if upper > lower */
+    float Periodic[3][2];
+
+    /* Method to search for the neighbours */
+    char  NeighbSearch[TYPE_NAME_LENGTH];
+
+    /* Lower and upper limits of the particles' smoothing lengths,
+     * the lengths adapt to the local density if upper > lower */
+    float AdaptSmooth[2];
+
+    /* The number of the levels of the particles' refinement (every 
+     * level halves the distance between the particles), and the 
+     * criteria of the refinement - the particles closer to the 
+     * boundary than RefineDist or with the velocity gradient 
+     * larger than RefineVelGrad are split (0 turns a criterion off) */
+    int   RefineLevels;
+    float RefineDist;
+    float RefineVelGrad;
+
+    /* Interval (in steps) between the sorts of the particles into
+     * the order of the cells of the grid (0 - they aren't sorted) */
+    int   SortInterval;
+
+    /* Interval (in steps) between the surfaces of the fluid written
+     * to the files (0 - they aren't written), the size of the cells
+     * of the surface's grid and the prefix of the files' names */
+    int   SurfaceInterval;
+    float SurfaceCell;
+    char  SurfaceFile[PATH_NAME_LENGTH];
+
+    /* Interval (in steps) between the lines of the diagnostics log 
+     * (0 - it isn't written), and its file (the standard output if 
+     * the name is empty) */
+    int   DiagInterval;
+    char  DiagFile[PATH_NAME_LENGTH];
+
+    /* The name of the shared memory segment the metrics of every
+     * step are published to (they aren't published if it's empty) */
+    char  Telemetry[TYPE_NAME_LENGTH];
+
+    /*** State of the calculation ***/
+
+    /* The number of steps done and the simulated time */
+    int   StepsNumber;
+    float Time;
+
+    /* The wall times (s) of the phases of the last step */
+    double PhaseTime[PHASES_NUMBER];
+
+    /* The function to calculate the particles' pressures */
+    void  (*CalcPressByEOS)   ( struct Simulation *Sim);
+
+    /* The function to correct the particles' pressures iteratively */
+    void  (*CorrectPressByEOS)( struct Simulation *Sim);
+
+    /* The functions to prepare the integration (before the forces
+     * are calculated) and to integrate the particles' motion */
+    void  (*PrepareIntegration)( struct Simulation *Sim);
+    void  (*Integrate)        ( struct Simulation *Sim);
+
+    /* The function to calculate the kernel's gradient */
+    int   (*GetGradKernel)    ( struct Simulation *Sim,
+                                float *Grad, float *Rij);
+
+    /* The function to calculate the kernel's value */
+    float (*GetKernel)        ( struct Simulation *Sim,
+                                float *Rij);
+
+    /* The functions to calculate the kernel's gradient and 
+     * the kernel's value for the given smoothing length */
+    int   (*GetGradKernelH)   ( struct Simulation *Sim,
+                                float *Grad, float *Rij,
+                                float SmoothR);
+    float (*GetKernelH)       ( struct Simulation *Sim,
+                                float *Rij, float SmoothR);
+
+    /* Non-zero if the smoothing lengths of the particles adapt 
+     * to the density, and the largest of the lengths */
+    int   AdaptiveSmooth;
+    float MaxSmoothR;
+
+    /* Kernel's normalization factor */
+    float KernelNormFactor;
+
+    /* Radius of the kernel's support */
+    float KernelSupport;
+
+    /* Factor to calculate the kernel's gradient */
+    float KernelGradFactor;
+
+    /* Periods of the domain along each axis (0 if the axis isn't periodic) */
+    float Period[3];
+
+    /* Non-zero if at least one axis is periodic */
+    int   PeriodicDomain;
+
+    /*** Neighbour pairs ***/
+
+    /* The pairs of the smoothing particles, the pairs of the particle
+     * i are Pairs[PairsStart[i]] ... Pairs[PairsStart[i + 1] - 1] */
+    struct NeighbPair *Pairs;
+    int   *PairsStart;
+
+    /* The pairs of the smoothing and the boundary particles, they 
+     * are stored in the same way (j is the boundary particle) */
+    struct NeighbPair *BPairs;
+    int   *BPairsStart;
+
+    /* The sizes of the arrays above */
+    int   PairsSize;
+    int   BPairsSize;
+    int   PairsStartSize;
+
+    /* The padding of the radius of the search for the pairs (the
+     * incompressible solver sums the densities at the positions 
+     * predicted for the end of the step over the pairs) */
+    float PairsSkin;
+
+    /* The data to search among the smoothing particles 
+     * and among the boundary particles */
+    struct NeighbData NeighbData;
+    struct NeighbData BNeighbData;
+
+    /* The grid of the smoothing particles used to reconstruct the
+     * surface of the fluid (it's apart from the data of the step,
+     * so the spatial hash of the step isn't rebuilt after it) */
+    struct NeighbData SurfaceData;
+
+    /* The distance field of the obstacles (it replaces the boundary
+     * particles if BOUNDARY is SDF) */
+    struct DistField DistField;
+
+    /* The hierarchy of the obstacles to sweep the particles against
+     * (it's built if COLLISIONS is on) */
+    struct ObstacleTree ObstacleTree;
+
+    /* The search method in use, non-zero if it's chosen automatically,
+     * and the measured times of the methods (brute force, grid, hash) */
+    int   NeighbMethod;
+    int   NeighbAuto;
+    double NeighbTime[3];
+
+    /*** State of the integration ***/
+
+    /* The accelerations and the rates of change of the densities of
+     * the last step (the kick-drift-kick integrator keeps them before
+     * the forces are calculated, the arrays are reused by the steps
+     * and grow only when the number of the particles grows) */
+    float (*PrevAccel)[3];
+    float *PrevDervDens;
+    int   PrevRatesSize;
+
+    /*** Diagnostics ***/
+
+    /* The diagnostics of the last step, the parts reduced by every
+     * thread (they are summed in the order of the threads, so the 
+     * result doesn't depend on the timing) and their number */
+    struct Diagnostics Diag;
+    struct Diagnostics *DiagParts;
+    int   DiagPartsSize;
+
+    /* The opened log of the diagnostics (FILE *) */
+    void  *DiagStream;
+
+    /* The mapped block of the published metrics (struct TelemetryBlock *) */
+    void  *TelemetryBlock;
+
+    /*** State of the refinement ***/
+
+    /* What to do with every particle (split, merge or keep) */
+    int   *RefineFlags;
+    int   RefineFlagsSize;
+
+    /*** State of the incompressible solver ***/
+
+    /* Predicted positions of the particles */
+    float (*PredPos)[3];
+
+    /* Accelerations caused by the pressures */
+    float (*PressAccel)[3];
+
+    /* Relative density errors of the particles */
+    float *DensError;
+
+    /* The size of the arrays above */
+    int   PressSolverSize;
+
+    /* The scaling factors of the density summation and the pressure
+     * correction factors for the particles of every number of the
+     * splits (one level if the particles aren't refined) */
+    float *PressDensScale;
+    float *PressDelta;
+    int   PressLevels;
+
+    /* Contributions of the boundary particles to the densities (only
+     * the ones near the other bodies are found again after the moving
+     * obstacles move), and non-zero for the boundary particles which
+     * have the neighbours of the other bodies */
+    float *BoundVolume;
+    int   *BoundMixed;
+
+    /* The number of iterations done by the incompressible solver
+     * and the average and the maximum relative density errors
+     * reached at the last step */
+    int   PressIterations;
+    float PressDensError;
+    float PressMaxDensError;
+};
 
 /**********************************************************/
 
@@ -0,0 +1,437 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "common.h"
+#include "vector.h"
+#include "motion.h"
+#include "distfield.h"
+
+/**********************************************************/
+
+/* The maximum number of the nodes of the distance field */
+#define DIST_FIELD_MAX_NODES   (64 * 1024 * 1024)
+
+/**********************************************************/
+
+/* Get the vertices of the obstacle */
+static int   GetObstacleVertices  ( struct Simulation *Sim, int i,
+                                    float **Vrtx);
+
+/* Find the nearest point of the segment */
+static void  GetNearestOnSegment  ( float *Pnt, float **Vrtx,
+                                    float *Nearest);
+
+/* Find the nearest point of the triangle */
+static void  GetNearestOnTriangle ( float *Pnt, float **Vrtx,
+                                    float *Nearest);
+
+/**********************************************************/
+
+/**
+ * Build the distance field of the obstacles of the simulation <Sim> -
+ * the grid covers the obstacles with the margin Band around them, and
+ * every obstacle updates the nodes within Band of it. The band is the
+ * radius the boundary particles would be searched within, so the field
+ * replaces them wherever they would act. The nodes are computed layer
+ * by layer along the last axis in parallel. The moving obstacles are
+ * left out (they keep their boundary particles). The function returns
+ * 0 if succeeded and -1 if the grid is too large.
+ */
+int
+InitDistField( struct Simulation *Sim)   /* Simulation */
+{
+    struct DistField *Field;
+    float (*Boxes)[2][3];
+    float *Vrtx[3];
+    float Upper[3];
+    float Pnt[3];
+    float Nearest[3];
+    float Dist;
+    int   Lower[3], Higher[3];
+    int   Idx[3];
+    int   Dimension;
+    int   Last;
+    int   VrtxNum;
+    int   Static;
+    size_t NodesNum;
+    size_t Node;
+    int   i, l, n, m, d;
+
+    Field = &Sim->DistField;
+    Dimension = Sim->Dimension;
+    Last = Dimension - 1;
+
+    /* The cells are a half of the distance between the particles
+     * by default, the band is the radius of the boundary pairs */
+    Field->CellSize = Sim->DistFieldCell;
+    if ( Field->CellSize <= 0.0f )
+        Field->CellSize = 0.5f * Sim->ParticlesDistrib;
+    Field->Band = Sim->KernelSupport;
+    if ( Sim->AdaptiveSmooth )
+        Field->Band *= Sim->MaxSmoothR / Sim->SmoothR;
+    if ( Field->Band < Sim->ParticlesDistrib )
+        Field->Band = Sim->ParticlesDistrib;
+    Field->Band += Field->CellSize;
+
+    /* The bounding boxes of the obstacles and of the grid */
+    Boxes = (float (*)[2][3])malloc( (Sim->ObstaclesNumber + 1) * sizeof(*Boxes));
+    for ( d = 0; d < 3; d++ )
+    {
+        Field->Origin[d] = 0.0f;
+        Upper[d] = 0.0f;
+    }
+    Static = 0;
+    for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+    {
+        /* The moving obstacles are left out (the box is empty) */
+        if ( GetObstacleBody( Sim, i) >= 0 )
+        {
+            Boxes[i][0][Last] = FLT_MAX;
+            Boxes[i][1][Last] = -FLT_MAX;
+            continue;
+        }
+        VrtxNum = GetObstacleVertices( Sim, i, Vrtx);
+        for ( d = 0; d < Dimension; d++ )
+        {
+            Boxes[i][0][d] = Boxes[i][1][d] = Vrtx[0][d];
+            for ( n = 1; n < VrtxNum; n++ )
+            {
+                if ( Vrtx[n][d] < Boxes[i][0][d] )
+                    Boxes[i][0][d] = Vrtx[n][d];
+                if ( Vrtx[n][d] > Boxes[i][1][d] )
+                    Boxes[i][1][d] = Vrtx[n][d];
+            }
+            if ( Static == 0 || Boxes[i][0][d] < Field->Origin[d] )
+                Field->Origin[d] = Boxes[i][0][d];
+            if ( Static == 0 || Boxes[i][1][d] > Upper[d] )
+                Upper[d] = Boxes[i][1][d];
+        }
+        Static++;
+    }
+
+    NodesNum = 1;
+    for ( d = 0; d < 3; d++ )
+    {
+        Field->NodesNum[d] = 1;
+        if ( d >= Dimension )
+            continue;
+        Field->Origin[d] -= Field->Band;
+        Field->NodesNum[d] = (int)ceil( (Upper[d] + Field->Band - Field->Origin[d]) /
+                                        Field->CellSize) + 1;
+        NodesNum *= Field->NodesNum[d];
+    }
+    if ( NodesNum > DIST_FIELD_MAX_NODES )
+    {
+        printf( "The distance field of %lu nodes is too large\n", (unsigned long)NodesNum);
+        free( Boxes);
+        return -1;
+    }
+
+    /* The nodes far from the obstacles */
+    Field->Nodes = (float (*)[4])malloc( NodesNum * sizeof(*Field->Nodes));
+    for ( Node = 0; Node < NodesNum; Node++ )
+    {
+        Field->Nodes[Node][0] = Field->Band;
+        Field->Nodes[Node][1] = Field->Nodes[Node][2] = Field->Nodes[Node][3] = 0.0f;
+    }
+
+    /* Every layer is updated by the obstacles which are within the band */
+#pragma omp parallel for schedule(dynamic,1) private(Vrtx,Pnt,Nearest,Dist,Lower,Higher,Idx,VrtxNum,Node,i,n,m,d)
+    for ( l = 0; l < Field->NodesNum[Last]; l++ )
+    {
+        memset( Pnt, 0, sizeof(Pnt));
+        Pnt[Last] = Field->Origin[Last] + l * Field->CellSize;
+        for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+        {
+            if ( Pnt[Last] < Boxes[i][0][Last] - Field->Band ||
+                 Pnt[Last] > Boxes[i][1][Last] + Field->Band )
+                continue;
+            VrtxNum = GetObstacleVertices( Sim, i, Vrtx);
+
+            /* The nodes of the layer around the obstacle */
+            Lower[1] = Higher[1] = Idx[2] = 0;
+            Idx[Last] = l;
+            for ( d = 0; d < Last; d++ )
+            {
+                Lower[d] = (int)floor( (Boxes[i][0][d] - Field->Band - Field->Origin[d]) /
+                                       Field->CellSize);
+                Higher[d] = (int)ceil( (Boxes[i][1][d] + Field->Band - Field->Origin[d]) /
+                                       Field->CellSize);
+                if ( Lower[d] < 0 )
+                    Lower[d] = 0;
+                if ( Higher[d] > Field->NodesNum[d] - 1 )
+                    Higher[d] = Field->NodesNum[d] - 1;
+            }
+
+            for ( m = Lower[1]; m <= Higher[1]; m++ )
+            {
+                if ( Last > 1 )
+                {
+                    Idx[1] = m;
+                    Pnt[1] = Field->Origin[1] + m * Field->CellSize;
+                }
+                for ( n = Lower[0]; n <= Higher[0]; n++ )
+                {
+                    Idx[0] = n;
+                    Pnt[0] = Field->Origin[0] + n * Field->CellSize;
+                    if ( VrtxNum == 2 )
+                        GetNearestOnSegment( Pnt, Vrtx, Nearest);
+                    else
+                        GetNearestOnTriangle( Pnt, Vrtx, Nearest);
+                    VectorSubstraction( 3, Nearest, Pnt, Nearest);
+                    Dist = VectorNorm( 3, Nearest);
+
+                    Node = ((size_t)Idx[2] * Field->NodesNum[1] + Idx[1]) *
+                           Field->NodesNum[0] + Idx[0];
+                    if ( Dist >= Field->Nodes[Node][0] )
+                        continue;
+                    Field->Nodes[Node][0] = Dist;
+                    for ( d = 0; d < 3; d++ )
+                        Field->Nodes[Node][d + 1] = ( Dist > 0.0f ) ? Nearest[d] / Dist : 0.0f;
+                }
+            }
+        }
+    }
+
+    free( Boxes);
+
+    return 0;
+} /* InitDistField */
+
+/**
+ * Free the distance field of the simulation <Sim>.
+ */
+void
+FreeDistField( struct Simulation *Sim)   /* Simulation */
+{
+    free( Sim->DistField.Nodes);
+    memset( &Sim->DistField, 0, sizeof(struct DistField));
+
+    return;
+} /* FreeDistField */
+
+/**
+ * Get the distance from the point <Pos> to the obstacles of the
+ * simulation <Sim> and the direction <Normal> away from them (the unit
+ * vector). Every corner of the point's cell knows the plane which
+ * touches the obstacles at its nearest point across its direction, the
+ * nearest of these planes to <Pos> is taken (the planes the point is
+ * behind belong to the corners on the other side of a thin wall). It's
+ * exact near a flat wall whatever the size of the cells, while the
+ * interpolation of the distances would cancel the directions of the
+ * corners on the opposite sides of a wall. The points farther than the
+ * band get the band and no direction.
+ */
+float
+GetObstacleDist( struct Simulation *Sim,   /* Simulation */
+                 float *Pos,               /* Point */
+                 float *Normal)            /* Direction from the obstacles */
+{
+    struct DistField *Field;
+    float *Nodes;
+    float Dist, MinDist;
+    float Rel;
+    int   Base[3];
+    int   Dimension;
+    size_t Node;
+    int   c, d, e;
+
+    Field = &Sim->DistField;
+    Dimension = Sim->Dimension;
+
+    memset( Normal, 0, Dimension * sizeof(float));
+    Base[1] = Base[2] = 0;
+    for ( d = 0; d < Dimension; d++ )
+    {
+        Base[d] = (int)floor( (Pos[d] - Field->Origin[d]) / Field->CellSize);
+        if ( Base[d] < 0 || Base[d] >= Field->NodesNum[d] - 1 )
+            return Field->Band;
+    }
+
+    /* The nearest of the planes of the corners of the cell (the nodes
+     * far from the obstacles or on them have no direction) */
+    MinDist = Field->Band;
+    for ( c = 0; c < (1 << Dimension); c++ )
+    {
+        Node = ((size_t)(Base[2] + ((c >> 2) & 1)) * Field->NodesNum[1] +
+                Base[1] + ((c >> 1) & 1)) * Field->NodesNum[0] + Base[0] + (c & 1);
+        Nodes = Field->Nodes[Node];
+        if ( Nodes[0] <= 0.0f || Nodes[0] >= Field->Band )
+            continue;
+        Dist = Nodes[0];
+        for ( d = 0; d < Dimension; d++ )
+        {
+            Rel = Pos[d] - (Field->Origin[d] + (Base[d] + ((c >> d) & 1)) * Field->CellSize);
+            Dist += Rel * Nodes[d + 1];
+        }
+        if ( Dist < 0.0f || Dist >= MinDist )
+            continue;
+        MinDist = Dist;
+        for ( e = 0; e < Dimension; e++ )
+            Normal[e] = Nodes[e + 1];
+    }
+
+    return MinDist;
+} /* GetObstacleDist */
+
+/**********************************************************/
+
+/**
+ * Get the vertices <Vrtx> of the obstacle <i> of the simulation <Sim>.
+ * The function returns the number of the vertices (2 for a segment
+ * and 3 for a triangle).
+ */
+static int
+GetObstacleVertices( struct Simulation *Sim,   /* Simulation */
+                     int i,                    /* Obstacle */
+                     float **Vrtx)             /* Its vertices */
+{
+    struct ObstacleSegment *Segment;
+    struct ObstacleTriangle *Triangle;
+
+    if ( Sim->Dimension == 2 )
+    {
+        Segment = &((struct ObstacleSegment *)Sim->Obstacles)[i];
+        Vrtx[0] = Segment->Vrtx1;
+        Vrtx[1] = Segment->Vrtx2;
+        return 2;
+    }
+
+    Triangle = &((struct ObstacleTriangle *)Sim->Obstacles)[i];
+    Vrtx[0] = Triangle->Vrtx1;
+    Vrtx[1] = Triangle->Vrtx2;
+    Vrtx[2] = Triangle->Vrtx3;
+
+    return 3;
+} /* GetObstacleVertices */
+
+/**
+ * Find the point <Nearest> of the segment <Vrtx> nearest to the point
+ * <Pnt>.
+ */
+static void
+GetNearestOnSegment( float *Pnt,       /* Point */
+                     float **Vrtx,     /* Vertices of the segment */
+                     float *Nearest)   /* The nearest point */
+{
+    float Edge[3], Rel[3];
+    float Len2;
+    float t;
+    int d;
+
+    VectorSubstraction( 3, Edge, Vrtx[1], Vrtx[0]);
+    VectorSubstraction( 3, Rel, Pnt, Vrtx[0]);
+    Len2 = VectorInnerproduct( 3, Edge, Edge);
+    t = ( Len2 > 0.0f ) ? VectorInnerproduct( 3, Rel, Edge) / Len2 : 0.0f;
+    if ( t < 0.0f )
+        t = 0.0f;
+    if ( t > 1.0f )
+        t = 1.0f;
+    for ( d = 0; d < 3; d++ )
+        Nearest[d] = Vrtx[0][d] + t * Edge[d];
+
+    return;
+} /* GetNearestOnSegment */
+
+/**
+ * Find the point <Nearest> of the triangle <Vrtx> nearest to the point
+ * <Pnt> - the regions of the vertices, of the edges and of the face are
+ * told apart by the barycentric coordinates of the point's projection.
+ * C.Ericson, Real-Time Collision Detection, Morgan Kaufmann, 2005.
+ */
+static void
+GetNearestOnTriangle( float *Pnt,       /* Point */
+                      float **Vrtx,     /* Vertices of the triangle */
+                      float *Nearest)   /* The nearest point */
+{
+    float AB[3], AC[3], AP[3], BP[3], CP[3];
+    float d1, d2, d3, d4, d5, d6;
+    float Va, Vb, Vc;
+    float v, w;
+    int d;
+
+    VectorSubstraction( 3, AB, Vrtx[1], Vrtx[0]);
+    VectorSubstraction( 3, AC, Vrtx[2], Vrtx[0]);
+    VectorSubstraction( 3, AP, Pnt, Vrtx[0]);
+
+    /* Region of the vertex A */
+    d1 = VectorInnerproduct( 3, AB, AP);
+    d2 = VectorInnerproduct( 3, AC, AP);
+    if ( d1 <= 0.0f && d2 <= 0.0f )
+    {
+        memcpy( Nearest, Vrtx[0], 3 * sizeof(float));
+        return;
+    }
+
+    /* Region of the vertex B */
+    VectorSubstraction( 3, BP, Pnt, Vrtx[1]);
+    d3 = VectorInnerproduct( 3, AB, BP);
+    d4 = VectorInnerproduct( 3, AC, BP);
+    if ( d3 >= 0.0f && d4 <= d3 )
+    {
+        memcpy( Nearest, Vrtx[1], 3 * sizeof(float));
+        return;
+    }
+
+    /* Region of the edge AB */
+    Vc = d1 * d4 - d3 * d2;
+    if ( Vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f )
+    {
+        v = d1 / (d1 - d3);
+        for ( d = 0; d < 3; d++ )
+            Nearest[d] = Vrtx[0][d] + v * AB[d];
+        return;
+    }
+
+    /* Region of the vertex C */
+    VectorSubstraction( 3, CP, Pnt, Vrtx[2]);
+    d5 = VectorInnerproduct( 3, AB, CP);
+    d6 = VectorInnerproduct( 3, AC, CP);
+    if ( d6 >= 0.0f && d5 <= d6 )
+    {
+        memcpy( Nearest, Vrtx[2], 3 * sizeof(float));
+        return;
+    }
+
+    /* Region of the edge AC */
+    Vb = d5 * d2 - d1 * d6;
+    if ( Vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f )
+    {
+        w = d2 / (d2 - d6);
+        for ( d = 0; d < 3; d++ )
+            Nearest[d] = Vrtx[0][d] + w * AC[d];
+        return;
+    }
+
+    /* Region of the edge BC */
+    Va = d3 * d6 - d5 * d4;
+    if ( Va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f )
+    {
+        w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        for ( d = 0; d < 3; d++ )
+            Nearest[d] = Vrtx[1][d] + w * (Vrtx[2][d] - Vrtx[1][d]);
+        return;
+    }
+
+    /* Region of the face (a degenerate triangle falls back to its edge) */
+    if ( Va + Vb + Vc == 0.0f )
+    {
+        GetNearestOnSegment( Pnt, Vrtx, Nearest);
+        return;
+    }
+    v = Vb / (Va + Vb + Vc);
+    w = Vc / (Va + Vb + Vc);
+    for ( d = 0; d < 3; d++ )
+        Nearest[d] = Vrtx[0][d] + v * AB[d] + w * AC[d];
+
+    return;
+} /* GetNearestOnTriangle */
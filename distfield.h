@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_DISTFIELD_H
+#define YAPS_DISTFIELD_H
+
+/**********************************************************/
+
+struct Simulation;
+
+/* Build the distance field of the obstacles */
+extern int   InitDistField( struct Simulation *Sim);
+
+/* Free the distance field */
+extern void  FreeDistField( struct Simulation *Sim);
+
+/* Get the distance to the obstacles and the direction from them */
+extern float GetObstacleDist( struct Simulation *Sim, float *Pos,
+                              float *Normal);
+
+/**********************************************************/
+
+#endif /* YAPS_DISTFIELD_H */
@@ -5,18 +5,28 @@
  * $Id$
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "common.h"
+#include "vector.h"
 #include "calc.h"
+#include "neighb.h"
+#include "refine.h"
 #include "eos.h"
 
 /**********************************************************/
 
 /* Batchelor EOS */
-static void CalcPressByBatchelorEOS( void);
+static void CalcPressByBatchelorEOS( struct Simulation *Sim);
 
 /* Desbrun EOS */
-static void CalcPressByDesbrunEOS( void);
+static void CalcPressByDesbrunEOS( struct Simulation *Sim);
+
+/* Predictive-corrective incompressible SPH */
+static void InitPCISPH           ( struct Simulation *Sim);
+static void ResetPressForPCISPH  ( struct Simulation *Sim);
+static void CorrectPressByPCISPH ( struct Simulation *Sim);
 
 /**********************************************************/
 
@@ -24,9 +34,11 @@ static void CalcPressByDesbrunEOS( void);
 struct StateEquation StateEquations[] =
 {
     /* EOS suggested by Batchelor */
-    "BATCHELOR", CalcPressByBatchelorEOS,
+    "BATCHELOR", NULL,       CalcPressByBatchelorEOS, NULL,
     /* EOS suggested by Desbrun   */
-    "DESBRUN",   CalcPressByDesbrunEOS,
+    "DESBRUN",   NULL,       CalcPressByDesbrunEOS,   NULL,
+    /* Incompressible PCISPH      */
+    "PCISPH",    InitPCISPH, ResetPressForPCISPH,     CorrectPressByPCISPH,
 };
 
 /* The number of all the equations of state */
@@ -46,18 +58,23 @@ int StateEquationsNum = sizeof(StateEquations) /
  * J.Comput.Phys., 110, 399-406, 1994.
  */
 static void
-CalcPressByBatchelorEOS( void)
+CalcPressByBatchelorEOS( struct Simulation *Sim)   /* Simulation */
 {
+    struct Particle *Particles;
+    float Density0;
     float B;
     float n;
     int i;
 
+    Particles = Sim->Particles;
+    Density0 = Sim->Density0;
+
     /* Monaghan'94 */
     n = 7.0f;
-    B = Density0 * SOS * SOS / n;
+    B = Density0 * Sim->SOS * Sim->SOS / n;
     
     /* Calculate pressures for all particles */
-    for ( i = 0; i < ParticlesNumber; i++ )
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
     {
         Particles[i].Press = B * (pow( Particles[i].Dens / Density0, n) - 1.0f);
     }
@@ -75,19 +92,599 @@ CalcPressByBatchelorEOS( void)
  * Eurographics Workshop on Animation and Simulation, 61-76, 1996.
  */
 static void
-CalcPressByDesbrunEOS( void)
+CalcPressByDesbrunEOS( struct Simulation *Sim)   /* Simulation */
 {
+    struct Particle *Particles;
     float k;
     int i;
     
+    Particles = Sim->Particles;
+
     /* Stiffness parameter */
     k = 30.0f;
 
     /* Calculate pressures for all particles */
-    for ( i = 0; i < ParticlesNumber; i++ )
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
     {
-        Particles[i].Press = k * ( Particles[i].Dens - Density0);
+        Particles[i].Press = k * ( Particles[i].Dens - Sim->Density0);
     }
 
     return;
 } /* CalcPressByDesbrunEOS */
+
+/**********************************************************/
+
+/*****************************************************************
+ * Predictive-corrective incompressible SPH                      *
+ * B.Solenthaler and R.Pajarola, Predictive-Corrective           *
+ * Incompressible SPH, ACM Trans.Graph., 28(3), 40:1-40:6, 2009. *
+ *****************************************************************/
+
+/* Default maximum relative density error */
+#define PCISPH_DENS_ERR     0.01f
+
+/* The minimum and the maximum number of iterations */
+#define PCISPH_MIN_ITERS    3
+#define PCISPH_MAX_ITERS    50
+
+/* Under-relaxation of the pressure correction, the prototype 
+ * particle's factor overestimates the stiffness near the walls */
+#define PCISPH_RELAXATION   0.5f
+
+/* The padding of the radius of the pairs' search is rounded up to 
+ * this part of the kernel's support (so the cells of the spatial 
+ * hash aren't rebuilt every time the padding changes a little) */
+#define PCISPH_SKIN_STEP    0.125f
+
+/**
+ * Calculate the volumes of the boundary particles (their contributions 
+ * to the densities, N.Akinci et al, Versatile Rigid-Fluid Coupling for 
+ * Incompressible SPH, ACM Trans.Graph., 31(4), 62:1-62:8, 2012), the 
+ * boundary particles are spaced irregularly, so each one contributes 
+ * to the density according to how many neighbours it has. The walls 
+ * are only one particle thick, hence the volumes are scaled to make 
+ * the density of the prototype particle resting at the distance of the 
+ * initial particle distribution from a flat wall equal to Density0. 
+ * <DensScale> is the mass scaling factor of the density summation.
+ * The neighbours of every boundary particle are found by the grid of
+ * the boundary particles (all the pairs are summed if the grid can't
+ * be used). The volumes are found once, the rigid motion of a body
+ * keeps the distances between its boundary particles, so after the
+ * bodies move only the particles which have or had the neighbours of
+ * the other bodies are summed again (the static obstacles are one more
+ * body here).
+ */
+static void
+GetBoundVolumes( struct Simulation *Sim,   /* Simulation */
+                 float DensScale)          /* Mass scaling factor */
+{
+    struct BParticle *BParticles;
+    struct MovingBody *Body;
+    struct NeighbData Grid;
+    float Rij[3];
+    float Distrib;
+    float BDistrib;
+    float FluidSum;
+    float WallSum;
+    float SelfSum;
+    float Scale;
+    int *Bodies;
+    int *Update;
+    int *Near;
+    int NearSize;
+    int NearNum;
+    int UseGrid;
+    int Moved;
+    int b, i, j, k;
+    int n, nb, x, y, z;
+
+    BParticles = Sim->BParticles;
+    Distrib = Sim->ParticlesDistrib;
+    BDistrib = Sim->BParticlesDistrib;
+
+    /* Nothing has changed since the volumes were found */
+    Moved = 0;
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+        Moved |= Sim->Bodies[b].Moved;
+    if ( Sim->BoundVolume != NULL && !Moved )
+        return;
+
+    /* Go over the lattice points inside the kernel's support, the 
+     * fluid occupies the half-space y >= 0, the wall lies at the 
+     * plane y = -ParticlesDistrib */
+    FluidSum = 0.0f;
+    WallSum = 0.0f;
+    SelfSum = 0.0f;
+    n = (int)(2.0f * Sim->SmoothR / Distrib) + 1;
+    nb = (int)(2.0f * Sim->SmoothR / BDistrib) + 1;
+    for ( x = -n; x <= n; x++ )
+    for ( y = 0; y <= n; y++ )
+    for ( z = (Sim->Dimension == 3) ? -n : 0; z <= ((Sim->Dimension == 3) ? n : 0); z++ )
+    {
+        Rij[0] = (float)x * Distrib;
+        Rij[1] = (float)y * Distrib;
+        Rij[2] = (float)z * Distrib;
+        FluidSum += Sim->GetKernel( Sim, Rij);
+    }
+    for ( x = -nb; x <= nb; x++ )
+    for ( z = (Sim->Dimension == 3) ? -nb : 0; z <= ((Sim->Dimension == 3) ? nb : 0); z++ )
+    {
+        Rij[0] = (float)x * BDistrib;
+        Rij[1] = 0.0f;
+        Rij[2] = (float)z * BDistrib;
+        SelfSum += Sim->GetKernel( Sim, Rij);
+        Rij[1] = Distrib;
+        WallSum += Sim->GetKernel( Sim, Rij);
+    }
+    FluidSum *= Sim->ParticleMass * DensScale;
+    Scale = (FluidSum < Sim->Density0) ? 
+            (Sim->Density0 - FluidSum) * SelfSum / (Sim->Density0 * WallSum) : 0.0f;
+
+    /* The bodies of the boundary particles (-1 for the static ones) */
+    Bodies = (int *)malloc( Sim->BParticlesNumber * sizeof(int));
+    Update = (int *)malloc( Sim->BParticlesNumber * sizeof(int));
+    for ( i = 0; i < Sim->BParticlesNumber; i++ )
+        Bodies[i] = -1;
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+    {
+        Body = &Sim->Bodies[b];
+        for ( k = 0; k < Body->BParticlesNum; k++ )
+            Bodies[Body->BParticles[k]] = b;
+    }
+
+    memset( &Grid, 0, sizeof(Grid));
+    UseGrid = ( PreparePointsGrid( Sim, &Grid, BParticles[0].Pos, sizeof(struct BParticle),
+                                   Sim->BParticlesNumber, Sim->KernelSupport) == 0 );
+
+    if ( Sim->BoundVolume == NULL )
+    {
+        Sim->BoundVolume = (float *)malloc( Sim->BParticlesNumber * sizeof(float));
+        Sim->BoundMixed = (int *)malloc( Sim->BParticlesNumber * sizeof(int));
+        for ( i = 0; i < Sim->BParticlesNumber; i++ )
+            Update[i] = 1;
+    }
+    else
+    {
+        /* The particles which had the neighbours of the other bodies,
+         * and the ones which get them near the bodies which have moved */
+        memcpy( Update, Sim->BoundMixed, Sim->BParticlesNumber * sizeof(int));
+        Near = NULL;
+        NearSize = 0;
+        for ( b = 0; b < Sim->BodiesNumber; b++ )
+        {
+            Body = &Sim->Bodies[b];
+            if ( !Body->Moved )
+                continue;
+            for ( k = 0; k < Body->BParticlesNum; k++ )
+            {
+                i = Body->BParticles[k];
+                NearNum = Sim->BParticlesNumber;
+                if ( UseGrid )
+                    NearNum = FindPointsNearBox( Sim, &Grid, BParticles[i].Pos,
+                                                 BParticles[i].Pos, &Near, &NearSize);
+                for ( n = 0; n < NearNum; n++ )
+                {
+                    j = UseGrid ? Near[n] : n;
+                    if ( Bodies[j] == b )
+                        continue;
+                    VectorSubstraction( Sim->Dimension, Rij, BParticles[i].Pos, BParticles[j].Pos);
+                    GetMinimumImage( Sim, Rij);
+                    if ( Sim->GetKernel( Sim, Rij) > 0.0f )
+                        Update[i] = Update[j] = 1;
+                }
+            }
+        }
+        free( Near);
+    }
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+        Sim->Bodies[b].Moved = 0;
+
+#pragma omp parallel
+    {
+        float Rij[3];
+        float Kernel;
+        float Sum;
+        int *Found;
+        int FoundSize;
+        int FoundNum;
+        int Mixed;
+        int i, j, k;
+
+        Found = NULL;
+        FoundSize = 0;
+
+#pragma omp for schedule(dynamic,50)
+        for ( i = 0; i < Sim->BParticlesNumber; i++ )
+        {
+            if ( !Update[i] )
+                continue;
+            FoundNum = Sim->BParticlesNumber;
+            if ( UseGrid )
+                FoundNum = FindPointsNearBox( Sim, &Grid, BParticles[i].Pos,
+                                              BParticles[i].Pos, &Found, &FoundSize);
+            Sum = 0.0f;
+            Mixed = 0;
+            for ( k = 0; k < FoundNum; k++ )
+            {
+                j = UseGrid ? Found[k] : k;
+                VectorSubstraction( Sim->Dimension, Rij, BParticles[i].Pos, BParticles[j].Pos);
+                GetMinimumImage( Sim, Rij);
+                Kernel = Sim->GetKernel( Sim, Rij);
+                Sum += Kernel;
+                if ( Kernel > 0.0f && Bodies[j] != Bodies[i] )
+                    Mixed = 1;
+            }
+            Sim->BoundVolume[i] = Scale * Sim->Density0 / Sum;
+            Sim->BoundMixed[i] = Mixed;
+        }
+
+        free( Found);
+    }
+
+    FreeNeighbData( &Grid);
+    free( Bodies);
+    free( Update);
+
+    return;
+} /* GetBoundVolumes */
+
+/**
+ * Calculate the scaling factor which converts the mass of a particle 
+ * into the mass to be used in the density summation (the summation 
+ * over the initial particle distribution gives exactly Density0 then) 
+ * and the pressure correction factor 'delta' of Solenthaler and 
+ * Pajarola for the prototype particle with full neighbourhood. Both 
+ * are computed on the initial lattice of the particles which come 
+ * from <Splits> splits (every split halves the mass, the volume and
+ * the smoothing length shrinks with the distance between them).
+ */
+static void
+GetPCISPHFactors( struct Simulation *Sim,   /* Simulation */
+                  int Splits,               /* Number of the splits */
+                  float *DensScale,         /* Mass scaling factor */
+                  float *Delta)             /* Pressure correction factor */
+{
+    float SumGrad[3], GradKernel[3];
+    float Rij[3];
+    float Mass;
+    float Distrib;
+    float SmoothR;
+    float Density0;
+    float SumGrad2;
+    float Sum;
+    float Beta;
+    float Scale;
+    int n, x, y, z, d;
+
+    Scale = (float)pow( 0.5, (double)Splits / Sim->Dimension);
+    Mass = Sim->ParticleMass * (float)pow( 0.5, Splits);
+    Distrib = Sim->ParticlesDistrib * Scale;
+    SmoothR = Sim->SmoothR * Scale;
+    Density0 = Sim->Density0;
+
+    Sum = 0.0f;
+    SumGrad2 = 0.0f;
+    SumGrad[0] = SumGrad[1] = SumGrad[2] = 0.0f;
+
+    /* Go over the lattice points inside the kernel's support */
+    n = (int)(2.0f * SmoothR / Distrib) + 1;
+    for ( x = -n; x <= n; x++ )
+    for ( y = -n; y <= n; y++ )
+    for ( z = (Sim->Dimension == 3) ? -n : 0; z <= ((Sim->Dimension == 3) ? n : 0); z++ )
+    {
+        Rij[0] = (float)x * Distrib;
+        Rij[1] = (float)y * Distrib;
+        Rij[2] = (float)z * Distrib;
+        Sum += Sim->GetKernelH( Sim, Rij, SmoothR);
+        if ( (x == 0 && y == 0 && z == 0) ||
+             Sim->GetGradKernelH( Sim, GradKernel, Rij, SmoothR) )
+            continue;
+        for ( d = 0; d < Sim->Dimension; d++ )
+            SumGrad[d] += GradKernel[d];
+        SumGrad2 += VectorInnerproduct( Sim->Dimension, GradKernel, GradKernel);
+    }
+
+    *DensScale = Density0 / (Mass * Sum);
+    
+    /* beta = 2 * (dt * m / rho0)^2, one mass comes from the pressure 
+     * force and the other one from the density summation */
+    Beta = 2.0f * Sim->TimeStep * Sim->TimeStep * Mass * Mass * *DensScale / 
+           (Density0 * Density0);
+    *Delta = 1.0f / (Beta * (VectorInnerproduct( Sim->Dimension, SumGrad, SumGrad) + 
+                             SumGrad2));
+
+    return;
+} /* GetPCISPHFactors */
+
+/**
+ * Find the factors of the incompressible solver (see GetPCISPHFactors())
+ * once - for the particles of every number of the splits if they are 
+ * refined.
+ */
+static void
+InitPCISPH( struct Simulation *Sim)   /* Simulation */
+{
+    int s;
+
+    Sim->PressLevels = 1;
+    if ( Sim->RefineLevels > 0 )
+        Sim->PressLevels += Sim->Dimension * Sim->RefineLevels;
+    Sim->PressDensScale = (float *)malloc( Sim->PressLevels * sizeof(float));
+    Sim->PressDelta = (float *)malloc( Sim->PressLevels * sizeof(float));
+    for ( s = 0; s < Sim->PressLevels; s++ )
+        GetPCISPHFactors( Sim, s, &Sim->PressDensScale[s], &Sim->PressDelta[s]);
+
+    return;
+} /* InitPCISPH */
+
+/**
+ * The pressures are found by the iterative solver 
+ * from the scratch at every step, so reset them.
+ */
+static void
+ResetPressForPCISPH( struct Simulation *Sim)   /* Simulation */
+{
+    int i;
+
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        Sim->Particles[i].Press = 0.0f;
+    }
+
+    return;
+} /* ResetPressForPCISPH */
+
+/**
+ * Calculate the kernel's value at the point <Rij> between the 
+ * predicted positions of the particles <i> and <j>. With the adaptive 
+ * smoothing lengths the values with the lengths of both particles 
+ * are averaged (the same way as for the pairs).
+ */
+static float
+GetPredKernel( struct Simulation *Sim,   /* Simulation */
+               float *Rij,               /* Vector Rij = Ri - Rj */
+               int i,                    /* Index of the particle i */
+               int j)                    /* Index of the particle j */
+{
+    float SmoothRi, SmoothRj;
+
+    if ( !Sim->AdaptiveSmooth )
+        return Sim->GetKernel( Sim, Rij);
+
+    SmoothRi = Sim->Particles[i].SmoothR;
+    SmoothRj = Sim->Particles[j].SmoothR;
+    if ( SmoothRi == SmoothRj )
+        return Sim->GetKernelH( Sim, Rij, SmoothRi);
+
+    return 0.5f * (Sim->GetKernelH( Sim, Rij, SmoothRi) + 
+                   Sim->GetKernelH( Sim, Rij, SmoothRj));
+} /* GetPredKernel */
+
+/**
+ * Correct pressures iteratively to keep the fluid incompressible.
+ * At the moment of invocation the accelerations of the particles 
+ * contain all the forces but pressure ones. The solver predicts the 
+ * positions the particles would have after the leap-frog step, sums 
+ * up the densities at the predicted positions and corrects pressures 
+ * until the density error falls below MaxDensError. The densities are
+ * summed over the pairs of the step, the search pads its radius by the
+ * largest relative displacement of the last step (PairsSkin). If the
+ * predicted positions move two particles farther than that, the pairs
+ * are found again with a larger padding, so the pairs coming into the 
+ * kernel's support during the step are always there. The factors of
+ * the particles depend on their splits (see InitPCISPH()). The 
+ * resulting pressure forces are added to the accelerations, the 
+ * densities are set to the predicted ones.
+ */
+static void
+CorrectPressByPCISPH( struct Simulation *Sim)   /* Simulation */
+{
+    struct Particle *Particles;
+    struct BParticle *BParticles;
+    float (*PredPos)[3];
+    float (*PressAccel)[3];
+    float *DensError;
+    float *BoundVolume;
+    struct NeighbPair *Pair;
+    float Rij[3];
+    float MaxDensError;
+    float Density0;
+    float TimeStep;
+    float DensScale;
+    float MaxErr;
+    float SumErr;
+    float IvalVel[3];
+    float MaxDisp2;
+    float Disp2;
+    float Skin;
+    float Vel;
+    float Dens;
+    float tmp;
+    int ParticlesNumber;
+    int BParticlesNumber;
+    int Dimension;
+    int Iter;
+    int Level;
+    int i, j, k, d;
+
+    Particles = Sim->Particles;
+    ParticlesNumber = Sim->ParticlesNumber;
+    BParticles = Sim->BParticles;
+    BParticlesNumber = Sim->BParticlesNumber;
+    Dimension = Sim->Dimension;
+    Density0 = Sim->Density0;
+    TimeStep = Sim->TimeStep;
+
+    if ( ParticlesNumber == 0 )
+        return;
+
+    /* Allocate memory for the solver's data */
+    if ( Sim->PressSolverSize < ParticlesNumber )
+    {
+        Sim->PressSolverSize = ParticlesNumber;
+        Sim->PredPos = (float (*)[3])
+                       realloc( Sim->PredPos, ParticlesNumber * sizeof(*PredPos));
+        Sim->PressAccel = (float (*)[3])
+                          realloc( Sim->PressAccel, ParticlesNumber * sizeof(*PressAccel));
+        Sim->DensError = (float *)
+                         realloc( Sim->DensError, ParticlesNumber * sizeof(float));
+    }
+    PredPos = Sim->PredPos;
+    PressAccel = Sim->PressAccel;
+    DensError = Sim->DensError;
+
+    MaxDensError = (Sim->MaxDensError > 0.0f) ? Sim->MaxDensError : PCISPH_DENS_ERR;
+
+    /* The boundary particles take the factor of the unrefined particles */
+    DensScale = Sim->PressDensScale[0];
+
+    /* The volumes of the boundary particles are found at the first
+     * step and after the moving obstacles have moved (see MoveObstacles) */
+    if ( BParticlesNumber > 0 )
+        GetBoundVolumes( Sim, DensScale);
+    BoundVolume = Sim->BoundVolume;
+
+    for ( i = 0; i < ParticlesNumber; i++ )
+        PressAccel[i][0] = PressAccel[i][1] = PressAccel[i][2] = 0.0f;
+
+    MaxErr = 0.0f;
+    SumErr = 0.0f;
+    for ( Iter = 0; Iter < PCISPH_MAX_ITERS; Iter++ )
+    {
+        /* Predict the positions using the leap-frog scheme */
+#pragma omp parallel for schedule(static) private(IvalVel,Vel,d)
+        for ( i = 0; i < ParticlesNumber; i++ )
+        {
+            GetIntervalVel( Sim, i, IvalVel);
+            for ( d = 0; d < Dimension; d++ )
+            {
+                Vel = IvalVel[d] + 
+                      (Particles[i].Accel[d] + PressAccel[i][d]) * TimeStep;
+                PredPos[i][d] = Particles[i].Pos[d] + Vel * TimeStep;
+            }
+        }
+
+        /* The pairs are found again if the particles move farther than
+         * their padding (the relative displacement is up to twice the
+         * largest one), it's rounded up and never shrinks in the step */
+        MaxDisp2 = 0.0f;
+        for ( i = 0; i < ParticlesNumber; i++ )
+        {
+            VectorSubstraction( Dimension, Rij, PredPos[i], Particles[i].Pos);
+            Disp2 = VectorInnerproduct( Dimension, Rij, Rij);
+            if ( Disp2 > MaxDisp2 )
+                MaxDisp2 = Disp2;
+        }
+        tmp = PCISPH_SKIN_STEP * Sim->KernelSupport;
+        Skin = (float)ceil( 2.0f * sqrt( MaxDisp2) / tmp) * tmp;
+        if ( Skin > Sim->PairsSkin )
+        {
+            Sim->PairsSkin = Skin;
+            RefindNeighbPairs( Sim);
+        }
+
+        /* Predict the densities and correct the pressures */
+#pragma omp parallel for schedule(dynamic,50) private(Rij,Dens,tmp,Level,j,k)
+        for ( i = 0; i < ParticlesNumber; i++ )
+        {
+            Level = GetSplitsNumber( Sim, Particles[i].Mass);
+            if ( Level >= Sim->PressLevels )
+                Level = Sim->PressLevels - 1;
+
+            /* The particle's own contribution */
+            Rij[0] = Rij[1] = Rij[2] = 0.0f;
+            Dens = Particles[i].Mass * GetPredKernel( Sim, Rij, i, i);
+            for ( k = Sim->PairsStart[i]; k < Sim->PairsStart[i + 1]; k++ )
+            {
+                j = Sim->Pairs[k].j;
+                VectorSubstraction( Dimension, Rij, PredPos[i], PredPos[j]);
+                GetMinimumImage( Sim, Rij);
+                Dens += Particles[j].Mass * GetPredKernel( Sim, Rij, i, j);
+            }
+            Dens *= Sim->PressDensScale[Level];
+            /* Contribution of the boundary */
+            for ( k = Sim->BPairsStart[i]; k < Sim->BPairsStart[i + 1]; k++ )
+            {
+                j = Sim->BPairs[k].j;
+                VectorSubstraction( Dimension, Rij, PredPos[i], BParticles[j].Pos);
+                GetMinimumImage( Sim, Rij);
+                Dens += BoundVolume[j] * GetPredKernel( Sim, Rij, i, i);
+            }
+            
+            /* Only the compression is corrected, 
+             * so the pressures are kept positive */
+            tmp = Particles[i].Press + 
+                  PCISPH_RELAXATION * Sim->PressDelta[Level] * (Dens - Density0);
+            Particles[i].Press = (tmp > 0.0f) ? tmp : 0.0f;
+            Particles[i].Dens = Dens;
+            DensError[i] = (Dens > Density0) ? (Dens - Density0) / Density0 : 0.0f;
+        }
+
+        /* Calculate the pressure forces (the positions don't change 
+         * during the iterations, so the cached gradients are used) */
+#pragma omp parallel for schedule(dynamic,50) private(Pair,tmp,j,k,d)
+        for ( i = 0; i < ParticlesNumber; i++ )
+        {
+            PressAccel[i][0] = PressAccel[i][1] = PressAccel[i][2] = 0.0f;
+            for ( k = Sim->PairsStart[i]; k < Sim->PairsStart[i + 1]; k++ )
+            {
+                Pair = &Sim->Pairs[k];
+                j = Pair->j;
+                tmp = Particles[j].Mass * (Particles[i].Press + Particles[j].Press) / 
+                      (Density0 * Density0) * Pair->GradFactor;
+                for ( d = 0; d < Dimension; d++ )
+                    PressAccel[i][d] -= tmp * Pair->Rij[d];
+            }
+            /* The boundary particles take the pressure of the particle */
+            for ( k = Sim->BPairsStart[i]; k < Sim->BPairsStart[i + 1]; k++ )
+            {
+                Pair = &Sim->BPairs[k];
+                j = Pair->j;
+                tmp = BoundVolume[j] / DensScale * 
+                      Particles[i].Press / (Density0 * Density0) * Pair->GradFactor;
+                for ( d = 0; d < Dimension; d++ )
+                    PressAccel[i][d] -= tmp * Pair->Rij[d];
+            }
+        }
+
+        /* The maximum and the average density errors */
+        MaxErr = 0.0f;
+        SumErr = 0.0f;
+        for ( i = 0; i < ParticlesNumber; i++ )
+        {
+            if ( DensError[i] > MaxErr )
+                MaxErr = DensError[i];
+            SumErr += DensError[i];
+        }
+
+        if ( MaxErr < MaxDensError && Iter + 1 >= PCISPH_MIN_ITERS )
+        {
+            Iter++;
+            break;
+        }
+    }
+
+    /* The pairs of the next step are padded by the largest relative
+     * displacement of two particles in this step (it isn't larger than
+     * the kernel's support, the pairs are found again if it's too small) */
+    Sim->PairsSkin = ( Skin < Sim->KernelSupport ) ? Skin : Sim->KernelSupport;
+
+    /* Add the pressure forces, the densities are not 
+     * integrated in time since they are summed up */
+    for ( i = 0; i < ParticlesNumber; i++ )
+    {
+        for ( d = 0; d < Dimension; d++ )
+            Particles[i].Accel[d] += PressAccel[i][d];
+#ifndef LEAN_PARTICLES
+        Particles[i].IvalDens = Particles[i].Dens;
+#endif
+        Particles[i].DervDens = 0.0f;
+    }
+
+    /* The iterations' count and the density errors */
+    Sim->PressIterations = Iter;
+    Sim->PressDensError = SumErr / (float)ParticlesNumber;
+    Sim->PressMaxDensError = MaxErr;
+
+    return;
+} /* CorrectPressByPCISPH */
@@ -10,11 +10,20 @@
 
 /**********************************************************/
 
+struct Simulation;
+
 /* State equation's info */
 struct StateEquation
 {
     char  *Name;                 /* Name of the EOS */
-    void (*CalcPress)( void);    /* Calculate particles' pressures */
+    void (*Init)( struct Simulation 
+                  *Sim);         /* Initialize the EOS (NULL if 
+                                    there's nothing to do) */
+    void (*CalcPress)( struct Simulation 
+                       *Sim);    /* Calculate particles' pressures */
+    void (*CorrectPress)( struct Simulation 
+                          *Sim); /* Correct pressures iteratively 
+                                    (NULL for explicit EOS) */
 };
 
 /* All implemented equations of state */
@@ -6,7 +6,6 @@
  */
 
 #include "common.h"
-#include "calc.h"
 #include "vector.h"
 #include "kernel.h"
 
@@ -17,12 +16,28 @@
 /**********************************************************/
 
 /* Cubic spline kernel */
-static void InitWspline    ( void);
-static int  GetGradWspline ( float *Grad, float *Rij);
+static void InitWspline    ( struct Simulation *Sim);
+static int  GetGradWspline ( struct Simulation *Sim, 
+                             float *Grad, float *Rij);
+static float GetWspline    ( struct Simulation *Sim, 
+                             float *Rij);
+static int  GetGradWsplineH( struct Simulation *Sim, 
+                             float *Grad, float *Rij, 
+                             float SmoothR);
+static float GetWsplineH   ( struct Simulation *Sim, 
+                             float *Rij, float SmoothR);
 
 /* Spiky kernel */
-static void InitWspiky     ( void);
-static int  GetGradWspiky  ( float *Grad, float *Rij);
+static void InitWspiky     ( struct Simulation *Sim);
+static int  GetGradWspiky  ( struct Simulation *Sim, 
+                             float *Grad, float *Rij);
+static float GetWspiky     ( struct Simulation *Sim, 
+                             float *Rij);
+static int  GetGradWspikyH ( struct Simulation *Sim, 
+                             float *Grad, float *Rij, 
+                             float SmoothR);
+static float GetWspikyH    ( struct Simulation *Sim, 
+                             float *Rij, float SmoothR);
 
 /**********************************************************/
 
@@ -30,9 +45,11 @@ static int  GetGradWspiky  ( float *Grad, float *Rij);
 struct Kernel Kernels[] =
 {
     /* Cubic spline kernel */
-    "SPLINE", InitWspline, GetGradWspline,
+    "SPLINE", InitWspline, GetGradWspline, GetWspline, 
+              GetGradWsplineH, GetWsplineH,
     /* Spiky kernel        */
-    "SPIKY",  InitWspiky,  GetGradWspiky,
+    "SPIKY",  InitWspiky,  GetGradWspiky,  GetWspiky, 
+              GetGradWspikyH,  GetWspikyH,
 };
 
 /* The number of all the kernels */
@@ -46,43 +63,59 @@ int KernelsNum = sizeof(Kernels) / sizeof(Kernels[0]);
  * Annu.Rev.Astron.Astrophys., 30, 543-574, 1992. *
  **************************************************/
 
-/* Factor to calculate the kernel's gradient */
-static float GradFactorWspline;
-
 /**
- * Initialize the kernel.
+ * Calculate the kernel's normalization factor and the factor 
+ * to calculate its gradient for the smoothing length <SmoothR>.
  */
 static void
-InitWspline( void)
+GetFactorsWspline( int Dim,             /* Dimension */
+                   float SmoothR,       /* Smoothing length */
+                   float *NormFactor,   /* Normalization factor */
+                   float *GradFactor)   /* Factor of the gradient */
 {
-    float NormFactor;
-    
     /* Kernel's normalization factor */
-    if ( Dimension == 2 )
-        NormFactor = 10.0f / (7.0f * PI * SmoothR * SmoothR);
-    else if ( Dimension == 3 )
-        NormFactor = 1.0f / (PI * SmoothR * SmoothR * SmoothR);
+    if ( Dim == 2 )
+        *NormFactor = 10.0f / (7.0f * PI * SmoothR * SmoothR);
+    else
+        *NormFactor = 1.0f / (PI * SmoothR * SmoothR * SmoothR);
     
     /* Factor to calculate the kernel's gradient */
-    GradFactorWspline = NormFactor / (SmoothR * SmoothR);
+    *GradFactor = *NormFactor / (SmoothR * SmoothR);
+
+    return;
+} /* GetFactorsWspline */
+
+/**
+ * Initialize the kernel.
+ */
+static void
+InitWspline( struct Simulation *Sim)   /* Simulation */
+{
+    GetFactorsWspline( Sim->Dimension, Sim->SmoothR, 
+                       &Sim->KernelNormFactor, &Sim->KernelGradFactor);
+    Sim->KernelSupport = 2.0f * Sim->SmoothR;
 
     return;
 } /* InitWspline */
 
 /**
  * Calculate the kernel's gradient at the point <Rij> with 
- * respect to Ri, the resulting gradient vector is return 
- * through <Grad>. The function returns -1 if the gradient 
- * vector is equal to zero and 0 if it's meaning.
+ * respect to Ri for the smoothing length <SmoothR> and the 
+ * gradient's factor <GradFactor>, the resulting gradient vector 
+ * is return through <Grad>. The function returns -1 if the 
+ * gradient vector is equal to zero and 0 if it's meaning.
  */
 static int
-GetGradWspline( float *Grad,   /* Result (gradient vector) */
-                float *Rij)    /* Vector Rij = Ri - Rj */
+GradWspline( int Dim,            /* Dimension */
+             float *Grad,        /* Result (gradient vector) */
+             float *Rij,         /* Vector Rij = Ri - Rj */
+             float SmoothR,      /* Smoothing length */
+             float GradFactor)   /* Factor of the gradient */
 {
     float s;
     int d;
     
-    s = VectorNorm( Rij) / SmoothR;
+    s = VectorNorm( Dim, Rij) / SmoothR;
     
     if ( s > 2.0f )
     {
@@ -90,20 +123,99 @@ GetGradWspline( float *Grad,   /* Result (gradient vector) */
     }
     else if ( s > 1.0f )
     {
-        for ( d = 0; d < Dimension; d++ )
-            Grad[d] = GradFactorWspline * Rij[d] * 
+        for ( d = 0; d < Dim; d++ )
+            Grad[d] = GradFactor * Rij[d] * 
                       -0.75f * (2.0f - s) * (2.0f - s) / s;
     }
     else
     {
-        for ( d = 0; d < Dimension; d++ )
-            Grad[d] = GradFactorWspline * Rij[d] * 
+        for ( d = 0; d < Dim; d++ )
+            Grad[d] = GradFactor * Rij[d] * 
                       (2.25f * s - 3.0f);
     }
 
     return 0;
+} /* GradWspline */
+
+/**
+ * Calculate the kernel's value at the point <Rij> for the smoothing 
+ * length <SmoothR> and the normalization factor <NormFactor>.
+ */
+static float
+Wspline( int Dim,            /* Dimension */
+         float *Rij,         /* Vector Rij = Ri - Rj */
+         float SmoothR,      /* Smoothing length */
+         float NormFactor)   /* Normalization factor */
+{
+    float s;
+    
+    s = VectorNorm( Dim, Rij) / SmoothR;
+    
+    if ( s > 2.0f )
+        return 0.0f;
+    else if ( s > 1.0f )
+        return NormFactor * 0.25f * (2.0f - s) * (2.0f - s) * (2.0f - s);
+    else
+        return NormFactor * (1.0f - 1.5f * s * s + 0.75f * s * s * s);
+} /* Wspline */
+
+/**
+ * Calculate the kernel's gradient at the point <Rij> with 
+ * respect to Ri, the resulting gradient vector is return 
+ * through <Grad>. The function returns -1 if the gradient 
+ * vector is equal to zero and 0 if it's meaning.
+ */
+static int
+GetGradWspline( struct Simulation *Sim,   /* Simulation */
+                float *Grad,              /* Result (gradient vector) */
+                float *Rij)               /* Vector Rij = Ri - Rj */
+{
+    return GradWspline( Sim->Dimension, Grad, Rij, 
+                        Sim->SmoothR, Sim->KernelGradFactor);
 } /* GetGradWspline */
 
+/**
+ * Calculate the kernel's value at the point <Rij>.
+ */
+static float
+GetWspline( struct Simulation *Sim,   /* Simulation */
+            float *Rij)               /* Vector Rij = Ri - Rj */
+{
+    return Wspline( Sim->Dimension, Rij, 
+                    Sim->SmoothR, Sim->KernelNormFactor);
+} /* GetWspline */
+
+/**
+ * Calculate the kernel's gradient at the point <Rij> for the 
+ * smoothing length <SmoothR> (see GetGradWspline()).
+ */
+static int
+GetGradWsplineH( struct Simulation *Sim,   /* Simulation */
+                 float *Grad,              /* Result (gradient vector) */
+                 float *Rij,               /* Vector Rij = Ri - Rj */
+                 float SmoothR)            /* Smoothing length */
+{
+    float NormFactor, GradFactor;
+
+    GetFactorsWspline( Sim->Dimension, SmoothR, &NormFactor, &GradFactor);
+    return GradWspline( Sim->Dimension, Grad, Rij, SmoothR, GradFactor);
+} /* GetGradWsplineH */
+
+/**
+ * Calculate the kernel's value at the point 
+ * <Rij> for the smoothing length <SmoothR>.
+ */
+static float
+GetWsplineH( struct Simulation *Sim,   /* Simulation */
+             float *Rij,               /* Vector Rij = Ri - Rj */
+             float SmoothR)            /* Smoothing length */
+{
+    float NormFactor, GradFactor;
+
+    GetFactorsWspline( Sim->Dimension, SmoothR, &NormFactor, &GradFactor);
+    return Wspline( Sim->Dimension, Rij, SmoothR, NormFactor);
+} /* GetWsplineH */
+
 /**********************************************************/
 
 /*******************************************************************
@@ -113,43 +225,59 @@ GetGradWspline( float *Grad,   /* Result (gradient vector) */
  * Eurographics Workshop on Animation and Simulation, 61-76, 1996. *
  *******************************************************************/
 
-/* Factor to calculate the kernel's gradient */
-static float GradFactorWspiky;
-
 /**
- * Initialize the kernel.
+ * Calculate the kernel's normalization factor and the factor 
+ * to calculate its gradient for the smoothing length <SmoothR>.
  */
 static void
-InitWspiky( void)
+GetFactorsWspiky( int Dim,             /* Dimension */
+                  float SmoothR,       /* Smoothing length */
+                  float *NormFactor,   /* Normalization factor */
+                  float *GradFactor)   /* Factor of the gradient */
 {
-    float NormFactor;
-    
     /* Kernel's normalization factor */
-    if ( Dimension == 2 )
-        NormFactor = 5.0f / (16.0f * PI * SmoothR * SmoothR);
-    else if ( Dimension == 3 )
-        NormFactor = 15.0f / (64.0f * PI * SmoothR * SmoothR * SmoothR);
+    if ( Dim == 2 )
+        *NormFactor = 5.0f / (16.0f * PI * SmoothR * SmoothR);
+    else
+        *NormFactor = 15.0f / (64.0f * PI * SmoothR * SmoothR * SmoothR);
     
     /* Factor to calculate the kernel's gradient */
-    GradFactorWspiky = NormFactor * (-3.0f / (SmoothR * SmoothR));
+    *GradFactor = *NormFactor * (-3.0f / (SmoothR * SmoothR));
+
+    return;
+} /* GetFactorsWspiky */
+
+/**
+ * Initialize the kernel.
+ */
+static void
+InitWspiky( struct Simulation *Sim)   /* Simulation */
+{
+    GetFactorsWspiky( Sim->Dimension, Sim->SmoothR, 
+                      &Sim->KernelNormFactor, &Sim->KernelGradFactor);
+    Sim->KernelSupport = 2.0f * Sim->SmoothR;
 
     return;
 } /* InitWspiky */
 
 /**
  * Calculate the kernel's gradient at the point <Rij> with 
- * respect to Ri, the resulting gradient vector is return 
- * through <Grad>. The function returns -1 if the gradient 
- * vector is equal to zero and 0 if it's meaning.
+ * respect to Ri for the smoothing length <SmoothR> and the 
+ * gradient's factor <GradFactor>, the resulting gradient vector 
+ * is return through <Grad>. The function returns -1 if the 
+ * gradient vector is equal to zero and 0 if it's meaning.
  */
 static int
-GetGradWspiky( float *Grad,   /* Result (gradient vector) */
-               float *Rij)    /* Vector Rij = Ri - Rj */
+GradWspiky( int Dim,            /* Dimension */
+            float *Grad,        /* Result (gradient vector) */
+            float *Rij,         /* Vector Rij = Ri - Rj */
+            float SmoothR,      /* Smoothing length */
+            float GradFactor)   /* Factor of the gradient */
 {
     float s;
     int d;
     
-    s = VectorNorm( Rij) / SmoothR;
+    s = VectorNorm( Dim, Rij) / SmoothR;
 
     if ( s > 2.0f )
     {
@@ -157,10 +285,87 @@ GetGradWspiky( float *Grad,   /* Result (gradient vector) */
     }
     else
     {
-        for ( d = 0; d < Dimension; d++ )
-            Grad[d] = GradFactorWspiky * Rij[d] * 
+        for ( d = 0; d < Dim; d++ )
+            Grad[d] = GradFactor * Rij[d] * 
                       (2.0f - s) * (2.0f - s) / s;
     }
 
     return 0;
+} /* GradWspiky */
+
+/**
+ * Calculate the kernel's value at the point <Rij> for the smoothing 
+ * length <SmoothR> and the normalization factor <NormFactor>.
+ */
+static float
+Wspiky( int Dim,            /* Dimension */
+        float *Rij,         /* Vector Rij = Ri - Rj */
+        float SmoothR,      /* Smoothing length */
+        float NormFactor)   /* Normalization factor */
+{
+    float s;
+    
+    s = VectorNorm( Dim, Rij) / SmoothR;
+
+    if ( s > 2.0f )
+        return 0.0f;
+    else
+        return NormFactor * (2.0f - s) * (2.0f - s) * (2.0f - s);
+} /* Wspiky */
+
+/**
+ * Calculate the kernel's gradient at the point <Rij> with 
+ * respect to Ri, the resulting gradient vector is return 
+ * through <Grad>. The function returns -1 if the gradient 
+ * vector is equal to zero and 0 if it's meaning.
+ */
+static int
+GetGradWspiky( struct Simulation *Sim,   /* Simulation */
+               float *Grad,              /* Result (gradient vector) */
+               float *Rij)               /* Vector Rij = Ri - Rj */
+{
+    return GradWspiky( Sim->Dimension, Grad, Rij, 
+                       Sim->SmoothR, Sim->KernelGradFactor);
 } /* GetGradWspiky */
+
+/**
+ * Calculate the kernel's value at the point <Rij>.
+ */
+static float
+GetWspiky( struct Simulation *Sim,   /* Simulation */
+           float *Rij)               /* Vector Rij = Ri - Rj */
+{
+    return Wspiky( Sim->Dimension, Rij, 
+                   Sim->SmoothR, Sim->KernelNormFactor);
+} /* GetWspiky */
+
+/**
+ * Calculate the kernel's gradient at the point <Rij> for the 
+ * smoothing length <SmoothR> (see GetGradWspiky()).
+ */
+static int
+GetGradWspikyH( struct Simulation *Sim,   /* Simulation */
+                float *Grad,              /* Result (gradient vector) */
+                float *Rij,               /* Vector Rij = Ri - Rj */
+                float SmoothR)            /* Smoothing length */
+{
+    float NormFactor, GradFactor;
+
+    GetFactorsWspiky( Sim->Dimension, SmoothR, &NormFactor, &GradFactor);
+    return GradWspiky( Sim->Dimension, Grad, Rij, SmoothR, GradFactor);
+} /* GetGradWspikyH */
+
+/**
+ * Calculate the kernel's value at the point 
+ * <Rij> for the smoothing length <SmoothR>.
+ */
+static float
+GetWspikyH( struct Simulation *Sim,   /* Simulation */
+            float *Rij,               /* Vector Rij = Ri - Rj */
+            float SmoothR)            /* Smoothing length */
+{
+    float NormFactor, GradFactor;
+
+    GetFactorsWspiky( Sim->Dimension, SmoothR, &NormFactor, &GradFactor);
+    return Wspiky( Sim->Dimension, Rij, SmoothR, NormFactor);
+} /* GetWspikyH */
@@ -10,13 +10,27 @@
 
 /**********************************************************/
 
+struct Simulation;
+
 /* The kernel's info */
 struct Kernel
 {
     char  *Name;                     /* Name of the kernel */
-    void (*Init)( void);             /* Initialize the kernel */
-    int  (*GetGrad)( float *Grad, 
+    void (*Init)( struct Simulation 
+                  *Sim);             /* Initialize the kernel */
+    int  (*GetGrad)( struct Simulation *Sim,
+                     float *Grad, 
                      float *Rij);    /* Get the kernel's gradient */
+    float (*GetValue)( struct Simulation *Sim,
+                       float *Rij);  /* Get the kernel's value */
+    int  (*GetGradH)( struct Simulation *Sim,
+                      float *Grad, float *Rij,
+                      float SmoothR);  /* Get the kernel's gradient for 
+                                          the given smoothing length */
+    float (*GetValueH)( struct Simulation *Sim,
+                        float *Rij,
+                        float SmoothR); /* Get the kernel's value for 
+                                           the given smoothing length */
 };
 
 /* All the implemented kernels */
@@ -5,9 +5,12 @@
  * $Id$
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include "opengl.h"
+#include "common.h"
 #include "scene.h"
-#include "calc.h"
+#include "yaps.h"
 #include "render.h"
 
 /**********************************************************/
@@ -24,11 +27,14 @@ main( int argc, char **argv)
     glutCreateWindow( argv[0]);
     glutSetWindowTitle( "YAPS");
     
-    /* Initialize scene */
-    InitScene();
-    
-    /* Initialize calculation module */
-    InitCalc();
+    /* Create the simulation from the scene file */
+    RenderedSim = CreateSimulation( argc > 1 ? argv[1] : SCENE_FILE_NAME, 
+                                    NULL);
+    if ( RenderedSim == NULL )
+    {
+        fprintf( stderr, "Can't create the simulation\n");
+        exit( 1);
+    }
     
     /* Initialize GL capabilities */
     InitGLCapabilities();
@@ -41,7 +47,10 @@ main( int argc, char **argv)
     glutReshapeFunc( ReshapeCallback);
     glutKeyboardFunc( KeyboardCallback);
     glutSpecialFunc( SpecialFuncCallback);
-    glutIdleFunc( IdleCallback);
+    glutTimerFunc( 0, TimerCallback, 0);
+
+    /* Start stepping the simulation on its own thread */
+    StartSolver();
 
     /* Go to main loop */
     glutMainLoop();
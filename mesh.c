@@ -0,0 +1,496 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "common.h"
+#include "mesh.h"
+
+/**********************************************************/
+
+/* The maximum length of the line of a text mesh */
+#define MESH_LINE_LENGTH       1024
+
+/* The sizes of the header and of the triangle of binary STL */
+#define STL_HEADER_SIZE        84
+#define STL_TRIANGLE_SIZE      50
+
+/**********************************************************/
+
+/* Face of OBJ mesh */
+struct MeshFace
+{
+    size_t Start;            /* Offset of the face's line */
+    int    First;            /* The first triangle of the face */
+    int    TrianglesNum;     /* Number of its triangles */
+    int    VerticesNum;      /* Number of the vertices before the face */
+};
+
+/**********************************************************/
+
+/* Map the file into memory */
+static int    MapMeshFile      ( const char *FileName, struct Mesh *Mesh);
+
+/* Copy the line of the text mesh */
+static size_t GetMeshLine      ( struct Mesh *Mesh, size_t Pos,
+                                 char *Line);
+
+/* Index the vertices and the faces of OBJ mesh */
+static int    IndexObjMesh     ( struct Mesh *Mesh);
+
+/* Read the index of the next vertex of the face of OBJ mesh */
+static char  *GetObjVertex     ( char *Token, int *Index);
+
+/* Read the triangles of the face of OBJ mesh */
+static int    ReadObjFace      ( struct Mesh *Mesh, struct MeshFace *Face,
+                                 struct ObstacleTriangle *Triangles,
+                                 float Scale, float *Offset);
+
+/* Store the vertex of the triangle */
+static void   SetMeshVertex    ( float *Vrtx, float *Pos,
+                                 float Scale, float *Offset);
+
+/**********************************************************/
+
+/**
+ * Open the mesh file <FileName> - map it into memory, find out its format
+ * (binary STL, ASCII STL or OBJ) and count its triangles (the polygons of
+ * OBJ mesh are split into the fans of the triangles). Binary STL may
+ * have some data after its triangles. The function returns 0 if
+ * succeeded and -1 if the file can't be read or it isn't valid (OBJ
+ * mesh without any face isn't valid).
+ */
+int
+OpenMesh( const char *FileName,   /* Mesh file */
+          struct Mesh *Mesh)      /* Mesh */
+{
+    char Line[MESH_LINE_LENGTH + 1];
+    char Word[16];
+    unsigned int Num;
+    size_t Pos;
+
+    memset( Mesh, 0, sizeof(struct Mesh));
+    if ( MapMeshFile( FileName, Mesh) )
+        return -1;
+
+    /* Binary STL has the number of the triangles in the header
+     * (and its header could begin with "solid" as well) */
+    Num = 0;
+    if ( Mesh->Size >= STL_HEADER_SIZE )
+    {
+        memcpy( &Num, Mesh->Data + STL_HEADER_SIZE - 4, sizeof(Num));
+        if ( Mesh->Size == STL_HEADER_SIZE + (size_t)Num * STL_TRIANGLE_SIZE )
+        {
+            Mesh->Format = MESH_STL_BINARY;
+            Mesh->TrianglesNum = (int)Num;
+            return 0;
+        }
+    }
+
+    /* ASCII STL - every vertex is on its own line */
+    if ( Mesh->Size >= 5 && strncmp( Mesh->Data, "solid", 5) == 0 )
+    {
+        Mesh->Format = MESH_STL_ASCII;
+        for ( Pos = 0; Pos < Mesh->Size; )
+        {
+            Pos = GetMeshLine( Mesh, Pos, Line);
+            if ( sscanf( Line, "%15s", Word) == 1 && strcmp( Word, "vertex") == 0 )
+                Mesh->VerticesNum++;
+        }
+        Mesh->TrianglesNum = Mesh->VerticesNum / 3;
+        return 0;
+    }
+
+    /* Binary STL followed by some data (the bytes of the number of
+     * the triangles of a text mesh are too large to fit its size) */
+    if ( Mesh->Size >= STL_HEADER_SIZE &&
+         Mesh->Size >= STL_HEADER_SIZE + (size_t)Num * STL_TRIANGLE_SIZE )
+    {
+        Mesh->Format = MESH_STL_BINARY;
+        Mesh->TrianglesNum = (int)Num;
+        return 0;
+    }
+
+    /* OBJ */
+    Mesh->Format = MESH_OBJ;
+    if ( IndexObjMesh( Mesh) || Mesh->FacesNum == 0 )
+    {
+        CloseMesh( Mesh);
+        return -1;
+    }
+
+    return 0;
+} /* OpenMesh */
+
+/**
+ * Read the triangles of the mesh <Mesh> into the array <Triangles> (it
+ * has to have the space for all of them), the vertices are scaled by
+ * <Scale> and moved by <Offset>. The triangles of binary STL and the
+ * faces of OBJ are read in parallel. The function returns 0 if succeeded
+ * and -1 if the mesh isn't valid.
+ */
+int
+ReadMeshTriangles( struct Mesh *Mesh,                    /* Mesh */
+                   struct ObstacleTriangle *Triangles,   /* Triangles */
+                   float Scale,                          /* Scale */
+                   float *Offset)                        /* Offset */
+{
+    char Line[MESH_LINE_LENGTH + 1];
+    char Word[16];
+    float Pos[3];
+    float *Vrtx;
+    size_t At;
+    int Invalid;
+    int Res;
+    int i, n;
+
+    Res = 0;
+    if ( Mesh->Format == MESH_STL_BINARY )
+    {
+#pragma omp parallel for schedule(static) private(Pos,At)
+        for ( i = 0; i < Mesh->TrianglesNum; i++ )
+        {
+            /* The normal is skipped, the vertices follow it */
+            At = STL_HEADER_SIZE + (size_t)i * STL_TRIANGLE_SIZE + 3 * sizeof(float);
+            memcpy( Pos, Mesh->Data + At, sizeof(Pos));
+            SetMeshVertex( Triangles[i].Vrtx1, Pos, Scale, Offset);
+            memcpy( Pos, Mesh->Data + At + sizeof(Pos), sizeof(Pos));
+            SetMeshVertex( Triangles[i].Vrtx2, Pos, Scale, Offset);
+            memcpy( Pos, Mesh->Data + At + 2 * sizeof(Pos), sizeof(Pos));
+            SetMeshVertex( Triangles[i].Vrtx3, Pos, Scale, Offset);
+        }
+    }
+    else if ( Mesh->Format == MESH_STL_ASCII )
+    {
+        n = 0;
+        for ( At = 0; At < Mesh->Size && n < 3 * Mesh->TrianglesNum; )
+        {
+            At = GetMeshLine( Mesh, At, Line);
+            if ( sscanf( Line, "%15s %f %f %f", Word, &Pos[0], &Pos[1], &Pos[2]) != 4 ||
+                 strcmp( Word, "vertex") != 0 )
+                continue;
+            i = n / 3;
+            Vrtx = ( n % 3 == 0 ) ? Triangles[i].Vrtx1 :
+                   ( n % 3 == 1 ) ? Triangles[i].Vrtx2 : Triangles[i].Vrtx3;
+            SetMeshVertex( Vrtx, Pos, Scale, Offset);
+            n++;
+        }
+        if ( n != 3 * Mesh->TrianglesNum )
+            Res = -1;
+    }
+    else
+    {
+        /* The invalid faces are counted by every thread and summed */
+        Invalid = 0;
+#pragma omp parallel for schedule(dynamic,256) reduction(+:Invalid)
+        for ( i = 0; i < Mesh->FacesNum; i++ )
+        {
+            if ( ReadObjFace( Mesh, &Mesh->Faces[i], Triangles, Scale, Offset) )
+                Invalid++;
+        }
+        if ( Invalid > 0 )
+            Res = -1;
+    }
+
+    return Res;
+} /* ReadMeshTriangles */
+
+/**
+ * Close the mesh <Mesh> - unmap the file and free the memory.
+ */
+void
+CloseMesh( struct Mesh *Mesh)   /* Mesh */
+{
+#ifndef _WIN32
+    if ( Mesh->Mapped )
+        munmap( Mesh->Data, Mesh->Size);
+    else
+#endif
+        free( Mesh->Data);
+    free( Mesh->Vertices);
+    free( Mesh->Faces);
+    memset( Mesh, 0, sizeof(struct Mesh));
+
+    return;
+} /* CloseMesh */
+
+/**
+ * Get FNV-1a hash <Hash> of the contents of the mesh file <FileName>
+ * (the caches of the scenes are keyed by it). The function returns 0
+ * if succeeded and -1 if the file can't be read.
+ */
+int
+GetMeshHash( const char *FileName,   /* Mesh file */
+             unsigned int *Hash)     /* Hash of the file */
+{
+    struct Mesh Mesh;
+    size_t i;
+
+    memset( &Mesh, 0, sizeof(struct Mesh));
+    if ( MapMeshFile( FileName, &Mesh) )
+        return -1;
+
+    *Hash = 2166136261u;
+    for ( i = 0; i < Mesh.Size; i++ )
+    {
+        *Hash ^= (unsigned char)Mesh.Data[i];
+        *Hash *= 16777619u;
+    }
+    CloseMesh( &Mesh);
+
+    return 0;
+} /* GetMeshHash */
+
+/**********************************************************/
+
+/**
+ * Map the file <FileName> into memory (it's read into memory if the
+ * system can't map it). The function returns 0 if succeeded and -1
+ * if the file can't be read.
+ */
+static int
+MapMeshFile( const char *FileName,   /* Mesh file */
+             struct Mesh *Mesh)      /* Mesh */
+{
+#ifndef _WIN32
+    struct stat Stat;
+    void *Map;
+    int File;
+
+    File = open( FileName, O_RDONLY);
+    if ( File < 0 )
+        return -1;
+    if ( fstat( File, &Stat) != 0 || Stat.st_size == 0 )
+    {
+        close( File);
+        return -1;
+    }
+    Map = mmap( NULL, Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+    close( File);
+    if ( Map == MAP_FAILED )
+        return -1;
+
+    Mesh->Data = (char *)Map;
+    Mesh->Size = Stat.st_size;
+    Mesh->Mapped = 1;
+#else
+    FILE *File;
+    long Size;
+
+    File = fopen( FileName, "rb");
+    if ( File == NULL )
+        return -1;
+    fseek( File, 0, SEEK_END);
+    Size = ftell( File);
+    fseek( File, 0, SEEK_SET);
+    if ( Size <= 0 )
+    {
+        fclose( File);
+        return -1;
+    }
+    Mesh->Data = (char *)malloc( Size);
+    Mesh->Size = (size_t)Size;
+    if ( fread( Mesh->Data, Size, 1, File) != 1 )
+    {
+        fclose( File);
+        free( Mesh->Data);
+        Mesh->Data = NULL;
+        return -1;
+    }
+    fclose( File);
+#endif
+
+    return 0;
+} /* MapMeshFile */
+
+/**
+ * Copy the line of the text mesh <Mesh> beginning at <Pos> to <Line>
+ * (it's cut at MESH_LINE_LENGTH characters), the function returns the
+ * position of the next line.
+ */
+static size_t
+GetMeshLine( struct Mesh *Mesh,   /* Mesh */
+             size_t Pos,          /* Position of the line */
+             char *Line)          /* The line */
+{
+    size_t End;
+    size_t n;
+
+    for ( End = Pos; End < Mesh->Size && Mesh->Data[End] != '\n'; End++ )
+        ;
+    n = End - Pos;
+    if ( n > MESH_LINE_LENGTH )
+        n = MESH_LINE_LENGTH;
+    memcpy( Line, Mesh->Data + Pos, n);
+    Line[n] = '\0';
+
+    return End + 1;
+} /* GetMeshLine */
+
+/**
+ * Index OBJ mesh <Mesh> - read its vertices ("v" lines) and store the
+ * positions of its faces ("f" lines), the other lines are skipped. The
+ * function returns 0 if succeeded and -1 if the mesh isn't valid.
+ */
+static int
+IndexObjMesh( struct Mesh *Mesh)   /* Mesh */
+{
+    char Line[MESH_LINE_LENGTH + 1];
+    char Word[16];
+    char *Token;
+    int Index;
+    int VerticesSize;
+    int FacesSize;
+    size_t Pos, Next;
+    int n;
+
+    VerticesSize = 0;
+    FacesSize = 0;
+    for ( Pos = 0; Pos < Mesh->Size; Pos = Next )
+    {
+        Next = GetMeshLine( Mesh, Pos, Line);
+        if ( sscanf( Line, "%15s", Word) != 1 )
+            continue;
+
+        if ( strcmp( Word, "v") == 0 )
+        {
+            if ( Mesh->VerticesNum == VerticesSize )
+            {
+                VerticesSize = 2 * VerticesSize + 1024;
+                Mesh->Vertices = (float *)realloc( Mesh->Vertices,
+                                                   3 * VerticesSize * sizeof(float));
+            }
+            n = sscanf( Line, "%*s %f %f %f", &Mesh->Vertices[3 * Mesh->VerticesNum],
+                        &Mesh->Vertices[3 * Mesh->VerticesNum + 1],
+                        &Mesh->Vertices[3 * Mesh->VerticesNum + 2]);
+            if ( n != 3 )
+                return -1;
+            Mesh->VerticesNum++;
+        }
+        else if ( strcmp( Word, "f") == 0 )
+        {
+            if ( Mesh->FacesNum == FacesSize )
+            {
+                FacesSize = 2 * FacesSize + 1024;
+                Mesh->Faces = (struct MeshFace *)realloc( Mesh->Faces,
+                                                          FacesSize * sizeof(struct MeshFace));
+            }
+            /* The polygon of n vertices is a fan of n - 2 triangles, 
+             * the vertices are counted as they are read (a comment 
+             * or anything else after them isn't a vertex) */
+            n = 0;
+            for ( Token = strchr( Line, 'f') + 1; (Token = GetObjVertex( Token, &Index)) != NULL; )
+                n++;
+            if ( n < 3 )
+                return -1;
+            Mesh->Faces[Mesh->FacesNum].Start = Pos;
+            Mesh->Faces[Mesh->FacesNum].First = Mesh->TrianglesNum;
+            Mesh->Faces[Mesh->FacesNum].TrianglesNum = n - 2;
+            Mesh->Faces[Mesh->FacesNum].VerticesNum = Mesh->VerticesNum;
+            Mesh->FacesNum++;
+            Mesh->TrianglesNum += n - 2;
+        }
+    }
+
+    return 0;
+} /* IndexObjMesh */
+
+/**
+ * Read the index <Index> of the vertex of the face of OBJ mesh which
+ * begins at <Token> (the vertices are "v", "v/vt", "v//vn" or "v/vt/vn",
+ * the indices of the texture and the normal are skipped). The function
+ * returns the position after the vertex or NULL if there is no vertex.
+ */
+static char *
+GetObjVertex( char *Token,   /* Position in the face's line */
+              int *Index)    /* Index of the vertex */
+{
+    char *Next;
+
+    *Index = (int)strtol( Token, &Next, 10);
+    if ( Next == Token )
+        return NULL;
+    for ( Token = Next; *Token != '\0' && *Token != ' ' && *Token != '\t'; Token++ )
+        ;
+
+    return Token;
+} /* GetObjVertex */
+
+/**
+ * Read the triangles of the face <Face> of OBJ mesh <Mesh> into the
+ * array <Triangles> (the negative indices are relative to the end of
+ * the vertices before the face). The function returns 0 if succeeded
+ * and -1 if the face refers to a vertex which doesn't exist or the
+ * number of its triangles isn't the one counted by the index.
+ */
+static int
+ReadObjFace( struct Mesh *Mesh,                    /* Mesh */
+             struct MeshFace *Face,                /* Face */
+             struct ObstacleTriangle *Triangles,   /* Triangles */
+             float Scale,                          /* Scale */
+             float *Offset)                        /* Offset */
+{
+    struct ObstacleTriangle *Triangle;
+    char Line[MESH_LINE_LENGTH + 1];
+    char *Token;
+    int Vertex[3];
+    int k, n;
+
+    GetMeshLine( Mesh, Face->Start, Line);
+
+    /* The first token is "f" */
+    Token = strchr( Line, 'f') + 1;
+
+    for ( k = 0; (Token = GetObjVertex( Token, &n)) != NULL; k++ )
+    {
+        n = ( n > 0 ) ? n - 1 : Face->VerticesNum + n;
+        if ( n < 0 || n >= Face->VerticesNum )
+            return -1;
+
+        /* Vertices 0, k - 1 and k make the triangle k - 2 of the fan
+         * (the triangles beyond the counted ones aren't there) */
+        Vertex[( k < 2 ) ? k : 2] = n;
+        if ( k < 2 )
+            continue;
+        if ( k - 2 >= Face->TrianglesNum )
+            return -1;
+        Triangle = &Triangles[Face->First + k - 2];
+        SetMeshVertex( Triangle->Vrtx1, &Mesh->Vertices[3 * Vertex[0]], Scale, Offset);
+        SetMeshVertex( Triangle->Vrtx2, &Mesh->Vertices[3 * Vertex[1]], Scale, Offset);
+        SetMeshVertex( Triangle->Vrtx3, &Mesh->Vertices[3 * Vertex[2]], Scale, Offset);
+        Vertex[1] = Vertex[2];
+    }
+    if ( k - 2 != Face->TrianglesNum )
+        return -1;
+
+    return 0;
+} /* ReadObjFace */
+
+/**
+ * Store the vertex <Pos> of the mesh scaled by <Scale> and moved by
+ * <Offset> to the vertex <Vrtx> of the triangle.
+ */
+static void
+SetMeshVertex( float *Vrtx,     /* Vertex of the triangle */
+               float *Pos,      /* Vertex of the mesh */
+               float Scale,     /* Scale */
+               float *Offset)   /* Offset */
+{
+    int d;
+
+    for ( d = 0; d < 3; d++ )
+        Vrtx[d] = Pos[d] * Scale + Offset[d];
+
+    return;
+} /* SetMeshVertex */
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_MESH_H
+#define YAPS_MESH_H
+
+/**********************************************************/
+
+#include <stddef.h>
+
+/* Formats of the mesh files */
+enum MeshFormats
+{
+    MESH_STL_BINARY,     /* Binary STL          */
+    MESH_STL_ASCII,      /* ASCII STL           */
+    MESH_OBJ,            /* Wavefront OBJ       */
+};
+
+/* Face of OBJ mesh */
+struct MeshFace;
+
+/* Mesh file mapped into memory - the triangles are counted when the
+ * mesh is opened and they are read straight into the array of the
+ * obstacles (the vertices and the faces of OBJ mesh are indexed when
+ * it's opened, so its faces are read in parallel) */
+struct Mesh
+{
+    char   *Data;            /* Contents of the file */
+    size_t Size;             /* Size of the file */
+    int    Mapped;           /* Non-zero if the file is mapped */
+    int    Format;           /* Format of the file */
+    int    TrianglesNum;     /* Number of the triangles */
+    float  *Vertices;        /* Vertices of OBJ mesh */
+    int    VerticesNum;      /* Number of the vertices */
+    struct MeshFace *Faces;  /* Faces of OBJ mesh */
+    int    FacesNum;         /* Number of the faces */
+};
+
+/**********************************************************/
+
+struct ObstacleTriangle;
+
+/* Open the mesh file and count its triangles */
+extern int  OpenMesh         ( const char *FileName, struct Mesh *Mesh);
+
+/* Read the triangles of the mesh */
+extern int  ReadMeshTriangles( struct Mesh *Mesh,
+                               struct ObstacleTriangle *Triangles,
+                               float Scale, float *Offset);
+
+/* Close the mesh file */
+extern void CloseMesh        ( struct Mesh *Mesh);
+
+/* Get the hash of the contents of the mesh file */
+extern int  GetMeshHash      ( const char *FileName, unsigned int *Hash);
+
+/**********************************************************/
+
+#endif /* YAPS_MESH_H */
@@ -0,0 +1,343 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "vector.h"
+#include "neighb.h"
+#include "collide.h"
+#include "motion.h"
+
+/**********************************************************/
+
+#define PI 3.1415926535f
+
+/**********************************************************/
+
+/* Get the pose of the body at the given time */
+static void  GetBodyPose     ( struct MovingBody *Body, float Time,
+                               float (*Rotation)[3], float *Offset);
+
+/* Move the point from its place in the scene file */
+static void  MovePoint       ( struct MovingBody *Body, float *Rest,
+                               float *Pos);
+
+/**********************************************************/
+
+/**
+ * Collect the obstacles and the boundary particles of every moving
+ * body of the simulation <Sim> and keep their places given by the scene
+ * file (the bodies are moved from them, so the errors don't accumulate),
+ * then move the bodies to their poses at the current time. The function
+ * returns 0 if succeeded.
+ */
+int
+InitMotion( struct Simulation *Sim)   /* Simulation */
+{
+    struct MovingBody *Body;
+    size_t ObstacleSize;
+    int b, i, j;
+
+    ObstacleSize = ( Sim->Dimension == 2 ) ? sizeof(struct ObstacleSegment) :
+                                             sizeof(struct ObstacleTriangle);
+
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+    {
+        Body = &Sim->Bodies[b];
+
+        /* The obstacles of the body */
+        Body->ObstaclesNum = 0;
+        for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+            if ( GetObstacleBody( Sim, i) == b )
+                Body->ObstaclesNum++;
+        Body->Obstacles = (int *)malloc( (Body->ObstaclesNum + 1) * sizeof(int));
+        Body->RestObstacles = malloc( (Body->ObstaclesNum + 1) * ObstacleSize);
+        Body->ObstaclesNum = 0;
+        for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+        {
+            if ( GetObstacleBody( Sim, i) != b )
+                continue;
+            Body->Obstacles[Body->ObstaclesNum] = i;
+            memcpy( (char *)Body->RestObstacles + Body->ObstaclesNum * ObstacleSize,
+                    (char *)Sim->Obstacles + i * ObstacleSize, ObstacleSize);
+            Body->ObstaclesNum++;
+        }
+
+        /* The boundary particles of its obstacles */
+        Body->BParticlesNum = 0;
+        for ( j = 0; j < Sim->BParticlesNumber; j++ )
+            if ( GetObstacleBody( Sim, Sim->BParticles[j].Obstacle) == b )
+                Body->BParticlesNum++;
+        Body->BParticles = (int *)malloc( (Body->BParticlesNum + 1) * sizeof(int));
+        Body->RestBParticles = (float (*)[3])
+                               malloc( (Body->BParticlesNum + 1) * sizeof(*Body->RestBParticles));
+        Body->BParticlesNum = 0;
+        for ( j = 0; j < Sim->BParticlesNumber; j++ )
+        {
+            if ( GetObstacleBody( Sim, Sim->BParticles[j].Obstacle) != b )
+                continue;
+            Body->BParticles[Body->BParticlesNum] = j;
+            memcpy( Body->RestBParticles[Body->BParticlesNum],
+                    Sim->BParticles[j].Pos, 3 * sizeof(float));
+            Body->BParticlesNum++;
+        }
+
+        /* The obstacles are where the scene file puts them */
+        memset( Body->Rotation, 0, sizeof(Body->Rotation));
+        memset( Body->Offset, 0, sizeof(Body->Offset));
+        for ( i = 0; i < 3; i++ )
+            Body->Rotation[i][i] = 1.0f;
+    }
+
+    MoveObstacles( Sim);
+
+    return 0;
+} /* InitMotion */
+
+/**
+ * Free the moving bodies of the simulation <Sim>.
+ */
+void
+FreeMotion( struct Simulation *Sim)   /* Simulation */
+{
+    struct MovingBody *Body;
+    int b;
+
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+    {
+        Body = &Sim->Bodies[b];
+        free( Body->Keys);
+        free( Body->Obstacles);
+        free( Body->RestObstacles);
+        free( Body->BParticles);
+        free( Body->RestBParticles);
+    }
+    free( Sim->Bodies);
+    Sim->Bodies = NULL;
+    Sim->BodiesNumber = 0;
+
+    return;
+} /* FreeMotion */
+
+/**
+ * Move the bodies of the simulation <Sim> to their poses at the
+ * current time - their obstacles and boundary particles are moved from
+ * their places in the scene file. The boundary particles which leave
+ * their cells are moved in the hash of the neighbour search, and the
+ * boxes of the moving obstacles are refitted, so nothing is rebuilt
+ * (the bodies which have moved are flagged, the incompressible solver
+ * finds the volumes of their boundary particles near the other bodies
+ * again).
+ * The bodies which keep their poses (before the first key and after
+ * the last one) aren't touched at all. The motion of the bodies till
+ * the next step is kept, the particles are swept against it.
+ */
+void
+MoveObstacles( struct Simulation *Sim)   /* Simulation */
+{
+    struct MovingBody *Body;
+    struct ObstacleSegment *Segments, *RestSegments;
+    struct ObstacleTriangle *Triangles, *RestTriangles;
+    float Rotation[3][3], NextRotation[3][3];
+    float Offset[3], NextOffset[3];
+    int Moved;
+    int b, i, k;
+
+    Segments = (struct ObstacleSegment *)Sim->Obstacles;
+    Triangles = (struct ObstacleTriangle *)Sim->Obstacles;
+    Moved = 0;
+
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+    {
+        Body = &Sim->Bodies[b];
+        GetBodyPose( Body, Sim->Time, Rotation, Offset);
+
+        /* The motion till the next step, it's swept by the collisions
+         * (x is moved to NextRotation * Rotation^T * (x - Offset) +
+         * NextOffset) */
+        GetBodyPose( Body, Sim->Time + Sim->TimeStep, NextRotation, NextOffset);
+        for ( i = 0; i < 3; i++ )
+        {
+            for ( k = 0; k < 3; k++ )
+                Body->StepRotation[i][k] = NextRotation[i][0] * Rotation[k][0] +
+                                           NextRotation[i][1] * Rotation[k][1] +
+                                           NextRotation[i][2] * Rotation[k][2];
+        }
+        for ( i = 0; i < 3; i++ )
+            Body->StepOffset[i] = NextOffset[i] - (Body->StepRotation[i][0] * Offset[0] +
+                                                   Body->StepRotation[i][1] * Offset[1] +
+                                                   Body->StepRotation[i][2] * Offset[2]);
+        Body->StepMoving = memcmp( Rotation, NextRotation, sizeof(Rotation)) != 0 ||
+                           memcmp( Offset, NextOffset, sizeof(Offset)) != 0;
+
+        if ( memcmp( Rotation, Body->Rotation, sizeof(Rotation)) == 0 &&
+             memcmp( Offset, Body->Offset, sizeof(Offset)) == 0 )
+            continue;
+        memcpy( Body->Rotation, Rotation, sizeof(Rotation));
+        memcpy( Body->Offset, Offset, sizeof(Offset));
+        Body->Moved = 1;
+        Moved = 1;
+
+        RestSegments = (struct ObstacleSegment *)Body->RestObstacles;
+        RestTriangles = (struct ObstacleTriangle *)Body->RestObstacles;
+#pragma omp parallel
+        {
+#pragma omp for private(i)
+            for ( k = 0; k < Body->ObstaclesNum; k++ )
+            {
+                i = Body->Obstacles[k];
+                if ( Sim->Dimension == 2 )
+                {
+                    MovePoint( Body, RestSegments[k].Vrtx1, Segments[i].Vrtx1);
+                    MovePoint( Body, RestSegments[k].Vrtx2, Segments[i].Vrtx2);
+                }
+                else
+                {
+                    MovePoint( Body, RestTriangles[k].Vrtx1, Triangles[i].Vrtx1);
+                    MovePoint( Body, RestTriangles[k].Vrtx2, Triangles[i].Vrtx2);
+                    MovePoint( Body, RestTriangles[k].Vrtx3, Triangles[i].Vrtx3);
+                }
+            }
+
+#pragma omp for private(i)
+            for ( k = 0; k < Body->BParticlesNum; k++ )
+            {
+                i = Body->BParticles[k];
+                MovePoint( Body, Body->RestBParticles[k], Sim->BParticles[i].Pos);
+                UpdateBoundaryCell( Sim, i);
+            }
+        }
+    }
+
+    if ( Moved )
+        RefitCollisions( Sim);
+
+    return;
+} /* MoveObstacles */
+
+/**
+ * Get the moving body of the obstacle <i> of the simulation <Sim> (the
+ * body of the line of the obstacles section it's given by). The
+ * function returns the index of the body or -1 if the obstacle doesn't
+ * move.
+ */
+int
+GetObstacleBody( struct Simulation *Sim,   /* Simulation */
+                 int i)                    /* Obstacle */
+{
+    int Line;
+    int b;
+
+    if ( Sim->BodiesNumber == 0 )
+        return -1;
+
+    if ( Sim->Dimension == 2 )
+        Line = ((struct ObstacleSegment *)Sim->Obstacles)[i].Line;
+    else
+        Line = ((struct ObstacleTriangle *)Sim->Obstacles)[i].Line;
+    for ( b = 0; b < Sim->BodiesNumber; b++ )
+    {
+        if ( Line >= Sim->Bodies[b].FirstLine && Line <= Sim->Bodies[b].LastLine )
+            return b;
+    }
+
+    return -1;
+} /* GetObstacleBody */
+
+/**********************************************************/
+
+/**
+ * Get the pose (<Rotation>, <Offset>) of the body <Body> at the time
+ * <Time> - the keys around it are interpolated linearly (the axis of
+ * the rotation is normalized), the body keeps the pose of the first
+ * key before it and the pose of the last key after it.
+ */
+static void
+GetBodyPose( struct MovingBody *Body,   /* Moving body */
+             float Time,                /* Time */
+             float (*Rotation)[3],      /* Rotation */
+             float *Offset)             /* Offset */
+{
+    struct MotionKey *Key0, *Key1;
+    float Axis[3], Pivot[3], Move[3];
+    float Angle;
+    float Frac;
+    float Len;
+    float c, s, t;
+    int k, d;
+
+    /* The keys around the time */
+    for ( k = 0; k < Body->KeysNum; k++ )
+        if ( Body->Keys[k].Time > Time )
+            break;
+    Key0 = &Body->Keys[( k > 0 ) ? k - 1 : 0];
+    Key1 = &Body->Keys[( k < Body->KeysNum ) ? k : Body->KeysNum - 1];
+    Frac = 0.0f;
+    if ( Key1->Time > Key0->Time )
+        Frac = (Time - Key0->Time) / (Key1->Time - Key0->Time);
+
+    for ( d = 0; d < 3; d++ )
+    {
+        Axis[d] = Key0->Axis[d] + Frac * (Key1->Axis[d] - Key0->Axis[d]);
+        Pivot[d] = Key0->Pivot[d] + Frac * (Key1->Pivot[d] - Key0->Pivot[d]);
+        Move[d] = Key0->Offset[d] + Frac * (Key1->Offset[d] - Key0->Offset[d]);
+    }
+    Angle = Key0->Angle + Frac * (Key1->Angle - Key0->Angle);
+
+    /* The rotation about the axis (Rodrigues' formula) */
+    Len = VectorNorm( 3, Axis);
+    if ( Len > 0.0f )
+    {
+        for ( d = 0; d < 3; d++ )
+            Axis[d] /= Len;
+    }
+    else
+    {
+        Angle = 0.0f;
+    }
+    c = (float)cos( Angle * PI / 180.0f);
+    s = (float)sin( Angle * PI / 180.0f);
+    t = 1.0f - c;
+    Rotation[0][0] = t * Axis[0] * Axis[0] + c;
+    Rotation[0][1] = t * Axis[0] * Axis[1] - s * Axis[2];
+    Rotation[0][2] = t * Axis[0] * Axis[2] + s * Axis[1];
+    Rotation[1][0] = t * Axis[1] * Axis[0] + s * Axis[2];
+    Rotation[1][1] = t * Axis[1] * Axis[1] + c;
+    Rotation[1][2] = t * Axis[1] * Axis[2] - s * Axis[0];
+    Rotation[2][0] = t * Axis[2] * Axis[0] - s * Axis[1];
+    Rotation[2][1] = t * Axis[2] * Axis[1] + s * Axis[0];
+    Rotation[2][2] = t * Axis[2] * Axis[2] + c;
+
+    /* The pivot stays in place (the offset is exactly the move
+     * of the key if the body isn't rotated) */
+    for ( d = 0; d < 3; d++ )
+        Offset[d] = Move[d] + (Pivot[d] - (Rotation[d][0] * Pivot[0] +
+                                           Rotation[d][1] * Pivot[1] +
+                                           Rotation[d][2] * Pivot[2]));
+
+    return;
+} /* GetBodyPose */
+
+/**
+ * Move the point <Rest> (its place in the scene file) with the body
+ * <Body> to <Pos>.
+ */
+static void
+MovePoint( struct MovingBody *Body,   /* Moving body */
+           float *Rest,               /* Place of the point */
+           float *Pos)                /* Its position */
+{
+    int d;
+
+    for ( d = 0; d < 3; d++ )
+        Pos[d] = Body->Rotation[d][0] * Rest[0] + Body->Rotation[d][1] * Rest[1] +
+                 Body->Rotation[d][2] * Rest[2] + Body->Offset[d];
+
+    return;
+} /* MovePoint */
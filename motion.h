@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_MOTION_H
+#define YAPS_MOTION_H
+
+/**********************************************************/
+
+struct Simulation;
+
+/* Collect the obstacles and the boundary particles of the moving bodies */
+extern int  InitMotion     ( struct Simulation *Sim);
+
+/* Free the moving bodies */
+extern void FreeMotion     ( struct Simulation *Sim);
+
+/* Move the bodies to their poses at the current time */
+extern void MoveObstacles  ( struct Simulation *Sim);
+
+/* Get the moving body of the obstacle */
+extern int  GetObstacleBody( struct Simulation *Sim, int i);
+
+/**********************************************************/
+
+#endif /* YAPS_MOTION_H */
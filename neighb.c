@@ -0,0 +1,1830 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <omp.h>
+#include "common.h"
+#include "vector.h"
+#include "calc.h"
+#include "neighb.h"
+
+/**********************************************************/
+
+/* The number of the particles processed together */
+#define NEIGHB_BLOCK            64
+
+/* The number of the points in a tile of the brute force search
+ * (the coordinates of a tile should stay in the L1 cache) */
+#define NEIGHB_TILE             512
+
+/* The coordinate of the points padding the last tile */
+#define NEIGHB_FAR_AWAY         1.0e30f
+
+/* The maximum number of the cells of a grid per point */
+#define NEIGHB_CELLS_PER_POINT  4
+
+/* Interval (in steps) between the probes of
+ * the method which isn't in use at the moment */
+#define NEIGHB_PROBE_INTERVAL   50
+
+/* The number of the pairs' tests per step below which
+ * the brute force search is tried first */
+#define NEIGHB_BRUTE_TESTS      4000000.0
+
+/* The cell coordinates of the spatial hash are clamped to this
+ * (the points which are so far away share the outermost cells) */
+#define NEIGHB_HASH_LIMIT       1.0e9f
+
+/* The key of the free slot of the spatial hash */
+#define NEIGHB_HASH_FREE        INT_MIN
+
+/* The minimum number of the slots of the spatial hash */
+#define NEIGHB_HASH_MIN_SIZE    64
+
+/* Weight of the last measurement in the average time */
+#define NEIGHB_TIME_WEIGHT      0.3
+
+/**********************************************************/
+
+/* The set of the points to search for the neighbours among */
+struct PointSet
+{
+    float  *Pos;               /* Position of the first point */
+    size_t Stride;             /* Distance between the positions */
+    int    Num;                /* Number of the points */
+    int    Self;               /* The points are the smoothing particles */
+    int    Reorder;            /* Permute the points into the cells' order */
+    float  Radius;             /* Radius of the neighbourhood */
+    struct NeighbData *Data;   /* The data to search */
+};
+
+/* The candidates to the pairs of a block of particles, the candidates
+ * of the particle First + i are j[Start[i]] ... j[Start[i + 1] - 1] */
+struct Candidates
+{
+    int   Start[NEIGHB_BLOCK + 1];
+    int   *j;
+    int   Size;
+    int   *Tmp;                /* Candidates in the order they are found */
+    int   TmpSize;
+};
+
+/* The method of the neighbour search */
+struct SearchMethod
+{
+    char  *Name;                          /* Name in the scene file */
+    int  (*Prepare)( struct Simulation *Sim,
+                     struct PointSet *Set);    /* Prepare the data */
+    void (*Collect)( struct Simulation *Sim,
+                     struct PointSet *Set,
+                     int First, int Last,
+                     struct Candidates *Cands); /* Find the candidates */
+};
+
+/* The possible methods */
+enum SearchMethodsTypes
+{
+    BRUTE_SEARCH,
+    GRID_SEARCH,
+    HASH_SEARCH
+};
+
+/* Get the index of the cell along an axis */
+typedef int (*GetCellIndexFunc)( struct Simulation *Sim,
+                                 struct NeighbData *Data,
+                                 int d, float x);
+
+/* Get the first point of the cell */
+typedef int (*GetCellHeadFunc) ( struct Simulation *Sim,
+                                 struct NeighbData *Data,
+                                 int *c);
+
+/* Get the range of the sorted points of the cell */
+typedef void (*GetCellRangeFunc)( struct Simulation *Sim,
+                                  struct NeighbData *Data,
+                                  int *c, int *Begin, int *End);
+
+/**********************************************************/
+
+/* Brute force search */
+static int   PrepareBruteForce  ( struct Simulation *Sim,
+                                  struct PointSet *Set);
+static void  CollectByBruteForce( struct Simulation *Sim,
+                                  struct PointSet *Set,
+                                  int First, int Last,
+                                  struct Candidates *Cands);
+
+/* Search using the uniform grid */
+static int   PrepareGrid        ( struct Simulation *Sim,
+                                  struct PointSet *Set);
+static void  CollectByGrid      ( struct Simulation *Sim,
+                                  struct PointSet *Set,
+                                  int First, int Last,
+                                  struct Candidates *Cands);
+
+/* Sort the points by the cells of the grid */
+static void  SortGridPoints     ( struct Simulation *Sim,
+                                  struct PointSet *Set,
+                                  int CellsNum);
+
+/* Search using the spatial hash */
+static int   PrepareHash        ( struct Simulation *Sim,
+                                  struct PointSet *Set);
+static void  CollectByHash      ( struct Simulation *Sim,
+                                  struct PointSet *Set,
+                                  int First, int Last,
+                                  struct Candidates *Cands);
+
+/* Get the index of the cell of the spatial hash along an axis */
+static int   GetHashCellIndex   ( struct Simulation *Sim,
+                                  struct NeighbData *Data,
+                                  int d, float x);
+
+/* Link and unlink the point in the spatial hash */
+static void  LinkHashPoint      ( struct NeighbData *Data, int j);
+static void  UnlinkHashPoint    ( struct NeighbData *Data, int j);
+
+/* Allocate the memory for the points of the hash */
+static void  ReserveHashPoints  ( struct NeighbData *Data, int Num);
+
+/* Set the cell of the point of the hash */
+static void  SetHashPointCell   ( struct Simulation *Sim,
+                                  struct PointSet *Set, int j);
+
+/* Store the point which has left its cell of the hash */
+static void  UpdatePointCell    ( struct Simulation *Sim,
+                                  struct NeighbData *Data,
+                                  int i, float *Pos);
+
+/* Search in the neighbouring cells */
+static void  CollectInCells     ( struct Simulation *Sim,
+                                  struct PointSet *Set,
+                                  int First, int Last,
+                                  struct Candidates *Cands,
+                                  GetCellIndexFunc GetIndex,
+                                  GetCellHeadFunc GetHead,
+                                  GetCellRangeFunc GetRange);
+
+/* Take the point as the candidate if it's closer than the radius */
+static void  AddCandidate       ( struct Simulation *Sim,
+                                  struct PointSet *Set,
+                                  int i, int j, float Radius2,
+                                  struct Candidates *Cands, int *Num);
+
+/* Find the pairs of the particles and of the boundary particles */
+static void  SearchPairs        ( struct Simulation *Sim, int Method,
+                                  int Reorder);
+
+/* Find the pairs of the smoothing particles and the given points */
+static void  FindPairs          ( struct Simulation *Sim,
+                                  struct PointSet *Set, int Method,
+                                  struct NeighbPair **Pairs,
+                                  int *PairsSize, int *Start);
+
+/* Evaluate the kernel for the pair of the particles
+ * with the different smoothing lengths */
+static void  GetPairKernel      ( struct Simulation *Sim,
+                                  struct NeighbPair *Pair,
+                                  float SmoothRi, float SmoothRj);
+
+/* Get the factor of the kernel's radial gradient */
+static float GetGradFactor      ( int Dim, float *Grad, float *Rij,
+                                  float Dist2);
+
+/**********************************************************/
+
+/* All implemented methods of the neighbour search */
+static struct SearchMethod SearchMethods[] =
+{
+    /* Tiled brute force search (all the pairs are tested) */
+    "BRUTE", PrepareBruteForce, CollectByBruteForce,
+    /* Search in the neighbouring cells of the uniform grid */
+    "GRID",  PrepareGrid,       CollectByGrid,
+    /* Search in the neighbouring cells of the spatial hash */
+    "HASH",  PrepareHash,       CollectByHash,
+};
+
+/* The size of this array */
+static int SearchMethodsNum = sizeof(SearchMethods) / sizeof(SearchMethods[0]);
+
+/* The name of the automatic choice of the method */
+#define AUTO_SEARCH_NAME    "AUTO"
+
+/**********************************************************/
+
+/**
+ * Initialize the neighbour search - choose the method according to
+ * the parameter NEIGHB_SEARCH. By default (and if it's AUTO) the
+ * method is chosen automatically - the brute force is tried first
+ * if there are few particles and the grid otherwise, then all the
+ * methods are timed from time to time and the fastest one is used.
+ * The function returns 0 if succeeded and -1 if the method is unknown.
+ */
+int
+InitNeighbSearch( struct Simulation *Sim)   /* Simulation */
+{
+    double Tests;
+    int i;
+
+    for ( i = 0; i < SearchMethodsNum; i++ )
+        Sim->NeighbTime[i] = 0.0;
+
+    if ( Sim->NeighbSearch[0] == '\0' ||
+         strcmp( Sim->NeighbSearch, AUTO_SEARCH_NAME) == 0 )
+    {
+        Tests = (double)Sim->ParticlesNumber *
+                (double)(Sim->ParticlesNumber + Sim->BParticlesNumber);
+        Sim->NeighbAuto = 1;
+        Sim->NeighbMethod = ( Tests < NEIGHB_BRUTE_TESTS ) ?
+                            BRUTE_SEARCH : GRID_SEARCH;
+        return 0;
+    }
+
+    for ( i = 0; i < SearchMethodsNum; i++ )
+    {
+        /* Search for the required method */
+        if ( strcmp( Sim->NeighbSearch, SearchMethods[i].Name) )
+            continue;
+        Sim->NeighbAuto = 0;
+        Sim->NeighbMethod = i;
+        return 0;
+    }
+
+    return -1;
+} /* InitNeighbSearch */
+
+/**********************************************************/
+
+/**
+ * Find the pairs of the neighbouring particles - all the pairs of the
+ * smoothing particles within the kernel's support, and all the pairs
+ * of the smoothing and the boundary particles within the kernel's
+ * support or within the range of the repulsive boundary forces (the
+ * support is padded by PairsSkin, the kernel and its gradient vanish
+ * for the farther pairs). For every pair the vector Rij, the squared
+ * distance, the kernel's value and its gradient are stored, so the
+ * interaction passes of the step don't evaluate the kernel again. The
+ * pairs of every particle are sorted by j whatever method is used, so
+ * the results don't depend on the method.
+ */
+void
+FindNeighbPairs( struct Simulation *Sim)   /* Simulation */
+{
+    double Time;
+    int Method;
+    int Reorder;
+    int i;
+
+    /* Allocate memory for the pairs' offsets */
+    if ( Sim->PairsStartSize < Sim->ParticlesNumber + 1 )
+    {
+        Sim->PairsStartSize = Sim->ParticlesNumber + 1;
+        Sim->PairsStart = (int *)realloc( Sim->PairsStart,
+                                          Sim->PairsStartSize * sizeof(int));
+        Sim->BPairsStart = (int *)realloc( Sim->BPairsStart,
+                                           Sim->PairsStartSize * sizeof(int));
+    }
+
+    /* The methods which aren't in use are probed in turn from time to time */
+    Method = Sim->NeighbMethod;
+    if ( Sim->NeighbAuto &&
+         Sim->StepsNumber % NEIGHB_PROBE_INTERVAL == NEIGHB_PROBE_INTERVAL - 1 )
+        Method = (Method + 1 + (Sim->StepsNumber / NEIGHB_PROBE_INTERVAL) % 
+                  (SearchMethodsNum - 1)) % SearchMethodsNum;
+
+    /* The particles are sorted by the cells of the grid from time to
+     * time (the neighbours get close in the memory), the grid is built
+     * at these steps whatever method is in use */
+    Reorder = ( Sim->SortInterval > 0 && Sim->StepsNumber % Sim->SortInterval == 0 );
+    if ( Reorder )
+        Method = GRID_SEARCH;
+    Time = omp_get_wtime();
+
+    SearchPairs( Sim, Method, Reorder);
+
+    /* Choose the faster method (the steps with the sort aren't timed) */
+    if ( Sim->NeighbAuto && !Reorder )
+    {
+        Time = omp_get_wtime() - Time;
+        Sim->NeighbTime[Method] = ( Sim->NeighbTime[Method] > 0.0 ) ?
+            (1.0 - NEIGHB_TIME_WEIGHT) * Sim->NeighbTime[Method] +
+            NEIGHB_TIME_WEIGHT * Time : Time;
+        for ( i = 0; i < SearchMethodsNum; i++ )
+        {
+            if ( Sim->NeighbTime[i] > 0.0 &&
+                 Sim->NeighbTime[i] < Sim->NeighbTime[Sim->NeighbMethod] )
+                Sim->NeighbMethod = i;
+        }
+    }
+
+    return;
+} /* FindNeighbPairs */
+
+/**
+ * Find the pairs of the neighbouring particles again during the step
+ * after PairsSkin has grown (the incompressible solver finds that the
+ * particles move farther than the padding). The method in use is taken,
+ * the particles aren't reordered and the search isn't timed.
+ */
+void
+RefindNeighbPairs( struct Simulation *Sim)   /* Simulation */
+{
+    SearchPairs( Sim, Sim->NeighbMethod, 0);
+
+    return;
+} /* RefindNeighbPairs */
+
+/**********************************************************/
+
+/**
+ * Update the cell of the particle <i> after its position has changed
+ * (it's called by the integration for every particle, by several 
+ * threads at once, and by the refinement for the particles it has
+ * changed). If the particle has crossed the border of its cell in the
+ * spatial hash, it's stored and it's moved in the hash before the next
+ * search (the hash doesn't depend on the order of the moved particles).
+ * The particles added at the end of the array needn't be updated, the
+ * search links them itself.
+ */
+void
+UpdateNeighbCell( struct Simulation *Sim,   /* Simulation */
+                  int i)                    /* The particle */
+{
+    UpdatePointCell( Sim, &Sim->NeighbData, i, Sim->Particles[i].Pos);
+
+    return;
+} /* UpdateNeighbCell */
+
+/**
+ * Update the cell of the boundary particle <i> after it has moved
+ * with its obstacle, the same way as UpdateNeighbCell() does for the
+ * smoothing particles (so the hash of the boundary is refitted, not
+ * rebuilt, while the obstacles move).
+ */
+void
+UpdateBoundaryCell( struct Simulation *Sim,   /* Simulation */
+                    int i)                    /* The boundary particle */
+{
+    UpdatePointCell( Sim, &Sim->BNeighbData, i, Sim->BParticles[i].Pos);
+
+    return;
+} /* UpdateBoundaryCell */
+
+/**********************************************************/
+
+/**
+ * Sort the <Num> points at <Pos> (<Stride> bytes apart) by the cells of
+ * the grid <Data> not smaller than <Radius>, so the points near any
+ * place could be found by FindPointsNearBox. The grid belongs to the
+ * caller (it's used by the post-processing after the step and by the 
+ * incompressible solver, so the data of the search of the step are left
+ * as they are). The function returns -1 if the grid can't be used and 0
+ * otherwise.
+ */
+int
+PreparePointsGrid( struct Simulation *Sim,    /* Simulation */
+                   struct NeighbData *Data,   /* Grid */
+                   float *Pos,                /* Position of the first point */
+                   size_t Stride,             /* Distance between the positions */
+                   int Num,                   /* Number of the points */
+                   float Radius)              /* Radius of the search */
+{
+    struct PointSet Set;
+
+    Set.Pos = Pos;
+    Set.Stride = Stride;
+    Set.Num = Num;
+    Set.Self = 0;
+    Set.Reorder = 0;
+    Set.Radius = Radius;
+    Set.Data = Data;
+
+    return PrepareGrid( Sim, &Set);
+} /* PreparePointsGrid */
+
+/**
+ * Find the points of the grid <Data> (see PreparePointsGrid) which 
+ * could be closer than its radius to the box <Min> ... <Max> - all the
+ * points of the cells of the box and of the cells around them. The
+ * points are stored in the array <Found> (of the size <FoundSize>,
+ * reallocated if needed), the function returns their number. The grid
+ * is only read, so the function could be called by several threads
+ * at once.
+ */
+int
+FindPointsNearBox( struct Simulation *Sim,    /* Simulation */
+                   struct NeighbData *Data,   /* Grid */
+                   float *Min,                /* Lower corner of the box */
+                   float *Max,                /* Upper corner of the box */
+                   int **Found,               /* Found points */
+                   int *FoundSize)            /* Size of the array */
+{
+    double Lo[3], Hi[3];
+    int c[3], n[3];
+    int Num;
+    int Cell;
+    int k, d;
+
+    /* The range of the cells along every axis (the range along
+     * a periodic axis is wrapped if it's shorter than the axis) */
+    for ( d = 0; d < 3; d++ )
+    {
+        Lo[d] = Hi[d] = 0.0;
+        if ( d >= Sim->Dimension )
+            continue;
+        Lo[d] = floor( (Min[d] - Data->Origin[d]) / Data->CellSize[d]) - 1.0;
+        Hi[d] = floor( (Max[d] - Data->Origin[d]) / Data->CellSize[d]) + 1.0;
+        if ( Sim->Period[d] > 0.0f && !(Hi[d] - Lo[d] + 1.0 < Data->CellsNum[d]) )
+        {
+            Lo[d] = 0.0;
+            Hi[d] = Data->CellsNum[d] - 1.0;
+        }
+        else if ( Sim->Period[d] == 0.0f )
+        {
+            if ( !(Lo[d] >= 0.0) )
+                Lo[d] = 0.0;
+            if ( !(Hi[d] <= Data->CellsNum[d] - 1.0) )
+                Hi[d] = Data->CellsNum[d] - 1.0;
+        }
+    }
+
+    Num = 0;
+    for ( c[2] = (int)Lo[2]; c[2] <= (int)Hi[2]; c[2]++ )
+    for ( c[1] = (int)Lo[1]; c[1] <= (int)Hi[1]; c[1]++ )
+    for ( c[0] = (int)Lo[0]; c[0] <= (int)Hi[0]; c[0]++ )
+    {
+        for ( d = 0; d < 3; d++ )
+        {
+            n[d] = c[d];
+            if ( Sim->Period[d] > 0.0f )
+                n[d] = ((c[d] % Data->CellsNum[d]) + Data->CellsNum[d]) % Data->CellsNum[d];
+        }
+        Cell = (n[2] * Data->CellsNum[1] + n[1]) * Data->CellsNum[0] + n[0];
+        for ( k = Data->CellStart[Cell]; k < Data->CellStart[Cell + 1]; k++ )
+        {
+            if ( Num == *FoundSize )
+            {
+                *FoundSize = 2 * *FoundSize + 256;
+                *Found = (int *)realloc( *Found, *FoundSize * sizeof(int));
+            }
+            (*Found)[Num++] = Data->CellPoints[k];
+        }
+    }
+
+    return Num;
+} /* FindPointsNearBox */
+
+/**********************************************************/
+
+/**
+ * Free the memory allocated for the pairs.
+ */
+void
+FreeNeighbPairs( struct Simulation *Sim)   /* Simulation */
+{
+    free( Sim->Pairs);
+    free( Sim->PairsStart);
+    free( Sim->BPairs);
+    free( Sim->BPairsStart);
+    Sim->Pairs = NULL;
+    Sim->PairsStart = NULL;
+    Sim->BPairs = NULL;
+    Sim->BPairsStart = NULL;
+    Sim->PairsSize = 0;
+    Sim->BPairsSize = 0;
+    Sim->PairsStartSize = 0;
+    FreeNeighbData( &Sim->NeighbData);
+    FreeNeighbData( &Sim->BNeighbData);
+
+    return;
+} /* FreeNeighbPairs */
+
+/**
+ * Free the data to search <Data>.
+ */
+void
+FreeNeighbData( struct NeighbData *Data)   /* Data to search */
+{
+    int i;
+
+    free( Data->Coords);
+    free( Data->CellStart);
+    free( Data->CellPoints);
+    free( Data->PointKeys);
+    free( Data->CellCounts);
+    free( Data->SortBuf);
+    free( Data->CellHead);
+    free( Data->CellNext);
+    free( Data->HashCells);
+    free( Data->PointCells);
+    for ( i = 0; i < Data->MovedListsNum; i++ )
+        free( Data->MovedLists[i].Points);
+    free( Data->MovedLists);
+    memset( Data, 0, sizeof(struct NeighbData));
+
+    return;
+} /* FreeNeighbData */
+
+/**********************************************************/
+
+/**
+ * Find the pairs of the smoothing particles of the simulation <Sim>
+ * and the pairs of the smoothing and the boundary particles by the
+ * method <Method>, the particles are sorted by the cells of the grid
+ * if <Reorder> is non-zero.
+ */
+static void
+SearchPairs( struct Simulation *Sim,   /* Simulation */
+             int Method,               /* Method of the search */
+             int Reorder)              /* Non-zero to sort the particles */
+{
+    struct PointSet Set;
+
+    /* The pairs of the smoothing particles (with the adaptive smoothing
+     * lengths the radius is set by the largest of them), the radius is
+     * padded if the pairs are used at the positions after the step */
+    Set.Pos = Sim->Particles[0].Pos;
+    Set.Stride = sizeof(struct Particle);
+    Set.Num = Sim->ParticlesNumber;
+    Set.Self = 1;
+    Set.Reorder = Reorder;
+    Set.Radius = Sim->KernelSupport;
+    if ( Sim->AdaptiveSmooth )
+        Set.Radius *= Sim->MaxSmoothR / Sim->SmoothR;
+    Set.Radius += Sim->PairsSkin;
+    Set.Data = &Sim->NeighbData;
+    FindPairs( Sim, &Set, Method, &Sim->Pairs, &Sim->PairsSize, Sim->PairsStart);
+
+    /* The pairs of the smoothing and the boundary particles, the
+     * boundary repulses particles closer than the initial distribution
+     * (there are none if the boundary is the distance field) */
+    if ( Sim->BParticlesNumber == 0 )
+        memset( Sim->BPairsStart, 0, (Sim->ParticlesNumber + 1) * sizeof(int));
+    else
+    {
+        Set.Pos = Sim->BParticles[0].Pos;
+        Set.Stride = sizeof(struct BParticle);
+        Set.Num = Sim->BParticlesNumber;
+        Set.Self = 0;
+        Set.Reorder = 0;
+        if ( Set.Radius < Sim->ParticlesDistrib )
+            Set.Radius = Sim->ParticlesDistrib;
+        Set.Data = &Sim->BNeighbData;
+        FindPairs( Sim, &Set, Method, &Sim->BPairs, &Sim->BPairsSize, Sim->BPairsStart);
+    }
+
+    return;
+} /* SearchPairs */
+
+/**
+ * Find the pairs of the smoothing particles and the points of the set
+ * <Set>, which are closer than the set's radius, using the method
+ * <Method> (if the data for the method can't be prepared, the brute
+ * force is used). The pairs are stored in the array <Pairs> (of the
+ * size <PairsSize>, reallocated if needed) particle by particle,
+ * <Start> gets the offsets of the particles' pairs (ParticlesNumber
+ * + 1 values). The particles are processed by blocks, every thread
+ * collects the pairs of its blocks in its own buffer, then the
+ * buffers are copied to their places in <Pairs>.
+ */
+static void
+FindPairs( struct Simulation *Sim,         /* Simulation */
+           struct PointSet *Set,           /* Set of the points */
+           int Method,                     /* Method of the search */
+           struct NeighbPair **Pairs,      /* Array of the pairs */
+           int *PairsSize,                 /* Size of the array */
+           int *Start)                     /* Offsets of the particles' pairs */
+{
+    struct Particle *Particles;
+    float Radius2;
+    float Support;
+    int   BlocksNum;
+    int   Dimension;
+    int   b;
+
+    Particles = Sim->Particles;
+    Dimension = Sim->Dimension;
+    Radius2 = Set->Radius * Set->Radius;
+    Support = Sim->KernelSupport / Sim->SmoothR;
+    BlocksNum = (Sim->ParticlesNumber + NEIGHB_BLOCK - 1) / NEIGHB_BLOCK;
+    Start[0] = 0;
+
+    if ( SearchMethods[Method].Prepare( Sim, Set) )
+    {
+        Method = BRUTE_SEARCH;
+        SearchMethods[Method].Prepare( Sim, Set);
+    }
+
+#pragma omp parallel
+    {
+        struct Candidates *Cands;
+        struct NeighbPair *Buf;
+        struct NeighbPair *Pair;
+        int   *Owned;
+        float *Posj;
+        float Rij[3];
+        float Grad[3];
+        float Dist2;
+        float SmoothRi, SmoothRj;
+        float Cutoff;
+        int   BufSize, BufNum;
+        int   OwnedNum;
+        int   First, Last;
+        int   i, j, k, n;
+
+        Cands = (struct Candidates *)calloc( 1, sizeof(struct Candidates));
+        Buf = NULL;
+        BufSize = BufNum = 0;
+        Owned = (int *)malloc( (BlocksNum + 1) * sizeof(int));
+        OwnedNum = 0;
+
+        /* Collect the pairs of the thread's blocks */
+#pragma omp for schedule(dynamic,1)
+        for ( b = 0; b < BlocksNum; b++ )
+        {
+            First = b * NEIGHB_BLOCK;
+            Last = First + NEIGHB_BLOCK;
+            if ( Last > Sim->ParticlesNumber )
+                Last = Sim->ParticlesNumber;
+
+            /* The candidates are sorted by j for every particle */
+            SearchMethods[Method].Collect( Sim, Set, First, Last, Cands);
+
+            for ( i = First; i < Last; i++ )
+            {
+                n = 0;
+                for ( k = Cands->Start[i - First]; k < Cands->Start[i - First + 1]; k++ )
+                {
+                    j = Cands->j[k];
+                    Posj = (float *)((char *)Set->Pos + j * Set->Stride);
+                    VectorSubstraction( Dimension, Rij, Particles[i].Pos, Posj);
+                    if ( Sim->PeriodicDomain )
+                        GetMinimumImage( Sim, Rij);
+                    Dist2 = VectorInnerproduct( Dimension, Rij, Rij);
+                    if ( !(Dist2 <= Radius2) )
+                        continue;
+
+                    /* With the adaptive smoothing lengths the pair is taken
+                     * if either particle is within the other one's support
+                     * (the boundary particles take the length of i) */
+                    if ( Sim->AdaptiveSmooth )
+                    {
+                        SmoothRi = Particles[i].SmoothR;
+                        SmoothRj = Set->Self ? Particles[j].SmoothR : SmoothRi;
+                        Cutoff = Support * (( SmoothRi > SmoothRj ) ? SmoothRi : SmoothRj) +
+                                 Sim->PairsSkin;
+                        if ( !Set->Self && Cutoff < Sim->ParticlesDistrib )
+                            Cutoff = Sim->ParticlesDistrib;
+                        if ( !(Dist2 <= Cutoff * Cutoff) )
+                            continue;
+                    }
+
+                    if ( BufNum == BufSize )
+                    {
+                        BufSize = 2 * BufSize + 256;
+                        Buf = (struct NeighbPair *)
+                              realloc( Buf, BufSize * sizeof(struct NeighbPair));
+                    }
+                    Pair = &Buf[BufNum++];
+                    Pair->j = j;
+                    memset( Pair->Rij, 0, sizeof(Pair->Rij));
+                    memcpy( Pair->Rij, Rij, Dimension * sizeof(float));
+                    if ( Sim->AdaptiveSmooth )
+                    {
+                        GetPairKernel( Sim, Pair, SmoothRi, SmoothRj);
+                    }
+                    else
+                    {
+                        /* The gradient is zero outside of the kernel's support */
+                        memset( Grad, 0, sizeof(Grad));
+                        if ( Sim->GetGradKernel( Sim, Grad, Rij) )
+                            memset( Grad, 0, sizeof(Grad));
+                        Pair->GradFactor = GetGradFactor( Dimension, Grad, Rij, Dist2);
+                        Pair->Kernel = Sim->GetKernel( Sim, Rij);
+                    }
+                    n++;
+                }
+                Start[i + 1] = n;
+            }
+            Owned[OwnedNum++] = b;
+        }
+
+#pragma omp single
+        {
+            /* Offsets of the particles' pairs */
+            for ( k = 0; k < Sim->ParticlesNumber; k++ )
+                Start[k + 1] += Start[k];
+
+            /* Allocate memory for the pairs */
+            if ( *PairsSize < Start[Sim->ParticlesNumber] )
+            {
+                *PairsSize = Start[Sim->ParticlesNumber];
+                *Pairs = (struct NeighbPair *)
+                         realloc( *Pairs, *PairsSize * sizeof(struct NeighbPair));
+            }
+        }
+
+        /* Copy the pairs to their places (the blocks
+         * are stored in the buffer in the order of Owned) */
+        Pair = Buf;
+        for ( k = 0; k < OwnedNum; k++ )
+        {
+            First = Owned[k] * NEIGHB_BLOCK;
+            Last = First + NEIGHB_BLOCK;
+            if ( Last > Sim->ParticlesNumber )
+                Last = Sim->ParticlesNumber;
+            n = Start[Last] - Start[First];
+            memcpy( *Pairs + Start[First], Pair, n * sizeof(struct NeighbPair));
+            Pair += n;
+        }
+
+        free( Cands->j);
+        free( Cands->Tmp);
+        free( Cands);
+        free( Buf);
+        free( Owned);
+    }
+
+    return;
+} /* FindPairs */
+
+/**
+ * Evaluate the kernel's value and gradient for the pair <Pair> of the 
+ * particles with the smoothing lengths <SmoothRi> and <SmoothRj>. The 
+ * kernel is symmetrized - the values with both lengths are averaged,
+ * so the forces between the particles stay antisymmetric.
+ */
+static void
+GetPairKernel( struct Simulation *Sim,    /* Simulation */
+               struct NeighbPair *Pair,   /* Pair of the particles */
+               float SmoothRi,            /* Smoothing length of i */
+               float SmoothRj)            /* Smoothing length of j */
+{
+    float Grad[3], GradJ[3];
+    float Dist2;
+    int d;
+
+    /* The gradient is zero outside of the kernel's support */
+    Dist2 = VectorInnerproduct( Sim->Dimension, Pair->Rij, Pair->Rij);
+    memset( Grad, 0, sizeof(Grad));
+    if ( Sim->GetGradKernelH( Sim, Grad, Pair->Rij, SmoothRi) )
+        memset( Grad, 0, sizeof(Grad));
+    Pair->Kernel = Sim->GetKernelH( Sim, Pair->Rij, SmoothRi);
+    if ( SmoothRj != SmoothRi )
+    {
+        memset( GradJ, 0, sizeof(GradJ));
+        if ( Sim->GetGradKernelH( Sim, GradJ, Pair->Rij, SmoothRj) )
+            memset( GradJ, 0, sizeof(GradJ));
+        for ( d = 0; d < Sim->Dimension; d++ )
+            Grad[d] = 0.5f * (Grad[d] + GradJ[d]);
+        Pair->Kernel = 0.5f * (Pair->Kernel + Sim->GetKernelH( Sim, Pair->Rij, SmoothRj));
+    }
+    Pair->GradFactor = GetGradFactor( Sim->Dimension, Grad, Pair->Rij, Dist2);
+
+    return;
+} /* GetPairKernel */
+
+/**
+ * Get the factor of the radial gradient <Grad> of the kernel at the
+ * point <Rij> (<Dist2> is its squared distance from the origin), the
+ * gradient is the factor times <Rij>. The factor is zero at the origin.
+ */
+static float
+GetGradFactor( int Dim,          /* Dimension */
+               float *Grad,      /* Kernel's gradient at Rij */
+               float *Rij,       /* Vector Rij = Ri - Rj */
+               float Dist2)      /* Squared distance |Rij|^2 */
+{
+    if ( !(Dist2 > 0.0f) )
+        return 0.0f;
+
+    return VectorInnerproduct( Dim, Grad, Rij) / Dist2;
+} /* GetGradFactor */
+
+/**********************************************************/
+
+/*****************************************************************
+ * Tiled brute force search                                      *
+ * The coordinates of the points are copied to separate arrays,  *
+ * the squared distances from a block of particles to a tile of  *
+ * points are computed by a loop the compiler can vectorize, and *
+ * the tile is reused by all the particles of the block.         *
+ *****************************************************************/
+
+/**
+ * Copy the coordinates of the points of the set <Set>, the arrays 
+ * are padded to the whole number of tiles with the distant points.
+ */
+static int
+PrepareBruteForce( struct Simulation *Sim,   /* Simulation */
+                   struct PointSet *Set)     /* Set of the points */
+{
+    struct NeighbData *Data;
+    float *Pos;
+    int Size;
+    int j, d;
+
+    Data = Set->Data;
+    Data->HashValid = 0;
+    Size = (Set->Num + NEIGHB_TILE - 1) / NEIGHB_TILE * NEIGHB_TILE;
+    if ( Data->CoordsSize < Size )
+    {
+        Data->CoordsSize = Size;
+        Data->Coords = (float *)realloc( Data->Coords, 3 * Size * sizeof(float));
+    }
+
+    for ( j = 0; j < Set->Num; j++ )
+    {
+        Pos = (float *)((char *)Set->Pos + j * Set->Stride);
+        for ( d = 0; d < 3; d++ )
+            Data->Coords[d * Size + j] = ( d < Sim->Dimension ) ? Pos[d] : 0.0f;
+    }
+    for ( j = Set->Num; j < Size; j++ )
+    {
+        for ( d = 0; d < 3; d++ )
+            Data->Coords[d * Size + j] = NEIGHB_FAR_AWAY;
+    }
+
+    return 0;
+} /* PrepareBruteForce */
+
+/**
+ * Find the candidates to the pairs of the particles <First> ...
+ * <Last> - 1 testing all the points of the set <Set>, the candidates
+ * are stored in <Cands>. The minimum image convention is applied the
+ * same way as in GetMinimumImage(), so the distances are the same.
+ */
+static void
+CollectByBruteForce( struct Simulation *Sim,   /* Simulation */
+                     struct PointSet *Set,     /* Set of the points */
+                     int First,                /* The first particle */
+                     int Last,                 /* The last particle + 1 */
+                     struct Candidates *Cands) /* Candidates */
+{
+    float Dist2[NEIGHB_TILE];
+    float *X, *Y, *Z;
+    float Period0, Period1, Period2;
+    float HalfPeriod0, HalfPeriod1, HalfPeriod2;
+    float Pos[3];
+    float Radius2;
+    float dx, dy, dz;
+    int   Count[NEIGHB_BLOCK];
+    int   TmpNum;
+    int   Tile, TileLen;
+    int   Size;
+    int   i, j, k, d;
+
+    Size = (Set->Num + NEIGHB_TILE - 1) / NEIGHB_TILE * NEIGHB_TILE;
+    X = Set->Data->Coords;
+    Y = X + Size;
+    Z = Y + Size;
+    Radius2 = Set->Radius * Set->Radius;
+
+    /* Non-periodic axes are never wrapped */
+    Period0 = Sim->Period[0];
+    Period1 = Sim->Period[1];
+    Period2 = Sim->Period[2];
+    HalfPeriod0 = ( Period0 > 0.0f ) ? 0.5f * Period0 : FLT_MAX;
+    HalfPeriod1 = ( Period1 > 0.0f ) ? 0.5f * Period1 : FLT_MAX;
+    HalfPeriod2 = ( Period2 > 0.0f ) ? 0.5f * Period2 : FLT_MAX;
+
+    /* The candidates are collected tile by tile as pairs (i, j) */
+    TmpNum = 0;
+    memset( Count, 0, sizeof(Count));
+    for ( Tile = 0; Tile < Set->Num; Tile += NEIGHB_TILE )
+    {
+        TileLen = ( Set->Num - Tile < NEIGHB_TILE ) ? Set->Num - Tile : NEIGHB_TILE;
+
+        for ( i = First; i < Last; i++ )
+        {
+            for ( d = 0; d < 3; d++ )
+                Pos[d] = ( d < Sim->Dimension ) ? Sim->Particles[i].Pos[d] : 0.0f;
+
+            /* This loop is vectorized (the minimum image is 
+             * applied by selects, which have no branches) */
+            for ( k = 0; k < NEIGHB_TILE; k++ )
+            {
+                dx = Pos[0] - X[Tile + k];
+                dy = Pos[1] - Y[Tile + k];
+                dz = Pos[2] - Z[Tile + k];
+                dx -= ( dx > HalfPeriod0 ) ? Period0 : 0.0f;
+                dx += ( dx < -HalfPeriod0 ) ? Period0 : 0.0f;
+                dy -= ( dy > HalfPeriod1 ) ? Period1 : 0.0f;
+                dy += ( dy < -HalfPeriod1 ) ? Period1 : 0.0f;
+                dz -= ( dz > HalfPeriod2 ) ? Period2 : 0.0f;
+                dz += ( dz < -HalfPeriod2 ) ? Period2 : 0.0f;
+                Dist2[k] = dx * dx + dy * dy + dz * dz;
+            }
+
+            for ( k = 0; k < TileLen; k++ )
+            {
+                j = Tile + k;
+                if ( !(Dist2[k] <= Radius2) || (Set->Self && j == i) )
+                    continue;
+                if ( TmpNum + 2 > Cands->TmpSize )
+                {
+                    Cands->TmpSize = 2 * Cands->TmpSize + 512;
+                    Cands->Tmp = (int *)realloc( Cands->Tmp,
+                                                 Cands->TmpSize * sizeof(int));
+                }
+                Cands->Tmp[TmpNum++] = i - First;
+                Cands->Tmp[TmpNum++] = j;
+                Count[i - First]++;
+            }
+        }
+    }
+
+    /* Sort the candidates by the particles, the tiles are
+     * processed in order, so j is sorted for each particle */
+    Cands->Start[0] = 0;
+    for ( i = 0; i < Last - First; i++ )
+        Cands->Start[i + 1] = Cands->Start[i] + Count[i];
+    if ( Cands->Size < TmpNum / 2 )
+    {
+        Cands->Size = TmpNum / 2;
+        Cands->j = (int *)realloc( Cands->j, Cands->Size * sizeof(int));
+    }
+    memcpy( Count, Cands->Start, sizeof(Count));
+    for ( k = 0; k < TmpNum; k += 2 )
+        Cands->j[Count[Cands->Tmp[k]]++] = Cands->Tmp[k + 1];
+
+    return;
+} /* CollectByBruteForce */
+
+/**********************************************************/
+
+/*****************************************************************
+ * Search using the uniform grid                                 *
+ * The points are sorted by the cells not smaller than the       *
+ * radius of the neighbourhood, so only the neighbouring cells   *
+ * are searched. Periodic axes are covered by the grid exactly   *
+ * and the cells are wrapped around them. The grid is rebuilt at *
+ * every step by the parallel counting sort, which can permute   *
+ * the points into the order of the cells at the same time.      *
+ *****************************************************************/
+
+/**
+ * Get the index of the cell along the axis <d> of the grid <Data>
+ * containing the coordinate <x>. Along a periodic axis the index is
+ * wrapped, otherwise it's clamped to [-2, CellsNum + 1] (the cells
+ * outside of the grid are empty).
+ */
+static int
+GetCellIndex( struct Simulation *Sim,   /* Simulation */
+              struct NeighbData *Data,  /* Data to search */
+              int d,                    /* Axis */
+              float x)                  /* Coordinate */
+{
+    float c;
+    int n;
+
+    c = (float)floor( (x - Data->Origin[d]) / Data->CellSize[d]);
+    if ( Sim->Period[d] > 0.0f )
+    {
+        /* The coordinate is far from the periodic box (or isn't finite) */
+        if ( !(c >= -(float)Data->CellsNum[d] && c < 2.0f * (float)Data->CellsNum[d]) )
+        {
+            c = (float)fmod( c, (float)Data->CellsNum[d]);
+            if ( !(c >= -(float)Data->CellsNum[d] && c < (float)Data->CellsNum[d]) )
+                c = 0.0f;
+        }
+        n = (int)c;
+        if ( n < 0 )
+            n += Data->CellsNum[d];
+        else if ( n >= Data->CellsNum[d] )
+            n -= Data->CellsNum[d];
+        return n;
+    }
+
+    /* The coordinate isn't finite is treated as being outside */
+    if ( !(c >= -2.0f) )
+        return -2;
+    if ( !(c <= (float)Data->CellsNum[d] + 1.0f) )
+        return Data->CellsNum[d] + 1;
+    return (int)c;
+} /* GetCellIndex */
+
+/**
+ * Sort the points of the set <Set> by the cells of the grid. The
+ * function returns -1 if the grid can't be used (a periodic axis
+ * is shorter than three cells) and 0 otherwise.
+ */
+static int
+PrepareGrid( struct Simulation *Sim,   /* Simulation */
+             struct PointSet *Set)     /* Set of the points */
+{
+    struct NeighbData *Data;
+    float Min[3], Max[3];
+    float *Pos;
+    double Size[3];
+    double CellsNum;
+    float Scale;
+    int j, d;
+
+    Data = Set->Data;
+    Data->HashValid = 0;
+
+    /* The bounding box of the points (the points 
+     * which aren't finite are left outside) */
+    for ( d = 0; d < 3; d++ )
+    {
+        Min[d] = FLT_MAX;
+        Max[d] = -FLT_MAX;
+    }
+    for ( j = 0; j < Set->Num; j++ )
+    {
+        Pos = (float *)((char *)Set->Pos + j * Set->Stride);
+        for ( d = 0; d < Sim->Dimension; d++ )
+        {
+            if ( !(Pos[d] >= -FLT_MAX && Pos[d] <= FLT_MAX) )
+                continue;
+            if ( Pos[d] < Min[d] )
+                Min[d] = Pos[d];
+            if ( Pos[d] > Max[d] )
+                Max[d] = Pos[d];
+        }
+    }
+    for ( d = 0; d < 3; d++ )
+    {
+        if ( Min[d] > Max[d] )
+            Min[d] = Max[d] = 0.0f;
+    }
+
+    /* The grid covers the bounding box (or the periodic box),
+     * the cells are enlarged if there are too many of them */
+    Scale = 1.0f;
+    do
+    {
+        CellsNum = 1.0;
+        for ( d = 0; d < 3; d++ )
+        {
+            Size[d] = 1.0;
+            Data->CellSize[d] = Set->Radius * Scale;
+            Data->Origin[d] = Min[d];
+            if ( d >= Sim->Dimension )
+                continue;
+            if ( Sim->Period[d] > 0.0f )
+            {
+                Size[d] = floor( Sim->Period[d] / (Set->Radius * Scale));
+                if ( Size[d] < 3.0 )
+                    return -1;
+                Data->CellSize[d] = Sim->Period[d] / (float)Size[d];
+                Data->Origin[d] = Sim->Periodic[d][0];
+            }
+            else
+            {
+                Size[d] = floor( ((double)Max[d] - Min[d]) / Data->CellSize[d]) + 1.0;
+            }
+            CellsNum *= Size[d];
+        }
+        Scale *= 2.0f;
+    }
+    while ( CellsNum > (double)(NEIGHB_CELLS_PER_POINT * Set->Num + 64) );
+
+    for ( d = 0; d < 3; d++ )
+        Data->CellsNum[d] = (int)Size[d];
+
+    /* Allocate memory for the grid */
+    if ( Data->CellStartSize < (int)CellsNum + 1 )
+    {
+        Data->CellStartSize = (int)CellsNum + 1;
+        Data->CellStart = (int *)realloc( Data->CellStart,
+                                          Data->CellStartSize * sizeof(int));
+    }
+    if ( Data->CellPointsSize < Set->Num )
+    {
+        Data->CellPointsSize = Set->Num;
+        Data->CellPoints = (int *)realloc( Data->CellPoints,
+                                           Data->CellPointsSize * sizeof(int));
+        Data->PointKeys = (int *)realloc( Data->PointKeys,
+                                          Data->CellPointsSize * sizeof(int));
+    }
+    if ( Set->Reorder && Data->SortBufSize < Set->Num )
+    {
+        Data->SortBufSize = Set->Num;
+        Data->SortBuf = (char *)realloc( Data->SortBuf,
+                                         Data->SortBufSize * Set->Stride);
+    }
+
+    SortGridPoints( Sim, Set, (int)CellsNum);
+
+    return 0;
+} /* PrepareGrid */
+
+/**
+ * Sort the points of the set <Set> by the <CellsNum> cells of the grid
+ * (the counting sort). Every thread finds the cells of its own part of
+ * the points and counts them, the counts of all the threads give the
+ * offsets of the cells and the places of every thread's points within
+ * the cells, then the threads put their points to the places. The
+ * parts go in the order of the threads, so the points of every cell
+ * stay sorted by index. If the points are to be reordered, they are
+ * permuted into the sorted order (the positions are the first fields
+ * of the points, so the whole points are copied), and the sorted
+ * points of every cell become the range of the indices.
+ */
+static void
+SortGridPoints( struct Simulation *Sim,   /* Simulation */
+                struct PointSet *Set,     /* Set of the points */
+                int CellsNum)             /* Number of the cells */
+{
+    struct NeighbData *Data;
+
+    Data = Set->Data;
+
+#pragma omp parallel
+    {
+        float *Pos;
+        int *Count, *Totals;
+        int ThreadsNum, Thread;
+        int First, Last;
+        int FirstCell, LastCell;
+        int Cell, Sum, n;
+        int c[3];
+        int j, k, t, d;
+
+        ThreadsNum = omp_get_num_threads();
+        Thread = omp_get_thread_num();
+
+        /* The counts of the cells of every thread and 
+         * the numbers of the points of the threads' cells */
+#pragma omp single
+        {
+            if ( Data->CellCountsSize < ThreadsNum * (CellsNum + 1) )
+            {
+                Data->CellCountsSize = ThreadsNum * (CellsNum + 1);
+                Data->CellCounts = (int *)realloc( Data->CellCounts,
+                                                   Data->CellCountsSize * sizeof(int));
+            }
+        }
+        Count = &Data->CellCounts[Thread * CellsNum];
+        Totals = &Data->CellCounts[ThreadsNum * CellsNum];
+        memset( Count, 0, CellsNum * sizeof(int));
+
+        /* The cells of the thread's points */
+        First = (int)((double)Set->Num * Thread / ThreadsNum);
+        Last = (int)((double)Set->Num * (Thread + 1) / ThreadsNum);
+        for ( j = First; j < Last; j++ )
+        {
+            Pos = (float *)((char *)Set->Pos + j * Set->Stride);
+            for ( d = 0; d < 3; d++ )
+            {
+                c[d] = 0;
+                if ( d >= Sim->Dimension )
+                    continue;
+                c[d] = GetCellIndex( Sim, Data, d, Pos[d]);
+                /* The point is on the border (rounding) */
+                if ( c[d] < 0 )
+                    c[d] = 0;
+                else if ( c[d] >= Data->CellsNum[d] )
+                    c[d] = Data->CellsNum[d] - 1;
+            }
+            Cell = (c[2] * Data->CellsNum[1] + c[1]) * Data->CellsNum[0] + c[0];
+            Data->PointKeys[j] = Cell;
+            Count[Cell]++;
+        }
+#pragma omp barrier
+
+        /* The offsets of the thread's part of the cells (from the first
+         * of them), the counts become the offsets within the cells */
+        FirstCell = (int)((double)CellsNum * Thread / ThreadsNum);
+        LastCell = (int)((double)CellsNum * (Thread + 1) / ThreadsNum);
+        Sum = 0;
+        for ( Cell = FirstCell; Cell < LastCell; Cell++ )
+        {
+            Data->CellStart[Cell] = Sum;
+            for ( t = 0; t < ThreadsNum; t++ )
+            {
+                n = Data->CellCounts[t * CellsNum + Cell];
+                Data->CellCounts[t * CellsNum + Cell] = Sum - Data->CellStart[Cell];
+                Sum += n;
+            }
+        }
+        Totals[Thread] = Sum;
+#pragma omp barrier
+
+#pragma omp single
+        {
+            /* The offsets of the parts of the cells */
+            for ( t = 0, Sum = 0; t < ThreadsNum; t++ )
+            {
+                n = Totals[t];
+                Totals[t] = Sum;
+                Sum += n;
+            }
+            Data->CellStart[CellsNum] = Sum;
+        }
+        for ( Cell = FirstCell; Cell < LastCell; Cell++ )
+            Data->CellStart[Cell] += Totals[Thread];
+#pragma omp barrier
+
+        /* Put the thread's points to their places */
+        for ( j = First; j < Last; j++ )
+        {
+            Cell = Data->PointKeys[j];
+            Data->CellPoints[Data->CellStart[Cell] + Count[Cell]++] = j;
+        }
+
+        if ( Set->Reorder )
+        {
+#pragma omp barrier
+            /* Permute the points */
+#pragma omp for
+            for ( k = 0; k < Set->Num; k++ )
+                memcpy( Data->SortBuf + k * Set->Stride,
+                        (char *)Set->Pos + Data->CellPoints[k] * Set->Stride,
+                        Set->Stride);
+#pragma omp for
+            for ( k = 0; k < Set->Num; k++ )
+            {
+                memcpy( (char *)Set->Pos + k * Set->Stride,
+                        Data->SortBuf + k * Set->Stride, Set->Stride);
+                Data->CellPoints[k] = k;
+            }
+        }
+    }
+
+    return;
+} /* SortGridPoints */
+
+/**
+ * Get the range <Begin> ... <End> - 1 of the sorted points of the cell
+ * <c> of the grid <Data>, the indices of the cell may be outside of 
+ * the grid by one cell. The range is empty if the cell is empty or
+ * outside of the grid.
+ */
+static void
+GetGridCellRange( struct Simulation *Sim,   /* Simulation */
+                  struct NeighbData *Data,  /* Data to search */
+                  int *c,                   /* Indices of the cell */
+                  int *Begin,               /* The first point */
+                  int *End)                 /* The last point + 1 */
+{
+    int n[3];
+    int Cell;
+    int d;
+
+    for ( d = 0; d < 3; d++ )
+    {
+        n[d] = c[d];
+        if ( Sim->Period[d] > 0.0f )
+        {
+            if ( n[d] < 0 )
+                n[d] += Data->CellsNum[d];
+            else if ( n[d] >= Data->CellsNum[d] )
+                n[d] -= Data->CellsNum[d];
+        }
+        else if ( n[d] < 0 || n[d] >= Data->CellsNum[d] )
+        {
+            *Begin = *End = 0;
+            return;
+        }
+    }
+
+    Cell = (n[2] * Data->CellsNum[1] + n[1]) * Data->CellsNum[0] + n[0];
+    *Begin = Data->CellStart[Cell];
+    *End = Data->CellStart[Cell + 1];
+
+    return;
+} /* GetGridCellRange */
+
+/**
+ * Find the candidates to the pairs of the particles <First> ...
+ * <Last> - 1 in the neighbouring cells of the grid.
+ */
+static void
+CollectByGrid( struct Simulation *Sim,   /* Simulation */
+               struct PointSet *Set,     /* Set of the points */
+               int First,                /* The first particle */
+               int Last,                 /* The last particle + 1 */
+               struct Candidates *Cands) /* Candidates */
+{
+    CollectInCells( Sim, Set, First, Last, Cands, GetCellIndex, NULL, GetGridCellRange);
+
+    return;
+} /* CollectByGrid */
+
+/**
+ * Find the candidates to the pairs of the particles <First> ...
+ * <Last> - 1 in the neighbouring cells, the cell of a particle is
+ * given by <GetIndex> and the points of a cell either by <GetHead>
+ * (the points are linked) or by <GetRange> (the points are sorted).
+ * The points closer than the radius are stored in <Cands> sorted 
+ * by j for every particle.
+ */
+static void
+CollectInCells( struct Simulation *Sim,     /* Simulation */
+                struct PointSet *Set,       /* Set of the points */
+                int First,                  /* The first particle */
+                int Last,                   /* The last particle + 1 */
+                struct Candidates *Cands,   /* Candidates */
+                GetCellIndexFunc GetIndex,  /* Cell of the coordinate */
+                GetCellHeadFunc GetHead,    /* The first point of the cell */
+                GetCellRangeFunc GetRange)  /* The sorted points of the cell */
+{
+    struct NeighbData *Data;
+    float Radius2;
+    int c[3], n[3];
+    int Lo[3], Hi[3];
+    int Begin, End;
+    int Num;
+    int i, j, k, l, d;
+    int x, y, z;
+
+    Data = Set->Data;
+    Radius2 = Set->Radius * Set->Radius;
+    Num = 0;
+    Cands->Start[0] = 0;
+
+    for ( i = First; i < Last; i++ )
+    {
+        for ( d = 0; d < 3; d++ )
+        {
+            c[d] = 0;
+            Lo[d] = Hi[d] = 0;
+            if ( d >= Sim->Dimension )
+                continue;
+            c[d] = GetIndex( Sim, Data, d, Sim->Particles[i].Pos[d]);
+            Lo[d] = -1;
+            Hi[d] = 1;
+        }
+
+        /* Search the neighbouring cells */
+        for ( z = Lo[2]; z <= Hi[2]; z++ )
+        for ( y = Lo[1]; y <= Hi[1]; y++ )
+        for ( x = Lo[0]; x <= Hi[0]; x++ )
+        {
+            n[0] = c[0] + x;
+            n[1] = c[1] + y;
+            n[2] = c[2] + z;
+            if ( GetRange != NULL )
+            {
+                GetRange( Sim, Data, n, &Begin, &End);
+                for ( k = Begin; k < End; k++ )
+                    AddCandidate( Sim, Set, i, Data->CellPoints[k], Radius2, Cands, &Num);
+            }
+            else
+            {
+                for ( j = GetHead( Sim, Data, n); j >= 0; j = Data->CellNext[j] )
+                    AddCandidate( Sim, Set, i, j, Radius2, Cands, &Num);
+            }
+        }
+
+        /* Sort the candidates of the particle (the cells are sorted,
+         * so the insertion sort merges a few sorted runs) */
+        for ( k = Cands->Start[i - First] + 1; k < Num; k++ )
+        {
+            j = Cands->j[k];
+            for ( l = k - 1; l >= Cands->Start[i - First] && Cands->j[l] > j; l-- )
+                Cands->j[l + 1] = Cands->j[l];
+            Cands->j[l + 1] = j;
+        }
+
+        Cands->Start[i - First + 1] = Num;
+    }
+
+    return;
+} /* CollectInCells */
+
+/**
+ * Store the point <j> of the set <Set> in <Cands> (<Num> candidates are 
+ * stored already) if it's closer to the particle <i> than the radius.
+ */
+static void
+AddCandidate( struct Simulation *Sim,     /* Simulation */
+              struct PointSet *Set,       /* Set of the points */
+              int i,                      /* The particle */
+              int j,                      /* The point */
+              float Radius2,              /* Squared radius */
+              struct Candidates *Cands,   /* Candidates */
+              int *Num)                   /* Number of the candidates */
+{
+    float *Posj;
+    float Rij[3];
+
+    if ( Set->Self && j == i )
+        return;
+    Posj = (float *)((char *)Set->Pos + j * Set->Stride);
+    VectorSubstraction( Sim->Dimension, Rij, Sim->Particles[i].Pos, Posj);
+    if ( Sim->PeriodicDomain )
+        GetMinimumImage( Sim, Rij);
+    if ( !(VectorInnerproduct( Sim->Dimension, Rij, Rij) <= Radius2) )
+        return;
+    if ( *Num == Cands->Size )
+    {
+        Cands->Size = 2 * Cands->Size + 512;
+        Cands->j = (int *)realloc( Cands->j, Cands->Size * sizeof(int));
+    }
+    Cands->j[(*Num)++] = j;
+
+    return;
+} /* AddCandidate */
+
+/**********************************************************/
+
+/*****************************************************************
+ * Search using the spatial hash                                 *
+ * The cells are the ones of the unbounded uniform grid, but     *
+ * only the occupied cells are stored - in the open addressing   *
+ * hash table keyed by the integer coordinates of the cell. The  *
+ * size of the table depends on the number of the points only,   *
+ * so the memory doesn't depend on the extent of the domain and  *
+ * the cells needn't be enlarged if the points are scattered.    *
+ * The cells are fixed in space, so the hash is kept between the *
+ * steps - the integration reports the particles which cross the *
+ * borders of the cells, and only they are moved in the hash.    *
+ *****************************************************************/
+
+/**
+ * Store the point <i> of the search <Data> if its position <Pos> has
+ * left the cell it has in the spatial hash (several threads may store
+ * the points at once, every thread stores them in its own list). 
+ * Nothing is stored if the hash isn't kept or if the point isn't in 
+ * it yet. The thread which has no list (the team has grown since the
+ * lists were made) drops the hash, it's rebuilt by the next search.
+ */
+static void
+UpdatePointCell( struct Simulation *Sim,   /* Simulation */
+                 struct NeighbData *Data,  /* Data to search */
+                 int i,                    /* The point */
+                 float *Pos)               /* Its position */
+{
+    struct MovedPoints *List;
+    int Thread;
+    int c[3];
+    int d;
+
+    if ( !Data->HashValid || i >= Data->HashNum )
+        return;
+
+    for ( d = 0; d < 3; d++ )
+    {
+        c[d] = 0;
+        if ( d < Sim->Dimension )
+            c[d] = GetHashCellIndex( Sim, Data, d, Pos[d]);
+    }
+    if ( memcmp( c, &Data->PointCells[3 * i], sizeof(c)) == 0 )
+        return;
+
+    Thread = omp_get_thread_num();
+    if ( Thread >= Data->MovedListsNum )
+    {
+        Data->HashValid = 0;
+        return;
+    }
+    List = &Data->MovedLists[Thread];
+    if ( List->Num == List->Size )
+    {
+        List->Size = 2 * List->Size + 64;
+        List->Points = (int *)realloc( List->Points, List->Size * sizeof(int));
+    }
+    List->Points[List->Num++] = i;
+
+    return;
+} /* UpdatePointCell */
+
+/**
+ * Get the index of the cell along the axis <d> of the hash <Data>
+ * containing the coordinate <x>. Along a periodic axis the index is
+ * wrapped as in the grid, otherwise the cells are unbounded (the 
+ * index is only clamped to +-NEIGHB_HASH_LIMIT).
+ */
+static int
+GetHashCellIndex( struct Simulation *Sim,   /* Simulation */
+                  struct NeighbData *Data,  /* Data to search */
+                  int d,                    /* Axis */
+                  float x)                  /* Coordinate */
+{
+    float c;
+
+    if ( Sim->Period[d] > 0.0f )
+        return GetCellIndex( Sim, Data, d, x);
+
+    /* The coordinate isn't finite is treated as being far away */
+    c = (float)floor( (x - Data->Origin[d]) / Data->CellSize[d]);
+    if ( !(c >= -NEIGHB_HASH_LIMIT) )
+        return -(int)NEIGHB_HASH_LIMIT;
+    if ( c > NEIGHB_HASH_LIMIT )
+        return (int)NEIGHB_HASH_LIMIT;
+    return (int)c;
+} /* GetHashCellIndex */
+
+/**
+ * Find the slot of the cell <c> in the hash <Data> - either the slot
+ * containing the cell or the free slot where the cell would be stored.
+ */
+static int
+FindHashSlot( struct NeighbData *Data,   /* Data to search */
+              int *c)                    /* Indices of the cell */
+{
+    unsigned int Key;
+    int *Cell;
+    int Slot;
+
+    Key = (unsigned int)c[0] * 73856093u ^
+          (unsigned int)c[1] * 19349663u ^
+          (unsigned int)c[2] * 83492791u;
+    Slot = (int)(Key & (unsigned int)(Data->HashSize - 1));
+
+    /* Linear probing (the table is at most half full) */
+    for ( ; ; Slot = (Slot + 1) & (Data->HashSize - 1) )
+    {
+        Cell = &Data->HashCells[3 * Slot];
+        if ( Cell[0] == NEIGHB_HASH_FREE )
+            return Slot;
+        if ( Cell[0] == c[0] && Cell[1] == c[1] && Cell[2] == c[2] )
+            return Slot;
+    }
+} /* FindHashSlot */
+
+/**
+ * Get the first point of the cell <c> of the hash <Data>, the indices
+ * along periodic axes may be outside of the periodic box by one cell.
+ * The function returns -1 if the cell is empty.
+ */
+static int
+GetHashCellHead( struct Simulation *Sim,   /* Simulation */
+                 struct NeighbData *Data,  /* Data to search */
+                 int *c)                   /* Indices of the cell */
+{
+    int n[3];
+    int d;
+
+    for ( d = 0; d < 3; d++ )
+    {
+        n[d] = c[d];
+        if ( Sim->Period[d] > 0.0f )
+        {
+            if ( n[d] < 0 )
+                n[d] += Data->CellsNum[d];
+            else if ( n[d] >= Data->CellsNum[d] )
+                n[d] -= Data->CellsNum[d];
+        }
+    }
+
+    return Data->CellHead[FindHashSlot( Data, n)];
+} /* GetHashCellHead */
+
+/**
+ * Link the points of the set <Set> into the cells of the hash. The
+ * hash of the previous step is updated if it's still valid (the cells
+ * aren't smaller than the radius and not too large) - only the points
+ * which have changed their cells since then are moved, the points 
+ * removed from the end of the set are unlinked and the points added
+ * to its end are linked. The function returns -1 if the hash can't be
+ * used (a periodic axis is shorter than three cells) and 0 otherwise.
+ */
+static int
+PrepareHash( struct Simulation *Sim,   /* Simulation */
+             struct PointSet *Set)     /* Set of the points */
+{
+    struct NeighbData *Data;
+    struct MovedPoints *List;
+    int MovedNum;
+    int Slot;
+    int Added;
+    int j, k, t, d;
+
+    Data = Set->Data;
+    Added = ( Set->Num > Data->HashNum ) ? Set->Num - Data->HashNum : 0;
+    MovedNum = 0;
+    for ( t = 0; t < Data->MovedListsNum; t++ )
+        MovedNum += Data->MovedLists[t].Num;
+
+    if ( Data->HashValid &&
+         2 * (Data->HashUsed + MovedNum + Added) <= Data->HashSize )
+    {
+        for ( d = 0; d < Sim->Dimension; d++ )
+        {
+            if ( Set->Radius > Data->CellSize[d] ||
+                 2.0f * Set->Radius < Data->CellSize[d] )
+                break;
+        }
+
+        if ( d == Sim->Dimension )
+        {
+            /* Unlink the removed points */
+            for ( j = Data->HashNum - 1; j >= Set->Num; j-- )
+                UnlinkHashPoint( Data, j);
+
+            /* Move the points which have changed their cells, the lists
+             * of the threads go one after another (a point may be stored
+             * several times, it's linked into the cell of its position) */
+            for ( t = 0; t < Data->MovedListsNum; t++ )
+            {
+                List = &Data->MovedLists[t];
+                for ( k = 0; k < List->Num; k++ )
+                {
+                    j = List->Points[k];
+                    if ( j >= Set->Num )
+                        continue;
+                    UnlinkHashPoint( Data, j);
+                    SetHashPointCell( Sim, Set, j);
+                    LinkHashPoint( Data, j);
+                }
+                List->Num = 0;
+            }
+
+            /* Link the added points */
+            if ( Added > 0 )
+            {
+                ReserveHashPoints( Data, Set->Num);
+                for ( j = Data->HashNum; j < Set->Num; j++ )
+                {
+                    SetHashPointCell( Sim, Set, j);
+                    LinkHashPoint( Data, j);
+                }
+            }
+            Data->HashNum = Set->Num;
+            return 0;
+        }
+    }
+    Data->HashValid = 0;
+    for ( t = 0; t < Data->MovedListsNum; t++ )
+        Data->MovedLists[t].Num = 0;
+
+    /* The cells are not smaller than the radius, 
+     * periodic axes are covered by them exactly */
+    for ( d = 0; d < 3; d++ )
+    {
+        Data->CellSize[d] = Set->Radius;
+        Data->Origin[d] = 0.0f;
+        Data->CellsNum[d] = 0;
+        if ( d >= Sim->Dimension || Sim->Period[d] == 0.0f )
+            continue;
+        Data->CellsNum[d] = (int)floor( Sim->Period[d] / Set->Radius);
+        if ( Data->CellsNum[d] < 3 )
+            return -1;
+        Data->CellSize[d] = Sim->Period[d] / (float)Data->CellsNum[d];
+        Data->Origin[d] = Sim->Periodic[d][0];
+    }
+
+    /* The table is at least twice as large as the number of the points */
+    Data->HashSize = NEIGHB_HASH_MIN_SIZE;
+    while ( Data->HashSize < 2 * Set->Num )
+        Data->HashSize *= 2;
+
+    /* Allocate memory for the hash */
+    if ( Data->CellHeadSize < Data->HashSize )
+    {
+        Data->CellHeadSize = Data->HashSize;
+        Data->CellHead = (int *)realloc( Data->CellHead,
+                                         Data->CellHeadSize * sizeof(int));
+    }
+    if ( Data->HashCellsSize < Data->HashSize )
+    {
+        Data->HashCellsSize = Data->HashSize;
+        Data->HashCells = (int *)realloc( Data->HashCells,
+                                          3 * Data->HashCellsSize * sizeof(int));
+    }
+    ReserveHashPoints( Data, Set->Num);
+
+    /* Link the points into the cells, the points are linked from the
+     * last one, so the points of every cell are sorted */
+    for ( Slot = 0; Slot < Data->HashSize; Slot++ )
+    {
+        Data->CellHead[Slot] = -1;
+        Data->HashCells[3 * Slot] = NEIGHB_HASH_FREE;
+    }
+    Data->HashUsed = 0;
+    for ( j = Set->Num - 1; j >= 0; j-- )
+    {
+        SetHashPointCell( Sim, Set, j);
+        LinkHashPoint( Data, j);
+    }
+    Data->HashNum = Set->Num;
+    Data->HashValid = 1;
+
+    /* The lists of the moved points for every thread of the teams
+     * which will integrate the points */
+    t = omp_get_max_threads();
+    if ( Data->MovedListsNum < t )
+    {
+        Data->MovedLists = (struct MovedPoints *)
+                           realloc( Data->MovedLists, t * sizeof(struct MovedPoints));
+        memset( &Data->MovedLists[Data->MovedListsNum], 0, 
+                (t - Data->MovedListsNum) * sizeof(struct MovedPoints));
+        Data->MovedListsNum = t;
+    }
+
+    return 0;
+} /* PrepareHash */
+
+/**
+ * Allocate the memory for the links and the cells of <Num> points of
+ * the hash <Data> (the memory of the linked points is kept).
+ */
+static void
+ReserveHashPoints( struct NeighbData *Data,   /* Data to search */
+                   int Num)                   /* Number of the points */
+{
+    if ( Data->CellNextSize < Num )
+    {
+        Data->CellNextSize = Num;
+        Data->CellNext = (int *)realloc( Data->CellNext,
+                                         Data->CellNextSize * sizeof(int));
+    }
+    if ( Data->PointCellsSize < Num )
+    {
+        Data->PointCellsSize = Num;
+        Data->PointCells = (int *)realloc( Data->PointCells,
+                                           3 * Data->PointCellsSize * sizeof(int));
+    }
+
+    return;
+} /* ReserveHashPoints */
+
+/**
+ * Set the cell of the point <j> of the set <Set> in the hash to the
+ * cell containing its position (the point isn't linked into it).
+ */
+static void
+SetHashPointCell( struct Simulation *Sim,   /* Simulation */
+                  struct PointSet *Set,     /* Set of the points */
+                  int j)                    /* The point */
+{
+    float *Pos;
+    int *c;
+    int d;
+
+    Pos = (float *)((char *)Set->Pos + j * Set->Stride);
+    c = &Set->Data->PointCells[3 * j];
+    for ( d = 0; d < 3; d++ )
+    {
+        c[d] = 0;
+        if ( d < Sim->Dimension )
+            c[d] = GetHashCellIndex( Sim, Set->Data, d, Pos[d]);
+    }
+
+    return;
+} /* SetHashPointCell */
+
+/**
+ * Link the point <j> into its cell of the hash <Data>, the cell is
+ * added to the table if it isn't there, the points of the cell are
+ * kept sorted.
+ */
+static void
+LinkHashPoint( struct NeighbData *Data,   /* Data to search */
+               int j)                     /* The point */
+{
+    int *Link;
+    int Slot;
+
+    Slot = FindHashSlot( Data, &Data->PointCells[3 * j]);
+    if ( Data->HashCells[3 * Slot] == NEIGHB_HASH_FREE )
+    {
+        memcpy( &Data->HashCells[3 * Slot], &Data->PointCells[3 * j], 3 * sizeof(int));
+        Data->HashUsed++;
+    }
+
+    Link = &Data->CellHead[Slot];
+    while ( *Link >= 0 && *Link < j )
+        Link = &Data->CellNext[*Link];
+    Data->CellNext[j] = *Link;
+    *Link = j;
+
+    return;
+} /* LinkHashPoint */
+
+/**
+ * Unlink the point <j> from its cell of the hash <Data> (the cell
+ * stays in the table even if it gets empty).
+ */
+static void
+UnlinkHashPoint( struct NeighbData *Data,   /* Data to search */
+                 int j)                     /* The point */
+{
+    int *Link;
+
+    Link = &Data->CellHead[FindHashSlot( Data, &Data->PointCells[3 * j])];
+    while ( *Link != j )
+        Link = &Data->CellNext[*Link];
+    *Link = Data->CellNext[j];
+
+    return;
+} /* UnlinkHashPoint */
+
+/**
+ * Find the candidates to the pairs of the particles <First> ...
+ * <Last> - 1 in the neighbouring cells of the hash.
+ */
+static void
+CollectByHash( struct Simulation *Sim,   /* Simulation */
+               struct PointSet *Set,     /* Set of the points */
+               int First,                /* The first particle */
+               int Last,                 /* The last particle + 1 */
+               struct Candidates *Cands) /* Candidates */
+{
+    CollectInCells( Sim, Set, First, Last, Cands, GetHashCellIndex, GetHashCellHead, NULL);
+
+    return;
+} /* CollectByHash */
@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_NEIGHB_H
+#define YAPS_NEIGHB_H
+
+/**********************************************************/
+
+#include <stddef.h>
+
+struct Simulation;
+struct NeighbData;
+
+/* Initialize the neighbour search */
+extern int  InitNeighbSearch( struct Simulation *Sim);
+
+/* Find the pairs of the neighbouring particles */
+extern void FindNeighbPairs ( struct Simulation *Sim);
+
+/* Find the pairs again after their padding has grown */
+extern void RefindNeighbPairs( struct Simulation *Sim);
+
+/* Update the cell of the particle after it has moved */
+extern void UpdateNeighbCell( struct Simulation *Sim, int i);
+
+/* Update the cell of the boundary particle after it has moved */
+extern void UpdateBoundaryCell( struct Simulation *Sim, int i);
+
+/* Sort the points by the cells of the grid */
+extern int  PreparePointsGrid( struct Simulation *Sim,
+                               struct NeighbData *Data,
+                               float *Pos, size_t Stride,
+                               int Num, float Radius);
+
+/* Find the points of the grid near the box */
+extern int  FindPointsNearBox( struct Simulation *Sim,
+                               struct NeighbData *Data,
+                               float *Min, float *Max,
+                               int **Found, int *FoundSize);
+
+/* Free the memory allocated for the pairs */
+extern void FreeNeighbPairs ( struct Simulation *Sim);
+
+/* Free the data to search */
+extern void FreeNeighbData  ( struct NeighbData *Data);
+
+/**********************************************************/
+
+#endif /* YAPS_NEIGHB_H */
@@ -0,0 +1,483 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+/*****************************************************************
+ * Adaptive refinement of the particles                          *
+ * A particle is split into two children of half the mass along  *
+ * one of the axes (the axes alternate, so D splits give the     *
+ * lattice with the half distance), the children are placed at   *
+ * the centres of the halves of the particle's cell. Two close   *
+ * refined particles of the same mass are merged back into one   *
+ * where the refinement isn't needed any more. Both operations   *
+ * conserve the mass and the momentum of the particles. The     *
+ * time step has to be stable for the particles of the finest    *
+ * level (their smoothing lengths are the smallest).             *
+ * See also: R.Vacondio et al., Variable resolution for SPH: a   *
+ * dynamic particle coalescing and splitting scheme, Comput.     *
+ * Methods Appl.Mech.Engrg., 256, 132-148, 2013.                 *
+ *****************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "vector.h"
+#include "calc.h"
+#include "neighb.h"
+#include "refine.h"
+#include "distfield.h"
+
+/**********************************************************/
+
+/* What to do with the particle */
+enum RefineActions
+{
+    REFINE_KEEP,     /* The particle is kept as it is         */
+    REFINE_SPLIT,    /* The particle is split into two        */
+    REFINE_MERGE,    /* The particle is merged with another   */
+};
+
+/* The particle is merged if it's this times farther from
+ * the criteria of the refinement (so the particles don't
+ * split and merge at every step near the criteria) */
+#define REFINE_HYSTERESIS       1.5f
+
+/* Maximum relative difference of the masses of merged particles */
+#define REFINE_MASS_TOLERANCE   0.01f
+
+/* The second child of a split (the children get their identifiers
+ * in the order of the identifiers of the split particles) */
+struct RefineChild
+{
+    int Id;          /* Identifier of the split particle */
+    int Index;       /* Index of the child */
+};
+
+/**********************************************************/
+
+/* Choose what to do with every particle */
+static void  FlagParticles      ( struct Simulation *Sim);
+
+/* Merge the pairs of the particles flagged to merge */
+static int   MergeParticles     ( struct Simulation *Sim);
+
+/* Split the particles flagged to split and remove the merged ones */
+static void  SplitParticles     ( struct Simulation *Sim,
+                                  int SplitsNum);
+
+/* Wrap the position around periodic boundaries */
+static void  WrapPosition       ( struct Simulation *Sim,
+                                  float *Pos);
+
+/* Compare the children by the split particles (for qsort) */
+static int   CompareChildren    ( const void *Child1, const void *Child2);
+
+/**********************************************************/
+
+/**
+ * Split and merge the particles according to the refinement criteria.
+ * The criteria are evaluated over the pairs of the last step, so the
+ * function is called before the pairs are searched for again.
+ */
+void
+RefineParticles( struct Simulation *Sim)   /* Simulation */
+{
+    int SplitsNum, MergesNum;
+    int i;
+
+    /* There are no pairs before the first step */
+    if ( Sim->StepsNumber == 0 || Sim->PairsStart == NULL )
+        return;
+
+    if ( Sim->RefineFlagsSize < Sim->ParticlesNumber )
+    {
+        Sim->RefineFlagsSize = Sim->ParticlesNumber;
+        Sim->RefineFlags = (int *)realloc( Sim->RefineFlags,
+                                           Sim->RefineFlagsSize * sizeof(int));
+    }
+
+    FlagParticles( Sim);
+    MergesNum = MergeParticles( Sim);
+
+    SplitsNum = 0;
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        if ( Sim->RefineFlags[i] == REFINE_SPLIT )
+            SplitsNum++;
+
+    if ( SplitsNum == 0 && MergesNum == 0 )
+        return;
+
+    SplitParticles( Sim, SplitsNum);
+
+    /* The largest smoothing length sets the radius of the search */
+    Sim->MaxSmoothR = 0.0f;
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        if ( Sim->Particles[i].SmoothR > Sim->MaxSmoothR )
+            Sim->MaxSmoothR = Sim->Particles[i].SmoothR;
+
+    return;
+} /* RefineParticles */
+
+/**********************************************************/
+
+/**
+ * Free the memory allocated for the refinement.
+ */
+void
+FreeRefine( struct Simulation *Sim)   /* Simulation */
+{
+    free( Sim->RefineFlags);
+    Sim->RefineFlags = NULL;
+    Sim->RefineFlagsSize = 0;
+
+    return;
+} /* FreeRefine */
+
+/**
+ * Get the number of the splits the particle of the mass <Mass>
+ * comes from (every split halves the mass).
+ */
+int
+GetSplitsNumber( struct Simulation *Sim,   /* Simulation */
+                 float Mass)               /* Mass of the particle */
+{
+    int Splits;
+
+    Splits = 0;
+    while ( Mass < 0.75f * Sim->ParticleMass )
+    {
+        Mass *= 2.0f;
+        Splits++;
+    }
+
+    return Splits;
+} /* GetSplitsNumber */
+
+/**********************************************************/
+
+/**
+ * Choose what to do with every particle. The particle is split if
+ * it's closer to the boundary than RefineDist or the norm of its
+ * velocity gradient is larger than RefineVelGrad, unless it has
+ * reached the finest level. The refined particle is merged if it's
+ * far enough from both criteria.
+ */
+static void
+FlagParticles( struct Simulation *Sim)   /* Simulation */
+{
+    struct Particle *Particles;
+    struct NeighbPair *Pair;
+    float VelGrad[3][3];
+    float MinMass;
+    float MinDist2;
+    float Grad2;
+    float Vij[3];
+    float Normal[3];
+    float tmp;
+    int   Dimension;
+    int   Near, Far;
+    int   i, j, k, a, b;
+
+    Particles = Sim->Particles;
+    Dimension = Sim->Dimension;
+
+    /* The mass of the particles of the finest level */
+    MinMass = Sim->ParticleMass * pow( 0.5, Dimension * Sim->RefineLevels);
+
+#pragma omp parallel for schedule(dynamic,50) private(Pair,VelGrad,MinDist2,Grad2,Vij,Normal,tmp,Near,Far,j,k,a,b)
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        /* Distance to the nearest boundary particle (or to the
+         * obstacles if the boundary is the distance field) */
+        MinDist2 = -1.0f;
+        for ( k = Sim->BPairsStart[i]; k < Sim->BPairsStart[i + 1]; k++ )
+        {
+            tmp = VectorInnerproduct( Dimension, Sim->BPairs[k].Rij, Sim->BPairs[k].Rij);
+            if ( MinDist2 < 0.0f || tmp < MinDist2 )
+                MinDist2 = tmp;
+        }
+        if ( Sim->DistField.Nodes != NULL )
+        {
+            tmp = GetObstacleDist( Sim, Particles[i].Pos, Normal);
+            if ( tmp < Sim->DistField.Band )
+                MinDist2 = tmp * tmp;
+        }
+
+        /* Velocity gradient - sum of m_j / ro_j * (v_j - v_i) x grad W */
+        memset( VelGrad, 0, sizeof(VelGrad));
+        for ( k = Sim->PairsStart[i]; k < Sim->PairsStart[i + 1]; k++ )
+        {
+            Pair = &Sim->Pairs[k];
+            j = Pair->j;
+            VectorSubstraction( Dimension, Vij, Particles[j].Vel, Particles[i].Vel);
+            tmp = Particles[j].Mass / Particles[j].Dens * Pair->GradFactor;
+            for ( a = 0; a < Dimension; a++ )
+                for ( b = 0; b < Dimension; b++ )
+                    VelGrad[a][b] += tmp * Vij[a] * Pair->Rij[b];
+        }
+        Grad2 = 0.0f;
+        for ( a = 0; a < Dimension; a++ )
+            for ( b = 0; b < Dimension; b++ )
+                Grad2 += VelGrad[a][b] * VelGrad[a][b];
+
+        Near = 0;
+        Far = 1;
+        if ( Sim->RefineDist > 0.0f && MinDist2 >= 0.0f )
+        {
+            tmp = Sim->RefineDist * Sim->RefineDist;
+            Near |= ( MinDist2 < tmp );
+            Far &= ( MinDist2 > REFINE_HYSTERESIS * REFINE_HYSTERESIS * tmp );
+        }
+        if ( Sim->RefineVelGrad > 0.0f )
+        {
+            tmp = Sim->RefineVelGrad * Sim->RefineVelGrad;
+            Near |= ( Grad2 > tmp );
+            Far &= ( Grad2 * REFINE_HYSTERESIS * REFINE_HYSTERESIS < tmp );
+        }
+
+        if ( Near && Particles[i].Mass > 1.5f * MinMass )
+            Sim->RefineFlags[i] = REFINE_SPLIT;
+        else if ( !Near && Far && Particles[i].Mass < 0.75f * Sim->ParticleMass )
+            Sim->RefineFlags[i] = REFINE_MERGE;
+        else
+            Sim->RefineFlags[i] = REFINE_KEEP;
+    }
+
+    return;
+} /* FlagParticles */
+
+/**********************************************************/
+
+/**
+ * Merge the pairs of the particles flagged to merge - every such
+ * particle is merged with the nearest of its neighbours which has
+ * the same mass, is flagged to merge too and lies within the double
+ * distance between the particles of its level. The merged particle
+ * takes the place of the first one, the second one gets zero mass
+ * and is removed later. The function returns the number of merges.
+ */
+static int
+MergeParticles( struct Simulation *Sim)   /* Simulation */
+{
+    struct Particle *Particles;
+    struct Particle *Pi, *Pj;
+    float Rij[3];
+    float Dist2, MinDist2;
+    float Distrib;
+    float Mass, wi, wj;
+    int   Dimension;
+    int   MergesNum;
+    int   i, j, k, d, n;
+
+    Particles = Sim->Particles;
+    Dimension = Sim->Dimension;
+    MergesNum = 0;
+
+    /* The pairs are chosen one by one, so it's done serially */
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        if ( Sim->RefineFlags[i] != REFINE_MERGE )
+            continue;
+        Pi = &Particles[i];
+
+        /* The distance between the particles of the level */
+        Distrib = Sim->ParticlesDistrib *
+                  pow( Pi->Mass / Sim->ParticleMass, 1.0f / Dimension);
+
+        /* The nearest partner (the pairs are of the last step) */
+        n = -1;
+        MinDist2 = 4.0f * Distrib * Distrib;
+        for ( k = Sim->PairsStart[i]; k < Sim->PairsStart[i + 1]; k++ )
+        {
+            j = Sim->Pairs[k].j;
+            if ( Sim->RefineFlags[j] != REFINE_MERGE ||
+                 fabs( Particles[j].Mass - Pi->Mass) > REFINE_MASS_TOLERANCE * Pi->Mass )
+                continue;
+            VectorSubstraction( Dimension, Rij, Pi->Pos, Particles[j].Pos);
+            GetMinimumImage( Sim, Rij);
+            Dist2 = VectorInnerproduct( Dimension, Rij, Rij);
+            if ( Dist2 < MinDist2 )
+            {
+                MinDist2 = Dist2;
+                n = j;
+            }
+        }
+        if ( n < 0 )
+            continue;
+        Pj = &Particles[n];
+
+        /* Mass-weighted averages conserve the mass and the momentum */
+        VectorSubstraction( Dimension, Rij, Pi->Pos, Pj->Pos);
+        GetMinimumImage( Sim, Rij);
+        Mass = Pi->Mass + Pj->Mass;
+        wi = Pi->Mass / Mass;
+        wj = Pj->Mass / Mass;
+        for ( d = 0; d < Dimension; d++ )
+        {
+            Pi->Pos[d] -= wj * Rij[d];
+            Pi->Vel[d] = wi * Pi->Vel[d] + wj * Pj->Vel[d];
+#ifndef LEAN_PARTICLES
+            Pi->IvalVel[d] = wi * Pi->IvalVel[d] + wj * Pj->IvalVel[d];
+#endif
+            Pi->Accel[d] = wi * Pi->Accel[d] + wj * Pj->Accel[d];
+        }
+        WrapPosition( Sim, Pi->Pos);
+        UpdateNeighbCell( Sim, i);
+        Pi->Dens = wi * Pi->Dens + wj * Pj->Dens;
+#ifndef LEAN_PARTICLES
+        Pi->IvalDens = wi * Pi->IvalDens + wj * Pj->IvalDens;
+#endif
+        Pi->DervDens = wi * Pi->DervDens + wj * Pj->DervDens;
+        Pi->Press = wi * Pi->Press + wj * Pj->Press;
+        Pi->SmoothR = (wi * Pi->SmoothR + wj * Pj->SmoothR) *
+                      pow( 2.0f, 1.0f / Dimension);
+        Pi->Mass = Mass;
+        Pj->Mass = 0.0f;
+
+        Sim->RefineFlags[i] = REFINE_KEEP;
+        Sim->RefineFlags[n] = REFINE_KEEP;
+        MergesNum++;
+    }
+
+    return MergesNum;
+} /* MergeParticles */
+
+/**********************************************************/
+
+/**
+ * Split the particles flagged to split and remove the particles
+ * merged into others (they have zero mass). The particle is split
+ * into two children along the axis next to the one of its last
+ * split, the children have the half of its mass and the same
+ * velocity and density, and they are placed at the quarters of
+ * the particle's cell along the axis. The first child keeps the
+ * place and the identifier of the particle, the second ones are
+ * added to the end of the array and get the next free identifiers
+ * in the order of the split particles' identifiers, so they don't
+ * depend on the order of the particles in memory. The place of a
+ * removed particle is taken by the last one. The array grows by a
+ * half when it's full, and the neighbour search is told about the
+ * changed particles only.
+ */
+static void
+SplitParticles( struct Simulation *Sim,   /* Simulation */
+                int SplitsNum)            /* Number of the splits */
+{
+    struct Particle *Particles;
+    struct Particle *Child;
+    struct RefineChild *Children;
+    float Offset;
+    int   Dimension;
+    int   Splits;
+    int   Axis;
+    int   i, k, n;
+
+    Dimension = Sim->Dimension;
+    n = Sim->ParticlesNumber;
+    if ( Sim->ParticlesSize < n + SplitsNum )
+    {
+        Sim->ParticlesSize = n + SplitsNum + (n + SplitsNum) / 2;
+        Sim->Particles = (struct Particle *)
+                         realloc( Sim->Particles, Sim->ParticlesSize * sizeof(struct Particle));
+    }
+    Particles = Sim->Particles;
+    Children = (struct RefineChild *)
+               malloc( ((SplitsNum > 0) ? SplitsNum : 1) * sizeof(struct RefineChild));
+
+    k = 0;
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        if ( Sim->RefineFlags[i] != REFINE_SPLIT )
+            continue;
+
+        /* The axes alternate, and the size of the particle's cell
+         * along the axis is halved by every split along it */
+        Splits = GetSplitsNumber( Sim, Particles[i].Mass);
+        Axis = Splits % Dimension;
+        Offset = 0.25f * Sim->ParticlesDistrib /
+                 (float)(1 << ((Splits + Dimension - 1 - Axis) / Dimension));
+
+        Particles[i].Mass *= 0.5f;
+        Particles[i].SmoothR *= pow( 0.5f, 1.0f / Dimension);
+        Particles[n] = Particles[i];
+        Child = &Particles[i];
+        Child->Pos[Axis] -= Offset;
+        WrapPosition( Sim, Child->Pos);
+        UpdateNeighbCell( Sim, i);
+        Child = &Particles[n];
+        Child->Pos[Axis] += Offset;
+        WrapPosition( Sim, Child->Pos);
+        Children[k].Id = Child->Id;
+        Children[k].Index = n;
+        k++;
+        n++;
+    }
+
+    /* Number the second children */
+    qsort( Children, k, sizeof(struct RefineChild), CompareChildren);
+    for ( i = 0; i < k; i++ )
+        Particles[Children[i].Index].Id = Sim->NextParticleId++;
+    free( Children);
+
+    /* Remove the merged particles */
+    for ( i = 0; i < n; i++ )
+    {
+        if ( Particles[i].Mass != 0.0f )
+            continue;
+        do
+            n--;
+        while ( n > i && Particles[n].Mass == 0.0f );
+        if ( n > i )
+        {
+            Particles[i] = Particles[n];
+            UpdateNeighbCell( Sim, i);
+        }
+    }
+    Sim->ParticlesNumber = n;
+
+    return;
+} /* SplitParticles */
+
+/**********************************************************/
+
+/**
+ * Wrap the position <Pos> around periodic boundaries.
+ */
+static void
+WrapPosition( struct Simulation *Sim,   /* Simulation */
+              float *Pos)               /* Position */
+{
+    int d;
+
+    for ( d = 0; d < Sim->Dimension; d++ )
+    {
+        if ( Sim->Period[d] == 0.0f )
+            continue;
+        if ( Pos[d] < Sim->Periodic[d][0] )
+            Pos[d] += Sim->Period[d];
+        else if ( Pos[d] >= Sim->Periodic[d][1] )
+            Pos[d] -= Sim->Period[d];
+    }
+
+    return;
+} /* WrapPosition */
+
+/**
+ * Compare the children <Child1> and <Child2> by the identifiers of
+ * the split particles (for qsort).
+ */
+static int
+CompareChildren( const void *Child1,   /* The first child */
+                 const void *Child2)   /* The second child */
+{
+    int Id1, Id2;
+
+    Id1 = ((const struct RefineChild *)Child1)->Id;
+    Id2 = ((const struct RefineChild *)Child2)->Id;
+
+    return ( Id1 > Id2 ) - ( Id1 < Id2 );
+} /* CompareChildren */
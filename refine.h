@@ -0,0 +1,26 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_REFINE_H
+#define YAPS_REFINE_H
+
+/**********************************************************/
+
+struct Simulation;
+
+/* Split and merge the particles according to the refinement criteria */
+extern void RefineParticles( struct Simulation *Sim);
+
+/* Free the memory allocated for the refinement */
+extern void FreeRefine     ( struct Simulation *Sim);
+
+/* Get the number of the splits the particle comes from */
+extern int  GetSplitsNumber( struct Simulation *Sim, float Mass);
+
+/**********************************************************/
+
+#endif /* YAPS_REFINE_H */
@@ -5,12 +5,22 @@
  * $Id$
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <process.h>
+#endif
 #include "opengl.h"
 #include "common.h"
 #include "calc.h"
-#include "vector.h"
+#include "motion.h"
+#include "yaps.h"
 #include "render.h"
 
 /**********************************************************/
@@ -21,11 +31,51 @@
 /* The number of display list to draw the help */
 #define HELP_LIST         2
 
+/* The number of the first display list to draw the moving bodies */
+#define BODIES_LIST       3
+
+/* The size (texels) of the texture of the sphere drawn on the sprites */
+#define SPRITE_SIZE       32
+
+/* The interval (ms) between the checks for a new snapshot to draw */
+#define FRAME_INTERVAL    15
+
+/* The interval (ms) the paused solver sleeps for */
+#define PAUSE_INTERVAL    20
+
+/* The flag of the snapshot which hasn't been drawn yet */
+#define SNAPSHOT_FRESH    4
+
+/* Atomic exchange of the value of the variable (with a full memory
+ * barrier), and a sleep of the thread */
+#ifndef _WIN32
+#define EXCHANGE(Var, Value)    (__sync_synchronize(), \
+                                 __sync_lock_test_and_set( &(Var), (Value)))
+#define SLEEP(Ms)               usleep( (Ms) * 1000)
+#else
+#define EXCHANGE(Var, Value)    InterlockedExchange( &(Var), (Value))
+#define SLEEP(Ms)               Sleep( Ms)
+#endif
+
+/* Point sprites (OpenGL 2.0 or ARB_point_sprite) */
+#ifndef GL_POINT_SPRITE
+#define GL_POINT_SPRITE   0x8861
+#endif
+#ifndef GL_COORD_REPLACE
+#define GL_COORD_REPLACE  0x8862
+#endif
+
 /**********************************************************/
 
 /* RGB color to draw the smoothing particles */
 static float ParticleColor[3]     = { 0.0f, 0.4f, 0.6f };
 
+/* Radius of the spheres of the smoothing particles */
+static float ParticleRadius       = 3.5f;
+
+/* Direction of the light shading the spheres of the particles */
+static float SpriteLight[3]       = { -0.4f, 0.4f, 0.82f };
+
 /* RGB color to draw the boundary particles */
 static float BParticleColor[3]    = { 0.9f, 0.9f, 0.9f };
 
@@ -44,14 +94,66 @@ static float TriangleFillColor[4] = { 0.6f, 0.6f, 0.6f, 0.8f };
 /* RGB color to draw the help */
 static float HelpColor[3]         = { 0.0f, 0.2f, 0.3f };
 
+/* The state of the simulation drawn by the renderer - the positions
+ * of the particles and the matrices of the poses of the moving bodies
+ * after the step StepsNumber */
+struct Snapshot
+{
+    float (*Pos)[3];
+    int   PosSize;
+    int   ParticlesNumber;
+    float (*Poses)[16];
+    int   StepsNumber;
+};
+
+/**********************************************************/
+
+/* Draw the obstacles */
+static void DrawObstacles( struct Simulation *Sim, void *Obstacles,
+                           int Num, int Static);
+
+/* Draw the smoothing particles */
+static void DrawParticles( struct Simulation *Sim, 
+                           struct Snapshot *Snap);
+
+/* Copy the state of the simulation to the snapshot and publish it */
+static void PublishSnapshot( struct Simulation *Sim);
+
+/* Step the simulation until it's stopped */
+#ifndef _WIN32
+static void *RunSolver( void *Arg);
+#else
+static unsigned __stdcall RunSolver( void *Arg);
+#endif
+
+/**********************************************************/
+
+/* Non-zero if the particles are drawn as the sprites of a sphere
+ * (the points are just round otherwise), and the sphere's texture */
+static int    PointSprites = 0;
+static GLuint SpriteTexture;
+
+/* The largest size of the points */
+static float  MaxPointSize = 1.0f;
+
+/* Scaling/rotation steps */
+static float ScaleStep   = 0.1f;
+static float XRotateStep = 1.0f;
+static float YRotateStep = 1.0f;
+
+/* Current scaling/rotation factors */
+static float ScaleFactor   = 1.0f;
+static float XRotateFactor = 0.0f;
+static float YRotateFactor = 0.0f;
+
 /**********************************************************/
 
 /* Default size of the window */
 int WindowWidth  = 500;
 int WindowHeight = 500;
 
-/* Clipping volume (the area to render) */
-float ClipVolume;
+/* The simulation to render */
+struct Simulation *RenderedSim;
 
 /**********************************************************/
 
@@ -79,8 +181,13 @@ static float HelpCharSize = 0.00015f;
 void
 InitDisplayLists( void)
 {
+    struct Simulation *Sim;
+    float ClipVolume;
     int i, j;
 
+    Sim = RenderedSim;
+    ClipVolume = Sim->ClipVolume;
+
     /* Initialize HELP_LIST */
     glNewList( HELP_LIST, GL_COMPILE);
     
@@ -112,16 +219,50 @@ InitDisplayLists( void)
 #if 0
     /* Draw boundary particles */
     glColor3fv( BParticleColor);
-    for ( i = 0; i < BParticlesNumber; i++ )
+    for ( i = 0; i < Sim->BParticlesNumber; i++ )
     {
         glPushMatrix();
-        glTranslatef( BParticles[i].Pos[0], BParticles[i].Pos[1], BParticles[i].Pos[2]);
+        glTranslatef( Sim->BParticles[i].Pos[0], Sim->BParticles[i].Pos[1], 
+                      Sim->BParticles[i].Pos[2]);
         glutSolidSphere( 2.0f, 10, 10);
         glPopMatrix();
     }
 #endif
     
-    if ( Dimension == 2 )
+    /* Draw the obstacles which don't move */
+    DrawObstacles( Sim, Sim->Obstacles, Sim->ObstaclesNumber, 1);
+
+    /* End of OBSTACLES_LIST */
+    glEndList();
+
+    /* The moving bodies are compiled where the scene file puts
+     * them, they are drawn with their poses by DisplayCallback */
+    for ( i = 0; i < Sim->BodiesNumber; i++ )
+    {
+        glNewList( BODIES_LIST + i, GL_COMPILE);
+        DrawObstacles( Sim, Sim->Bodies[i].RestObstacles, 
+                       Sim->Bodies[i].ObstaclesNum, 0);
+        glEndList();
+    }
+    
+    return;
+} /* InitDisplayLists */
+
+/**
+ * Draw the <Num> obstacles <Obstacles> of the simulation <Sim> (the
+ * segments or the triangles), only the obstacles which don't move
+ * are drawn if <Static> is non-zero (<Obstacles> are the obstacles
+ * of the simulation then).
+ */
+static void
+DrawObstacles( struct Simulation *Sim,   /* Simulation */
+               void *Obstacles,          /* Obstacles */
+               int Num,                  /* Number of the obstacles */
+               int Static)               /* Draw the static ones only */
+{
+    int i;
+
+    if ( Sim->Dimension == 2 )
     {
         /* Obstacles are segments */
         struct ObstacleSegment *Segments;
@@ -129,15 +270,17 @@ InitDisplayLists( void)
         
         /* Draw segments */
         glBegin( GL_LINES);
-        for ( i = 0; i < ObstaclesNumber; i++ )
+        for ( i = 0; i < Num; i++ )
         {
+            if ( Static && GetObstacleBody( Sim, i) >= 0 )
+                continue;
             glColor3fv( SegmentColor);
             glVertex3fv( Segments[i].Vrtx1);
             glVertex3fv( Segments[i].Vrtx2);
         }
         glEnd();
     }
-    else if ( Dimension == 3 )
+    else if ( Sim->Dimension == 3 )
     {
         /* Obstacles are triangles */
         struct ObstacleTriangle *Triangles;
@@ -146,8 +289,10 @@ InitDisplayLists( void)
         /* Draw triangles' edges */
         glPolygonMode( GL_FRONT_AND_BACK, GL_LINE);
         glBegin( GL_TRIANGLES);
-        for ( i = 0; i < ObstaclesNumber; i++ )
+        for ( i = 0; i < Num; i++ )
         {
+            if ( Static && GetObstacleBody( Sim, i) >= 0 )
+                continue;
             glColor3fv( TriangleLineColor);
             glVertex3fv( Triangles[i].Vrtx1);
             glVertex3fv( Triangles[i].Vrtx2);
@@ -161,8 +306,10 @@ InitDisplayLists( void)
         if ( TriangleFillColor[3] < 1.0f )
             glDepthMask( GL_FALSE);
         glBegin( GL_TRIANGLES);
-        for ( i = 0; i < ObstaclesNumber; i++ )
+        for ( i = 0; i < Num; i++ )
         {
+            if ( Static && GetObstacleBody( Sim, i) >= 0 )
+                continue;
             glColor4fv( TriangleFillColor);
             glVertex3fv( Triangles[i].Vrtx1);
             glVertex3fv( Triangles[i].Vrtx2);
@@ -174,11 +321,64 @@ InitDisplayLists( void)
             glDepthMask( GL_TRUE);
     }
 
-    /* End of OBSTACLES_LIST */
-    glEndList();
-    
     return;
-} /* InitDisplayLists */
+} /* DrawObstacles */
+
+/**
+ * Draw the smoothing particles of the snapshot <Snap> of the simulation
+ * <Sim> by one call - the positions are passed to OpenGL as a vertex
+ * array (they are uploaded once per frame), every particle is a point
+ * of the size of its sphere on the screen. The points are the
+ * sprites of a lit sphere in 3D simulation (if they are supported),
+ * the particles of a flat scene are just round points of one color.
+ */
+static void
+DrawParticles( struct Simulation *Sim,   /* Simulation */
+               struct Snapshot *Snap)    /* Snapshot to draw */
+{
+    float Size;
+    int Sprites;
+
+    if ( Snap->ParticlesNumber == 0 )
+        return;
+
+    /* The diameter of the spheres in pixels (the projection is
+     * orthographic, so it doesn't depend on the depth) */
+    Size = 2.0f * ParticleRadius * ScaleFactor * (float)WindowWidth / Sim->ClipVolume;
+    if ( Size > MaxPointSize )
+        Size = MaxPointSize;
+    glPointSize( Size);
+
+    Sprites = ( PointSprites && Sim->Dimension == 3 );
+    if ( Sprites )
+    {
+        /* The texels outside of the sphere are dropped, so the
+         * depth buffer isn't written by the corners of the sprites */
+        glBindTexture( GL_TEXTURE_2D, SpriteTexture);
+        glEnable( GL_TEXTURE_2D);
+        glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+        glEnable( GL_POINT_SPRITE);
+        glTexEnvi( GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+        glEnable( GL_ALPHA_TEST);
+        glAlphaFunc( GL_GREATER, 0.5f);
+    }
+    glColor3fv( ParticleColor);
+
+    glEnableClientState( GL_VERTEX_ARRAY);
+    glVertexPointer( 3, GL_FLOAT, 0, Snap->Pos);
+    glDrawArrays( GL_POINTS, 0, Snap->ParticlesNumber);
+    glDisableClientState( GL_VERTEX_ARRAY);
+
+    if ( Sprites )
+    {
+        glDisable( GL_ALPHA_TEST);
+        glDisable( GL_POINT_SPRITE);
+        glDisable( GL_TEXTURE_2D);
+        glBindTexture( GL_TEXTURE_2D, 0);
+    }
+
+    return;
+} /* DrawParticles */
 
 /**********************************************************/
 
@@ -188,6 +388,14 @@ InitDisplayLists( void)
 void
 InitGLCapabilities( void)
 {
+    GLubyte Texels[SPRITE_SIZE][SPRITE_SIZE][4];
+    const char *Version;
+    const char *Extensions;
+    float Normal[3];
+    float Range[2];
+    float Shade;
+    int i, j, k;
+
     /* Turn on antialiasing for lines */
     glEnable( GL_LINE_SMOOTH);
     glHint( GL_LINE_SMOOTH_HINT, GL_NICEST);
@@ -199,6 +407,49 @@ InitGLCapabilities( void)
     /* Turn on blending */
     glEnable( GL_BLEND);
     glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    /* The particles are points, they are round in any case */
+    glEnable( GL_POINT_SMOOTH);
+    glHint( GL_POINT_SMOOTH_HINT, GL_NICEST);
+    glGetFloatv( GL_POINT_SIZE_RANGE, Range);
+    MaxPointSize = Range[1];
+
+    /* The particles of 3D simulation are the sprites of a lit sphere
+     * if the sprites are supported (the texture is the sphere shaded 
+     * by the light, it's transparent outside of the sphere, its first
+     * row is the top of the sprite) */
+    Version = (const char *)glGetString( GL_VERSION);
+    Extensions = (const char *)glGetString( GL_EXTENSIONS);
+    PointSprites = ( (Version != NULL && Version[0] >= '2' && Version[0] <= '9') ||
+                     (Extensions != NULL && strstr( Extensions, "GL_ARB_point_sprite") != NULL) );
+    if ( PointSprites && RenderedSim->Dimension == 3 )
+    {
+        for ( i = 0; i < SPRITE_SIZE; i++ )
+            for ( j = 0; j < SPRITE_SIZE; j++ )
+            {
+                Normal[0] = 2.0f * (j + 0.5f) / SPRITE_SIZE - 1.0f;
+                Normal[1] = 1.0f - 2.0f * (i + 0.5f) / SPRITE_SIZE;
+                Normal[2] = 1.0f - Normal[0] * Normal[0] - Normal[1] * Normal[1];
+                Shade = 0.0f;
+                if ( Normal[2] > 0.0f )
+                {
+                    Normal[2] = (float)sqrt( Normal[2]);
+                    Shade = Normal[0] * SpriteLight[0] + Normal[1] * SpriteLight[1] + 
+                            Normal[2] * SpriteLight[2];
+                    Shade = 0.35f + 0.65f * ( Shade > 0.0f ? Shade : 0.0f);
+                }
+                for ( k = 0; k < 3; k++ )
+                    Texels[i][j][k] = (GLubyte)(255.0f * Shade * ParticleColor[k] + 0.5f);
+                Texels[i][j][3] = ( Normal[2] > 0.0f ) ? 255 : 0;
+            }
+        glGenTextures( 1, &SpriteTexture);
+        glBindTexture( GL_TEXTURE_2D, SpriteTexture);
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, SPRITE_SIZE, SPRITE_SIZE, 0, 
+                      GL_RGBA, GL_UNSIGNED_BYTE, Texels);
+        glBindTexture( GL_TEXTURE_2D, 0);
+    }
     
     return;
 } /* InitGLCapabilities */
@@ -207,41 +458,193 @@ InitGLCapabilities( void)
 
 /**********************************************************
  *                                                        *
- *                     GLUT CALLBACKS                     *
+ *                     SOLVER THREAD                      *
+ *                                                        *
+ * The solver steps the simulation on its own thread and  *
+ * the renderer draws the snapshots of its state, so they *
+ * don't wait for each other. The snapshots are triple    *
+ * buffered - the solver fills one of them, the renderer  *
+ * draws another one, and the third one is the latest     *
+ * complete snapshot. They are swapped by atomic exchange *
+ * of their indices, so neither thread ever blocks.       *
  *                                                        *
  **********************************************************/
 
-/* State of pause instruction */
-static int Pause = 1;
+/* State of pause instruction, and the request to stop the solver */
+static volatile int Pause = 1;
+static volatile int Quit = 0;
+
+/* The snapshots, the ones owned by the solver and the renderer and
+ * the latest complete one (with SNAPSHOT_FRESH if it's new) */
+static struct Snapshot Snapshots[3];
+static int    Writing = 0;
+static int    Reading = 1;
+static volatile long Ready = 2;
+
+/* The solver's thread */
+#ifndef _WIN32
+static pthread_t Solver;
+#else
+static HANDLE Solver;
+#endif
+
+/**
+ * Start the solver's thread stepping the simulation (it waits while
+ * the simulation is paused), the state before the first step is the
+ * first snapshot.
+ */
+void
+StartSolver( void)
+{
+    PublishSnapshot( RenderedSim);
+
+#ifndef _WIN32
+    pthread_create( &Solver, NULL, RunSolver, NULL);
+#else
+    Solver = (HANDLE)_beginthreadex( NULL, 0, RunSolver, NULL, 0, NULL);
+#endif
+
+    return;
+} /* StartSolver */
 
 /**
- * GLUT idle callback.
+ * Stop the solver's thread (the step in progress is completed).
  */
 void
-IdleCallback( void)
+StopSolver( void)
 {
-    /* Check the state */
-    if ( Pause == 1 )
+    Quit = 1;
+#ifndef _WIN32
+    pthread_join( Solver, NULL);
+#else
+    WaitForSingleObject( Solver, INFINITE);
+    CloseHandle( Solver);
+#endif
+
+    return;
+} /* StopSolver */
+
+/**
+ * The solver's thread - step the simulation and publish the snapshot
+ * after every step until the solver is stopped.
+ */
+#ifndef _WIN32
+static void *
+#else
+static unsigned __stdcall
+#endif
+RunSolver( void *Arg)   /* Not used */
+{
+    while ( !Quit )
     {
-        return;
+        /* Check the state */
+        if ( Pause )
+        {
+            SLEEP( PAUSE_INTERVAL);
+            continue;
+        }
+
+        /* Do one calculation step */
+        StepSimulation( RenderedSim, 1);
+
+        /* Report the work of the incompressible solver */
+        if ( RenderedSim->PressIterations > 0 )
+            printf( "Step %d: %d iterations, density error %.3f%% (max %.3f%%)\n", 
+                    RenderedSim->StepsNumber, RenderedSim->PressIterations, 
+                    100.0f * RenderedSim->PressDensError, 
+                    100.0f * RenderedSim->PressMaxDensError);
+
+        PublishSnapshot( RenderedSim);
     }
-    
-    /* Do one calculation step */
-    DoCalcStep();
 
-    /* Redisplay */
-    glutPostRedisplay();
+    return 0;
+} /* RunSolver */
+
+/**
+ * Copy the positions of the particles and the poses of the moving
+ * bodies of the simulation <Sim> to the solver's snapshot, and swap
+ * it with the latest complete one (the solver gets the snapshot which
+ * has been drawn or the one which hasn't, the latter is skipped).
+ */
+static void
+PublishSnapshot( struct Simulation *Sim)   /* Simulation */
+{
+    struct Snapshot *Snap;
+    struct MovingBody *Body;
+    int i, d;
+
+    Snap = &Snapshots[Writing];
+
+    /* The number of the particles changes if they are refined */
+    if ( Snap->PosSize < Sim->ParticlesNumber )
+    {
+        Snap->PosSize = Sim->ParticlesNumber;
+        Snap->Pos = (float (*)[3])realloc( Snap->Pos, Snap->PosSize * sizeof(*Snap->Pos));
+    }
+    if ( Snap->Poses == NULL && Sim->BodiesNumber > 0 )
+        Snap->Poses = (float (*)[16])calloc( Sim->BodiesNumber, sizeof(*Snap->Poses));
+
+#pragma omp parallel for schedule(static)
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        memcpy( Snap->Pos[i], Sim->Particles[i].Pos, sizeof(Snap->Pos[i]));
+    Snap->ParticlesNumber = Sim->ParticlesNumber;
+    Snap->StepsNumber = Sim->StepsNumber;
+
+    /* The matrices of the poses (OpenGL's order, by columns) */
+    for ( i = 0; i < Sim->BodiesNumber; i++ )
+    {
+        Body = &Sim->Bodies[i];
+        for ( d = 0; d < 3; d++ )
+        {
+            Snap->Poses[i][d] = Body->Rotation[d][0];
+            Snap->Poses[i][4 + d] = Body->Rotation[d][1];
+            Snap->Poses[i][8 + d] = Body->Rotation[d][2];
+            Snap->Poses[i][12 + d] = Body->Offset[d];
+            Snap->Poses[i][3 + 4 * d] = 0.0f;
+        }
+        Snap->Poses[i][15] = 1.0f;
+    }
+
+    Writing = (int)(EXCHANGE( Ready, Writing | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH);
+
+    return;
+} /* PublishSnapshot */
+
+/**********************************************************
+ *                                                        *
+ *                     GLUT CALLBACKS                     *
+ *                                                        *
+ **********************************************************/
+
+/**
+ * GLUT timer callback - the scene is redisplayed if there is
+ * a new snapshot (the timer is set again every time).
+ */
+void
+TimerCallback( int Value)   /* Not used */
+{
+    if ( Ready & SNAPSHOT_FRESH )
+        glutPostRedisplay();
+
+    glutTimerFunc( FRAME_INTERVAL, TimerCallback, 0);
     
     return;
-} /* IdleCallBack */
+} /* TimerCallback */
 
 /**
- * GLUT display callback.
+ * GLUT display callback - the latest snapshot is drawn (the one
+ * drawn last time is drawn again if there is no new one).
  */
 void
 DisplayCallback( void)
 {
+    struct Snapshot *Snap;
     int i;
+
+    /* Take the new snapshot */
+    if ( Ready & SNAPSHOT_FRESH )
+        Reading = (int)(EXCHANGE( Ready, Reading) & ~SNAPSHOT_FRESH);
+    Snap = &Snapshots[Reading];
     
     /* Clear the buffers */
     glClearColor( BackgroundColor[0],
@@ -254,18 +657,20 @@ DisplayCallback( void)
     glCallList( HELP_LIST);
     
     /* Draw the particles */
-    for ( i = 0; i < ParticlesNumber; i++ )
+    DrawParticles( RenderedSim, Snap);
+
+    /* Draw the obstacles */
+    glCallList( OBSTACLES_LIST);
+
+    /* Draw the moving bodies with their poses */
+    for ( i = 0; i < RenderedSim->BodiesNumber && Snap->Poses != NULL; i++ )
     {
         glPushMatrix();
-        glTranslatef( Particles[i].Pos[0], Particles[i].Pos[1], Particles[i].Pos[2]);
-        glColor3fv( ParticleColor);
-        glutSolidSphere( 3.5f, 20, 20);
+        glMultMatrixf( Snap->Poses[i]);
+        glCallList( BODIES_LIST + i);
         glPopMatrix();
     }
 
-    /* Draw the obstacles */
-    glCallList( OBSTACLES_LIST);
-
     /* Swap the buffers */
     glutSwapBuffers();
     
@@ -279,6 +684,11 @@ void
 ReshapeCallback( int Width,   /* Window's width */
                  int Height)  /* Window's height */
 {
+    float ClipVolume;
+
+    ClipVolume = RenderedSim->ClipVolume;
+
+
     /* It's not allowed to change the size of the window */
     glutReshapeWindow( WindowWidth, WindowHeight);
     glViewport( 0, 0, WindowWidth, WindowHeight);
@@ -309,12 +719,8 @@ KeyboardCallback( unsigned char Key,   /* Key's code */
       case 'Q':
       case 'q':
           /* 'q' or 'Q' - exit the program */
-          free( Particles);
-          free( BParticles);
-          if ( Dimension == 2 )
-              free( (struct ObstacleSegment *)Obstacles);
-          else if ( Dimension == 3 )
-              free( (struct ObstacleTriangle *)Obstacles);
+          StopSolver();
+          DestroySimulation( RenderedSim);
           exit( 0);
       default:
         break;
@@ -323,16 +729,6 @@ KeyboardCallback( unsigned char Key,   /* Key's code */
     return;
 } /* KeyboardCallback */
 
-/* Scaling/rotation steps */
-static float ScaleStep   = 0.1f;
-static float XRotateStep = 1.0f;
-static float YRotateStep = 1.0f;
-
-/* Current scaling/rotation factors */
-static float ScaleFactor   = 1.0f;
-static float XRotateFactor = 0.0f;
-static float YRotateFactor = 0.0f;
-
 /**
  * GLUT special functions callback.
  */
@@ -341,6 +737,10 @@ SpecialFuncCallback( int Key,   /* Key's code */
                      int X,     /* Position of */
                      int Y)     /* the mouse   */
 {
+    float ClipVolume;
+
+    ClipVolume = RenderedSim->ClipVolume;
+
     switch (Key) {
       case GLUT_KEY_UP:
         XRotateFactor += XRotateStep;
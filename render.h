@@ -14,8 +14,10 @@
 extern int WindowWidth;
 extern int WindowHeight;
 
-/* Clipping volume (the area to render) */
-extern float ClipVolume;
+struct Simulation;
+
+/* The simulation to render */
+extern struct Simulation *RenderedSim;
 
 /**********************************************************/
 
@@ -25,13 +27,17 @@ extern void InitDisplayLists    ( void);
 /* Initialize GL capabilities */
 extern void InitGLCapabilities  ( void);
 
+/* Start and stop the solver's thread */
+extern void StartSolver         ( void);
+extern void StopSolver          ( void);
+
 /* GLUT callbacks */
 extern void DisplayCallback     ( void);
 extern void ReshapeCallback     ( int Width, 
                                   int Height);
 extern void KeyboardCallback    ( unsigned char Key, 
                                   int X, int Y);
-extern void IdleCallback        ( void);
+extern void TimerCallback       ( int Value);
 extern void SpecialFuncCallback ( int Key, 
                                   int X, int Y);
 
@@ -9,68 +9,145 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <math.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
 #include "common.h"
-#include "calc.h"
-#include "render.h"
 #include "vector.h"
+#include "mesh.h"
 #include "scene.h"
 
 /**********************************************************/
 
-/* The name of the file with scene description */
-#define SCENE_FILE_NAME     "scene"
-
 /* The maximum length of the file's string (with line feed) */
 #define FILE_LINE_LENGTH    1024
 
+/* The keyword of the obstacles given by a mesh file */
+#define MESH_KEYWORD        "MESH"
+
+/* The tag and the version of the compiled scene's cache */
+#define SCENE_CACHE_TAG     "YAPSSCN"
+#define SCENE_CACHE_VERSION 2
+
+/* The suffix of the cache's name and the name to turn it off */
+#define SCENE_CACHE_SUFFIX  ".cache"
+#define SCENE_CACHE_OFF     "OFF"
+
 /**********************************************************/
 
 /* Section info */
 struct Section;
 
+/* Cloud of particles */
+struct Cloud;
+
 /* Read and process the obstacles section from scene file */ 
-static int   ReadObstaclesSection       ( char **Scene, 
+static int   ReadObstaclesSection       ( struct Simulation *Sim,
+                                          char **Scene, 
+                                          struct Section *Info);
+
+/* Read the triangle-obstacles (and the meshes) from scene file */
+static int   ReadObstacleTriangles      ( struct Simulation *Sim,
+                                          char **Scene, 
                                           struct Section *Info);
 
 /* Read and process the clouds section from scene file */ 
-static int   ReadCloudsSection          ( char **Scene, 
+static int   ReadCloudsSection          ( struct Simulation *Sim,
+                                          char **Scene, 
+                                          struct Section *Info);
+
+/* Read the keys of the motion of the obstacles from scene file */ 
+static int   ReadMotionSection          ( struct Simulation *Sim,
+                                          char **Scene, 
                                           struct Section *Info);
 
 /* Read and process the section containing parameters from scene file */ 
-static int   ReadParamsSection          ( char **Scene, 
+static int   ReadParamsSection          ( struct Simulation *Sim,
+                                          char **Scene, 
                                           struct Section *Info);
 
 /* Unification of array of points */
-static void  UnifyPoints                ( int UnifiedPart,
-                                          float ***Pnts, 
+static void  UnifyPoints                ( int Dim, int UnifiedPart,
+                                          float *Pnts, int Stride,
+                                          float Snap, float (*Periodic)[2],
                                           int *PntsNum);
 
+/* Fill cloud of particles with points */
+static int   FillCloudWithPoints        ( int Dim,
+                                          struct Cloud *Cloud,
+                                          float *Pnts, int Stride,
+                                          float Ival);
+
+/* Fill obstacle with points */
+static int   FillObstacleWithPoints     ( int Dim,
+                                          void *Obstacle,
+                                          float *Pnts, int Stride,
+                                          float Ival);
+
 /* Fill triangle given by three vertices with points */
-static void  FillTriangleWithPoints     ( float *Vrtx1, float *Vrtx2, 
-                                          float *Vrtx3, float ***Pnts, 
-                                          int *PntsNum, float Ival);
+static int   FillTriangleWithPoints     ( int Dim,
+                                          float *Vrtx1, float *Vrtx2, 
+                                          float *Vrtx3, float *Pnts, 
+                                          int Stride, float Ival);
 
 /* Fill parallelepiped given by origin and three vectors with points */ 
-static void  FillParlpipedWithPoints    ( float *Vrtx, float *Vec1, 
+static int   FillParlpipedWithPoints    ( int Dim,
+                                          float *Vrtx, float *Vec1, 
                                           float *Vec2, float *Vec3, 
-                                          float ***Pnts, int *PntsNum, 
+                                          float *Pnts, int Stride, 
                                           float Ival);
 
 /* Fill parallelogram given by origin and two vectors with points */ 
-static void  FillParlgramWithPoints     ( float *Vrtx, float *Vec1, 
-                                          float *Vec2, float ***Pnts, 
-                                          int *PntsNum, float Ival);
+static int   FillParlgramWithPoints     ( int Dim,
+                                          float *Vrtx, float *Vec1, 
+                                          float *Vec2, float *Pnts, 
+                                          int Stride, float Ival);
 
 /* Fill segment given by origin and vector with points */ 
-static void  FillSegmentWithPoints      ( float *Vrtx, float *Vec, 
-                                          float ***Pnts, int *PntsNum, 
+static int   FillSegmentWithPoints      ( int Dim,
+                                          float *Vrtx, float *Vec, 
+                                          float *Pnts, int Stride, 
                                           float Ival);
 
 /* Get point on segment given by origin and vector by parameter */
-static void  GetPointOnSegmentByParam   ( float *Vrtx, float *Vec, 
+static void  GetPointOnSegmentByParam   ( int Dim,
+                                          float *Vrtx, float *Vec, 
                                           float *Pnt, float Param);
 
+/* Get the key of the generated part of the scene */
+static char *GetSceneKey                ( struct Simulation *Sim,
+                                          char **Scene, 
+                                          struct Section *Sects,
+                                          int *KeySize);
+
+/* Get FNV-1a hash of the bytes */
+static unsigned int HashBytes           ( const char *Bytes, int Size);
+
+/* Read the generated part of the scene from the cache */
+static int   ReadSceneCache             ( struct Simulation *Sim,
+                                          const char *CacheFile,
+                                          const char *Key, int KeySize);
+
+/* Map the cache's file into memory */
+static char *MapSceneCache              ( const char *CacheFile,
+                                          size_t *Size, int *Mapped);
+
+/* Unmap the cache's file */
+static void  UnmapSceneCache            ( char *Data, size_t Size, int Mapped);
+
+/* Write the generated part of the scene to the cache */
+static void  WriteSceneCache            ( struct Simulation *Sim,
+                                          const char *CacheFile,
+                                          const char *Key, int KeySize);
+
 /**********************************************************/
 
 /* Section info */
@@ -79,9 +156,11 @@ struct Section
     char *Name;                   /* Name in the scene description file */
     int FirstLine;                /* The first line of the section */
     int EndLine;                  /* The end line of the section */
-    int (*Func)( char **Scene, 
+    int (*Func)( struct Simulation *Sim,
+                 char **Scene, 
                  struct Section 
                         *Info);   /* The function to read the section */
+    int Cached;                   /* Non-zero if the section's result is cached */
 };
 
 /* The maximum length of a section's name */
@@ -91,15 +170,47 @@ struct Section
 #define SECTION_END           "$END"
 
 /* Possible sections in the scene description file, 
- * they are processed in the order they follow here */
+ * they are processed in the order they follow here (the 
+ * cached sections follow all the ones which aren't) */
 static struct Section Sections[] =
 {
     /* Parameters section - contains simulator's parameters */
-    "$PARAMS",    -1, -1, ReadParamsSection,
+    "$PARAMS",    -1, -1, ReadParamsSection,    0,
+    /* Motion section - moves the obstacles as rigid bodies */
+    "$MOTION",    -1, -1, ReadMotionSection,    0,
     /* Clouds section - set up clouds of particles          */
-    "$CLOUDS",    -1, -1, ReadCloudsSection,
+    "$CLOUDS",    -1, -1, ReadCloudsSection,    1,
     /* Obstacles section - set up obstacles in the scene    */
-    "$OBSTACLES", -1, -1, ReadObstaclesSection,
+    "$OBSTACLES", -1, -1, ReadObstaclesSection, 1,
+};
+
+/* Cloud of particles - a parallelogram in 2D simulation (the origin
+ * and two vectors) or a parallelepiped in 3D simulation (the origin 
+ * and three vectors) */
+struct Cloud
+{
+    float Vrtx[4][3];             /* The origin and the vectors */
+    float Vel[3];                 /* Initial velocity of the particles */
+};
+
+/* The header of the compiled scene's cache - the particles, the boundary
+ * particles and the obstacles generated from the scene are written to 
+ * the file as they are in memory, so the file could be read or mapped 
+ * without any parsing. The header is followed by the key the scene is
+ * generated from (aligned to 8 bytes), and then by the three arrays */
+struct SceneCacheHeader
+{
+    char  Tag[8];                 /* SCENE_CACHE_TAG */
+    int   Version;                /* SCENE_CACHE_VERSION */
+    int   ParticleSize;           /* Sizes of the records (they depend */
+    int   BParticleSize;          /* on the build and on the dimension) */
+    int   ObstacleSize;
+    unsigned int KeyHash;         /* Hash of the key */
+    int   KeySize;                /* Size of the key */
+    int   ParticlesNumber;        /* Number of the smoothing particles */
+    int   BParticlesNumber;       /* Number of the boundary particles */
+    int   ObstaclesNumber;        /* Number of the obstacles */
+    float ParticleMass;           /* Mass of the particles */
 };
 
 /* The size of this array */
@@ -107,29 +218,49 @@ static int SectsNum = sizeof(Sections) / sizeof(Sections[0]);
 
 /**
  * Initialize the scene - the function reads the scene description 
- * file and initializes all variables and data structures used 
- * in simulation and rendering.
+ * file <FileName> and initializes all variables and data structures 
+ * of the simulation <Sim> used in simulation and rendering. The 
+ * NULL-terminated array <Params> (it could be NULL) contains strings 
+ * "NAME value" which override the parameters from the file. The 
+ * particles and the obstacles generated from the scene are kept in
+ * the cache (SCENE_CACHE, the file's name with SCENE_CACHE_SUFFIX by
+ * default), and they are read from it instead of being generated 
+ * again while the sections they are generated from are the same. The
+ * function returns 0 if succeeded, -1 if the file can't be opened, 
+ * -2 if some of <Params> isn't valid and the number of string 
+ * containing an error otherwise.
  */
-void
-InitScene( void)
+int
+InitScene( struct Simulation *Sim,   /* Simulation */
+           const char *FileName,     /* Scene description file */
+           const char **Params)      /* Overriding parameters */
 {
+    struct Section Sects[sizeof(Sections) / sizeof(Sections[0])];
     FILE *File;
     char **Scene;
     char Str[FILE_LINE_LENGTH + 1];
     char Name[SECTION_NAME_LENGTH + 1];
     char Fmt[6];
+    char *CacheFile;
+    char *Key;
+    int KeySize;
     int LinesNum;
     char SearchEnd;
+    int FromCache;
+    int Res;
     int i, j, n;
 
-    File = fopen( SCENE_FILE_NAME, "r");
+    File = fopen( FileName, "r");
     
     if ( File == NULL )
     {
         /* There is no scene file */
-        return;
+        return -1;
     }
 
+    /* Sections' info is filled for this file only */
+    memcpy( Sects, Sections, sizeof(Sections));
+
     /* Read scene description file */
     LinesNum = 0;
     Scene = NULL;
@@ -174,7 +305,7 @@ InitScene( void)
              * it's necessary to find the section's end */
             if ( strcmp( SECTION_END, Name) )
                 continue;
-            Sections[j].EndLine = i;
+            Sects[j].EndLine = i;
             SearchEnd = 0;
             continue;
         }
@@ -183,9 +314,9 @@ InitScene( void)
         {
             /* Some section has been found in the 
              * scene file - check if it is valid */
-            if ( strcmp( Sections[j].Name, Name) )
+            if ( strcmp( Sects[j].Name, Name) )
                 continue;
-            Sections[j].FirstLine = i + 1;
+            Sects[j].FirstLine = i + 1;
             /* Now it's necessary to find the end */
             SearchEnd = 1;
             break;
@@ -193,8 +324,52 @@ InitScene( void)
     }
     
     /* Read and process the sections of the scene file */
-    for ( i = 0; i < SectsNum; i++ )
-        Sections[i].Func( Scene, &Sections[i]);
+    Res = 0;
+    CacheFile = NULL;
+    Key = NULL;
+    KeySize = 0;
+    FromCache = 0;
+    for ( i = 0; i < SectsNum && Res == 0; i++ )
+    {
+        /* All the parameters are known before the first cached 
+         * section, so the key of the generated part is known too */
+        if ( Sects[i].Cached && Key == NULL && 
+             strcmp( Sim->SceneCache, SCENE_CACHE_OFF) != 0 )
+        {
+            CacheFile = (char *)malloc( strlen( FileName) + strlen( Sim->SceneCache) +
+                                        sizeof(SCENE_CACHE_SUFFIX));
+            if ( Sim->SceneCache[0] == '\0' )
+                sprintf( CacheFile, "%s%s", FileName, SCENE_CACHE_SUFFIX);
+            else
+                strcpy( CacheFile, Sim->SceneCache);
+            Key = GetSceneKey( Sim, Scene, Sects, &KeySize);
+            FromCache = ( ReadSceneCache( Sim, CacheFile, Key, KeySize) == 0 );
+        }
+        if ( Sects[i].Cached && FromCache )
+            continue;
+
+        Res = Sects[i].Func( Sim, Scene, &Sects[i]);
+
+        /* The parameters given by the caller override the ones from 
+         * the file, they are set before the particles are created */
+        if ( Res == 0 && Sects[i].Func == ReadParamsSection && Params != NULL )
+        {
+            for ( j = 0; Params[j] != NULL; j++ )
+            {
+                if ( SetSceneParam( Sim, Params[j]) )
+                {
+                    Res = -2;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Keep the generated part of the scene */
+    if ( Res == 0 && Key != NULL && !FromCache )
+        WriteSceneCache( Sim, CacheFile, Key, KeySize);
+    free( CacheFile);
+    free( Key);
 
     /* Close the file and free the memory */
     if ( File != NULL )
@@ -205,7 +380,7 @@ InitScene( void)
         free( Scene);
     }
 
-    return;
+    return Res;
 } /* InitScene */
 
 /**********************************************************/
@@ -213,240 +388,431 @@ InitScene( void)
 /**
  * Read obstacles section which is specified by <Info> from array with 
  * scene description <Scene>, initialize corresponding data structures
- * and create boundary particles. The function returns 0 if succeeded 
- * and the number of string containing an error otherwise.
+ * and create boundary particles. The boundary particles of all the 
+ * obstacles are counted first, and then the obstacles are filled with
+ * them in parallel right in the array of the boundary particles. The 
+ * function returns 0 if succeeded and the number of string containing
+ * an error otherwise.
  */
 static int
-ReadObstaclesSection( char **Scene,           /* Array with scene description */
-                      struct Section *Info)   /* Section's info */ 
+ReadObstaclesSection( struct Simulation *Sim,   /* Simulation */
+                      char **Scene,             /* Array with scene description */
+                      struct Section *Info)     /* Section's info */ 
 {
-    float **Pnts;
+    struct ObstacleSegment *Segments;
+    struct ObstacleTriangle *Triangles;
+    int *First;
     int PntsNum;
+    int Dimension;
     int Res;
-    int i, n;
+    int i, j, n;
     
-    Pnts = NULL;
-    PntsNum = 0;
+    Dimension = Sim->Dimension;
+    Segments = NULL;
+    Triangles = NULL;
     Res = 0;
 
     /* Obstacle's specification occupies one string */
-    ObstaclesNumber = Info->EndLine - Info->FirstLine;
+    Sim->ObstaclesNumber = Info->EndLine - Info->FirstLine;
 
     if ( Dimension == 2 )
     {
-        struct ObstacleSegment *Segments;
-        float Vec[2];
-        
         /* Allocate memory for obstacles */
         Segments = (struct ObstacleSegment *)
-                   malloc( ObstaclesNumber * sizeof(struct ObstacleSegment));
-        Obstacles = (void *)Segments;
+                   malloc( Sim->ObstaclesNumber * sizeof(struct ObstacleSegment));
+        Sim->Obstacles = (void *)Segments;
         
-        for ( i = 0; i < ObstaclesNumber; i++ )
+        for ( i = 0; i < Sim->ObstaclesNumber; i++ )
         {
             /* In 2D simulation segment-obstacles are used */
             memset( &Segments[i], 0, sizeof(struct ObstacleSegment));
+            Segments[i].Line = i;
             n = sscanf( Scene[Info->FirstLine + i], "%f %f %f %f", 
                         &(Segments[i].Vrtx1[0]), &(Segments[i].Vrtx1[1]), 
                         &(Segments[i].Vrtx2[0]), &(Segments[i].Vrtx2[1]));
             /* An error has occured */
             if ( n != 4 )
+            {
+                Res = Info->FirstLine + i;
                 break;
-            /* Fill segment with points */
-            VectorSubstraction( Vec, Segments[i].Vrtx2, Segments[i].Vrtx1);
-            FillSegmentWithPoints( Segments[i].Vrtx1, Vec, &Pnts, 
-                                   &PntsNum, BParticlesDistrib);
+            }
         }
-        /* An error has occured */
-        if ( i != ObstaclesNumber )
-            free( Segments);
     }
     else if ( Dimension == 3 )
     {
-        struct ObstacleTriangle *Triangles;
-        
-        /* Allocate memory for obstacles */
-        Triangles = (struct ObstacleTriangle *)
-                    malloc( ObstaclesNumber * sizeof(struct ObstacleTriangle));
-        Obstacles = (void *)Triangles;
-        
-        for ( i = 0; i < ObstaclesNumber; i++ )
-        {
-            /* In 3D simulation triangle-obstacles are used */
-            memset( &Triangles[i], 0, sizeof(struct ObstacleTriangle));
-            n = sscanf( Scene[Info->FirstLine + i], "%f %f %f %f %f %f %f %f %f", 
-                        &(Triangles[i].Vrtx1[0]), &(Triangles[i].Vrtx1[1]), 
-                        &(Triangles[i].Vrtx1[2]), &(Triangles[i].Vrtx2[0]), 
-                        &(Triangles[i].Vrtx2[1]), &(Triangles[i].Vrtx2[2]), 
-                        &(Triangles[i].Vrtx3[0]), &(Triangles[i].Vrtx3[1]), 
-                        &(Triangles[i].Vrtx3[2]));
-            /* An error has occured */
-            if ( n != 9 )
-                break;
-            /* Fill triangle with points */
-            FillTriangleWithPoints( Triangles[i].Vrtx1, Triangles[i].Vrtx2, 
-                                    Triangles[i].Vrtx3, &Pnts, &PntsNum, 
-                                    BParticlesDistrib);
-        }
-        /* An error has occured */
-        if ( i != ObstaclesNumber )
-            free( Triangles);
+        /* In 3D simulation triangle-obstacles are used */
+        Res = ReadObstacleTriangles( Sim, Scene, Info);
+        Triangles = (struct ObstacleTriangle *)Sim->Obstacles;
     }
 
-    if ( i != ObstaclesNumber )
+    if ( Res != 0 )
     {
         /* An error has occured */
-        Res = i;
+        free( Sim->Obstacles);
+        Sim->Obstacles = NULL;
+        Sim->ObstaclesNumber = 0;
+        return Res;
     }
-    else
+
+    /* The first boundary particle of every obstacle */
+    First = (int *)malloc( (Sim->ObstaclesNumber + 1) * sizeof(int));
+    First[0] = 0;
+    for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+    {
+        if ( Dimension == 2 )
+            n = FillObstacleWithPoints( Dimension, &Segments[i], NULL, 0, 
+                                        Sim->BParticlesDistrib);
+        else
+            n = FillObstacleWithPoints( Dimension, &Triangles[i], NULL, 0, 
+                                        Sim->BParticlesDistrib);
+        First[i + 1] = First[i] + n;
+    }
+    PntsNum = First[Sim->ObstaclesNumber];
+
+    /* Create boundary particles filling the obstacles with them */
+    Sim->BParticles = (struct BParticle *)calloc( PntsNum + 1, sizeof(struct BParticle));
+#pragma omp parallel for schedule(dynamic,16) private(j)
+    for ( i = 0; i < Sim->ObstaclesNumber; i++ )
+    {
+        if ( Dimension == 2 )
+            FillObstacleWithPoints( Dimension, &Segments[i], 
+                                    Sim->BParticles[First[i]].Pos, 
+                                    sizeof(struct BParticle), Sim->BParticlesDistrib);
+        else
+            FillObstacleWithPoints( Dimension, &Triangles[i], 
+                                    Sim->BParticles[First[i]].Pos, 
+                                    sizeof(struct BParticle), Sim->BParticlesDistrib);
+        for ( j = First[i]; j < First[i + 1]; j++ )
+            Sim->BParticles[j].Obstacle = i;
+    }
+    free( First);
+
+    /* The obstacles share the points of their common edges 
+     * (the points closer than the tolerance are snapped, the
+     * shared point belongs to the first of the obstacles), the
+     * walls which meet across a periodic boundary share them too */
+    UnifyPoints( Dimension, 0, Sim->BParticles[0].Pos, sizeof(struct BParticle), 
+                 Sim->UnifyTolerance * Sim->BParticlesDistrib, Sim->Periodic, &PntsNum);
+    Sim->BParticles = (struct BParticle *)
+                      realloc( Sim->BParticles, (PntsNum + 1) * sizeof(struct BParticle));
+    /* Update the number of the boundary particles */
+    Sim->BParticlesNumber = PntsNum;
+
+    return 0;
+} /* ReadObstaclesSection */
+
+/**
+ * Read the triangle-obstacles of the obstacles section which is specified
+ * by <Info> from array with scene description <Scene>. Every string is 
+ * either a triangle (the coordinates of its three vertices) or the mesh
+ * file "MESH file [scale [x y z]]" (binary STL, ASCII STL or OBJ) whose 
+ * vertices are scaled and moved by (x,y,z). The meshes are opened first
+ * to count all the triangles, and then they are read straight into the
+ * array of the obstacles. The function returns 0 if succeeded and the 
+ * number of string containing an error otherwise.
+ */
+static int
+ReadObstacleTriangles( struct Simulation *Sim,   /* Simulation */
+                       char **Scene,             /* Array with scene description */
+                       struct Section *Info)     /* Section's info */ 
+{
+    struct ObstacleTriangle *Triangles;
+    struct Mesh *Meshes;
+    char FileName[FILE_LINE_LENGTH + 1];
+    char Word[SECTION_NAME_LENGTH + 1];
+    char Fmt[16];
+    char *Str;
+    float Scale;
+    float Offset[3];
+    int TrianglesNum;
+    int LinesNum;
+    int Res;
+    int i, k, n;
+
+    LinesNum = Info->EndLine - Info->FirstLine;
+    Meshes = (struct Mesh *)calloc( LinesNum + 1, sizeof(struct Mesh));
+    Res = 0;
+
+    /* Count the triangles of all the strings */
+    TrianglesNum = 0;
+    for ( i = 0; i < LinesNum && Res == 0; i++ )
     {
-        /* Create boundary particles using coordinates of 
-         * points which the obstacles have been filled with */
-        UnifyPoints( 0, &Pnts, &PntsNum);
-        BParticles = (struct BParticle *)malloc( PntsNum * sizeof(struct BParticle));
-        for ( i = 0; i < PntsNum; i++ )
+        Str = Scene[Info->FirstLine + i];
+        sprintf( Fmt, "%%%ds", SECTION_NAME_LENGTH);
+        if ( sscanf( Str, Fmt, Word) == 1 && strcmp( Word, MESH_KEYWORD) == 0 )
+        {
+            sprintf( Fmt, "%%*s %%%ds", FILE_LINE_LENGTH);
+            if ( sscanf( Str, Fmt, FileName) != 1 || OpenMesh( FileName, &Meshes[i]) )
+                Res = Info->FirstLine + i;
+            TrianglesNum += Meshes[i].TrianglesNum;
+        }
+        else
         {
-            memset( &BParticles[i], 0, sizeof(struct BParticle));
-            /* Boundary particle's position */
-            memcpy( BParticles[i].Pos, Pnts[i], Dimension * sizeof(float));
+            TrianglesNum++;
         }
-        /* Update the number of the boundary particles */
-        BParticlesNumber = PntsNum;
     }
 
-    /* Delete points */
-    for ( i = 0; i < PntsNum; i++ )
-        free( Pnts[i]);
-    free( Pnts);
+    /* Allocate memory for obstacles and read them */
+    Triangles = (struct ObstacleTriangle *)
+                calloc( TrianglesNum + 1, sizeof(struct ObstacleTriangle));
+    k = 0;
+    for ( i = 0; i < LinesNum && Res == 0; i++ )
+    {
+        Str = Scene[Info->FirstLine + i];
+        if ( Meshes[i].Data != NULL )
+        {
+            Scale = 1.0f;
+            memset( Offset, 0, sizeof(Offset));
+            sscanf( Str, "%*s %*s %f %f %f %f", &Scale, &Offset[0], &Offset[1], &Offset[2]);
+            if ( ReadMeshTriangles( &Meshes[i], &Triangles[k], Scale, Offset) )
+                Res = Info->FirstLine + i;
+            for ( n = 0; n < Meshes[i].TrianglesNum; n++ )
+                Triangles[k++].Line = i;
+            continue;
+        }
+        n = sscanf( Str, "%f %f %f %f %f %f %f %f %f", 
+                    &(Triangles[k].Vrtx1[0]), &(Triangles[k].Vrtx1[1]), 
+                    &(Triangles[k].Vrtx1[2]), &(Triangles[k].Vrtx2[0]), 
+                    &(Triangles[k].Vrtx2[1]), &(Triangles[k].Vrtx2[2]), 
+                    &(Triangles[k].Vrtx3[0]), &(Triangles[k].Vrtx3[1]), 
+                    &(Triangles[k].Vrtx3[2]));
+        /* An error has occured */
+        if ( n != 9 )
+            Res = Info->FirstLine + i;
+        Triangles[k++].Line = i;
+    }
+
+    for ( i = 0; i < LinesNum; i++ )
+        CloseMesh( &Meshes[i]);
+    free( Meshes);
+
+    Sim->Obstacles = (void *)Triangles;
+    Sim->ObstaclesNumber = TrianglesNum;
 
     return Res;
-} /* ReadObstaclesSection */
+} /* ReadObstacleTriangles */
+
+/**********************************************************/
+
+/**
+ * Read motion section which is specified by <Info> from array with 
+ * scene description <Scene>. Every string is a key of the motion of 
+ * the obstacles given by the lines FIRST ... LAST of the obstacles 
+ * section (numbered from 1 without the comments, a mesh is one line) -
+ * "FIRST[-LAST] TIME DX DY ANGLE [PX PY]" in 2D simulation or
+ * "FIRST[-LAST] TIME DX DY DZ ANGLE AX AY AZ [PX PY PZ]" in 3D
+ * simulation: at the moment TIME the
+ * obstacles are rotated by ANGLE (degrees) about the axis A (Z in 2D)
+ * passing through the point P (the origin by default) and then moved
+ * by D. The keys of the same lines make one body, they are sorted by
+ * time. The function returns 0 if succeeded and the number of string
+ * containing an error otherwise.
+ */
+static int
+ReadMotionSection( struct Simulation *Sim,   /* Simulation */
+                   char **Scene,             /* Array with scene description */
+                   struct Section *Info)     /* Section's info */
+{
+    struct MovingBody *Body;
+    struct MotionKey Key;
+    int FirstLine, LastLine;
+    int i, j, k, n;
+
+    for ( i = Info->FirstLine; i < Info->EndLine; i++ )
+    {
+        /* The lines of the body */
+        n = sscanf( Scene[i], "%d-%d", &FirstLine, &LastLine);
+        if ( n < 1 )
+            return i;
+        if ( n == 1 )
+            LastLine = FirstLine;
+        if ( FirstLine < 1 || LastLine < FirstLine )
+            return i;
+        FirstLine--;
+        LastLine--;
+
+        /* The pose of the key */
+        memset( &Key, 0, sizeof(Key));
+        if ( Sim->Dimension == 2 )
+        {
+            n = sscanf( Scene[i], "%*s %f %f %f %f %f %f", &Key.Time, 
+                        &Key.Offset[0], &Key.Offset[1], &Key.Angle, 
+                        &Key.Pivot[0], &Key.Pivot[1]);
+            Key.Axis[2] = 1.0f;
+            if ( n != 4 && n != 6 )
+                return i;
+        }
+        else
+        {
+            n = sscanf( Scene[i], "%*s %f %f %f %f %f %f %f %f %f %f %f", 
+                        &Key.Time, &Key.Offset[0], &Key.Offset[1], 
+                        &Key.Offset[2], &Key.Angle, &Key.Axis[0], 
+                        &Key.Axis[1], &Key.Axis[2], &Key.Pivot[0], 
+                        &Key.Pivot[1], &Key.Pivot[2]);
+            if ( n != 8 && n != 11 )
+                return i;
+        }
+
+        /* The body of the lines (the bodies can't share the lines) */
+        for ( j = 0; j < Sim->BodiesNumber; j++ )
+        {
+            Body = &Sim->Bodies[j];
+            if ( Body->FirstLine == FirstLine && Body->LastLine == LastLine )
+                break;
+            if ( Body->FirstLine <= LastLine && FirstLine <= Body->LastLine )
+                return i;
+        }
+        if ( j == Sim->BodiesNumber )
+        {
+            Sim->Bodies = (struct MovingBody *)
+                          realloc( Sim->Bodies, (j + 1) * sizeof(struct MovingBody));
+            Sim->BodiesNumber++;
+            memset( &Sim->Bodies[j], 0, sizeof(struct MovingBody));
+            Sim->Bodies[j].FirstLine = FirstLine;
+            Sim->Bodies[j].LastLine = LastLine;
+        }
+        Body = &Sim->Bodies[j];
+
+        /* Insert the key keeping the keys sorted */
+        Body->Keys = (struct MotionKey *)
+                     realloc( Body->Keys, (Body->KeysNum + 1) * sizeof(struct MotionKey));
+        for ( k = Body->KeysNum; k > 0 && Body->Keys[k - 1].Time > Key.Time; k-- )
+            Body->Keys[k] = Body->Keys[k - 1];
+        Body->Keys[k] = Key;
+        Body->KeysNum++;
+    }
+
+    return 0;
+} /* ReadMotionSection */
 
 /**********************************************************/
 
 /**
  * Read clouds section which is specified by <Info> from array with 
  * scene description <Scene>, initialize corresponding data structures
- * and create smoothing particles. The function returns 0 if succeeded 
- * and the number of string containing an error otherwise.
+ * and create smoothing particles. The particles of all the clouds are
+ * counted first, then every cloud is filled with them in parallel right
+ * in the array of the particles, and then the clouds are unified one by
+ * one. The function returns 0 if succeeded and the number of string 
+ * containing an error otherwise.
  */
 static int
-ReadCloudsSection( char **Scene,           /* Array with scene description */
-                   struct Section *Info)   /* Section's info */
+ReadCloudsSection( struct Simulation *Sim,   /* Simulation */
+                   char **Scene,             /* Array with scene description */
+                   struct Section *Info)     /* Section's info */
 {
-    float **Pnts;
+    struct Particle *Particles;
+    struct Cloud *Clouds;
+    int *First;
+    int CloudsNum;
     int PntsNum;
-    int Res;
-    int i, j, n;
+    int Dimension;
+    int i, j, k, n;
     
-    Pnts = NULL;
-    PntsNum = 0;
-    Res = 0;
-    
-    if ( Dimension == 2 )
+    Dimension = Sim->Dimension;
+    CloudsNum = Info->EndLine - Info->FirstLine;
+    if ( CloudsNum < 0 )
+        CloudsNum = 0;
+    Clouds = (struct Cloud *)calloc( CloudsNum + 1, sizeof(struct Cloud));
+
+    for ( k = 0; k < CloudsNum; k++ )
     {
-        float Vrtx1[2], Vrtx2[2], Vrtx3[2];
-        float Vel[2];
-        
-        for ( i = Info->FirstLine; i < Info->EndLine; i++ )
+        i = Info->FirstLine + k;
+        if ( Dimension == 2 )
         {
             /* In 2D simulation cloud of particle 
              * has the form of a parallelogram */
             n = sscanf( Scene[i], "%f %f  %f %f  %f %f  %f %f", 
-                                   &Vrtx1[0], &Vrtx1[1], 
-                                   &Vrtx2[0], &Vrtx2[1], 
-                                   &Vrtx3[0], &Vrtx3[1], 
-                                   &Vel[0], &Vel[1]);
+                                   &Clouds[k].Vrtx[0][0], &Clouds[k].Vrtx[0][1], 
+                                   &Clouds[k].Vrtx[1][0], &Clouds[k].Vrtx[1][1], 
+                                   &Clouds[k].Vrtx[2][0], &Clouds[k].Vrtx[2][1], 
+                                   &Clouds[k].Vel[0], &Clouds[k].Vel[1]);
             /* An error has occured */
             if ( n != 8 )
                 break;
-            /* Fill parallelogram with points */
-            n = PntsNum;
-            FillParlgramWithPoints( Vrtx1, Vrtx2, Vrtx3, &Pnts, 
-                                    &PntsNum, ParticlesDistrib);
-            /* Create new particles using coordinates of points 
-             * which the parallelogram has been filled with */
-            UnifyPoints( n, &Pnts, &PntsNum);
-            Particles = (struct Particle *)
-                        realloc( Particles, PntsNum * sizeof(struct Particle));
-            for ( j = n; j < PntsNum; j++ )
-            {
-                memset( &Particles[j], 0, sizeof(struct Particle));
-                /* Particle's position */
-                memcpy( Particles[j].Pos, Pnts[j], Dimension * sizeof(float));
-                /* Particle's velocity */
-                memcpy( Particles[j].Vel, Vel, Dimension * sizeof(float));
-                memcpy( Particles[j].IvalVel, Vel, Dimension * sizeof(float));
-            }
         }
-    }
-    else if ( Dimension == 3 )
-    {
-        float Vrtx1[3], Vrtx2[3], Vrtx3[3], Vrtx4[3];
-        float Vel[3];
-        
-        for ( i = Info->FirstLine; i < Info->EndLine; i++ )
+        else if ( Dimension == 3 )
         {
             /* In 3D simulation cloud of particle 
              * has the form of a parallelepiped */
             n = sscanf( Scene[i], "%f %f %f  %f %f %f  %f %f %f \
                                    %f %f %f  %f %f %f", 
-                                   &Vrtx1[0], &Vrtx1[1], &Vrtx1[2], 
-                                   &Vrtx2[0], &Vrtx2[1], &Vrtx2[2], 
-                                   &Vrtx3[0], &Vrtx3[1], &Vrtx3[2], 
-                                   &Vrtx4[0], &Vrtx4[1], &Vrtx4[2], 
-                                   &Vel[0], &Vel[1], &Vel[2]);
+                                   &Clouds[k].Vrtx[0][0], &Clouds[k].Vrtx[0][1], &Clouds[k].Vrtx[0][2], 
+                                   &Clouds[k].Vrtx[1][0], &Clouds[k].Vrtx[1][1], &Clouds[k].Vrtx[1][2], 
+                                   &Clouds[k].Vrtx[2][0], &Clouds[k].Vrtx[2][1], &Clouds[k].Vrtx[2][2], 
+                                   &Clouds[k].Vrtx[3][0], &Clouds[k].Vrtx[3][1], &Clouds[k].Vrtx[3][2], 
+                                   &Clouds[k].Vel[0], &Clouds[k].Vel[1], &Clouds[k].Vel[2]);
             /* An error has occured */
             if ( n != 15 )
                 break;
-            /* Fill parallelepiped with points */
-            n = PntsNum;
-            FillParlpipedWithPoints( Vrtx1, Vrtx2, Vrtx3, Vrtx4, 
-                                     &Pnts, &PntsNum, ParticlesDistrib);
-            /* Create new particles using coordinates of points 
-             * which the parallelepiped has been filled with */
-            UnifyPoints( n, &Pnts, &PntsNum);
-            Particles = (struct Particle *)
-                        realloc( Particles, PntsNum * sizeof(struct Particle));
-            for ( j = n; j < PntsNum; j++ )
-            {
-                memset( &Particles[j], 0, sizeof(struct Particle));
-                /* Particle's position */
-                memcpy( Particles[j].Pos, Pnts[j], Dimension * sizeof(float));
-                /* Particle's velocity */
-                memcpy( Particles[j].Vel, Vel, Dimension * sizeof(float));
-                memcpy( Particles[j].IvalVel, Vel, Dimension * sizeof(float));
-            }
         }
     }
 
-    if ( i != Info->EndLine )
+    if ( k != CloudsNum )
     {
         /* An error has occured */
-        free( Particles);
-        Res = i;
+        free( Clouds);
+        return Info->FirstLine + k;
     }
-    else
+
+    /* The first particle of every cloud */
+    First = (int *)malloc( (CloudsNum + 1) * sizeof(int));
+    First[0] = 0;
+    for ( k = 0; k < CloudsNum; k++ )
+        First[k + 1] = First[k] + FillCloudWithPoints( Dimension, &Clouds[k], NULL, 0,
+                                                       Sim->ParticlesDistrib);
+
+    /* Create the particles filling the clouds with them */
+    Particles = (struct Particle *)calloc( First[CloudsNum] + 1, sizeof(struct Particle));
+    for ( k = 0; k < CloudsNum; k++ )
     {
-        /* Set other particles' parameters */
-        for ( i = 0; i < PntsNum; i++ )
+        FillCloudWithPoints( Dimension, &Clouds[k], Particles[First[k]].Pos, 
+                             sizeof(struct Particle), Sim->ParticlesDistrib);
+#pragma omp parallel for schedule(static)
+        for ( j = First[k]; j < First[k + 1]; j++ )
         {
-            /* Particle's density */
-            Particles[i].Dens = Density0;
-            Particles[i].IvalDens = Density0;
-            /* Particle's mass */
-            Particles[i].Mass = pow( ParticlesDistrib, 3) * Density0;
+            /* Particle's velocity */
+            memcpy( Particles[j].Vel, Clouds[k].Vel, Dimension * sizeof(float));
+#ifndef LEAN_PARTICLES
+            memcpy( Particles[j].IvalVel, Clouds[k].Vel, Dimension * sizeof(float));
+#endif
         }
-        /* Update the number of the particles */
-        ParticlesNumber = PntsNum;
     }
-    
-    /* Delete points */
-    for ( i = 0; i < PntsNum; i++ )
-        free( Pnts[i]);
-    free( Pnts);
 
-    return Res;
+    /* The clouds are unified at once (the first of the repeated 
+     * particles is kept, so it moves with the first cloud) */
+    PntsNum = First[CloudsNum];
+    UnifyPoints( Dimension, 0, Particles[0].Pos, 
+                 sizeof(struct Particle), 0.0f, Sim->Periodic, &PntsNum);
+    Particles = (struct Particle *)
+                realloc( Particles, (PntsNum + 1) * sizeof(struct Particle));
+    free( First);
+    free( Clouds);
+
+    /* Set other particles' parameters */
+#pragma omp parallel for schedule(static)
+    for ( i = 0; i < PntsNum; i++ )
+    {
+        /* Particle's density */
+        Particles[i].Dens = Sim->Density0;
+#ifndef LEAN_PARTICLES
+        Particles[i].IvalDens = Sim->Density0;
+#endif
+        /* Particle's mass */
+        Particles[i].Mass = pow( Sim->ParticlesDistrib, 3) * Sim->Density0;
+        /* Particle's smoothing length */
+        Particles[i].SmoothR = Sim->SmoothR;
+        /* Particle's identifier */
+        Particles[i].Id = i;
+    }
+    /* Update the particles */
+    Sim->Particles = Particles;
+    Sim->ParticlesNumber = PntsNum;
+    Sim->ParticlesSize = PntsNum + 1;
+    Sim->NextParticleId = PntsNum;
+    Sim->ParticleMass = pow( Sim->ParticlesDistrib, 3) * Sim->Density0;
+
+    return 0;
 } /* ReadCloudsSection */
 
 /**********************************************************/
@@ -454,10 +820,10 @@ ReadCloudsSection( char **Scene,           /* Array with scene description */
 /* Parameter's info */
 struct Param
 {
-    char *Name;   /* Name of the parameter         */
-    int Type;     /* Type of the parameter         */
-    void *Var;    /* Pointer to a variable the 
-                     parameter's value to store in */
+    char *Name;     /* Name of the parameter         */
+    int Type;       /* Type of the parameter         */
+    size_t Offset;  /* Offset of a field of the simulation 
+                       the parameter's value to store in */
 };
 
 /* Possible types of parameters */
@@ -466,41 +832,95 @@ enum ParamsTypes
     INT_PARAM,       /* int    */
     FLOAT_PARAM,     /* float  */
     STRING_PARAM,    /* char*  */
+    PATH_PARAM,      /* char*, the name of a file */
+    RANGE_PARAM,     /* float2 */
 };
 
 /* The maximum length of a parameter-string */
-#define STRING_PARAM_LENGTH  16
+#define STRING_PARAM_LENGTH  (TYPE_NAME_LENGTH - 1)
+
+/* The maximum length of a parameter-path */
+#define PATH_PARAM_LENGTH    (PATH_NAME_LENGTH - 1)
 
 /* The maximum length of a parameter's name */
 #define PARAM_NAME_LENGTH  16
 
+/* Offset of the field of the simulation */
+#define SIM_FIELD(Field)   offsetof(struct Simulation, Field)
+
 /* Possible parameters in the parameters section */
 static struct Param Params[] =
 {
     /* Dimension of the simulation                 */
-    "DIM",           INT_PARAM,     (void *)(&Dimension),
+    "DIM",           INT_PARAM,     SIM_FIELD(Dimension),
     /* Initial particle distribution               */
-    "PRTS_DISTR",    FLOAT_PARAM,   (void *)(&ParticlesDistrib),
+    "PRTS_DISTR",    FLOAT_PARAM,   SIM_FIELD(ParticlesDistrib),
     /* Initial boundary particle distribution      */
-    "BPRTS_DISTR",   FLOAT_PARAM,   (void *)(&BParticlesDistrib),
+    "BPRTS_DISTR",   FLOAT_PARAM,   SIM_FIELD(BParticlesDistrib),
     /* Rest density                                */
-    "DENS0",         FLOAT_PARAM,   (void *)(&Density0),
+    "DENS0",         FLOAT_PARAM,   SIM_FIELD(Density0),
     /* Speed of sound                              */
-    "SOS",           FLOAT_PARAM,   (void *)(&SOS),
+    "SOS",           FLOAT_PARAM,   SIM_FIELD(SOS),
     /* Kernel to use in the calculations           */
-    "KERNEL",        STRING_PARAM,  (void *)(KernelType),
+    "KERNEL",        STRING_PARAM,  SIM_FIELD(KernelType),
     /* Kernel's smoothing length                   */
-    "SMOOTH_LEN",    FLOAT_PARAM,   (void *)(&SmoothR),
+    "SMOOTH_LEN",    FLOAT_PARAM,   SIM_FIELD(SmoothR),
     /* Equation of state to calculate pressures    */
-    "EOS",           STRING_PARAM,  (void *)(EOSType),
+    "EOS",           STRING_PARAM,  SIM_FIELD(EOSType),
     /* Alpha factor to calculate viscosity         */
-    "VISC_ALPHA",    FLOAT_PARAM,   (void *)(&ViscAlpha),
+    "VISC_ALPHA",    FLOAT_PARAM,   SIM_FIELD(ViscAlpha),
     /* Beta factor to calculate viscosity          */
-    "VISC_BETA",     FLOAT_PARAM,   (void *)(&ViscBeta),
+    "VISC_BETA",     FLOAT_PARAM,   SIM_FIELD(ViscBeta),
     /* Time step of integration                    */
-    "TIME_STEP",     FLOAT_PARAM,   (void *)(&TimeStep),
+    "TIME_STEP",     FLOAT_PARAM,   SIM_FIELD(TimeStep),
+    /* Scheme of the time integration              */
+    "INTEGRATOR",    STRING_PARAM,  SIM_FIELD(Integrator),
+    /* Maximum density error (incompressible EOS)  */
+    "DENS_ERR",      FLOAT_PARAM,   SIM_FIELD(MaxDensError),
     /* Clipping volume (the area to render)        */
-    "CLIP_VOL",      FLOAT_PARAM,   (void *)(&ClipVolume),
+    "CLIP_VOL",      FLOAT_PARAM,   SIM_FIELD(ClipVolume),
+    /* Periodic boundaries along X-axis            */
+    "PERIODIC_X",    RANGE_PARAM,   SIM_FIELD(Periodic[0]),
+    /* Periodic boundaries along Y-axis            */
+    "PERIODIC_Y",    RANGE_PARAM,   SIM_FIELD(Periodic[1]),
+    /* Periodic boundaries along Z-axis            */
+    "PERIODIC_Z",    RANGE_PARAM,   SIM_FIELD(Periodic[2]),
+    /* Method to search for the neighbours         */
+    "NEIGHB_SEARCH", STRING_PARAM,  SIM_FIELD(NeighbSearch),
+    /* Limits of adaptive smoothing lengths        */
+    "ADAPT_SMOOTH",  RANGE_PARAM,   SIM_FIELD(AdaptSmooth),
+    /* Number of the levels of the refinement      */
+    "REFINE_LEVELS", INT_PARAM,     SIM_FIELD(RefineLevels),
+    /* Distance to the boundary to refine within   */
+    "REFINE_DIST",   FLOAT_PARAM,   SIM_FIELD(RefineDist),
+    /* Velocity gradient to refine above           */
+    "REFINE_GRAD",   FLOAT_PARAM,   SIM_FIELD(RefineVelGrad),
+    /* Interval between the sorts of the particles */
+    "SORT_INTERVAL", INT_PARAM,     SIM_FIELD(SortInterval),
+    /* Interval between the surfaces written       */
+    "SURFACE_STEPS", INT_PARAM,     SIM_FIELD(SurfaceInterval),
+    /* Size of the cells of the surface's grid     */
+    "SURFACE_CELL",  FLOAT_PARAM,   SIM_FIELD(SurfaceCell),
+    /* Prefix of the surface's files               */
+    "SURFACE_FILE",  PATH_PARAM,    SIM_FIELD(SurfaceFile),
+    /* Interval between the diagnostics' lines     */
+    "DIAG_STEPS",    INT_PARAM,     SIM_FIELD(DiagInterval),
+    /* File of the diagnostics' log                */
+    "DIAG_FILE",     PATH_PARAM,    SIM_FIELD(DiagFile),
+    /* Shared memory to publish the metrics to     */
+    "TELEMETRY",     STRING_PARAM,  SIM_FIELD(Telemetry),
+    /* Tolerance of merging the boundary points    */
+    "UNIFY_TOL",     FLOAT_PARAM,   SIM_FIELD(UnifyTolerance),
+    /* Cache of the generated particles (or OFF)   */
+    "SCENE_CACHE",   PATH_PARAM,    SIM_FIELD(SceneCache),
+    /* Boundary (PARTICLES or distance field SDF)  */
+    "BOUNDARY",      STRING_PARAM,  SIM_FIELD(Boundary),
+    /* Size of the cells of the distance field     */
+    "SDF_CELL",      FLOAT_PARAM,   SIM_FIELD(DistFieldCell),
+    /* Sweep the particles against the obstacles   */
+    "COLLISIONS",    INT_PARAM,     SIM_FIELD(Collisions),
+    /* Normal velocity kept by the bounce          */
+    "RESTITUTION",   FLOAT_PARAM,   SIM_FIELD(Restitution),
 };
 
 /* The size of this array */
@@ -513,141 +933,288 @@ static int ParamsNum = sizeof(Params) / sizeof(Params[0]);
  * of string containing an error otherwise.
  */
 static int
-ReadParamsSection( char **Scene,           /* Array with scene description */
-                   struct Section *Info)   /* Section's info */
+ReadParamsSection( struct Simulation *Sim,   /* Simulation */
+                   char **Scene,             /* Array with scene description */
+                   struct Section *Info)     /* Section's info */
+{
+    int i;
+
+    /* Read parameters from the parameters section */
+    for ( i = Info->FirstLine; i < Info->EndLine; i++ )
+    {
+        /* The parameter isn't valid */
+        if ( SetSceneParam( Sim, Scene[i]) )
+            return i;
+    }
+
+    return 0;
+} /* ReadParamsSection */
+
+/**********************************************************/
+
+/**
+ * Set the parameter of the simulation <Sim> from the string <Str> 
+ * written as in the parameters section of the scene description 
+ * file ("NAME value"). The function returns 0 if succeeded and -1 
+ * if the parameter isn't valid (the strings which are too long for
+ * their fields aren't cut, they aren't valid).
+ */
+int
+SetSceneParam( struct Simulation *Sim,   /* Simulation */
+               const char *Str)          /* Parameter's name and value */
 {
     char Name[PARAM_NAME_LENGTH + 1];
+    char *Var;
     char Fmt[10];
-    int i, j, n;
-    int Res;
+    size_t Length;
+    int j, n;
 
-    Res = 0;
+    sprintf( Fmt, "%%%ds %%n", PARAM_NAME_LENGTH);
+    if ( sscanf( Str, Fmt, Name, &n) < 1 )
+        return -1;
 
-    /* Read parameters from the parameters section */
-    for ( i = Info->FirstLine; i < Info->EndLine; i++ )
+    for ( j = 0; j < ParamsNum; j++ )
     {
-        sprintf( Fmt, "%%%ds %%n", PARAM_NAME_LENGTH);
-        sscanf( Scene[i], Fmt, Name, &n);
+        if ( strcmp( Params[j].Name, Name) )
+            continue;
 
-        for ( j = 0; j < ParamsNum; j++ )
+        /* Some parameter has been found - read and store its value */
+        Var = (char *)Sim + Params[j].Offset;
+        if ( Params[j].Type == INT_PARAM )
         {
-            if ( strcmp( Params[j].Name, Name) )
-                continue;
-
-            /* Some parameter has been found - read and store its value */
-            if ( Params[j].Type == INT_PARAM )
-            {
-                /* The type of the parameter is integer */
-                sscanf( Scene[i] + n, "%d", (int *)Params[j].Var);
-                break;
-            }
-            else if ( Params[j].Type == FLOAT_PARAM )
-            {
-                /* The type of the parameter is float */
-                sscanf( Scene[i] + n, "%f", (float *)Params[j].Var);
-                break;
-            }
-            else if ( Params[j].Type == STRING_PARAM )
+            /* The type of the parameter is integer */
+            sscanf( Str + n, "%d", (int *)Var);
+            break;
+        }
+        else if ( Params[j].Type == FLOAT_PARAM )
+        {
+            /* The type of the parameter is float */
+            sscanf( Str + n, "%f", (float *)Var);
+            break;
+        }
+        else if ( Params[j].Type == STRING_PARAM || Params[j].Type == PATH_PARAM )
+        {
+            /* The type of the parameter is string (char *), it's the
+             * first word of the value */
+            Str += n;
+            Length = strcspn( Str, " \t\r\n");
+            if ( Length > (size_t)(( Params[j].Type == STRING_PARAM ) ?
+                                   STRING_PARAM_LENGTH : PATH_PARAM_LENGTH) )
             {
-                /* The type of the parameter is string (char *) */
-                sprintf( Fmt, "%%%ds", STRING_PARAM_LENGTH);
-                sscanf( Scene[i] + n, Fmt, (char *)Params[j].Var);
-                break;
+                printf( "The value of %s is too long\n", Name);
+                return -1;
             }
+            memcpy( Var, Str, Length);
+            Var[Length] = '\0';
+            break;
         }
-        
-        if ( j == ParamsNum )
+        else if ( Params[j].Type == RANGE_PARAM )
         {
-            /* The parameter isn't valid */
-            Res = i;
+            /* The type of the parameter is range (float[2]) */
+            sscanf( Str + n, "%f %f", (float *)Var, 
+                                      (float *)Var + 1);
             break;
         }
     }
+    
+    /* The parameter isn't valid */
+    if ( j == ParamsNum )
+        return -1;
 
-    return Res;
-} /* ReadParamsSection */
+    return 0;
+} /* SetSceneParam */
 
 /**********************************************************/
 
 /**
- * Unification of array of points - the function searches for identical 
- * points in the array <Pnts> of the size <PntsNum>, eliminates all of 
- * them but one, and shift the array. New size of the array is returned 
- * through <PntsNum>. The size of the part of the array which is already 
- * unified is set through <UnifiedPart>.
+ * Unification of array of points - the function eliminates the repeated
+ * points of the array <Pnts> of the size <PntsNum> (the first of them 
+ * is kept) and shifts the array keeping the order of the points. The 
+ * points are the first <Dim> floats of the records of <Stride> bytes, 
+ * the records are moved as a whole. The points are identical if they 
+ * are equal exactly or, if <Snap> is positive, if they are rounded to
+ * the same node of the lattice with the spacing <Snap>. Along the axes
+ * which are periodic (their ranges <Periodic> aren't empty) the points
+ * are compared as they are wrapped into the range (the points within
+ * half of the spacing of its upper bound are at the lower one), but
+ * they are kept where they are. The points are found by their keys in
+ * the hash, so the expected time is linear. New size of the array is
+ * returned through <PntsNum>. The size of the part of the array which
+ * is already unified is set through <UnifiedPart>.
  */
 static void
-UnifyPoints( int UnifiedPart, /* Unified part of the array */
-             float ***Pnts,   /* Array of points */
-             int *PntsNum)    /* Size of the array */
+UnifyPoints( int Dim,               /* Dimension */
+             int UnifiedPart,       /* Unified part of the array */
+             float *Pnts,           /* Array of points */
+             int Stride,            /* Size of the records (bytes) */
+             float Snap,            /* Spacing of the lattice (0 - exact) */
+             float (*Periodic)[2],  /* Periodic ranges of the axes */
+             int *PntsNum)          /* Size of the array */
 {
-    float **p;
-    int i, j, k;
+    unsigned int *Keys;
+    unsigned int *Key;
+    unsigned int Hash;
+    float Period;
+    float x;
+    float *Pnt;
+    int *Table;
+    int TableSize;
+    int Slot;
+    int Kept;
+    int j, d;
     int n;
 
-    /* Array of points */
-    p = *Pnts;
     /* Current size of the array */
     n = *PntsNum;
     
-    /* Unify the array */
-    for ( i = 0; i < n - 1; i++ )
+    /* The keys of the points (the bits of the coordinates 
+     * or the indices of the nodes of the lattice) */
+    Keys = (unsigned int *)malloc( (3 * n + 3) * sizeof(unsigned int));
+#pragma omp parallel for schedule(static) private(Pnt,Period,x,d)
+    for ( j = 0; j < n; j++ )
     {
-        /* Search from the current position for 
-         * point which is identical to p[i] */
-        for ( j = ((UnifiedPart > i) ? UnifiedPart : i) + 1; j < n; j++ )
+        Pnt = (float *)((char *)Pnts + (size_t)j * Stride);
+        for ( d = 0; d < 3; d++ )
         {
-            /* Is point identical to p[i]? */
-            if ( memcmp( p[i], p[j], Dimension * sizeof(float)) )
+            Keys[3 * j + d] = 0;
+            if ( d >= Dim )
                 continue;
-            /* Eliminate p[j] */
-            free (p[j]);
-            n--;
-            /* Search from the end of the array 
-             * for point to replace p[j] */
-            for ( k = n; k > j; k-- )
+            x = Pnt[d];
+            Period = Periodic[d][1] - Periodic[d][0];
+            if ( Period > 0.0f )
             {
-                /* Is point identical to p[j]? */
-                if ( memcmp( p[i], p[k], Dimension * sizeof(float)) )
-                {
-                    /* Replace */
-                    p[j] = p[k];
-                    p[k] = NULL;
-                    break;
-                }
-                /* Eliminate p[k] */
-                free (p[k]);
-                n--;
+                x -= Periodic[d][0] - Snap / 2.0f;
+                x -= Period * (float)floor( x / Period);
+                x += Periodic[d][0] - Snap / 2.0f;
             }
+            if ( Snap > 0.0f )
+                Keys[3 * j + d] = (unsigned int)(int)floor( x / Snap + 0.5f);
+            else
+                memcpy( &Keys[3 * j + d], &x, sizeof(float));
+        }
+    }
+
+    /* Open addressing table of the kept points (at most half full) */
+    for ( TableSize = 1; TableSize < 2 * n; TableSize *= 2 )
+        ;
+    Table = (int *)malloc( TableSize * sizeof(int));
+    for ( Slot = 0; Slot < TableSize; Slot++ )
+        Table[Slot] = -1;
+
+    /* Unify the array */
+    Kept = 0;
+    for ( j = 0; j < n; j++ )
+    {
+        Key = &Keys[3 * j];
+        Hash = Key[0] * 73856093u ^ Key[1] * 19349663u ^ Key[2] * 83492791u;
+        Hash ^= Hash >> 16;
+        Slot = (int)(Hash & (unsigned int)(TableSize - 1));
+
+        /* Linear probing for the same key */
+        for ( ; Table[Slot] >= 0; Slot = (Slot + 1) & (TableSize - 1) )
+        {
+            if ( memcmp( &Keys[3 * Table[Slot]], Key, 3 * sizeof(unsigned int)) == 0 )
+                break;
+        }
+
+        /* Eliminate the point (the unified part is kept as it is) */
+        if ( Table[Slot] >= 0 && j >= UnifiedPart )
+            continue;
+
+        /* Keep the point at the end of the kept ones */
+        if ( Kept != j )
+        {
+            memcpy( (char *)Pnts + (size_t)Kept * Stride, 
+                    (char *)Pnts + (size_t)j * Stride, Stride);
+            memcpy( &Keys[3 * Kept], Key, 3 * sizeof(unsigned int));
         }
+        if ( Table[Slot] < 0 )
+            Table[Slot] = Kept;
+        Kept++;
     }
+
+    free( Keys);
+    free( Table);
     
     /* New size of the array */
-    *PntsNum = n;
-    /* Reallocate the array */
-    p = (float **)realloc( p, n * sizeof(float *));
-    *Pnts = p;
+    *PntsNum = Kept;
 
     return;
 } /* UnifyPoints */
 
 /**********************************************************/
 
+/**
+ * The function fills the cloud <Cloud> with points (a parallelogram in
+ * 2D simulation and a parallelepiped in 3D simulation), the interval 
+ * between points is set by <Ival>. The points are written to the array
+ * <Pnts> of records of <Stride> bytes (if it's NULL, they are only 
+ * counted). The function returns the number of the points.
+ */
+static int
+FillCloudWithPoints( int Dim,             /* Dimension */
+                     struct Cloud *Cloud, /* Cloud */
+                     float *Pnts,         /* Array of points */
+                     int Stride,          /* Size of the records (bytes) */
+                     float Ival)          /* Interval between points */
+{
+    if ( Dim == 2 )
+        return FillParlgramWithPoints( Dim, Cloud->Vrtx[0], Cloud->Vrtx[1], 
+                                       Cloud->Vrtx[2], Pnts, Stride, Ival);
+    else
+        return FillParlpipedWithPoints( Dim, Cloud->Vrtx[0], Cloud->Vrtx[1], 
+                                        Cloud->Vrtx[2], Cloud->Vrtx[3], Pnts, 
+                                        Stride, Ival);
+} /* FillCloudWithPoints */
+
+/**
+ * The function fills the obstacle <Obstacle> with points (a segment in
+ * 2D simulation and a triangle in 3D simulation), the interval between
+ * points is set by <Ival>. The points are written to the array <Pnts>
+ * of records of <Stride> bytes (if it's NULL, they are only counted). 
+ * The function returns the number of the points.
+ */
+static int
+FillObstacleWithPoints( int Dim,          /* Dimension */
+                        void *Obstacle,   /* Obstacle */
+                        float *Pnts,      /* Array of points */
+                        int Stride,       /* Size of the records (bytes) */
+                        float Ival)       /* Interval between points */
+{
+    struct ObstacleSegment *Segment;
+    struct ObstacleTriangle *Triangle;
+    float Vec[3];
+
+    if ( Dim == 2 )
+    {
+        Segment = (struct ObstacleSegment *)Obstacle;
+        VectorSubstraction( Dim, Vec, Segment->Vrtx2, Segment->Vrtx1);
+        return FillSegmentWithPoints( Dim, Segment->Vrtx1, Vec, Pnts, Stride, Ival);
+    }
+    else
+    {
+        Triangle = (struct ObstacleTriangle *)Obstacle;
+        return FillTriangleWithPoints( Dim, Triangle->Vrtx1, Triangle->Vrtx2, 
+                                       Triangle->Vrtx3, Pnts, Stride, Ival);
+    }
+} /* FillObstacleWithPoints */
+
+/**********************************************************/
+
 /**
  * The function fills triangle given by <Vrtx1>, <Vrtx2> and <Vrtx3> with 
- * points, the interval between points is set by <Ival>. At the moment of 
- * function invocation, the array <Pnts> could already contain some points 
- * and in this case <PntsNum> has to contain its current size; if the 
- * array is empty, <Pnts> has to be set to NULL, and <PntsNum> has to be 
- * set to 0. New points are stored in the end of reallocated array <Pnts>, 
- * new size of the array is returned through <PntsNum>.
+ * points, the interval between points is set by <Ival>. The points are 
+ * written to the array <Pnts> of records of <Stride> bytes (the first 
+ * floats of every record), if <Pnts> is NULL they are only counted. The
+ * function returns the number of the points.
  */
-static void
-FillTriangleWithPoints( float *Vrtx1,   /* Vertex 1 */
+static int
+FillTriangleWithPoints( int Dim,        /* Dimension */
+                        float *Vrtx1,   /* Vertex 1 */
                         float *Vrtx2,   /* Vertex 2 */
                         float *Vrtx3,   /* Vertex 3 */
-                        float ***Pnts,  /* Array of points */
-                        int *PntsNum,   /* Size of the array */
+                        float *Pnts,    /* Array of points */
+                        int Stride,     /* Size of the records (bytes) */
                         float Ival)     /* Interval between points */
 {
     float Vec[3], Vec1[3], Vec2[3];
@@ -655,29 +1222,33 @@ FillTriangleWithPoints( float *Vrtx1,   /* Vertex 1 */
     float Offset;
     float Param;
     float R;
-    int i, j;
+    int i, j, n;
     
     /* Reference vectors */
-    VectorSubstraction( Vec1, Vrtx2, Vrtx1);
-    VectorSubstraction( Vec2, Vrtx3, Vrtx1);
+    VectorSubstraction( Dim, Vec1, Vrtx2, Vrtx1);
+    VectorSubstraction( Dim, Vec2, Vrtx3, Vrtx1);
     /* The length of the triangle's side */
-    R = VectorNorm( Vec1);
+    R = VectorNorm( Dim, Vec1);
     /* The number of points the triangle's side can be filled with */
     j = (int)(R / Ival);
-    /* Fill triangle with points */
+    /* Fill triangle with points (the segments 
+     * have different numbers of the points) */
+    n = 0;
     Offset = (R - (float)(j - 1) * Ival) / 2;
     for ( i = 0; i < j; i++ )
     {
         /* Get point1 on one triangle's side and point2 on another */
         Param = R ? ((Ival * (float)i + Offset) / R) : 0;
-        GetPointOnSegmentByParam( Vrtx1, Vec1, Pnt1, Param);
-        GetPointOnSegmentByParam( Vrtx1, Vec2, Pnt2, Param);
+        GetPointOnSegmentByParam( Dim, Vrtx1, Vec1, Pnt1, Param);
+        GetPointOnSegmentByParam( Dim, Vrtx1, Vec2, Pnt2, Param);
         /* Fill the resulting segment with points */
-        VectorSubstraction( Vec, Pnt2, Pnt1);
-        FillSegmentWithPoints( Pnt1, Vec, Pnts, PntsNum, Ival);
+        VectorSubstraction( Dim, Vec, Pnt2, Pnt1);
+        n += FillSegmentWithPoints( Dim, Pnt1, Vec, ( Pnts == NULL ) ? NULL :
+                                    (float *)((char *)Pnts + (size_t)n * Stride),
+                                    Stride, Ival);
     }
     
-    return;
+    return n;
 } /* FillTriangleWithPoints */
 
 /**********************************************************/
@@ -685,44 +1256,51 @@ FillTriangleWithPoints( float *Vrtx1,   /* Vertex 1 */
 /**
  * The function fills parallelepiped given by origin <Vrtx> and reference 
  * vectors <Vec1>, <Vec2> and <Vec3> with with points, the interval between 
- * points is set by <Ival>. At the moment of function invocation, the array 
- * <Pnts> could already contain some points and in this case <PntsNum> has 
- * to contain its current size; if the array is empty, <Pnts> has to be 
- * set to NULL, and <PntsNum> has to be set to 0. New points are stored in 
- * the end of reallocated array <Pnts>, new size of the array is returned 
- * through <PntsNum>.
+ * points is set by <Ival>. The points are written to the array <Pnts> of
+ * records of <Stride> bytes (the first floats of every record), if <Pnts>
+ * is NULL they are only counted. All the layers of the parallelepiped 
+ * have the same number of the points, so they are filled in parallel. 
+ * The function returns the number of the points.
  */
-static void
-FillParlpipedWithPoints( float *Vrtx,    /* Origin */
+static int
+FillParlpipedWithPoints( int Dim,        /* Dimension */
+                         float *Vrtx,    /* Origin */
                          float *Vec1,    /* Vector 1 */
                          float *Vec2,    /* Vector 2 */
                          float *Vec3,    /* Vector 3 */
-                         float ***Pnts,  /* Array of points */
-                         int *PntsNum,   /* Size of the array */
+                         float *Pnts,    /* Array of points */
+                         int Stride,     /* Size of the records (bytes) */
                          float Ival)     /* Interval between points */
 {
     float Pnt[3];
     float Param;
     float Offset;
     float R;
-    int i, j;
+    int i, j, n;
     
     /* The length of the parallelepiped's edge */
-    R = VectorNorm( Vec1);
+    R = VectorNorm( Dim, Vec1);
     /* The number of points the parallelepiped's edge can be filled with */
     j = (int)(R / Ival);
+    /* The number of points of every layer */
+    n = FillParlgramWithPoints( Dim, Vrtx, Vec2, Vec3, NULL, Stride, Ival);
+    if ( Pnts == NULL )
+        return j * n;
     /* Fill parallelepiped with points */
     Offset = (R - (float)(j - 1) * Ival) / 2;
+#pragma omp parallel for schedule(static) private(Pnt,Param)
     for ( i = 0; i < j; i++ )
     {
         /* Get point on the parallelepiped's edge */
         Param = R ? ((Ival * (float)i + Offset) / R) : 0;
-        GetPointOnSegmentByParam( Vrtx, Vec1, Pnt, Param);
+        GetPointOnSegmentByParam( Dim, Vrtx, Vec1, Pnt, Param);
         /* Fill the parallelogram with points */
-        FillParlgramWithPoints( Pnt, Vec2, Vec3, Pnts, PntsNum, Ival);
+        FillParlgramWithPoints( Dim, Pnt, Vec2, Vec3, 
+                                (float *)((char *)Pnts + (size_t)i * n * Stride), 
+                                Stride, Ival);
     }
     
-    return;
+    return j * n;
 } /* FillParlpipedWithPoints */
 
 /**********************************************************/
@@ -730,43 +1308,50 @@ FillParlpipedWithPoints( float *Vrtx,    /* Origin */
 /**
  * The function fills parallelogram given by origin <Vrtx> and reference 
  * vectors <Vec1> and <Vec2> with points, the interval between points is 
- * set by <Ival>. At the moment of function invocation, the array <Pnts> 
- * could already contain some points and in this case <PntsNum> has to 
- * contain its current size; if the array is empty, <Pnts> has to be set 
- * to NULL, and <PntsNum> has to be set to 0. New points are stored in the 
- * end of reallocated array <Pnts>, new size of the array is returned 
- * through <PntsNum>.
+ * set by <Ival>. The points are written to the array <Pnts> of records 
+ * of <Stride> bytes (the first floats of every record), if <Pnts> is NULL
+ * they are only counted. All the rows of the parallelogram have the same
+ * number of the points, so they are filled in parallel. The function 
+ * returns the number of the points.
  */
-static void        
-FillParlgramWithPoints( float *Vrtx,    /* Origin */
+static int
+FillParlgramWithPoints( int Dim,        /* Dimension */
+                        float *Vrtx,    /* Origin */
                         float *Vec1,    /* Vector 1 */
                         float *Vec2,    /* Vector 2 */
-                        float ***Pnts,  /* Array of points */
-                        int *PntsNum,   /* Size of the array */
+                        float *Pnts,    /* Array of points */
+                        int Stride,     /* Size of the records (bytes) */
                         float Ival)     /* Interval between points */
 {
     float Pnt[3];
     float Param;
     float Offset;
     float R;
-    int i, j;
+    int i, j, n;
     
     /* The length of the parallelogram's side */
-    R = VectorNorm( Vec1);
+    R = VectorNorm( Dim, Vec1);
     /* The number of points the parallelogram's side can be filled with */
     j = (int)(R / Ival);
+    /* The number of points of every row */
+    n = FillSegmentWithPoints( Dim, Vrtx, Vec2, NULL, Stride, Ival);
+    if ( Pnts == NULL )
+        return j * n;
     /* Fill parallelogram with points */
     Offset = (R - (float)(j - 1) * Ival) / 2;
+#pragma omp parallel for schedule(static) private(Pnt,Param)
     for ( i = 0; i < j; i++ )
     {
         /* Get point on the parallelogram's side */
         Param = R ? ((Ival * (float)i + Offset) / R) : 0;
-        GetPointOnSegmentByParam( Vrtx, Vec1, Pnt, Param);
+        GetPointOnSegmentByParam( Dim, Vrtx, Vec1, Pnt, Param);
         /* Fill the segment with points */
-        FillSegmentWithPoints( Pnt, Vec2, Pnts, PntsNum, Ival);
+        FillSegmentWithPoints( Dim, Pnt, Vec2, 
+                               (float *)((char *)Pnts + (size_t)i * n * Stride), 
+                               Stride, Ival);
     }
     
-    return;
+    return j * n;
 } /* FillParlgramWithPoints */
 
 /**********************************************************/
@@ -774,47 +1359,41 @@ FillParlgramWithPoints( float *Vrtx,    /* Origin */
 /**
  * The function fills segment given by origin <Vrtx> and reference 
  * vector <Vec> with points, the interval between points is set by 
- * <Ival>. At the moment of function invocation, the array <Pnts> 
- * could already contain some points and in this case <PntsNum> has 
- * to contain its current size; if the array is empty, <Pnts> has 
- * to be set to NULL, and <PntsNum> has to be set to 0. New points 
- * are stored in the end of reallocated array <Pnts>, new size of 
- * the array is returned through <PntsNum>.
+ * <Ival>. The points are written to the array <Pnts> of records of 
+ * <Stride> bytes (the first floats of every record), if <Pnts> is 
+ * NULL they are only counted. The function returns the number of 
+ * the points.
  */
-static void
-FillSegmentWithPoints( float *Vrtx,    /* Origin */
+static int
+FillSegmentWithPoints( int Dim,        /* Dimension */
+                       float *Vrtx,    /* Origin */
                        float *Vec,     /* Vector */
-                       float ***Pnts,  /* Array of points */
-                       int *PntsNum,   /* Size of the array */
+                       float *Pnts,    /* Array of points */
+                       int Stride,     /* Size of the records (bytes) */
                        float Ival)     /* Interval between points */
 {
     float Param;
     float Offset;
     float R;
-    int i, j, n;
+    int i, j;
     
     /* The length of the segment */
-    R = VectorNorm( Vec);
-    /* Current size of the array */
-    n = *PntsNum;
+    R = VectorNorm( Dim, Vec);
     /* The number of points the segment can be filled with */
     j = (int)(R / Ival);
-    /* New size of the array */
-    *PntsNum += j;
-    /* Reallocate the array */
-    *Pnts = (float **)realloc( *Pnts, *PntsNum * sizeof(float *));
+    if ( Pnts == NULL )
+        return j;
     /* Fill segment with points */
     Offset = (R - (float)(j - 1) * Ival) / 2;
     for ( i = 0; i < j; i++ )
     {
-        /* Allocate memory for new point */
-        (*Pnts)[i + n] = (float *)malloc( Dimension * sizeof(float));
         /* Get next point on the segment by parameter and store it */
         Param = R ? ((Ival * (float)i + Offset) / R): 0;
-        GetPointOnSegmentByParam( Vrtx, Vec, (*Pnts)[i + n], Param);
+        GetPointOnSegmentByParam( Dim, Vrtx, Vec, 
+                                  (float *)((char *)Pnts + (size_t)i * Stride), Param);
     }
 
-    return;
+    return j;
 } /* FillSegmentWithPoints */
 
 /**********************************************************/
@@ -825,15 +1404,336 @@ FillSegmentWithPoints( float *Vrtx,    /* Origin */
  * point from <Vrtx> is determined by <Param> (should be [0..1]).
  */
 static void
-GetPointOnSegmentByParam( float *Vrtx,    /* Origin */
+GetPointOnSegmentByParam( int Dim,        /* Dimension */
+                          float *Vrtx,    /* Origin */
                           float *Vec,     /* Vector */
                           float *Pnt,     /* Point */
                           float Param)    /* Parameter */
 {
     int d;
     
-    for ( d = 0; d < Dimension; d++ )
+    for ( d = 0; d < Dim; d++ )
         Pnt[d] = Param * Vec[d] + Vrtx[d];
 
     return;
 } /* GetPointOnSegmentByParam */
+
+/**********************************************************/
+
+/**
+ * Get the key of the part of the scene <Scene> generated by the cached
+ * sections of <Sects> - the parameters the generation depends on, the
+ * lines of the sections and the hashes of the mesh files they refer 
+ * to. The key is allocated by the function, its size is returned 
+ * through <KeySize>.
+ */
+static char *
+GetSceneKey( struct Simulation *Sim,   /* Simulation */
+             char **Scene,             /* Array with scene description */
+             struct Section *Sects,    /* Sections' info */
+             int *KeySize)             /* Size of the key */
+{
+    char FileName[FILE_LINE_LENGTH + 1];
+    char Word[SECTION_NAME_LENGTH + 1];
+    char Fmt[16];
+    unsigned int Hash;
+    char *Key;
+    int Size;
+    int i, j;
+
+    /* The parameters are written exactly (9 digits of a float) */
+    Key = (char *)malloc( FILE_LINE_LENGTH);
+    sprintf( Key, "%d %d %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+             Sim->Dimension, (int)sizeof(struct Particle), Sim->ParticlesDistrib, 
+             Sim->BParticlesDistrib, Sim->Density0, Sim->SmoothR,
+             Sim->UnifyTolerance, Sim->Periodic[0][0], Sim->Periodic[0][1],
+             Sim->Periodic[1][0], Sim->Periodic[1][1], Sim->Periodic[2][0],
+             Sim->Periodic[2][1]);
+    Size = strlen( Key);
+
+    for ( i = 0; i < SectsNum; i++ )
+    {
+        if ( !Sects[i].Cached )
+            continue;
+        for ( j = Sects[i].FirstLine - 1; j < Sects[i].EndLine; j++ )
+        {
+            if ( j < 0 )
+                continue;
+            Key = (char *)realloc( Key, Size + strlen( Scene[j]) + 16);
+            strcpy( Key + Size, Scene[j]);
+            Size += strlen( Scene[j]);
+
+            /* The meshes are keyed by their contents */
+            sprintf( Fmt, "%%%ds %%%ds", SECTION_NAME_LENGTH, FILE_LINE_LENGTH);
+            if ( sscanf( Scene[j], Fmt, Word, FileName) == 2 && 
+                 strcmp( Word, MESH_KEYWORD) == 0 && 
+                 GetMeshHash( FileName, &Hash) == 0 )
+            {
+                sprintf( Key + Size, "%08x\n", Hash);
+                Size += strlen( Key + Size);
+            }
+        }
+    }
+
+    *KeySize = Size;
+
+    return Key;
+} /* GetSceneKey */
+
+/**
+ * Get FNV-1a hash of the <Size> bytes <Bytes> (32 bits).
+ */
+static unsigned int
+HashBytes( const char *Bytes,   /* The bytes */
+           int Size)            /* Number of the bytes */
+{
+    unsigned int Hash;
+    int i;
+
+    Hash = 2166136261u;
+    for ( i = 0; i < Size; i++ )
+    {
+        Hash ^= (unsigned char)Bytes[i];
+        Hash *= 16777619u;
+    }
+
+    return Hash;
+} /* HashBytes */
+
+/**
+ * Read the particles, the boundary particles and the obstacles of the
+ * simulation <Sim> from the cache <CacheFile> if it was written for the
+ * key <Key> of the size <KeySize> (the key is compared entirely, not 
+ * only by the hash). The file is mapped into memory, so the records are
+ * copied to the arrays of the simulation right from the pages of the
+ * file. The function returns 0 if succeeded and -1 if there is no 
+ * valid cache for the key.
+ */
+static int
+ReadSceneCache( struct Simulation *Sim,   /* Simulation */
+                const char *CacheFile,    /* Cache's file */
+                const char *Key,          /* Key of the scene */
+                int KeySize)              /* Size of the key */
+{
+    struct SceneCacheHeader Header;
+    char *Data;
+    size_t Size;
+    size_t Offset;
+    int ObstacleSize;
+    int Mapped;
+
+    Data = MapSceneCache( CacheFile, &Size, &Mapped);
+    if ( Data == NULL )
+        return -1;
+
+    /* The header and the key (it's padded to 8 bytes) */
+    ObstacleSize = ( Sim->Dimension == 2 ) ? sizeof(struct ObstacleSegment) :
+                                             sizeof(struct ObstacleTriangle);
+    Offset = sizeof(Header) + ((KeySize + 7) & ~7);
+    if ( Size < Offset )
+    {
+        UnmapSceneCache( Data, Size, Mapped);
+        return -1;
+    }
+    memcpy( &Header, Data, sizeof(Header));
+    if ( strcmp( Header.Tag, SCENE_CACHE_TAG) != 0 ||
+         Header.Version != SCENE_CACHE_VERSION ||
+         Header.ParticleSize != sizeof(struct Particle) ||
+         Header.BParticleSize != sizeof(struct BParticle) ||
+         Header.ObstacleSize != ObstacleSize ||
+         Header.KeyHash != HashBytes( Key, KeySize) ||
+         Header.KeySize != KeySize ||
+         memcmp( Data + sizeof(Header), Key, KeySize) != 0 ||
+         Header.ParticlesNumber < 0 || Header.BParticlesNumber < 0 ||
+         Header.ObstaclesNumber < 0 ||
+         Size - Offset != Header.ParticlesNumber * sizeof(struct Particle) +
+                          Header.BParticlesNumber * sizeof(struct BParticle) +
+                          Header.ObstaclesNumber * (size_t)ObstacleSize )
+    {
+        UnmapSceneCache( Data, Size, Mapped);
+        return -1;
+    }
+
+    /* Space for one record at least, so the arrays aren't NULL */
+    Sim->Particles = (struct Particle *)
+                     malloc( (Header.ParticlesNumber + 1) * sizeof(struct Particle));
+    Sim->BParticles = (struct BParticle *)
+                      malloc( (Header.BParticlesNumber + 1) * sizeof(struct BParticle));
+    Sim->Obstacles = malloc( (Header.ObstaclesNumber + 1) * ObstacleSize);
+    memcpy( Sim->Particles, Data + Offset, 
+            Header.ParticlesNumber * sizeof(struct Particle));
+    Offset += Header.ParticlesNumber * sizeof(struct Particle);
+    memcpy( Sim->BParticles, Data + Offset, 
+            Header.BParticlesNumber * sizeof(struct BParticle));
+    Offset += Header.BParticlesNumber * sizeof(struct BParticle);
+    memcpy( Sim->Obstacles, Data + Offset, 
+            Header.ObstaclesNumber * (size_t)ObstacleSize);
+    UnmapSceneCache( Data, Size, Mapped);
+
+    Sim->ParticlesNumber = Header.ParticlesNumber;
+    Sim->ParticlesSize = Header.ParticlesNumber + 1;
+    Sim->NextParticleId = Header.ParticlesNumber;
+    Sim->BParticlesNumber = Header.BParticlesNumber;
+    Sim->ObstaclesNumber = Header.ObstaclesNumber;
+    Sim->ParticleMass = Header.ParticleMass;
+
+    return 0;
+} /* ReadSceneCache */
+
+/**
+ * Map the cache's file <CacheFile> into memory (it's read into memory
+ * if the system can't map it), the size of the file is returned through
+ * <Size> and the way it's got through <Mapped>. The function returns 
+ * the contents of the file or NULL if it can't be read.
+ */
+static char *
+MapSceneCache( const char *CacheFile,   /* Cache's file */
+               size_t *Size,            /* Size of the file */
+               int *Mapped)             /* The file is mapped */
+{
+#ifndef _WIN32
+    struct stat Stat;
+    void *Map;
+    int File;
+
+    File = open( CacheFile, O_RDONLY);
+    if ( File < 0 )
+        return NULL;
+    if ( fstat( File, &Stat) != 0 || Stat.st_size == 0 )
+    {
+        close( File);
+        return NULL;
+    }
+    Map = mmap( NULL, Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+    close( File);
+    if ( Map == MAP_FAILED )
+        return NULL;
+
+    *Size = Stat.st_size;
+    *Mapped = 1;
+
+    return (char *)Map;
+#else
+    FILE *File;
+    char *Data;
+    long FileSize;
+
+    File = fopen( CacheFile, "rb");
+    if ( File == NULL )
+        return NULL;
+    fseek( File, 0, SEEK_END);
+    FileSize = ftell( File);
+    fseek( File, 0, SEEK_SET);
+    if ( FileSize <= 0 )
+    {
+        fclose( File);
+        return NULL;
+    }
+    Data = (char *)malloc( FileSize);
+    if ( fread( Data, FileSize, 1, File) != 1 )
+    {
+        fclose( File);
+        free( Data);
+        return NULL;
+    }
+    fclose( File);
+
+    *Size = (size_t)FileSize;
+    *Mapped = 0;
+
+    return Data;
+#endif
+} /* MapSceneCache */
+
+/**
+ * Unmap the contents <Data> of the size <Size> of the cache's file
+ * (they are freed if the file has been read, <Mapped> is zero).
+ */
+static void
+UnmapSceneCache( char *Data,     /* Contents of the file */
+                 size_t Size,    /* Size of the file */
+                 int Mapped)     /* The file is mapped */
+{
+#ifndef _WIN32
+    if ( Mapped )
+        munmap( Data, Size);
+    else
+#endif
+        free( Data);
+
+    return;
+} /* UnmapSceneCache */
+
+/**
+ * Write the particles, the boundary particles and the obstacles of the
+ * simulation <Sim> to the cache <CacheFile> with the key <Key> of the
+ * size <KeySize>. The cache is written to a temporary file which then
+ * replaces it, so the simulations reading the cache at the same time
+ * never see it half-written. Nothing is done if it can't be written.
+ */
+static void
+WriteSceneCache( struct Simulation *Sim,   /* Simulation */
+                 const char *CacheFile,    /* Cache's file */
+                 const char *Key,          /* Key of the scene */
+                 int KeySize)              /* Size of the key */
+{
+    struct SceneCacheHeader Header;
+    static const char Pad[8] = { 0 };
+    static int CachesWritten = 0;
+    FILE *File;
+    char *TempFile;
+    int Written;
+    int Serial;
+
+    memset( &Header, 0, sizeof(Header));
+    strcpy( Header.Tag, SCENE_CACHE_TAG);
+    Header.Version = SCENE_CACHE_VERSION;
+    Header.ParticleSize = sizeof(struct Particle);
+    Header.BParticleSize = sizeof(struct BParticle);
+    Header.ObstacleSize = ( Sim->Dimension == 2 ) ? sizeof(struct ObstacleSegment) :
+                                                    sizeof(struct ObstacleTriangle);
+    Header.KeyHash = HashBytes( Key, KeySize);
+    Header.KeySize = KeySize;
+    Header.ParticlesNumber = Sim->ParticlesNumber;
+    Header.BParticlesNumber = Sim->BParticlesNumber;
+    Header.ObstaclesNumber = Sim->ObstaclesNumber;
+    Header.ParticleMass = Sim->ParticleMass;
+
+    /* The temporary file is unique for the process and for the cache
+     * written by it (the sweep creates the simulations in parallel) */
+#pragma omp critical (SceneCache)
+    Serial = CachesWritten++;
+    TempFile = (char *)malloc( strlen( CacheFile) + 32);
+    sprintf( TempFile, "%s.%d.%d", CacheFile, (int)getpid(), Serial);
+    File = fopen( TempFile, "wb");
+    if ( File == NULL )
+    {
+        free( TempFile);
+        return;
+    }
+
+    Written = ( fwrite( &Header, sizeof(Header), 1, File) == 1 &&
+                fwrite( Key, KeySize, 1, File) == 1 &&
+                fwrite( Pad, ((KeySize + 7) & ~7) - KeySize, 1, File) <= 1 &&
+                (int)fwrite( Sim->Particles, Header.ParticleSize, Sim->ParticlesNumber,
+                             File) == Sim->ParticlesNumber &&
+                (int)fwrite( Sim->BParticles, Header.BParticleSize, Sim->BParticlesNumber,
+                             File) == Sim->BParticlesNumber &&
+                (int)fwrite( Sim->Obstacles, Header.ObstacleSize, Sim->ObstaclesNumber,
+                             File) == Sim->ObstaclesNumber );
+    if ( fclose( File) != 0 )
+        Written = 0;
+
+    /* The old cache is removed first (rename doesn't replace 
+     * the files everywhere), the readers keep reading it */
+    if ( Written )
+    {
+        remove( CacheFile);
+        Written = ( rename( TempFile, CacheFile) == 0 );
+    }
+    if ( !Written )
+        remove( TempFile);
+    free( TempFile);
+
+    return;
+} /* WriteSceneCache */
@@ -10,8 +10,21 @@
 
 /**********************************************************/
 
+/* The name of the default file with scene description */
+#define SCENE_FILE_NAME     "scene"
+
+/**********************************************************/
+
+struct Simulation;
+
 /* Read and process the scene description file */
-extern void InitScene( void);
+extern int InitScene    ( struct Simulation *Sim, 
+                          const char *FileName, 
+                          const char **Params);
+
+/* Set the parameter given as in the parameters section */
+extern int SetSceneParam( struct Simulation *Sim, 
+                          const char *Str);
 
 /**********************************************************/
 
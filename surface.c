@@ -0,0 +1,781 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+/**
+ * Reconstruction of the surface of the fluid - the volume fraction
+ * of the fluid (the sum of the particles' volumes times the kernel)
+ * is sampled at the nodes of the uniform grid, and the surface is
+ * the contour of the level SURFACE_ISO_LEVEL. The grid is sparse,
+ * only the blocks of the cells within the kernel's support of some
+ * particle are sampled (the field is zero elsewhere), the particles
+ * near a block are found by the grid of the neighbour search (the
+ * surface has its own grid, the data of the step are kept). The
+ * blocks are processed in parallel, the cells are split into the
+ * simplices (triangles in 2D, tetrahedra in 3D) which are marched,
+ * so the contour is a set of segments in 2D and of triangles in 3D.
+ * The vertices on the same edge of the grid are welded, and the mesh
+ * is written to the Wavefront OBJ file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "common.h"
+#include "vector.h"
+#include "calc.h"
+#include "neighb.h"
+#include "surface.h"
+
+/**********************************************************/
+
+/* The number of the cells of a block along every axis */
+#define SURFACE_BLOCK       8
+
+/* The volume fraction of the fluid on the surface */
+#define SURFACE_ISO_LEVEL   0.5f
+
+/* The coordinates of the blocks are clamped to this */
+#define SURFACE_MAX_BLOCK   (1 << 20)
+
+/* The maximum number of the blocks in the box of the particles
+ * (one bit of the bitmap marking the blocks per block) */
+#define SURFACE_MAX_BITMAP  (1 << 28)
+
+/* The prefix of the names of the files by default */
+#define SURFACE_FILE_NAME   "surface"
+
+/**********************************************************/
+
+/* Block of the cells of the sparse grid */
+struct SurfaceBlock
+{
+    int   c[3];          /* Integer coordinates of the block */
+};
+
+/* Corner of an element of the surface - the vertex on the edge of the
+ * grid, the edge goes from the node along the directions of the mask */
+struct SurfaceCorner
+{
+    int   Key[4];        /* Node (x,y,z) and the mask of the directions */
+    float Pos[3];        /* Position of the vertex */
+};
+
+/* The corner and its place in the mesh (is used to weld the corners) */
+struct SurfaceWeld
+{
+    int   Key[4];        /* The key of the corner */
+    int   Corner;        /* Index of the corner */
+};
+
+/* The corners of the elements (Dimension corners per element) */
+struct SurfaceMesh
+{
+    struct SurfaceCorner *Corners;
+    int   CornersNum;
+    int   CornersSize;
+};
+
+/**********************************************************/
+
+/* Find the blocks within the kernel's support of the particles */
+static int   CollectBlocks      ( struct Simulation *Sim,
+                                  float Radius, float CellSize,
+                                  struct SurfaceBlock **Blocks);
+
+/* Get the range of the blocks near the particle */
+static int   GetParticleBlocks  ( struct Simulation *Sim, float *Pos,
+                                  float Radius, double Size,
+                                  int *Lo, int *Hi);
+
+/* Sample the field in the block and march its cells */
+static void  MarchBlock         ( struct Simulation *Sim,
+                                  struct SurfaceBlock *Block,
+                                  float Radius, float CellSize,
+                                  int **Found, int *FoundSize,
+                                  struct SurfaceMesh *Mesh);
+
+/* Add the elements of the contour in the simplex */
+static void  MarchSimplex       ( struct Simulation *Sim,
+                                  int (*Nodes)[3], float *Values,
+                                  int *Axes, float CellSize,
+                                  struct SurfaceMesh *Mesh);
+
+/* Get the corner on the edge of the simplex */
+static void  GetEdgeCorner      ( int (*Nodes)[3], float *Values,
+                                  int *Axes, float CellSize,
+                                  int u, int v,
+                                  struct SurfaceCorner *Corner);
+
+/* Write the mesh to the file */
+static int   WriteMeshFile      ( struct Simulation *Sim,
+                                  struct SurfaceCorner *Corners,
+                                  int CornersNum);
+
+/* Compare the corners (for qsort) */
+static int   CompareWelds       ( const void *Weld1, const void *Weld2);
+
+/**********************************************************/
+
+/* The orders of the axes along the edges of the simplices of a cell
+ * (every simplex goes from the lower corner of the cell to the upper
+ * one along the axes, so the simplices of the cells match) */
+static int SimplicesAxes3D[6][3] =
+{
+    { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 },
+    { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 }
+};
+static int SimplicesAxes2D[2][3] =
+{
+    { 0, 1, 2 }, { 1, 0, 2 }
+};
+
+/**********************************************************/
+
+/**
+ * Reconstruct the surface of the fluid of the simulation <Sim> and
+ * write it to the file <prefix>_<step>.obj, the prefix is given by
+ * the parameter SURFACE_FILE. The size of the cells of the grid is
+ * given by SURFACE_CELL (half of the initial distance between the
+ * particles by default). The function returns 0 if succeeded and
+ * -1 if the grid can't be built or the file can't be written.
+ */
+int
+WriteSurface( struct Simulation *Sim)   /* Simulation */
+{
+    struct SurfaceBlock *Blocks;
+    struct SurfaceCorner *Corners;
+    float Radius;
+    float CellSize;
+    int *Start;
+    int BlocksNum;
+    int Res;
+    int b;
+
+    if ( Sim->ParticlesNumber == 0 )
+        return 0;
+
+    /* The field vanishes farther than the kernel's support */
+    Radius = Sim->KernelSupport * Sim->MaxSmoothR / Sim->SmoothR;
+    CellSize = ( Sim->SurfaceCell > 0.0f ) ? Sim->SurfaceCell :
+                                             0.5f * Sim->ParticlesDistrib;
+    if ( PreparePointsGrid( Sim, &Sim->SurfaceData, Sim->Particles[0].Pos,
+                            sizeof(struct Particle), Sim->ParticlesNumber, Radius) )
+        return -1;
+
+    BlocksNum = CollectBlocks( Sim, Radius, CellSize, &Blocks);
+    if ( BlocksNum < 0 )
+        return -1;
+    Start = (int *)malloc( (BlocksNum + 1) * sizeof(int));
+    Start[0] = 0;
+    Corners = NULL;
+
+#pragma omp parallel
+    {
+        struct SurfaceMesh Mesh;
+        struct SurfaceCorner *Corner;
+        int *Found;
+        int *Owned;
+        int FoundSize;
+        int OwnedNum;
+        int n, i;
+
+        memset( &Mesh, 0, sizeof(Mesh));
+        Found = NULL;
+        FoundSize = 0;
+        Owned = (int *)malloc( (BlocksNum + 1) * sizeof(int));
+        OwnedNum = 0;
+
+        /* March the thread's blocks */
+#pragma omp for schedule(dynamic,1)
+        for ( b = 0; b < BlocksNum; b++ )
+        {
+            n = Mesh.CornersNum;
+            MarchBlock( Sim, &Blocks[b], Radius, CellSize, &Found, &FoundSize, &Mesh);
+            Start[b + 1] = Mesh.CornersNum - n;
+            Owned[OwnedNum++] = b;
+        }
+
+#pragma omp single
+        {
+            /* Offsets of the blocks' corners */
+            for ( i = 0; i < BlocksNum; i++ )
+                Start[i + 1] += Start[i];
+            Corners = (struct SurfaceCorner *)
+                      malloc( (Start[BlocksNum] + 1) * sizeof(struct SurfaceCorner));
+        }
+
+        /* Copy the corners to their places (the blocks are
+         * stored in the thread's mesh in the order of Owned) */
+        Corner = Mesh.Corners;
+        for ( i = 0; i < OwnedNum; i++ )
+        {
+            n = Start[Owned[i] + 1] - Start[Owned[i]];
+            memcpy( Corners + Start[Owned[i]], Corner, n * sizeof(struct SurfaceCorner));
+            Corner += n;
+        }
+
+        free( Mesh.Corners);
+        free( Found);
+        free( Owned);
+    }
+
+    Res = WriteMeshFile( Sim, Corners, Start[BlocksNum]);
+
+    free( Corners);
+    free( Start);
+    free( Blocks);
+
+    return Res;
+} /* WriteSurface */
+
+/**
+ * Free the grid of the surface of the simulation <Sim>.
+ */
+void
+FreeSurface( struct Simulation *Sim)   /* Simulation */
+{
+    FreeNeighbData( &Sim->SurfaceData);
+
+    return;
+} /* FreeSurface */
+
+/**********************************************************/
+
+/**
+ * Find the blocks of the grid with the cells of the size <CellSize>
+ * which are closer than <Radius> to some particle. The particles mark
+ * their blocks in the bitmap of the blocks of the box of all of them
+ * (in parallel, the blocks marked by several particles are kept once),
+ * then the marked blocks are taken in the order of the bitmap. The 
+ * array of the blocks (sorted, every block once) is allocated and 
+ * stored in <Blocks>, the function returns the number of the blocks
+ * or -1 if the box is too large.
+ */
+static int
+CollectBlocks( struct Simulation *Sim,        /* Simulation */
+               float Radius,                  /* Radius of the particles */
+               float CellSize,                /* Size of the cells */
+               struct SurfaceBlock **Blocks)  /* Blocks */
+{
+    unsigned int *Bitmap;
+    unsigned int Word;
+    double BitsNum;
+    double Size;
+    int Lo[3], Hi[3];
+    int Extent[3];
+    int WordsNum;
+    int BlocksNum;
+    int Index;
+    int i, k, d;
+
+    Size = (double)CellSize * SURFACE_BLOCK;
+    *Blocks = NULL;
+    for ( d = 0; d < 3; d++ )
+    {
+        Lo[d] = SURFACE_MAX_BLOCK;
+        Hi[d] = -SURFACE_MAX_BLOCK;
+    }
+
+    /* The box of the blocks of all the particles */
+#pragma omp parallel
+    {
+        int PartLo[3], PartHi[3];
+        int Min[3], Max[3];
+        int i, d;
+
+        memcpy( Min, Lo, sizeof(Min));
+        memcpy( Max, Hi, sizeof(Max));
+#pragma omp for schedule(static)
+        for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        {
+            if ( GetParticleBlocks( Sim, Sim->Particles[i].Pos, Radius, Size,
+                                    PartLo, PartHi) )
+                continue;
+            for ( d = 0; d < 3; d++ )
+            {
+                if ( PartLo[d] < Min[d] )
+                    Min[d] = PartLo[d];
+                if ( PartHi[d] > Max[d] )
+                    Max[d] = PartHi[d];
+            }
+        }
+#pragma omp critical (SurfaceBox)
+        {
+            for ( d = 0; d < 3; d++ )
+            {
+                if ( Min[d] < Lo[d] )
+                    Lo[d] = Min[d];
+                if ( Max[d] > Hi[d] )
+                    Hi[d] = Max[d];
+            }
+        }
+    }
+
+    BitsNum = 1.0;
+    for ( d = 0; d < 3; d++ )
+    {
+        /* There are no finite particles */
+        if ( Lo[d] > Hi[d] )
+            return 0;
+        Extent[d] = Hi[d] - Lo[d] + 1;
+        BitsNum *= Extent[d];
+    }
+    if ( BitsNum > SURFACE_MAX_BITMAP )
+        return -1;
+    WordsNum = ((int)BitsNum + 31) / 32;
+    Bitmap = (unsigned int *)calloc( WordsNum, sizeof(unsigned int));
+
+    /* Mark the blocks of every particle */
+#pragma omp parallel for schedule(static)
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+    {
+        int PartLo[3], PartHi[3];
+        int c[3];
+        int Bit;
+
+        if ( GetParticleBlocks( Sim, Sim->Particles[i].Pos, Radius, Size,
+                                PartLo, PartHi) )
+            continue;
+        for ( c[2] = PartLo[2]; c[2] <= PartHi[2]; c[2]++ )
+        for ( c[1] = PartLo[1]; c[1] <= PartHi[1]; c[1]++ )
+        for ( c[0] = PartLo[0]; c[0] <= PartHi[0]; c[0]++ )
+        {
+            Bit = ((c[2] - Lo[2]) * Extent[1] + c[1] - Lo[1]) * Extent[0] + c[0] - Lo[0];
+#pragma omp atomic
+            Bitmap[Bit / 32] |= 1u << (Bit % 32);
+        }
+    }
+
+    /* The marked blocks in the order of the bitmap 
+     * (the blocks are sorted by z, then y, then x) */
+    BlocksNum = 0;
+    for ( k = 0; k < WordsNum; k++ )
+        for ( Word = Bitmap[k]; Word != 0; Word &= Word - 1 )
+            BlocksNum++;
+    *Blocks = (struct SurfaceBlock *)malloc( (BlocksNum + 1) * sizeof(struct SurfaceBlock));
+    BlocksNum = 0;
+    for ( k = 0; k < WordsNum; k++ )
+    {
+        if ( Bitmap[k] == 0 )
+            continue;
+        for ( i = 0; i < 32; i++ )
+        {
+            if ( !(Bitmap[k] & (1u << i)) )
+                continue;
+            Index = 32 * k + i;
+            (*Blocks)[BlocksNum].c[0] = Index % Extent[0] + Lo[0];
+            (*Blocks)[BlocksNum].c[1] = Index / Extent[0] % Extent[1] + Lo[1];
+            (*Blocks)[BlocksNum].c[2] = Index / (Extent[0] * Extent[1]) + Lo[2];
+            BlocksNum++;
+        }
+    }
+
+    free( Bitmap);
+
+    return BlocksNum;
+} /* CollectBlocks */
+
+/**
+ * Get the range <Lo> ... <Hi> of the blocks (of the size <Size>) which
+ * are closer than <Radius> to the particle at <Pos>, the range is zero
+ * along the axes beyond the dimension. The function returns -1 if the
+ * position isn't finite and 0 otherwise.
+ */
+static int
+GetParticleBlocks( struct Simulation *Sim,   /* Simulation */
+                   float *Pos,               /* Position of the particle */
+                   float Radius,             /* Radius of the particle */
+                   double Size,              /* Size of the blocks */
+                   int *Lo,                  /* The lower blocks */
+                   int *Hi)                  /* The upper blocks */
+{
+    double l, h;
+    int d;
+
+    for ( d = 0; d < 3; d++ )
+    {
+        Lo[d] = Hi[d] = 0;
+        if ( d >= Sim->Dimension )
+            continue;
+        l = floor( (Pos[d] - Radius) / Size);
+        h = floor( (Pos[d] + Radius) / Size);
+        if ( !(l <= h) )
+            return -1;
+        Lo[d] = ( l < -SURFACE_MAX_BLOCK ) ? -SURFACE_MAX_BLOCK : (int)l;
+        Hi[d] = ( h > SURFACE_MAX_BLOCK ) ? SURFACE_MAX_BLOCK : (int)h;
+    }
+
+    return 0;
+} /* GetParticleBlocks */
+
+/**
+ * Sample the volume fraction of the fluid at the nodes of the block
+ * <Block> and add the elements of the contour in its cells to <Mesh>.
+ * <Found> (of the size <FoundSize>) is the buffer of the particles
+ * near the block. Along the periodic axes only the cells inside of
+ * the periodic box are marched.
+ */
+static void
+MarchBlock( struct Simulation *Sim,       /* Simulation */
+            struct SurfaceBlock *Block,   /* Block */
+            float Radius,                 /* Radius of the particles */
+            float CellSize,               /* Size of the cells */
+            int **Found,                  /* Particles near the block */
+            int *FoundSize,               /* Size of the buffer */
+            struct SurfaceMesh *Mesh)     /* Mesh */
+{
+    float Values[(SURFACE_BLOCK + 1) * (SURFACE_BLOCK + 1) * (SURFACE_BLOCK + 1)];
+    float SimplexValues[4];
+    int   SimplexNodes[4][3];
+    int   (*SimplicesAxes)[3];
+    struct Particle *Pj;
+    float Min[3], Max[3];
+    float Node[3];
+    float Rij[3];
+    float Radius2;
+    float Value;
+    int   NodesNum[3];
+    int   CellsNum[3];
+    int   Base[3];
+    int   n[3];
+    int   Inside, Outside;
+    int   FoundNum;
+    int   SimplicesNum;
+    int   Index;
+    int   i, j, k, s, d;
+
+    Radius2 = Radius * Radius;
+    for ( d = 0; d < 3; d++ )
+    {
+        NodesNum[d] = ( d < Sim->Dimension ) ? SURFACE_BLOCK + 1 : 1;
+        CellsNum[d] = ( d < Sim->Dimension ) ? SURFACE_BLOCK : 1;
+        Base[d] = ( d < Sim->Dimension ) ? Block->c[d] * SURFACE_BLOCK : 0;
+        Min[d] = Base[d] * CellSize;
+        Max[d] = (Base[d] + NodesNum[d] - 1) * CellSize;
+    }
+    FoundNum = FindPointsNearBox( Sim, &Sim->SurfaceData, Min, Max, Found, FoundSize);
+    if ( FoundNum == 0 )
+        return;
+
+    /* Sample the field at the nodes of the block */
+    Inside = Outside = 0;
+    for ( n[2] = 0; n[2] < NodesNum[2]; n[2]++ )
+    for ( n[1] = 0; n[1] < NodesNum[1]; n[1]++ )
+    for ( n[0] = 0; n[0] < NodesNum[0]; n[0]++ )
+    {
+        for ( d = 0; d < 3; d++ )
+            Node[d] = (Base[d] + n[d]) * CellSize;
+        Value = 0.0f;
+        for ( k = 0; k < FoundNum; k++ )
+        {
+            Pj = &Sim->Particles[(*Found)[k]];
+            VectorSubstraction( Sim->Dimension, Rij, Node, Pj->Pos);
+            if ( Sim->PeriodicDomain )
+                GetMinimumImage( Sim, Rij);
+            if ( !(VectorInnerproduct( Sim->Dimension, Rij, Rij) <= Radius2) )
+                continue;
+            Value += Pj->Mass / Pj->Dens * Sim->GetKernelH( Sim, Rij, Pj->SmoothR);
+        }
+        Index = (n[2] * NodesNum[1] + n[1]) * NodesNum[0] + n[0];
+        Values[Index] = Value;
+        if ( Value >= SURFACE_ISO_LEVEL )
+            Inside++;
+        else
+            Outside++;
+    }
+
+    /* The contour doesn't cross the block */
+    if ( Inside == 0 || Outside == 0 )
+        return;
+
+    SimplicesAxes = ( Sim->Dimension == 3 ) ? SimplicesAxes3D : SimplicesAxes2D;
+    SimplicesNum = ( Sim->Dimension == 3 ) ? 6 : 2;
+
+    /* March the simplices of every cell */
+    for ( n[2] = 0; n[2] < CellsNum[2]; n[2]++ )
+    for ( n[1] = 0; n[1] < CellsNum[1]; n[1]++ )
+    for ( n[0] = 0; n[0] < CellsNum[0]; n[0]++ )
+    {
+        /* The cell is outside of the periodic box */
+        for ( d = 0; d < Sim->Dimension; d++ )
+        {
+            Value = (Base[d] + n[d]) * CellSize;
+            if ( Sim->Period[d] > 0.0f &&
+                 (Value < Sim->Periodic[d][0] || Value >= Sim->Periodic[d][1]) )
+                break;
+        }
+        if ( d < Sim->Dimension )
+            continue;
+
+        for ( s = 0; s < SimplicesNum; s++ )
+        {
+            /* The nodes of the simplex go along the axes */
+            memcpy( SimplexNodes[0], n, sizeof(n));
+            for ( i = 1; i <= Sim->Dimension; i++ )
+            {
+                memcpy( SimplexNodes[i], SimplexNodes[i - 1], sizeof(n));
+                SimplexNodes[i][SimplicesAxes[s][i - 1]]++;
+            }
+            for ( i = 0; i <= Sim->Dimension; i++ )
+            {
+                j = (SimplexNodes[i][2] * NodesNum[1] + SimplexNodes[i][1]) *
+                    NodesNum[0] + SimplexNodes[i][0];
+                SimplexValues[i] = Values[j];
+                /* The nodes are global from here */
+                for ( d = 0; d < 3; d++ )
+                    SimplexNodes[i][d] += Base[d];
+            }
+            MarchSimplex( Sim, SimplexNodes, SimplexValues, SimplicesAxes[s],
+                          CellSize, Mesh);
+        }
+    }
+
+    return;
+} /* MarchBlock */
+
+/**
+ * Add the elements of the contour in the simplex with the nodes
+ * <Nodes> (Dimension + 1 nodes going along the axes <Axes>) and
+ * the values <Values> at them to <Mesh> - one segment in 2D, one
+ * triangle or two triangles in 3D. The triangles face the outside
+ * of the fluid (the lower values).
+ */
+static void
+MarchSimplex( struct Simulation *Sim,     /* Simulation */
+              int (*Nodes)[3],            /* Nodes of the simplex */
+              float *Values,              /* Values at the nodes */
+              int *Axes,                  /* Axes of the edges */
+              float CellSize,             /* Size of the cells */
+              struct SurfaceMesh *Mesh)   /* Mesh */
+{
+    struct SurfaceCorner Tmp;
+    struct SurfaceCorner *Corner;
+    float Normal[3], Dir[3];
+    float Edge1[3], Edge2[3];
+    int In[4], Out[4];
+    int Edges[4][2];
+    int InNum, OutNum;
+    int EdgesNum;
+    int i, k, d;
+
+    InNum = OutNum = 0;
+    for ( i = 0; i <= Sim->Dimension; i++ )
+    {
+        if ( Values[i] >= SURFACE_ISO_LEVEL )
+            In[InNum++] = i;
+        else
+            Out[OutNum++] = i;
+    }
+    if ( InNum == 0 || OutNum == 0 )
+        return;
+
+    /* The edges crossed by the contour (going round the quadrangle
+     * if two nodes are inside and two are outside) */
+    EdgesNum = 0;
+    if ( InNum == 1 )
+    {
+        for ( k = 0; k < OutNum; k++, EdgesNum++ )
+        {
+            Edges[EdgesNum][0] = In[0];
+            Edges[EdgesNum][1] = Out[k];
+        }
+    }
+    else if ( OutNum == 1 )
+    {
+        for ( k = 0; k < InNum; k++, EdgesNum++ )
+        {
+            Edges[EdgesNum][0] = In[k];
+            Edges[EdgesNum][1] = Out[0];
+        }
+    }
+    else
+    {
+        Edges[0][0] = In[0]; Edges[0][1] = Out[0];
+        Edges[1][0] = In[0]; Edges[1][1] = Out[1];
+        Edges[2][0] = In[1]; Edges[2][1] = Out[1];
+        Edges[3][0] = In[1]; Edges[3][1] = Out[0];
+        EdgesNum = 4;
+    }
+
+    /* Allocate memory for the corners */
+    if ( Mesh->CornersNum + 6 > Mesh->CornersSize )
+    {
+        Mesh->CornersSize = 2 * Mesh->CornersSize + 1024;
+        Mesh->Corners = (struct SurfaceCorner *)
+                        realloc( Mesh->Corners, Mesh->CornersSize * sizeof(struct SurfaceCorner));
+    }
+    Corner = &Mesh->Corners[Mesh->CornersNum];
+
+    for ( k = 0; k < EdgesNum; k++ )
+        GetEdgeCorner( Nodes, Values, Axes, CellSize,
+                       Edges[k][0], Edges[k][1], &Corner[k]);
+
+    if ( Sim->Dimension == 2 )
+    {
+        /* The segment */
+        Mesh->CornersNum += 2;
+        return;
+    }
+
+    /* The quadrangle is split into two triangles */
+    if ( EdgesNum == 4 )
+    {
+        Corner[5] = Corner[3];
+        Corner[4] = Corner[2];
+        Corner[3] = Corner[0];
+    }
+
+    /* The direction to the outside */
+    memset( Dir, 0, sizeof(Dir));
+    for ( d = 0; d < 3; d++ )
+    {
+        for ( k = 0; k < OutNum; k++ )
+            Dir[d] += (float)Nodes[Out[k]][d] / OutNum;
+        for ( k = 0; k < InNum; k++ )
+            Dir[d] -= (float)Nodes[In[k]][d] / InNum;
+    }
+
+    for ( i = 0; i < (( EdgesNum == 4 ) ? 6 : 3); i += 3 )
+    {
+        VectorSubstraction( 3, Edge1, Corner[i + 1].Pos, Corner[i].Pos);
+        VectorSubstraction( 3, Edge2, Corner[i + 2].Pos, Corner[i].Pos);
+        Normal[0] = Edge1[1] * Edge2[2] - Edge1[2] * Edge2[1];
+        Normal[1] = Edge1[2] * Edge2[0] - Edge1[0] * Edge2[2];
+        Normal[2] = Edge1[0] * Edge2[1] - Edge1[1] * Edge2[0];
+        if ( VectorInnerproduct( 3, Normal, Dir) < 0.0f )
+        {
+            Tmp = Corner[i + 1];
+            Corner[i + 1] = Corner[i + 2];
+            Corner[i + 2] = Tmp;
+        }
+    }
+    Mesh->CornersNum += ( EdgesNum == 4 ) ? 6 : 3;
+
+    return;
+} /* MarchSimplex */
+
+/**
+ * Get the corner <Corner> on the edge from the node <u> to the node
+ * <v> of the simplex with the nodes <Nodes> and the values <Values>.
+ * The key of the corner is the lower node of the edge and the mask
+ * of the axes <Axes> between the nodes, so the corners on the same
+ * edge of the grid get the same key.
+ */
+static void
+GetEdgeCorner( int (*Nodes)[3],                /* Nodes of the simplex */
+               float *Values,                  /* Values at the nodes */
+               int *Axes,                      /* Axes of the edges */
+               float CellSize,                 /* Size of the cells */
+               int u,                          /* The first node */
+               int v,                          /* The second node */
+               struct SurfaceCorner *Corner)   /* Corner */
+{
+    float t;
+    int a, b;
+    int k, d;
+
+    a = ( u < v ) ? u : v;
+    b = ( u < v ) ? v : u;
+    memcpy( Corner->Key, Nodes[a], 3 * sizeof(int));
+    Corner->Key[3] = 0;
+    for ( k = a; k < b; k++ )
+        Corner->Key[3] |= 1 << Axes[k];
+
+    t = (SURFACE_ISO_LEVEL - Values[a]) / (Values[b] - Values[a]);
+    for ( d = 0; d < 3; d++ )
+        Corner->Pos[d] = (Nodes[a][d] + t * (Nodes[b][d] - Nodes[a][d])) * CellSize;
+
+    return;
+} /* GetEdgeCorner */
+
+/**********************************************************/
+
+/**
+ * Weld the corners <Corners> with the same keys into the vertices and
+ * write the mesh (the elements of Dimension corners) to the file.
+ * The function returns 0 if succeeded and -1 otherwise.
+ */
+static int
+WriteMeshFile( struct Simulation *Sim,           /* Simulation */
+               struct SurfaceCorner *Corners,    /* Corners */
+               int CornersNum)                   /* Number of the corners */
+{
+    struct SurfaceWeld *Welds;
+    char FileName[PATH_NAME_LENGTH + 32];
+    int *Vertices;
+    int VerticesNum;
+    FILE *File;
+    int i, k;
+
+    sprintf( FileName, "%s_%06d.obj",
+             Sim->SurfaceFile[0] ? Sim->SurfaceFile : SURFACE_FILE_NAME,
+             Sim->StepsNumber);
+    File = fopen( FileName, "w");
+    if ( File == NULL )
+        return -1;
+
+    /* The corners sorted by the keys get the vertices */
+    Welds = (struct SurfaceWeld *)malloc( (CornersNum + 1) * sizeof(struct SurfaceWeld));
+    Vertices = (int *)malloc( (CornersNum + 1) * sizeof(int));
+    for ( i = 0; i < CornersNum; i++ )
+    {
+        memcpy( Welds[i].Key, Corners[i].Key, sizeof(Welds[i].Key));
+        Welds[i].Corner = i;
+    }
+    qsort( Welds, CornersNum, sizeof(struct SurfaceWeld), CompareWelds);
+
+    fprintf( File, "# Surface of the fluid, step %d, time %g\n",
+             Sim->StepsNumber, Sim->Time);
+    VerticesNum = 0;
+    for ( i = 0; i < CornersNum; i++ )
+    {
+        k = Welds[i].Corner;
+        if ( i == 0 || CompareWelds( &Welds[i], &Welds[i - 1]) )
+        {
+            fprintf( File, "v %g %g %g\n", Corners[k].Pos[0],
+                     Corners[k].Pos[1], Corners[k].Pos[2]);
+            VerticesNum++;
+        }
+        Vertices[k] = VerticesNum;
+    }
+
+    /* The segments in 2D and the triangles in 3D */
+    for ( i = 0; i + Sim->Dimension <= CornersNum; i += Sim->Dimension )
+    {
+        if ( Sim->Dimension == 2 )
+            fprintf( File, "l %d %d\n", Vertices[i], Vertices[i + 1]);
+        else
+            fprintf( File, "f %d %d %d\n", Vertices[i], Vertices[i + 1], Vertices[i + 2]);
+    }
+
+    free( Welds);
+    free( Vertices);
+
+    return ( fclose( File) == 0 ) ? 0 : -1;
+} /* WriteMeshFile */
+
+/**
+ * Compare the keys of the corners <Weld1> and <Weld2> (for qsort).
+ */
+static int
+CompareWelds( const void *Weld1,   /* The first corner */
+              const void *Weld2)   /* The second corner */
+{
+    const int *Key1 = ((const struct SurfaceWeld *)Weld1)->Key;
+    const int *Key2 = ((const struct SurfaceWeld *)Weld2)->Key;
+    int k;
+
+    for ( k = 0; k < 4; k++ )
+    {
+        if ( Key1[k] != Key2[k] )
+            return ( Key1[k] < Key2[k] ) ? -1 : 1;
+    }
+
+    return 0;
+} /* CompareWelds */
@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_SURFACE_H
+#define YAPS_SURFACE_H
+
+/**********************************************************/
+
+struct Simulation;
+
+/* Reconstruct the surface of the fluid and write it to the file */
+extern int  WriteSurface( struct Simulation *Sim);
+
+/* Free the grid of the surface */
+extern void FreeSurface ( struct Simulation *Sim);
+
+/**********************************************************/
+
+#endif /* YAPS_SURFACE_H */
@@ -0,0 +1,336 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+/**
+ * Parameter sweep - the program runs many simulations of the same
+ * scene with different values of the parameters and writes summary
+ * of every run. The runs are small, so each of them is calculated
+ * by one thread, and the runs are distributed among all the threads
+ * (the throughput of the sweep matters, not the time of a run).
+ *
+ * Usage: yaps-sweep [-n steps] [-j threads] [-o file] scene
+ *                   NAME=value | NAME=first:last:count ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "common.h"
+#include "yaps.h"
+
+/**********************************************************/
+
+/* The maximum number of parameters to sweep */
+#define MAX_SWEEP_PARAMS     8
+
+/* The maximum length of a parameter's name */
+#define SWEEP_NAME_LENGTH    16
+
+/* The number of steps done between the checks of a run */
+#define CHECK_STEPS          100
+
+/* Default number of steps of a run */
+#define DEFAULT_STEPS        1000
+
+/**********************************************************/
+
+/* Swept parameter */
+struct SweepParam
+{
+    char  Name[SWEEP_NAME_LENGTH + 1];  /* Name in the scene file */
+    float First;                        /* The first value */
+    float Last;                         /* The last value */
+    int   Count;                        /* Number of values */
+};
+
+/* Possible states of a run */
+enum RunStates
+{
+    RUN_OK,          /* The run has been done     */
+    RUN_FAILED,      /* The scene isn't valid     */
+    RUN_DIVERGED,    /* The simulation has blown  */
+};
+
+/* The names of the states of a run */
+static char *RunStateNames[] = { "OK", "FAILED", "DIVERGED" };
+
+/* Summary of a run */
+struct RunSummary
+{
+    float Values[MAX_SWEEP_PARAMS]; /* Values of the swept parameters */
+    int   State;                    /* State of the run */
+    int   StepsNumber;              /* Number of steps done */
+    int   ParticlesNumber;          /* Number of particles */
+    double WallTime;                /* Time of the calculation (s) */
+    float KinEnergy;                /* Kinetic energy */
+    float MeanDens;                 /* Average density */
+    float MaxDensDev;               /* Maximum relative density deviation */
+    float Centroid[3];              /* Centroid of the fluid */
+};
+
+/**********************************************************/
+
+/* Parse the description of the swept parameter */
+static int   ParseSweepParam    ( const char *Str,
+                                  struct SweepParam *Param);
+
+/* Do one run of the sweep */
+static void  DoRun              ( const char *SceneFile,
+                                  struct SweepParam *Params,
+                                  int ParamsNum, int StepsNum,
+                                  struct RunSummary *Run);
+
+/* Get the summary of the simulation */
+static int   SummarizeSimulation( struct Simulation *Sim,
+                                  struct RunSummary *Run);
+
+/**********************************************************/
+
+int
+main( int argc, char **argv)
+{
+    struct SweepParam Params[MAX_SWEEP_PARAMS];
+    struct RunSummary *Runs;
+    const char *SceneFile;
+    FILE *Out;
+    double Start, Total;
+    int ParamsNum;
+    int RunsNum;
+    int StepsNum;
+    int ThreadsNum;
+    int i, k;
+
+    SceneFile = NULL;
+    Out = stdout;
+    ParamsNum = 0;
+    StepsNum = DEFAULT_STEPS;
+    ThreadsNum = 0;
+
+    /* Read the command line */
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "-n") == 0 && i + 1 < argc )
+            StepsNum = atoi( argv[++i]);
+        else if ( strcmp( argv[i], "-j") == 0 && i + 1 < argc )
+            ThreadsNum = atoi( argv[++i]);
+        else if ( strcmp( argv[i], "-o") == 0 && i + 1 < argc )
+        {
+            Out = fopen( argv[++i], "w");
+            if ( Out == NULL )
+            {
+                fprintf( stderr, "Can't open %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if ( SceneFile == NULL )
+            SceneFile = argv[i];
+        else if ( ParamsNum < MAX_SWEEP_PARAMS &&
+                  ParseSweepParam( argv[i], &Params[ParamsNum]) == 0 )
+            ParamsNum++;
+        else
+        {
+            fprintf( stderr, "Invalid parameter: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if ( SceneFile == NULL || StepsNum <= 0 )
+    {
+        fprintf( stderr, "Usage: %s [-n steps] [-j threads] [-o file] scene "
+                         "NAME=value | NAME=first:last:count ...\n", argv[0]);
+        return 1;
+    }
+
+    /* All combinations of the values are run */
+    RunsNum = 1;
+    for ( k = 0; k < ParamsNum; k++ )
+        RunsNum *= Params[k].Count;
+    Runs = (struct RunSummary *)calloc( RunsNum, sizeof(struct RunSummary));
+
+    /* Every run is calculated by one thread (the parallel loops
+     * of the calculation module run serially inside of a run) */
+    if ( ThreadsNum > 0 )
+        omp_set_num_threads( ThreadsNum);
+    omp_set_nested( 0);
+
+    Start = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic,1) private(k)
+    for ( i = 0; i < RunsNum; i++ )
+    {
+        int Index;
+
+        /* Values of the parameters of the run
+         * (the first parameter changes slowest) */
+        Index = i;
+        for ( k = ParamsNum - 1; k >= 0; k-- )
+        {
+            int n = Index % Params[k].Count;
+            Index /= Params[k].Count;
+            Runs[i].Values[k] = ( Params[k].Count > 1 ) ?
+                Params[k].First + (Params[k].Last - Params[k].First) *
+                                  (float)n / (float)(Params[k].Count - 1) :
+                Params[k].First;
+        }
+
+        DoRun( SceneFile, Params, ParamsNum, StepsNum, &Runs[i]);
+    }
+    Total = omp_get_wtime() - Start;
+
+    /* Write the summaries */
+    fprintf( Out, "# %s, %d steps\n", SceneFile, StepsNum);
+    fprintf( Out, "%-5s ", "RUN");
+    for ( k = 0; k < ParamsNum; k++ )
+        fprintf( Out, "%-12s ", Params[k].Name);
+    fprintf( Out, "%-8s %-6s %-8s %-12s %-12s %-12s %-12s %-12s %s\n",
+             "STATE", "STEPS", "TIME", "KIN_ENERGY", "MEAN_DENS",
+             "MAX_DENS_DEV", "CENTROID_X", "CENTROID_Y", "CENTROID_Z");
+    for ( i = 0; i < RunsNum; i++ )
+    {
+        fprintf( Out, "%-5d ", i);
+        for ( k = 0; k < ParamsNum; k++ )
+            fprintf( Out, "%-12g ", Runs[i].Values[k]);
+        fprintf( Out, "%-8s %-6d %-8.2f %-12g %-12g %-12g %-12g %-12g %g\n",
+                 RunStateNames[Runs[i].State], Runs[i].StepsNumber,
+                 Runs[i].WallTime, Runs[i].KinEnergy, Runs[i].MeanDens,
+                 Runs[i].MaxDensDev, Runs[i].Centroid[0],
+                 Runs[i].Centroid[1], Runs[i].Centroid[2]);
+    }
+    fprintf( stderr, "%d runs in %.2f s (%.2f runs/s, %d threads)\n",
+             RunsNum, Total, RunsNum / Total, omp_get_max_threads());
+
+    if ( Out != stdout )
+        fclose( Out);
+    free( Runs);
+
+    return 0;
+} /* main */
+
+/**********************************************************/
+
+/**
+ * Parse the description <Str> of the swept parameter - either
+ * "NAME=value" or "NAME=first:last:count", and store it in <Param>.
+ * The function returns 0 if succeeded and -1 otherwise.
+ */
+static int
+ParseSweepParam( const char *Str,             /* Description */
+                 struct SweepParam *Param)    /* Swept parameter */
+{
+    const char *Value;
+    int n;
+
+    Value = strchr( Str, '=');
+    if ( Value == NULL || Value == Str || Value - Str > SWEEP_NAME_LENGTH )
+        return -1;
+
+    memcpy( Param->Name, Str, Value - Str);
+    Param->Name[Value - Str] = '\0';
+    Value++;
+
+    n = sscanf( Value, "%f:%f:%d", &Param->First, &Param->Last, &Param->Count);
+    if ( n == 1 )
+    {
+        /* Single value */
+        Param->Last = Param->First;
+        Param->Count = 1;
+    }
+    else if ( n != 3 || Param->Count < 1 )
+        return -1;
+
+    return 0;
+} /* ParseSweepParam */
+
+/**********************************************************/
+
+/**
+ * Do one run of the sweep - create the simulation of the scene
+ * <SceneFile> with the parameters <Params> set to the values
+ * stored in <Run>, do <StepsNum> steps and store the summary
+ * in <Run>. The run is stopped if the simulation blows.
+ */
+static void
+DoRun( const char *SceneFile,       /* Scene description file */
+       struct SweepParam *Params,   /* Swept parameters */
+       int ParamsNum,               /* Number of the parameters */
+       int StepsNum,                /* Number of steps */
+       struct RunSummary *Run)      /* Summary of the run */
+{
+    char Strs[MAX_SWEEP_PARAMS][SWEEP_NAME_LENGTH + 32];
+    const char *Overrides[MAX_SWEEP_PARAMS + 1];
+    struct Simulation *Sim;
+    double Start;
+    int n;
+    int k;
+
+    /* Overriding parameters */
+    for ( k = 0; k < ParamsNum; k++ )
+    {
+        sprintf( Strs[k], "%s %.9g", Params[k].Name, Run->Values[k]);
+        Overrides[k] = Strs[k];
+    }
+    Overrides[ParamsNum] = NULL;
+
+    Start = omp_get_wtime();
+    Sim = CreateSimulation( SceneFile, Overrides);
+    if ( Sim == NULL )
+    {
+        Run->State = RUN_FAILED;
+        return;
+    }
+
+    /* Check the simulation from time to time */
+    Run->State = RUN_OK;
+    while ( Sim->StepsNumber < StepsNum )
+    {
+        n = StepsNum - Sim->StepsNumber;
+        StepSimulation( Sim, n < CHECK_STEPS ? n : CHECK_STEPS);
+        if ( SummarizeSimulation( Sim, Run) )
+        {
+            Run->State = RUN_DIVERGED;
+            break;
+        }
+    }
+    Run->WallTime = omp_get_wtime() - Start;
+    Run->StepsNumber = Sim->StepsNumber;
+    Run->ParticlesNumber = Sim->ParticlesNumber;
+
+    DestroySimulation( Sim);
+
+    return;
+} /* DoRun */
+
+/**********************************************************/
+
+/**
+ * Get the summary of the current state of the simulation <Sim> (its
+ * diagnostics) and store it in <Run>. The function returns -1 if the
+ * state isn't finite (the simulation has blown) and 0 otherwise.
+ */
+static int
+SummarizeSimulation( struct Simulation *Sim,   /* Simulation */
+                     struct RunSummary *Run)   /* Summary of the run */
+{
+    struct Diagnostics Diag;
+    int d;
+
+    GetDiagnostics( Sim, &Diag);
+
+    Run->KinEnergy = (float)Diag.KinEnergy;
+    Run->MeanDens = (float)Diag.MeanDens;
+    Run->MaxDensDev = Diag.MaxDensDev;
+    for ( d = 0; d < 3; d++ )
+        Run->Centroid[d] = (float)Diag.Centroid[d];
+
+    /* NaN fails all the comparisons */
+    if ( !(Diag.KinEnergy < HUGE_VAL) || !(Diag.MaxDensDev < HUGE_VAL) ||
+         !(fabs( Diag.Centroid[0] + Diag.Centroid[1] + Diag.Centroid[2]) < HUGE_VAL) )
+        return -1;
+
+    return 0;
+} /* SummarizeSimulation */
@@ -0,0 +1,300 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "common.h"
+#include "telemetry.h"
+
+/**********************************************************/
+
+/* The number of the attempts to take a consistent copy of the block */
+#define TELEMETRY_READ_TRIES    1000
+
+/* The maximum length of the name of the segment */
+#define SEGMENT_NAME_LENGTH     (TYPE_NAME_LENGTH + 1)
+
+/* Full memory barrier - the writes before it are seen by the other
+ * processes before the writes after it (and the same for the reads) */
+#if defined(__GNUC__)
+#define MEMORY_BARRIER()        __sync_synchronize()
+#else
+#define MEMORY_BARRIER()
+#endif
+
+/**********************************************************/
+
+#ifndef _WIN32
+
+/* Get the name of the shared memory segment */
+static void  GetSegmentName      ( const char *Name, char *Segment);
+
+/* Create the segment and map the metrics block */
+static struct TelemetryBlock *CreateTelemetry( struct Simulation *Sim);
+
+/**********************************************************/
+
+/**
+ * Publish the metrics of the last step of the simulation <Sim> to the
+ * shared memory segment TELEMETRY (the segment is created at the first
+ * call). The block is written under the sequence lock, so a reader
+ * never waits for the simulation and never blocks it. The function
+ * returns -1 if the segment can't be created and 0 otherwise.
+ */
+int
+PublishTelemetry( struct Simulation *Sim)   /* Simulation */
+{
+    struct TelemetryBlock *Block;
+
+    if ( Sim->TelemetryBlock == NULL )
+    {
+        Sim->TelemetryBlock = CreateTelemetry( Sim);
+        if ( Sim->TelemetryBlock == NULL )
+        {
+            printf( "Can't create the shared memory %s\n", Sim->Telemetry);
+            Sim->Telemetry[0] = '\0';
+            return -1;
+        }
+    }
+    Block = (struct TelemetryBlock *)Sim->TelemetryBlock;
+
+    /* Odd sequence - the block is being written */
+    Block->Sequence++;
+    MEMORY_BARRIER();
+
+    Block->StepsNumber = Sim->StepsNumber;
+    Block->ParticlesNumber = Sim->ParticlesNumber;
+    Block->PressIterations = Sim->PressIterations;
+    Block->Time = Sim->Time;
+    Block->TimeStep = Sim->TimeStep;
+    Block->WallTime = omp_get_wtime();
+    memcpy( Block->PhaseTime, Sim->PhaseTime, sizeof(Block->PhaseTime));
+    Block->Diag = Sim->Diag;
+
+    /* Even sequence - the block is consistent again */
+    MEMORY_BARRIER();
+    Block->Sequence++;
+
+    return 0;
+} /* PublishTelemetry */
+
+/**
+ * Mark the metrics of the simulation <Sim> as final, unmap the block
+ * and remove the segment. The readers which have mapped the segment
+ * keep reading the final metrics until they unmap it.
+ */
+void
+CloseTelemetry( struct Simulation *Sim)   /* Simulation */
+{
+    struct TelemetryBlock *Block;
+    char Segment[SEGMENT_NAME_LENGTH + 1];
+
+    Block = (struct TelemetryBlock *)Sim->TelemetryBlock;
+    if ( Block == NULL )
+        return;
+
+    Block->Sequence++;
+    MEMORY_BARRIER();
+    Block->Running = 0;
+    MEMORY_BARRIER();
+    Block->Sequence++;
+
+    munmap( Block, sizeof(struct TelemetryBlock));
+    GetSegmentName( Sim->Telemetry, Segment);
+    shm_unlink( Segment);
+    Sim->TelemetryBlock = NULL;
+
+    return;
+} /* CloseTelemetry */
+
+/**
+ * Map the metrics block of the segment <Name> published by another
+ * process (read only). The function returns NULL if there is no such
+ * segment (yet), the metrics could be not initialized yet even if the
+ * block is mapped, ReadTelemetry fails until they are.
+ */
+const struct TelemetryBlock *
+AttachTelemetry( const char *Name)   /* Name of the segment */
+{
+    struct stat Stat;
+    char Segment[SEGMENT_NAME_LENGTH + 1];
+    void *Block;
+    int File;
+
+    if ( strlen( Name) >= TYPE_NAME_LENGTH )
+        return NULL;
+    GetSegmentName( Name, Segment);
+
+    File = shm_open( Segment, O_RDONLY, 0);
+    if ( File < 0 )
+        return NULL;
+    /* The segment could be just created by the simulation */
+    if ( fstat( File, &Stat) != 0 || Stat.st_size < (off_t)sizeof(struct TelemetryBlock) )
+    {
+        close( File);
+        return NULL;
+    }
+    Block = mmap( NULL, sizeof(struct TelemetryBlock), PROT_READ, MAP_SHARED, File, 0);
+    close( File);
+    if ( Block == MAP_FAILED )
+        return NULL;
+
+    return (const struct TelemetryBlock *)Block;
+} /* AttachTelemetry */
+
+/**
+ * Unmap the metrics block <Block> mapped by AttachTelemetry.
+ */
+void
+DetachTelemetry( const struct TelemetryBlock *Block)   /* Metrics block */
+{
+    if ( Block != NULL )
+        munmap( (void *)Block, sizeof(struct TelemetryBlock));
+
+    return;
+} /* DetachTelemetry */
+
+/**********************************************************/
+
+/**
+ * Get the name <Segment> of the shared memory segment of the metrics
+ * <Name> (the names of the POSIX segments begin with a slash).
+ */
+static void
+GetSegmentName( const char *Name,   /* Name of the metrics */
+                char *Segment)      /* Name of the segment */
+{
+    Segment[0] = '\0';
+    if ( Name[0] != '/' )
+        strcpy( Segment, "/");
+    strcat( Segment, Name);
+
+    return;
+} /* GetSegmentName */
+
+/**
+ * Create the shared memory segment TELEMETRY of the simulation <Sim>
+ * and map its metrics block. The segment left by an earlier run is
+ * removed first (its readers keep their mapping), the block is tagged
+ * after all the constant fields are written. The function returns
+ * NULL if the segment can't be created.
+ */
+static struct TelemetryBlock *
+CreateTelemetry( struct Simulation *Sim)   /* Simulation */
+{
+    struct TelemetryBlock *Block;
+    char Segment[SEGMENT_NAME_LENGTH + 1];
+    void *Map;
+    int File;
+
+    GetSegmentName( Sim->Telemetry, Segment);
+    shm_unlink( Segment);
+    File = shm_open( Segment, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if ( File < 0 )
+        return NULL;
+    if ( ftruncate( File, sizeof(struct TelemetryBlock)) != 0 )
+    {
+        close( File);
+        shm_unlink( Segment);
+        return NULL;
+    }
+    Map = mmap( NULL, sizeof(struct TelemetryBlock), PROT_READ | PROT_WRITE,
+                MAP_SHARED, File, 0);
+    close( File);
+    if ( Map == MAP_FAILED )
+    {
+        shm_unlink( Segment);
+        return NULL;
+    }
+
+    Block = (struct TelemetryBlock *)Map;
+    memset( Block, 0, sizeof(struct TelemetryBlock));
+    Block->Version = TELEMETRY_VERSION;
+    Block->Pid = (int)getpid();
+    Block->Running = 1;
+    Block->Dimension = Sim->Dimension;
+    MEMORY_BARRIER();
+    Block->Magic = TELEMETRY_MAGIC;
+
+    return Block;
+} /* CreateTelemetry */
+
+#else /* _WIN32 */
+
+/**
+ * There is no POSIX shared memory, the metrics can't be published.
+ */
+int
+PublishTelemetry( struct Simulation *Sim)   /* Simulation */
+{
+    printf( "Can't create the shared memory %s\n", Sim->Telemetry);
+    Sim->Telemetry[0] = '\0';
+
+    return -1;
+} /* PublishTelemetry */
+
+void
+CloseTelemetry( struct Simulation *Sim)   /* Simulation */
+{
+    return;
+} /* CloseTelemetry */
+
+const struct TelemetryBlock *
+AttachTelemetry( const char *Name)   /* Name of the segment */
+{
+    return NULL;
+} /* AttachTelemetry */
+
+void
+DetachTelemetry( const struct TelemetryBlock *Block)   /* Metrics block */
+{
+    return;
+} /* DetachTelemetry */
+
+#endif /* _WIN32 */
+
+/**********************************************************/
+
+/**
+ * Take a consistent copy <Copy> of the metrics block <Block> (it's
+ * mapped by AttachTelemetry), the copy is retried while the writer
+ * is in the middle of an update. The function returns -1 if the block
+ * isn't initialized or no consistent copy could be taken (the writer
+ * has died during an update) and 0 otherwise.
+ */
+int
+ReadTelemetry( const struct TelemetryBlock *Block,   /* Metrics block */
+               struct TelemetryBlock *Copy)          /* The copy */
+{
+    unsigned int Sequence;
+    int Try;
+
+    for ( Try = 0; Try < TELEMETRY_READ_TRIES; Try++ )
+    {
+        Sequence = Block->Sequence;
+        MEMORY_BARRIER();
+        if ( Sequence & 1 )
+            continue;
+        memcpy( Copy, (const void *)Block, sizeof(struct TelemetryBlock));
+        MEMORY_BARRIER();
+        if ( Block->Sequence != Sequence )
+            continue;
+        if ( Copy->Magic != TELEMETRY_MAGIC || Copy->Version != TELEMETRY_VERSION )
+            return -1;
+        return 0;
+    }
+
+    return -1;
+} /* ReadTelemetry */
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_TELEMETRY_H
+#define YAPS_TELEMETRY_H
+
+/**********************************************************/
+
+#include "common.h"
+
+/* The tag and the version of the layout of the metrics block */
+#define TELEMETRY_MAGIC      0x53504159
+#define TELEMETRY_VERSION    2
+
+/* The metrics of a simulation published to a shared memory segment,
+ * the simulation writes them once per step and any process could map
+ * the segment and read them. The block is a sequence lock - Sequence
+ * is odd while the block is written, so the reader copies the block
+ * and retries if Sequence was odd or has changed during the copy */
+struct TelemetryBlock
+{
+    unsigned int Magic;             /* TELEMETRY_MAGIC */
+    unsigned int Version;           /* TELEMETRY_VERSION */
+    volatile unsigned int Sequence; /* Sequence of the writes */
+    int    Pid;                     /* Process of the simulation */
+    int    Running;                 /* Zero after the simulation is destroyed */
+    int    Dimension;               /* Dimension of the simulation */
+    int    StepsNumber;             /* Number of steps done */
+    int    ParticlesNumber;         /* Number of the smoothing particles */
+    int    PressIterations;         /* Iterations of the incompressible solver */
+    float  Time;                    /* Simulated time */
+    float  TimeStep;                /* Time step of integration */
+    double WallTime;                /* Wall clock of the simulation's process (s) */
+    double PhaseTime[PHASES_NUMBER];/* Wall times of the phases of the last step (s) */
+    struct Diagnostics Diag;        /* Diagnostics of the last step */
+};
+
+/**********************************************************/
+
+struct Simulation;
+
+/* Publish the metrics of the last step to the shared memory */
+extern int  PublishTelemetry( struct Simulation *Sim);
+
+/* Mark the metrics as final and remove the shared memory */
+extern void CloseTelemetry  ( struct Simulation *Sim);
+
+/* Map the metrics published by another process */
+extern const struct TelemetryBlock *AttachTelemetry( const char *Name);
+
+/* Unmap the metrics published by another process */
+extern void DetachTelemetry ( const struct TelemetryBlock *Block);
+
+/* Take a consistent copy of the published metrics */
+extern int  ReadTelemetry   ( const struct TelemetryBlock *Block,
+                              struct TelemetryBlock *Copy);
+
+/**********************************************************/
+
+#endif /* YAPS_TELEMETRY_H */
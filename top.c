@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+/**
+ * Live metrics of a running simulation - the program maps the shared
+ * memory segment the simulation publishes its metrics to (the scene
+ * parameter TELEMETRY) and prints them periodically. It only reads
+ * the segment, so it could be started and stopped at any time without
+ * disturbing the simulation. It waits for the segment if there is no
+ * one yet, and exits when the simulation is destroyed.
+ *
+ * Usage: yaps-top [-d seconds] [-n count] name
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "common.h"
+#include "telemetry.h"
+
+/**********************************************************/
+
+/* Default interval between the lines (s) */
+#define DEFAULT_DELAY        1.0
+
+/* The number of lines between the headers */
+#define HEADER_LINES         20
+
+/**********************************************************/
+
+/* Print the header of the lines */
+static void  PrintHeader    ( void);
+
+/* Print the line of the metrics */
+static void  PrintMetrics   ( struct TelemetryBlock *Now,
+                              struct TelemetryBlock *Last);
+
+/* Check if the process of the simulation is alive */
+static int   IsProcessAlive ( int Pid);
+
+/* Wait for the given time */
+static void  Delay          ( double Seconds);
+
+/**********************************************************/
+
+int
+main( int argc, char **argv)
+{
+    const struct TelemetryBlock *Block;
+    struct TelemetryBlock Now, Last;
+    const char *Name;
+    double Seconds;
+    int LinesNum;
+    int Lines;
+    int Waiting;
+    int i;
+
+    Name = NULL;
+    Seconds = DEFAULT_DELAY;
+    LinesNum = 0;
+
+    /* Read the command line */
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "-d") == 0 && i + 1 < argc )
+            Seconds = atof( argv[++i]);
+        else if ( strcmp( argv[i], "-n") == 0 && i + 1 < argc )
+            LinesNum = atoi( argv[++i]);
+        else if ( Name == NULL )
+            Name = argv[i];
+        else
+        {
+            fprintf( stderr, "Invalid parameter: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if ( Name == NULL || Seconds <= 0.0 )
+    {
+        fprintf( stderr, "Usage: %s [-d seconds] [-n count] name\n", argv[0]);
+        return 1;
+    }
+
+    /* Wait for the simulation */
+    Waiting = 0;
+    Block = NULL;
+    while ( Block == NULL || ReadTelemetry( Block, &Last) != 0 )
+    {
+        if ( Block == NULL )
+            Block = AttachTelemetry( Name);
+        if ( !Waiting )
+        {
+            printf( "Waiting for %s...\n", Name);
+            fflush( stdout);
+            Waiting = 1;
+        }
+        Delay( Seconds);
+    }
+
+    for ( Lines = 0; LinesNum == 0 || Lines < LinesNum; Lines++ )
+    {
+        Delay( Seconds);
+        if ( ReadTelemetry( Block, &Now) != 0 )
+        {
+            printf( "The metrics of %s are inconsistent\n", Name);
+            break;
+        }
+
+        if ( Lines % HEADER_LINES == 0 )
+            PrintHeader();
+        PrintMetrics( &Now, &Last);
+        Last = Now;
+
+        if ( !Now.Running )
+        {
+            printf( "The simulation has finished\n");
+            break;
+        }
+        if ( !IsProcessAlive( Now.Pid) )
+        {
+            printf( "The process %d of the simulation is gone\n", Now.Pid);
+            break;
+        }
+    }
+
+    DetachTelemetry( Block);
+
+    return 0;
+} /* main */
+
+/**********************************************************/
+
+/**
+ * Print the header of the lines of the metrics.
+ */
+static void
+PrintHeader( void)
+{
+    printf( "%-8s %-10s %-7s %-8s %-8s %-7s %-7s %-7s %-7s %-7s %-4s %-11s %-9s %s\n",
+            "STEP", "TIME", "PARTS", "STEPS/S", "STEP_MS", "REFINE", "NEIGHB",
+            "FORCES", "PRESS", "INTEGR", "IT", "KIN_ENERGY", "MAX_VEL",
+            "MAX_DENS_DEV");
+
+    return;
+} /* PrintHeader */
+
+/**
+ * Print the line of the metrics <Now>, the rate of the steps is got
+ * from the difference with the metrics <Last> of the last line (and
+ * from the time of the last step if no steps are done since it). The
+ * times of the phases are in milliseconds.
+ */
+static void
+PrintMetrics( struct TelemetryBlock *Now,    /* Current metrics */
+              struct TelemetryBlock *Last)   /* Metrics of the last line */
+{
+    double StepTime;
+    double Rate;
+    int k;
+
+    StepTime = 0.0;
+    for ( k = 0; k < PHASES_NUMBER; k++ )
+        StepTime += Now->PhaseTime[k];
+
+    Rate = 0.0;
+    if ( Now->StepsNumber > Last->StepsNumber && Now->WallTime > Last->WallTime )
+        Rate = (Now->StepsNumber - Last->StepsNumber) / (Now->WallTime - Last->WallTime);
+    else if ( StepTime > 0.0 )
+        Rate = 1.0 / StepTime;
+
+    printf( "%-8d %-10g %-7d %-8.1f %-8.3f", Now->StepsNumber, Now->Time,
+            Now->ParticlesNumber, Rate, 1000.0 * StepTime);
+    for ( k = 0; k < PHASES_NUMBER; k++ )
+        printf( " %-7.3f", 1000.0 * Now->PhaseTime[k]);
+    printf( " %-4d %-11g %-9g %g\n", Now->PressIterations, Now->Diag.KinEnergy,
+            Now->Diag.MaxVel, Now->Diag.MaxDensDev);
+    fflush( stdout);
+
+    return;
+} /* PrintMetrics */
+
+/**
+ * Check if the process <Pid> is alive (a process which can't be
+ * signaled by this user is alive too).
+ */
+static int
+IsProcessAlive( int Pid)   /* Process */
+{
+    return kill( (pid_t)Pid, 0) == 0 || errno != ESRCH;
+} /* IsProcessAlive */
+
+/**
+ * Wait for <Seconds> seconds.
+ */
+static void
+Delay( double Seconds)   /* Time to wait (s) */
+{
+    struct timespec Wait;
+
+    Wait.tv_sec = (time_t)Seconds;
+    Wait.tv_nsec = (long)((Seconds - (double)Wait.tv_sec) * 1e9);
+    nanosleep( &Wait, NULL);
+
+    return;
+} /* Delay */
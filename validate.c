@@ -0,0 +1,449 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+/**
+ * Validation - the program runs every given scene twice: the reference
+ * run is done by the default calculation path, the candidate run is
+ * done with the parameters given in the command line (they select an
+ * alternative path of the calculation). The runs are compared step by
+ * step and the comparison passes if all the metrics stay within the
+ * tolerances. The exit code is 0 if all the scenes have passed.
+ *
+ * Usage: yaps-validate [-n steps] [-s interval] [-t metric=tolerance]
+ *                      [-r NAME=value] scene ... [NAME=value ...]
+ *
+ * Metrics (all are maximum over the sampled steps):
+ *   POS_RMS   - RMS of the distances between the positions of the
+ *               particles of the runs (in smoothing lengths), the
+ *               particles are matched by their identifiers (the
+ *               runs could order them differently)
+ *   CENTROID  - distance between the centroids (in smoothing lengths)
+ *   DENS      - difference of the average densities (relative to
+ *               the rest density)
+ *   ENERGY    - difference of the kinetic energies (relative to the
+ *               maximum kinetic energy of the reference run)
+ *   DENS_DRIFT   - drift of the average density of either run from its
+ *                  initial value (relative to the rest density)
+ *   ENERGY_DRIFT - drift of the total (kinetic and potential) energy
+ *                  of either run from its initial value (relative to
+ *                  the initial one, the viscosity dissipates some of it)
+ *
+ * The numbers of the particles of the runs are compared at every
+ * comparison (the refinement changes them), the scene fails at once
+ * if they differ or if a particle of one run is missing in the other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "yaps.h"
+
+/**********************************************************/
+
+/* The maximum number of the parameters of the runs */
+#define MAX_RUN_PARAMS     16
+
+/* Default number of steps */
+#define DEFAULT_STEPS      1000
+
+/* Default interval (in steps) between the comparisons */
+#define DEFAULT_INTERVAL   10
+
+/**********************************************************/
+
+/* Metric of the comparison */
+struct Metric
+{
+    char  *Name;         /* Name in the command line */
+    float Tolerance;     /* Maximum allowed value */
+    float Value;         /* Value reached */
+};
+
+/* Possible metrics */
+enum MetricsTypes
+{
+    POS_RMS_METRIC,
+    CENTROID_METRIC,
+    DENS_METRIC,
+    ENERGY_METRIC,
+    DENS_DRIFT_METRIC,
+    ENERGY_DRIFT_METRIC,
+    METRICS_NUMBER
+};
+
+/* Default tolerances */
+static struct Metric Metrics[METRICS_NUMBER] =
+{
+    /* RMS of the positions' differences (smoothing lengths) */
+    "POS_RMS",      0.5f,    0.0f,
+    /* Distance between the centroids (smoothing lengths)    */
+    "CENTROID",     0.05f,   0.0f,
+    /* Difference of the average densities (rest density)    */
+    "DENS",         0.005f,  0.0f,
+    /* Difference of the kinetic energies (maximum energy)   */
+    "ENERGY",       0.05f,   0.0f,
+    /* Drift of the average density (rest density)           */
+    "DENS_DRIFT",   0.1f,    0.0f,
+    /* Drift of the total energy (initial energy)            */
+    "ENERGY_DRIFT", 0.25f,   0.0f,
+};
+
+/**********************************************************/
+
+/* Validate the scene */
+static int   ValidateScene  ( const char *SceneFile,
+                              const char **RefParams,
+                              const char **Params,
+                              int StepsNum, int Interval);
+
+/* Get the state of the simulation */
+static int   GetRunState    ( struct Simulation *Sim,
+                              struct Diagnostics *State);
+
+/* Update the drifts of the run from its initial state */
+static void  UpdateDrifts   ( struct Simulation *Sim,
+                              struct Diagnostics *Init,
+                              struct Diagnostics *State);
+
+/* Get the indices of the particles by their identifiers */
+static int  *GetIdsIndices  ( struct Simulation *Sim);
+
+/* Convert "NAME=value" into "NAME value" */
+static char *GetParamString ( const char *Arg);
+
+/**********************************************************/
+
+int
+main( int argc, char **argv)
+{
+    const char *RefParams[MAX_RUN_PARAMS + 1];
+    const char *Params[MAX_RUN_PARAMS + 1];
+    const char **Scenes;
+    int RefParamsNum;
+    int ParamsNum;
+    int ScenesNum;
+    int StepsNum;
+    int Interval;
+    int Failed;
+    float Tol;
+    char Name[16];
+    int i, k;
+
+    Scenes = (const char **)malloc( argc * sizeof(const char *));
+    RefParamsNum = ParamsNum = ScenesNum = 0;
+    StepsNum = DEFAULT_STEPS;
+    Interval = DEFAULT_INTERVAL;
+
+    /* Read the command line */
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "-n") == 0 && i + 1 < argc )
+            StepsNum = atoi( argv[++i]);
+        else if ( strcmp( argv[i], "-s") == 0 && i + 1 < argc )
+            Interval = atoi( argv[++i]);
+        else if ( strcmp( argv[i], "-t") == 0 && i + 1 < argc )
+        {
+            i++;
+            if ( sscanf( argv[i], "%15[^=]=%f", Name, &Tol) == 2 )
+            {
+                for ( k = 0; k < METRICS_NUMBER; k++ )
+                {
+                    if ( strcmp( Metrics[k].Name, Name) == 0 )
+                    {
+                        Metrics[k].Tolerance = Tol;
+                        break;
+                    }
+                }
+            }
+            else
+                k = METRICS_NUMBER;
+            if ( k == METRICS_NUMBER )
+            {
+                fprintf( stderr, "Invalid tolerance: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if ( strcmp( argv[i], "-r") == 0 && i + 1 < argc &&
+                  RefParamsNum < MAX_RUN_PARAMS )
+            RefParams[RefParamsNum++] = GetParamString( argv[++i]);
+        else if ( strchr( argv[i], '=') != NULL && ParamsNum < MAX_RUN_PARAMS )
+            Params[ParamsNum++] = GetParamString( argv[i]);
+        else
+            Scenes[ScenesNum++] = argv[i];
+    }
+    RefParams[RefParamsNum] = NULL;
+    Params[ParamsNum] = NULL;
+
+    if ( ScenesNum == 0 || StepsNum <= 0 || Interval <= 0 )
+    {
+        fprintf( stderr, "Usage: %s [-n steps] [-s interval] [-t metric=tolerance] "
+                         "[-r NAME=value] scene ... [NAME=value ...]\n", argv[0]);
+        return 2;
+    }
+
+    /* Validate all the scenes */
+    Failed = 0;
+    for ( i = 0; i < ScenesNum; i++ )
+        Failed += ValidateScene( Scenes[i], RefParams, Params, StepsNum, Interval);
+
+    printf( "%d of %d scenes passed\n", ScenesNum - Failed, ScenesNum);
+
+    for ( k = 0; k < RefParamsNum; k++ )
+        free( (char *)RefParams[k]);
+    for ( k = 0; k < ParamsNum; k++ )
+        free( (char *)Params[k]);
+    free( Scenes);
+
+    return Failed ? 1 : 0;
+} /* main */
+
+/**********************************************************/
+
+/**
+ * Validate the scene <SceneFile> - run the reference simulation with
+ * the parameters <RefParams> and the candidate simulation with the
+ * parameters <Params> for <StepsNum> steps, compare them every
+ * <Interval> steps and report the metrics. The function returns 0
+ * if the comparison has passed and 1 otherwise.
+ */
+static int
+ValidateScene( const char *SceneFile,    /* Scene description file */
+               const char **RefParams,   /* Parameters of the reference */
+               const char **Params,      /* Parameters of the candidate */
+               int StepsNum,             /* Number of steps */
+               int Interval)             /* Interval between comparisons */
+{
+    struct Simulation *Ref, *Cand;
+    struct Diagnostics RefInit, CandInit;
+    struct Diagnostics RefState, CandState;
+    double MaxKinEnergy, Dist, Sum, Value;
+    float SmoothR;
+    int *Indices;
+    int Failed;
+    int i, j, k, d, n;
+
+    Ref = CreateSimulation( SceneFile, RefParams);
+    Cand = CreateSimulation( SceneFile, Params);
+    if ( Ref == NULL || Cand == NULL ||
+         Ref->ParticlesNumber != Cand->ParticlesNumber ||
+         Ref->Dimension != Cand->Dimension )
+    {
+        printf( "%s: FAIL (the runs can't be created or differ)\n", SceneFile);
+        DestroySimulation( Ref);
+        DestroySimulation( Cand);
+        return 1;
+    }
+
+    for ( k = 0; k < METRICS_NUMBER; k++ )
+        Metrics[k].Value = 0.0f;
+    SmoothR = Ref->SmoothR;
+    MaxKinEnergy = 0.0;
+    Failed = 0;
+
+    /* The drifts are measured from the initial states */
+    if ( GetRunState( Ref, &RefInit) || GetRunState( Cand, &CandInit) )
+        Failed = 1;
+
+    while ( Ref->StepsNumber < StepsNum && Failed == 0 )
+    {
+        n = StepsNum - Ref->StepsNumber;
+        StepSimulation( Ref, n < Interval ? n : Interval);
+        StepSimulation( Cand, n < Interval ? n : Interval);
+
+        /* The refinement could change the numbers of the particles,
+         * then the runs can't be compared particle by particle */
+        if ( Ref->ParticlesNumber != Cand->ParticlesNumber )
+        {
+            printf( "%s: FAIL after %d steps (the numbers of the particles "
+                    "differ: %d and %d)\n", SceneFile, Ref->StepsNumber,
+                    Ref->ParticlesNumber, Cand->ParticlesNumber);
+            DestroySimulation( Ref);
+            DestroySimulation( Cand);
+            return 1;
+        }
+
+        /* The state which isn't finite fails the comparison */
+        if ( GetRunState( Ref, &RefState) || GetRunState( Cand, &CandState) )
+        {
+            Failed = 1;
+            break;
+        }
+
+        /* The positions are compared particle by particle, the
+         * particles are found by their identifiers */
+        Indices = GetIdsIndices( Cand);
+        for ( i = 0; i < Ref->ParticlesNumber; i++ )
+        {
+            k = Ref->Particles[i].Id;
+            if ( k < 0 || k >= Cand->NextParticleId || Indices[k] < 0 )
+                break;
+        }
+        if ( i < Ref->ParticlesNumber )
+        {
+            printf( "%s: FAIL after %d steps (the particle %d of the "
+                    "reference is missing in the candidate)\n", SceneFile,
+                    Ref->StepsNumber, Ref->Particles[i].Id);
+            free( Indices);
+            DestroySimulation( Ref);
+            DestroySimulation( Cand);
+            return 1;
+        }
+        Sum = 0.0;
+        for ( i = 0; i < Ref->ParticlesNumber; i++ )
+        {
+            j = Indices[Ref->Particles[i].Id];
+            for ( d = 0; d < Ref->Dimension; d++ )
+            {
+                Dist = Ref->Particles[i].Pos[d] - Cand->Particles[j].Pos[d];
+                /* The particles could be wrapped differently */
+                if ( Ref->Period[d] > 0.0f && fabs( Dist) > 0.5 * Ref->Period[d] )
+                    Dist -= ( Dist > 0.0 ? 1.0 : -1.0 ) * Ref->Period[d];
+                Sum += Dist * Dist;
+            }
+        }
+        free( Indices);
+        Value = sqrt( Sum / Ref->ParticlesNumber) / SmoothR;
+        if ( Value > Metrics[POS_RMS_METRIC].Value )
+            Metrics[POS_RMS_METRIC].Value = (float)Value;
+
+        Sum = 0.0;
+        for ( d = 0; d < Ref->Dimension; d++ )
+        {
+            Dist = RefState.Centroid[d] - CandState.Centroid[d];
+            Sum += Dist * Dist;
+        }
+        Value = sqrt( Sum) / SmoothR;
+        if ( Value > Metrics[CENTROID_METRIC].Value )
+            Metrics[CENTROID_METRIC].Value = (float)Value;
+
+        Value = fabs( RefState.MeanDens - CandState.MeanDens) / Ref->Density0;
+        if ( Value > Metrics[DENS_METRIC].Value )
+            Metrics[DENS_METRIC].Value = (float)Value;
+
+        if ( RefState.KinEnergy > MaxKinEnergy )
+            MaxKinEnergy = RefState.KinEnergy;
+        Value = ( MaxKinEnergy > 0.0 ) ?
+                fabs( RefState.KinEnergy - CandState.KinEnergy) / MaxKinEnergy : 0.0;
+        if ( Value > Metrics[ENERGY_METRIC].Value )
+            Metrics[ENERGY_METRIC].Value = (float)Value;
+
+        UpdateDrifts( Ref, &RefInit, &RefState);
+        UpdateDrifts( Cand, &CandInit, &CandState);
+    }
+
+    /* Report the metrics */
+    for ( k = 0; k < METRICS_NUMBER; k++ )
+        if ( !(Metrics[k].Value <= Metrics[k].Tolerance) )
+            Failed = 1;
+    printf( "%s: %s after %d steps\n", SceneFile, Failed ? "FAIL" : "PASS",
+            Ref->StepsNumber);
+    for ( k = 0; k < METRICS_NUMBER; k++ )
+        printf( "    %-12s %-12g (tolerance %g) %s\n", Metrics[k].Name,
+                Metrics[k].Value, Metrics[k].Tolerance,
+                ( Metrics[k].Value <= Metrics[k].Tolerance ) ? "ok" : "FAIL");
+
+    DestroySimulation( Ref);
+    DestroySimulation( Cand);
+
+    return Failed;
+} /* ValidateScene */
+
+/**********************************************************/
+
+/**
+ * Get the state of the simulation <Sim> (its diagnostics) and store it
+ * in <State>. The function returns -1 if the state isn't finite and 0
+ * otherwise.
+ */
+static int
+GetRunState( struct Simulation *Sim,      /* Simulation */
+             struct Diagnostics *State)   /* State of the run */
+{
+    GetDiagnostics( Sim, State);
+
+    /* NaN fails all the comparisons */
+    if ( !(State->KinEnergy < HUGE_VAL) || !(fabs( State->MeanDens) < HUGE_VAL) ||
+         !(fabs( State->Centroid[0] + State->Centroid[1] +
+                 State->Centroid[2]) < HUGE_VAL) )
+        return -1;
+
+    return 0;
+} /* GetRunState */
+
+/**
+ * Update the drift metrics by the state <State> of the simulation <Sim>
+ * measured from its initial state <Init>.
+ */
+static void
+UpdateDrifts( struct Simulation *Sim,      /* Simulation */
+              struct Diagnostics *Init,    /* Initial state of the run */
+              struct Diagnostics *State)   /* State of the run */
+{
+    double Energy, Value;
+
+    Value = fabs( State->MeanDens - Init->MeanDens) / Sim->Density0;
+    if ( Value > Metrics[DENS_DRIFT_METRIC].Value )
+        Metrics[DENS_DRIFT_METRIC].Value = (float)Value;
+
+    Energy = Init->KinEnergy + Init->PotEnergy;
+    Value = ( Energy != 0.0 ) ?
+            fabs( State->KinEnergy + State->PotEnergy - Energy) / fabs( Energy) : 0.0;
+    if ( Value > Metrics[ENERGY_DRIFT_METRIC].Value )
+        Metrics[ENERGY_DRIFT_METRIC].Value = (float)Value;
+
+    return;
+} /* UpdateDrifts */
+
+/**********************************************************/
+
+/**
+ * Get the indices of the particles of the simulation <Sim> by their
+ * identifiers, the array (allocated by malloc) has an entry for every
+ * identifier given, it's -1 if there is no particle with it now.
+ */
+static int *
+GetIdsIndices( struct Simulation *Sim)   /* Simulation */
+{
+    int *Indices;
+    int i;
+
+    Indices = (int *)malloc( (Sim->NextParticleId + 1) * sizeof(int));
+    for ( i = 0; i < Sim->NextParticleId; i++ )
+        Indices[i] = -1;
+    for ( i = 0; i < Sim->ParticlesNumber; i++ )
+        Indices[Sim->Particles[i].Id] = i;
+
+    return Indices;
+} /* GetIdsIndices */
+
+/**********************************************************/
+
+/**
+ * Convert the command line argument <Arg> "NAME=value" into the
+ * string "NAME value" (as in the scene file) allocated by malloc.
+ */
+static char *
+GetParamString( const char *Arg)   /* Command line argument */
+{
+    char *Str;
+    char *p;
+
+    Str = (char *)malloc( strlen( Arg) + 1);
+    strcpy( Str, Arg);
+    for ( p = Str; *p != '\0'; p++ )
+    {
+        if ( *p == '=' )
+        {
+            *p = ' ';
+            break;
+        }
+    }
+
+    return Str;
+} /* GetParamString */
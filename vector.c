@@ -6,7 +6,6 @@
  */
 
 #include <math.h>
-#include "common.h"
 #include "vector.h"
 
 /**********************************************************/
@@ -16,13 +15,14 @@
  * stores the result in vector <ResVec>: <ResVec> = <Vec1> + <Vec2>.
  */
 void
-VectorAddition( float *ResVec,   /* Resulting vector */
+VectorAddition( int Dim,         /* Dimension */
+                float *ResVec,   /* Resulting vector */
                 float *Vec1,     /* Vector 1 */
                 float *Vec2)     /* Vector 2 */
 {
     int d;
     
-    for ( d = 0; d < Dimension; d++ )
+    for ( d = 0; d < Dim; d++ )
         ResVec[d] = Vec1[d] + Vec2[d];
     
     return;
@@ -35,13 +35,14 @@ VectorAddition( float *ResVec,   /* Resulting vector */
  * stores the result in vector <ResVec>: <ResVec> = <Vec1> - <Vec2>.
  */
 void
-VectorSubstraction( float *ResVec,   /* Resulting vector */
+VectorSubstraction( int Dim,         /* Dimension */
+                    float *ResVec,   /* Resulting vector */
                     float *Vec1,     /* Vector 1 */
                     float *Vec2)     /* Vector 2 */
 {
     int d;
     
-    for ( d = 0; d < Dimension; d++ )
+    for ( d = 0; d < Dim; d++ )
         ResVec[d] = Vec1[d] - Vec2[d];
     
     return;
@@ -54,14 +55,15 @@ VectorSubstraction( float *ResVec,   /* Resulting vector */
  * of two vectors - (<Vec1>, <Vec2>).
  */
 float
-VectorInnerproduct( float *Vec1,   /* Vector 1 */
+VectorInnerproduct( int Dim,       /* Dimension */
+                    float *Vec1,   /* Vector 1 */
                     float *Vec2)   /* Vector 2 */
 {
     float Res;
     int d;
 
     Res = 0;
-    for ( d = 0; d < Dimension; d++ )
+    for ( d = 0; d < Dim; d++ )
         Res += Vec1[d] * Vec2[d];
 
     return Res;
@@ -74,13 +76,14 @@ VectorInnerproduct( float *Vec1,   /* Vector 1 */
  * the norm of the vector - |<Vec>|.
  */
 float
-VectorNorm( float *Vec)   /* Vector */
+VectorNorm( int Dim,      /* Dimension */
+            float *Vec)   /* Vector */
 {
     float Res;
     int d;
 
     Res = 0;
-    for ( d = 0; d < Dimension; d++ )
+    for ( d = 0; d < Dim; d++ )
         Res += Vec[d] * Vec[d];
 
     Res = sqrt( Res );
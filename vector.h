@@ -10,22 +10,28 @@
 
 /**********************************************************/
 
+/* All the functions take the dimension <Dim> of the vectors */
+
 /* <ResVec> = <Vec1> + <Vec2>   */
-extern void  VectorAddition     ( float *ResVec, 
+extern void  VectorAddition     ( int Dim,
+                                  float *ResVec, 
                                   float *Vec1, 
                                   float *Vec2);
 
 /* <ResVec> = <Vec1> - <Vec2>   */
-extern void  VectorSubstraction ( float *ResVec, 
+extern void  VectorSubstraction ( int Dim,
+                                  float *ResVec, 
                                   float *Vec1, 
                                   float *Vec2);
 
 /* (<Vec1>, <Vec2>) is returned */
-extern float VectorInnerproduct ( float *Vec1, 
+extern float VectorInnerproduct ( int Dim,
+                                  float *Vec1, 
                                   float *Vec2);
 
 /* |<Vec>| is returned          */
-extern float VectorNorm         ( float *Vec);
+extern float VectorNorm         ( int Dim,
+                                  float *Vec);
 
 /**********************************************************/
 
@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "scene.h"
+#include "calc.h"
+#include "surface.h"
+#include "telemetry.h"
+#include "yaps.h"
+
+/**********************************************************/
+
+/* Write the diagnostics of the last step to the log */
+static void WriteDiagnostics( struct Simulation *Sim);
+
+/**********************************************************/
+
+/**
+ * Create the simulation described by the scene description file 
+ * <SceneFile> - read the scene and initialize calculation module. 
+ * The NULL-terminated array <Params> of strings "NAME value" (it 
+ * could be NULL) overrides the parameters of the scene file. The 
+ * function returns NULL if the scene can't be read or it is not 
+ * valid.
+ */
+struct Simulation *
+CreateSimulation( const char *SceneFile,   /* Scene description file */
+                  const char **Params)     /* Overriding parameters */
+{
+    struct Simulation *Sim;
+
+    Sim = (struct Simulation *)calloc( 1, sizeof(struct Simulation));
+    if ( Sim == NULL )
+        return NULL;
+
+    /* Read the scene and initialize calculation module */
+    if ( InitScene( Sim, SceneFile, Params) || InitCalc( Sim) )
+    {
+        DestroySimulation( Sim);
+        return NULL;
+    }
+
+    return Sim;
+} /* CreateSimulation */
+
+/**********************************************************/
+
+/**
+ * Do <StepsNum> calculation steps of the simulation <Sim>, the surface
+ * of the fluid is written every SURFACE_STEPS steps, the diagnostics
+ * are logged every DIAG_STEPS steps and the metrics are published to
+ * the shared memory TELEMETRY every step (if they are set).
+ */
+void
+StepSimulation( struct Simulation *Sim,   /* Simulation */
+                int StepsNum)             /* Number of steps */
+{
+    int i;
+
+    for ( i = 0; i < StepsNum; i++ )
+    {
+        DoCalcStep( Sim);
+        if ( Sim->SurfaceInterval > 0 &&
+             Sim->StepsNumber % Sim->SurfaceInterval == 0 )
+            WriteSurface( Sim);
+        if ( Sim->DiagInterval > 0 &&
+             Sim->StepsNumber % Sim->DiagInterval == 0 )
+            WriteDiagnostics( Sim);
+        if ( Sim->Telemetry[0] != '\0' )
+            PublishTelemetry( Sim);
+    }
+
+    return;
+} /* StepSimulation */
+
+/**
+ * Get the diagnostics <Diag> of the simulation <Sim> (the kinetic energy,
+ * the momentum, etc.), they are reduced by the integration of every step
+ * and describe the state after the last step (or the initial state if
+ * no step is done yet).
+ */
+void
+GetDiagnostics( struct Simulation *Sim,    /* Simulation */
+                struct Diagnostics *Diag)  /* Diagnostics */
+{
+    *Diag = Sim->Diag;
+
+    return;
+} /* GetDiagnostics */
+
+/**
+ * Write the diagnostics of the last step of the simulation <Sim> to the
+ * log (the file DIAG_FILE or the standard output), the log is opened
+ * at the first line and every line is the step, the time, the kinetic
+ * energy, the maximum speed, the maximum relative deviation of the 
+ * density, the momentum and the centre of mass.
+ */
+static void
+WriteDiagnostics( struct Simulation *Sim)   /* Simulation */
+{
+    struct Diagnostics *Diag;
+    FILE *Stream;
+    int d;
+
+    if ( Sim->DiagStream == NULL )
+    {
+        if ( Sim->DiagFile[0] == '\0' )
+            Sim->DiagStream = stdout;
+        else
+            Sim->DiagStream = fopen( Sim->DiagFile, "w");
+        if ( Sim->DiagStream == NULL )
+        {
+            printf( "Can't open the diagnostics log %s\n", Sim->DiagFile);
+            Sim->DiagInterval = 0;
+            return;
+        }
+    }
+    Stream = (FILE *)Sim->DiagStream;
+
+    Diag = &Sim->Diag;
+    fprintf( Stream, "%d %g %g %g %g", Sim->StepsNumber, Sim->Time,
+             Diag->KinEnergy, Diag->MaxVel, Diag->MaxDensDev);
+    for ( d = 0; d < Sim->Dimension; d++ )
+        fprintf( Stream, " %g", Diag->Momentum[d]);
+    for ( d = 0; d < Sim->Dimension; d++ )
+        fprintf( Stream, " %g", Diag->Centroid[d]);
+    fprintf( Stream, "\n");
+    fflush( Stream);
+
+    return;
+} /* WriteDiagnostics */
+
+/**********************************************************/
+
+/**
+ * Destroy the simulation <Sim> and free all its memory.
+ */
+void
+DestroySimulation( struct Simulation *Sim)   /* Simulation */
+{
+    if ( Sim == NULL )
+        return;
+
+    if ( Sim->DiagStream != NULL && Sim->DiagStream != stdout )
+        fclose( (FILE *)Sim->DiagStream);
+    CloseTelemetry( Sim);
+    FreeSurface( Sim);
+    FreeCalc( Sim);
+    free( Sim->Particles);
+    free( Sim->BParticles);
+    free( Sim->Obstacles);
+    free( Sim);
+
+    return;
+} /* DestroySimulation */
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2005,2010 Yury Mishin <yury.mishin@gmail.com>
+ * See the file COPYING for copying permission.
+ *
+ * $Id$
+ */
+
+#ifndef YAPS_YAPS_H
+#define YAPS_YAPS_H
+
+/**********************************************************/
+
+/* The interface of the simulator's library (libyaps), all the
+ * state of a simulation is kept in struct Simulation (see
+ * common.h), so any number of independent simulations could
+ * be created, stepped and destroyed in one process */
+
+#include "common.h"
+
+/**********************************************************/
+
+/* Create the simulation described by the scene file */
+extern struct Simulation *CreateSimulation  ( const char *SceneFile,
+                                              const char **Params);
+
+/* Do the given number of calculation steps */
+extern void               StepSimulation    ( struct Simulation *Sim,
+                                              int StepsNum);
+
+/* Get the diagnostics of the last step */
+extern void               GetDiagnostics    ( struct Simulation *Sim,
+                                              struct Diagnostics *Diag);
+
+/* Destroy the simulation and free all its memory */
+extern void               DestroySimulation ( struct Simulation *Sim);
+
+/**********************************************************/
+
+#endif /* YAPS_YAPS_H */